@@ -64,7 +64,14 @@ int main(int argc, char** argv)
 		objects.size(), live_total, mb(live_total));
 
 	// 3. Raw event stream audit
-	auto reader = event_log_reader::open(client.get_event_log_path());
+	std::vector<std::pair<uint64_t, uint64_t>> event_log_ranges;
+	bool event_log_compressed = false;
+	client.get_event_log_ranges(event_log_ranges, event_log_compressed);
+	file_range event_log(client.get_event_log_path());
+	event_log.compressed = event_log_compressed;
+	for (auto& range : event_log_ranges)
+		event_log.pieces.push_back({ range.first, range.second });
+	auto reader = event_log_reader::open(event_log);
 	if (reader == nullptr)
 	{
 		printf("Failed to open the event log\n");
@@ -88,7 +95,7 @@ int main(int argc, char** argv)
 	// Which allocation types the mismatched frees belong to: type_id -> {count, delta bytes}
 	std::unordered_map<uint64_t, std::pair<uint64_t, int64_t>> mismatch_by_type;
 
-	reader->read_range(reader->begin_offset(), reader->end_offset(), [&](const event_view& e)
+	reader->visit_range(reader->begin_offset(), reader->end_offset(), [&](const event_view& e)
 	{
 		if (e.is_alloc)
 		{
@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include <string>
+#include <utility>
 #include <vector>
 #include <functional>
 
@@ -76,11 +77,19 @@ namespace owlcat
 		// Attempts to connect to a running profiler server, then tells it what to capture.
 		// capture_flags / native_config are sent to the server as CMD_CONFIGURE.
 		bool start(const std::string& addr, int server_port, const std::string& db_file_name, uint32_t capture_flags = CAPTURE_MANAGED, const std::string& native_config = std::string());
+		// Imports a spool written by the profiler server (OWLCAT_PROFILER_SPOOL, see
+		// spool_file.h) into a new capture, as if the events had arrived over the network.
+		// With follow, keeps reading as the spool grows until stop() is called; otherwise
+		// processing ends at the spool's current end (call stop() to wait for it).
+		bool import_spool(const std::string& spool_prefix, const std::string& db_file_name, bool follow);
 		// Stops communications with profiler server. Leaves current profiling data accessible.
 		void stop();
 		// Closes profiler data database. It will no longer be accessible.
 		void close_db();
-		// Saves in-memory or temporary database to a persistent file
+		// Saves in-memory or temporary database to a persistent file. A capture just made is
+		// saved as the journal it was written to, uncompressed, in a time that doesn't depend
+		// on its size; saved to another volume, it is packed into a block-compressed container.
+		// An opened capture saved to another file is always packed, compressed.
 		bool save_db(const std::string& new_db_file_name, bool move);
 		// Opens previously saved profiling data
 		bool open_data(const std::string& file);
@@ -99,9 +108,22 @@ namespace owlcat
 		// the database so far. Monotonic: sample it periodically to measure the insert rate.
 		uint64_t get_db_inserted_events_count() const;
 
+		// Returns the total number of database transactions committed by the current capture.
+		// Monotonic: sample it periodically to measure the commit rate.
+		uint64_t get_db_commits_count() const;
+
+		// Returns the round-trip time (command sent -> reply received) of the last command
+		// answered by the server, in microseconds. 0 if no command was answered yet.
+		uint64_t get_last_command_round_trip_us() const;
+
 		// Returns the path of the event log file of the current capture (empty if no
 		// capture is open). Used by diagnostic tools to access the raw event stream.
 		const char* get_event_log_path() const;
+		// Returns the byte ranges (offset, size) of the event log in that file, read one after
+		// the other: the event log is an entry of the capture's container, in pieces if the
+		// container is a journal (size is UINT64_MAX for a whole file), which may be
+		// block-compressed
+		void get_event_log_ranges(std::vector<std::pair<uint64_t, uint64_t>>& ranges, bool& compressed) const;
 
 		// Sets the local symbol search path (';'-separated directories) used to resolve
 		// native callstack frames to function names. Applied in the background and
@@ -148,6 +170,43 @@ namespace owlcat
 		uint64_t callstack_id;
 	};
 
+	/*
+		A frame the server recorded only partially because it couldn't keep up (see
+		owlcat::overload_level). Its allocation counts and sizes are lower than the truth.
+	*/
+	struct degraded_frame_t
+	{
+		uint64_t frame;
+		// owlcat::overload_level: the most degraded level in effect during the frame
+		uint8_t level;
+		// Allocations that were not recorded at all, only counted
+		uint64_t dropped_allocs;
+		uint64_t dropped_size;
+	};
+
+	/*
+		Allocations of one type that were only counted, not recorded, in degraded frames
+	*/
+	struct dropped_allocations_t
+	{
+		uint64_t type_id;
+		uint64_t allocs;
+		uint64_t size;
+	};
+
+	/*
+		Summary of a frame graph over consecutive frames [first_frame, last_frame]: the
+		smallest, largest and summed per-frame values
+	*/
+	struct frame_bucket_t
+	{
+		uint64_t first_frame;
+		uint64_t last_frame;
+		int64_t min;
+		int64_t max;
+		int64_t sum;
+	};
+
 	// Universal progress callback typr
 	using progress_func_t = std::function<bool(size_t current, size_t max)>;
 
@@ -167,9 +226,25 @@ namespace owlcat
 		void get_frame_boundaries(uint64_t& min, uint64_t& max);
 		// Get number of allocations, frees, maximum number of allocations, frees and running total of allocated memory for the specified timeframe
 		void get_frame_stats(std::vector<uint64_t>& alloc_counts, std::vector<uint64_t>& free_counts, uint64_t& max_allocs, uint64_t& max_frees, std::vector<uint64_t>& size_points, int64_t& max_size, uint64_t from_frame, uint64_t to_frame);
+		// Get the total number of allocations and frees in the specified timeframe, in constant time
+		void get_frame_totals(uint64_t& allocs, uint64_t& frees, uint64_t from_frame, uint64_t to_frame);
 		// Per-frame whole-process memory (committed/working-set/GC-heap bytes), aligned like
 		// get_frame_stats' size_points. Empty for captures made before this was added.
 		void get_memory_series(std::vector<uint64_t>& committed_points, std::vector<uint64_t>& working_set_points, std::vector<uint64_t>& gc_heap_points, uint64_t& max_committed, uint64_t from_frame, uint64_t to_frame);
+		// Same series as get_frame_stats, summarised in buckets of bucket_frames consecutive
+		// frames (a power of two). Buckets are aligned on the first frame recorded, so
+		// a timeframe starting at a bucket's first frame returns that bucket again; the ones
+		// at the ends of the timeframe are cut short. Takes time proportional to the number of
+		// buckets, whatever the length of the timeframe: request about one bucket per pixel.
+		void get_frame_stats_buckets(std::vector<frame_bucket_t>& allocs, std::vector<frame_bucket_t>& frees, std::vector<frame_bucket_t>& sizes, uint64_t from_frame, uint64_t to_frame, size_t bucket_frames);
+		// Same series as get_memory_series, summarised like get_frame_stats_buckets
+		void get_memory_buckets(std::vector<frame_bucket_t>& committed, std::vector<frame_bucket_t>& working_set, std::vector<frame_bucket_t>& gc_heap, uint64_t from_frame, uint64_t to_frame, size_t bucket_frames);
+		// Returns the degraded frames (see degraded_frame_t) in the specified timeframe. Empty
+		// if the server kept up, and for captures made before this was added.
+		void get_degraded_frames(std::vector<degraded_frame_t>& frames, uint64_t from_frame, uint64_t to_frame);
+		// Returns the allocations that were only counted in the specified timeframe, per type,
+		// largest first
+		void get_dropped_allocations(std::vector<dropped_allocations_t>& types, uint64_t from_frame, uint64_t to_frame);
 		// Returns a list of live objects for the specified timeframe
 		void get_live_objects(std::vector<live_object>& objects, int from, int to, progress_func_t progress_func);
 		// Returns a name for type ID
@@ -183,5 +258,8 @@ namespace owlcat
 		size_t get_callstacks_count() const;
 		// Queries the database for information about a particular allocation
 		bool get_allocation_type_and_stack(uint64_t address, uint64_t& type_id, uint64_t& stack_id) const;
+		// The same for many addresses at once, which is much faster than one call per address.
+		// type_ids and stack_ids get one entry per address, UINT64_MAX if it was never allocated.
+		void get_allocations_type_and_stack(const std::vector<uint64_t>& addresses, std::vector<uint64_t>& type_ids, std::vector<uint64_t>& stack_ids) const;
 	};
 }
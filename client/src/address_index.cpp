@@ -0,0 +1,132 @@
+#include "address_index.h"
+
+#include <algorithm>
+
+namespace owlcat
+{
+	// Allocations collected before sorting them into a run
+	static const size_t RUN_SIZE = 1024 * 1024;
+	// Radix sort digit
+	static const int DIGIT_BITS = 11;
+
+	void address_index::reset()
+	{
+		m_pending.clear();
+		m_pending.shrink_to_fit();
+		m_runs.clear();
+		m_runs.shrink_to_fit();
+		m_sort_buffer.clear();
+		m_sort_buffer.shrink_to_fit();
+	}
+
+	void address_index::add(uint64_t address, uint64_t type_id, uint64_t callstack_id)
+	{
+		m_pending.push_back({ address, { type_id, callstack_id } });
+		if (m_pending.size() >= RUN_SIZE)
+			flush_pending();
+	}
+
+	void address_index::sort_by_address(std::vector<entry>& entries)
+	{
+		// An LSD radix sort on the address bits that differ: allocations are aligned, and
+		// come from a few GB of address space, so that's 2 or 3 passes
+		uint64_t all_or = 0, all_and = ~0ull;
+		for (const entry& e : entries)
+		{
+			all_or |= e.address;
+			all_and &= e.address;
+		}
+		const uint64_t varying = all_or ^ all_and;
+		if (varying == 0)
+			return;
+
+		int low = 0;
+		while (!(varying & (1ull << low)))
+			++low;
+		int high = 63;
+		while (!(varying & (1ull << high)))
+			--high;
+
+		m_sort_buffer.resize(entries.size());
+		for (int shift = low; shift <= high; shift += DIGIT_BITS)
+		{
+			size_t counts[1 << DIGIT_BITS] = {};
+			for (const entry& e : entries)
+				++counts[(e.address >> shift) & ((1 << DIGIT_BITS) - 1)];
+
+			size_t position = 0;
+			for (size_t& count : counts)
+			{
+				const size_t digit_count = count;
+				count = position;
+				position += digit_count;
+			}
+
+			for (const entry& e : entries)
+				m_sort_buffer[counts[(e.address >> shift) & ((1 << DIGIT_BITS) - 1)]++] = e;
+			entries.swap(m_sort_buffer);
+		}
+	}
+
+	void address_index::flush_pending()
+	{
+		if (m_pending.empty())
+			return;
+
+		// Sort by address, then keep the latest allocation of each address. The pending
+		// allocations were added in order, and the sort is stable: the latest comes last.
+		sort_by_address(m_pending);
+		std::vector<entry> run;
+		run.reserve(m_pending.size());
+		for (const entry& e : m_pending)
+		{
+			if (!run.empty() && run.back().address == e.address)
+				run.back() = e;
+			else
+				run.push_back(e);
+		}
+		m_pending.clear();
+		m_runs.push_back(std::move(run));
+
+		// Merge while the newest run is at least half the size of the one before it
+		while (m_runs.size() >= 2 && m_runs[m_runs.size() - 2].size() <= m_runs.back().size() * 2)
+		{
+			std::vector<entry>& older = m_runs[m_runs.size() - 2];
+			std::vector<entry>& newer = m_runs.back();
+
+			std::vector<entry> merged;
+			merged.reserve(older.size() + newer.size());
+			size_t i = 0, j = 0;
+			while (i < older.size() || j < newer.size())
+			{
+				if (j == newer.size() || (i < older.size() && older[i].address < newer[j].address))
+				{
+					merged.push_back(older[i++]);
+				}
+				else
+				{
+					// The newer run wins an address both have
+					if (i < older.size() && older[i].address == newer[j].address)
+						++i;
+					merged.push_back(newer[j++]);
+				}
+			}
+
+			m_runs.pop_back();
+			m_runs.back() = std::move(merged);
+		}
+	}
+
+	address_index::allocation address_index::find(uint64_t address)
+	{
+		flush_pending();
+
+		for (auto run = m_runs.rbegin(); run != m_runs.rend(); ++run)
+		{
+			auto iter = std::lower_bound(run->begin(), run->end(), address, [](const entry& e, uint64_t value) { return e.address < value; });
+			if (iter != run->end() && iter->address == address)
+				return iter->value;
+		}
+		return { NONE, NONE };
+	}
+}
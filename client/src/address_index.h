@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace owlcat
+{
+	/*
+		Address -> latest allocation's type and callstack, for looking up what was allocated
+		at an address (e.g. the results of a references query) without scanning the event
+		log.
+
+		Allocations are added in log order. They are kept as sorted runs of (address, type,
+		callstack), merged like a binary counter, so there are O(log n) runs and adding is
+		amortized O(log n). Merging keeps only the latest allocation of an address: with
+		addresses reused all the time (the GC heap), the index is much smaller than the
+		number of allocations. A lookup is a binary search per run, newest first.
+
+		Not thread-safe.
+	*/
+	class address_index
+	{
+	public:
+		static constexpr uint64_t NONE = ~0ull;
+
+		struct allocation
+		{
+			uint64_t type_id;
+			uint64_t callstack_id;
+		};
+
+		// Forgets everything
+		void reset();
+
+		// Adds an allocation, later than all the others
+		void add(uint64_t address, uint64_t type_id, uint64_t callstack_id);
+
+		// Returns the latest allocation at the address, or { NONE, NONE }
+		allocation find(uint64_t address);
+
+	private:
+		struct entry
+		{
+			uint64_t address;
+			allocation value;
+		};
+
+		// Sorts by address, keeping the order of entries with the same address
+		void sort_by_address(std::vector<entry>& entries);
+		// Sorts the pending allocations into a run, and merges runs that have become no
+		// bigger than the next newer one
+		void flush_pending();
+
+		// The latest allocations, not sorted yet
+		std::vector<entry> m_pending;
+		std::vector<entry> m_sort_buffer;
+		// Sorted by address, one entry per address; newer runs come later, and are smaller
+		std::vector<std::vector<entry>> m_runs;
+	};
+}
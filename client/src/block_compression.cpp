@@ -0,0 +1,676 @@
+#include "block_compression.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <thread>
+
+namespace owlcat
+{
+	namespace block_compression
+	{
+		static const char magic[8] = { 'O', 'W', 'L', 'B', 'L', 'K', 'Z', 0 };
+
+		static const size_t MIN_MATCH = 4;
+		// The largest match offset the 2 bytes can hold
+		static const size_t MAX_OFFSET = 65535;
+		// Matches end at least this far from the end of the block, so that looking for them
+		// never reads past it
+		static const size_t END_LITERALS = 5;
+		static const unsigned HASH_BITS = 14;
+		// Blocks each thread compresses between two writes of compress_file
+		static const size_t BLOCKS_PER_THREAD = 16;
+
+		static uint32_t read32(const uint8_t* data)
+		{
+			uint32_t value;
+			memcpy(&value, data, sizeof(value));
+			return value;
+		}
+
+		static uint32_t hash32(uint32_t value)
+		{
+			return (value * 2654435761u) >> (32 - HASH_BITS);
+		}
+
+		static uint8_t* write_length(uint8_t* out, size_t length)
+		{
+			while (length >= 255)
+			{
+				*out++ = 255;
+				length -= 255;
+			}
+			*out++ = (uint8_t)length;
+			return out;
+		}
+
+		static bool read_length(const uint8_t*& in, const uint8_t* in_end, size_t& length)
+		{
+			uint8_t byte;
+			do
+			{
+				if (in == in_end)
+					return false;
+				byte = *in++;
+				length += byte;
+			} while (byte == 255);
+			return true;
+		}
+
+		static void write32(uint8_t* out, uint32_t value)
+		{
+			memcpy(out, &value, sizeof(value));
+		}
+
+		// ---------------- Huffman coding of the literals ----------------
+
+		// Longest code: the decoding table has 2^HUFFMAN_MAX_BITS entries
+		static const unsigned HUFFMAN_MAX_BITS = 11;
+		// Code lengths of the 256 symbols, 4 bits each
+		static const size_t HUFFMAN_TABLE_SIZE = 128;
+
+		// Code lengths of a Huffman code for the symbol counts, at most HUFFMAN_MAX_BITS
+		// long; 0 for symbols that don't occur. Codes too long are shortened by flattening
+		// the counts until they fit, which costs little: it only happens with very rare
+		// symbols.
+		static void huffman_lengths(const uint32_t counts[256], uint8_t lengths[256])
+		{
+			uint32_t weights[256];
+			memcpy(weights, counts, sizeof(weights));
+
+			while (true)
+			{
+				memset(lengths, 0, 256);
+
+				// Leaves first, then the inner nodes as they are created
+				std::vector<int> parents;
+				int leaves[256];
+				using node_t = std::pair<uint64_t, int>;
+				std::priority_queue<node_t, std::vector<node_t>, std::greater<node_t>> queue;
+				for (int symbol = 0; symbol < 256; ++symbol)
+				{
+					if (weights[symbol] == 0)
+						continue;
+					leaves[symbol] = (int)parents.size();
+					parents.push_back(-1);
+					queue.push({ weights[symbol], leaves[symbol] });
+				}
+
+				// A single symbol still needs a code: 1 bit
+				if (queue.size() == 1)
+				{
+					for (int symbol = 0; symbol < 256; ++symbol)
+						lengths[symbol] = weights[symbol] != 0 ? 1 : 0;
+				}
+				if (queue.size() <= 1)
+					return;
+
+				while (queue.size() > 1)
+				{
+					const node_t a = queue.top();
+					queue.pop();
+					const node_t b = queue.top();
+					queue.pop();
+					const int node = (int)parents.size();
+					parents.push_back(-1);
+					parents[a.second] = node;
+					parents[b.second] = node;
+					queue.push({ a.first + b.first, node });
+				}
+
+				unsigned max_length = 0;
+				for (int symbol = 0; symbol < 256; ++symbol)
+				{
+					if (weights[symbol] == 0)
+						continue;
+					unsigned length = 0;
+					for (int node = leaves[symbol]; parents[node] != -1; node = parents[node])
+						++length;
+					lengths[symbol] = (uint8_t)length;
+					max_length = std::max(max_length, length);
+				}
+
+				if (max_length <= HUFFMAN_MAX_BITS)
+					return;
+
+				for (auto& weight : weights)
+				{
+					if (weight != 0)
+						weight = (weight + 1) / 2;
+				}
+			}
+		}
+
+		// Canonical codes for the code lengths, bit-reversed, as the bit stream is read from
+		// the least significant bit. Returns false if the lengths don't make a prefix code.
+		static bool huffman_codes(const uint8_t lengths[256], uint16_t codes[256])
+		{
+			uint32_t length_counts[HUFFMAN_MAX_BITS + 1] = {};
+			for (int symbol = 0; symbol < 256; ++symbol)
+			{
+				if (lengths[symbol] > HUFFMAN_MAX_BITS)
+					return false;
+				++length_counts[lengths[symbol]];
+			}
+			// Symbols without a code
+			length_counts[0] = 0;
+
+			// available: codes of the length not prefixed by a shorter one
+			uint32_t next_codes[HUFFMAN_MAX_BITS + 1] = {};
+			uint32_t code = 0;
+			uint32_t available = 1;
+			for (unsigned length = 1; length <= HUFFMAN_MAX_BITS; ++length)
+			{
+				code = (code + length_counts[length - 1]) << 1;
+				next_codes[length] = code;
+				available = (available - length_counts[length - 1]) * 2;
+				if (length_counts[length] > available)
+					return false;
+			}
+
+			for (int symbol = 0; symbol < 256; ++symbol)
+			{
+				const unsigned length = lengths[symbol];
+				if (length == 0)
+					continue;
+				const uint32_t canonical = next_codes[length]++;
+				uint32_t reversed = 0;
+				for (unsigned bit = 0; bit < length; ++bit)
+					reversed |= ((canonical >> bit) & 1) << (length - 1 - bit);
+				codes[symbol] = (uint16_t)reversed;
+			}
+			return true;
+		}
+
+		// The literals are coded in this many streams, each holding a quarter of them, which
+		// are decoded together: decoding a code depends on the length of the previous one,
+		// so a single stream is decoded at the latency of a table lookup per literal
+		static const size_t HUFFMAN_STREAMS = 4;
+
+		// Writes the code lengths table, then for every stream its coded size (uint32_t) and
+		// its coded literals. Returns the end of the output.
+		static uint8_t* huffman_encode(const uint8_t* literals, size_t count, const uint8_t lengths[256], uint8_t* out)
+		{
+			uint16_t codes[256] = {};
+			huffman_codes(lengths, codes);
+
+			for (size_t i = 0; i < HUFFMAN_TABLE_SIZE; ++i)
+				*out++ = (uint8_t)(lengths[2 * i] | (lengths[2 * i + 1] << 4));
+
+			const size_t stream_count = (count + HUFFMAN_STREAMS - 1) / HUFFMAN_STREAMS;
+			for (size_t stream = 0; stream < HUFFMAN_STREAMS; ++stream)
+			{
+				const size_t begin = std::min(count, stream * stream_count);
+				const size_t end = std::min(count, begin + stream_count);
+
+				uint8_t* stream_size = out;
+				out += sizeof(uint32_t);
+				uint8_t* stream_begin = out;
+
+				uint64_t buffer = 0;
+				unsigned bits = 0;
+				for (size_t i = begin; i < end; ++i)
+				{
+					buffer |= (uint64_t)codes[literals[i]] << bits;
+					bits += lengths[literals[i]];
+					while (bits >= 8)
+					{
+						*out++ = (uint8_t)buffer;
+						buffer >>= 8;
+						bits -= 8;
+					}
+				}
+				if (bits > 0)
+					*out++ = (uint8_t)buffer;
+
+				write32(stream_size, (uint32_t)(out - stream_begin));
+			}
+			return out;
+		}
+
+		// Reads one stream of coded literals
+		struct bit_reader_t
+		{
+			const uint8_t* pos;
+			const uint8_t* end;
+			uint64_t size;
+			uint64_t buffer = 0;
+			unsigned bits = 0;
+			uint64_t consumed_bits = 0;
+
+			// Tops the buffer up to at least 56 bits
+			void refill()
+			{
+				if (end - pos >= 8)
+				{
+					uint64_t next;
+					memcpy(&next, pos, sizeof(next));
+					buffer |= next << bits;
+					pos += (63 - bits) >> 3;
+					bits |= 56;
+				}
+				else
+				{
+					// The end of the stream: zeroes past it
+					for (; bits <= 56; bits += 8)
+					{
+						if (pos < end)
+							buffer |= (uint64_t)*pos++ << bits;
+					}
+				}
+			}
+
+			// Returns false for bits that are no code
+			bool decode(const uint16_t* table, uint8_t& literal)
+			{
+				const uint16_t entry = table[buffer & ((1u << HUFFMAN_MAX_BITS) - 1)];
+				const unsigned length = entry >> 8;
+				literal = (uint8_t)entry;
+				buffer >>= length;
+				bits -= length;
+				consumed_bits += length;
+				return length != 0;
+			}
+		};
+
+		// Decodes count literals, returns the end of the coded data, or null if it is damaged
+		static const uint8_t* huffman_decode(const uint8_t* in, const uint8_t* in_end, uint8_t* literals, size_t count)
+		{
+			if ((size_t)(in_end - in) < HUFFMAN_TABLE_SIZE)
+				return nullptr;
+
+			uint8_t lengths[256];
+			for (size_t i = 0; i < HUFFMAN_TABLE_SIZE; ++i)
+			{
+				lengths[2 * i] = in[i] & 15;
+				lengths[2 * i + 1] = in[i] >> 4;
+			}
+			in += HUFFMAN_TABLE_SIZE;
+
+			uint16_t codes[256] = {};
+			if (!huffman_codes(lengths, codes))
+				return nullptr;
+
+			// Entry for every HUFFMAN_MAX_BITS bits: symbol | code length << 8, 0 for no code
+			uint16_t table[1 << HUFFMAN_MAX_BITS] = {};
+			for (int symbol = 0; symbol < 256; ++symbol)
+			{
+				if (lengths[symbol] == 0)
+					continue;
+				for (uint32_t index = codes[symbol]; index < (1u << HUFFMAN_MAX_BITS); index += 1u << lengths[symbol])
+					table[index] = (uint16_t)(symbol | (lengths[symbol] << 8));
+			}
+
+			bit_reader_t readers[HUFFMAN_STREAMS];
+			for (auto& reader : readers)
+			{
+				uint32_t stream_size;
+				if ((size_t)(in_end - in) < sizeof(stream_size))
+					return nullptr;
+				memcpy(&stream_size, in, sizeof(stream_size));
+				in += sizeof(stream_size);
+				if (stream_size > (size_t)(in_end - in))
+					return nullptr;
+
+				reader.pos = in;
+				reader.end = in + stream_size;
+				reader.size = stream_size;
+				in += stream_size;
+			}
+
+			// All streams but the last hold stream_count literals
+			const size_t stream_count = (count + HUFFMAN_STREAMS - 1) / HUFFMAN_STREAMS;
+			uint8_t* outputs[HUFFMAN_STREAMS];
+			size_t counts[HUFFMAN_STREAMS];
+			for (size_t stream = 0; stream < HUFFMAN_STREAMS; ++stream)
+			{
+				const size_t begin = std::min(count, stream * stream_count);
+				outputs[stream] = literals + begin;
+				counts[stream] = std::min(count, begin + stream_count) - begin;
+			}
+
+			bool valid = true;
+			// A refill holds 5 codes: decode 4 per refill, in every stream at once
+			size_t i = 0;
+			for (; i + 4 <= counts[HUFFMAN_STREAMS - 1]; i += 4)
+			{
+				for (size_t stream = 0; stream < HUFFMAN_STREAMS; ++stream)
+					readers[stream].refill();
+				for (size_t k = 0; k < 4; ++k)
+				{
+					for (size_t stream = 0; stream < HUFFMAN_STREAMS; ++stream)
+						valid &= readers[stream].decode(table, outputs[stream][i + k]);
+				}
+			}
+			for (size_t stream = 0; stream < HUFFMAN_STREAMS; ++stream)
+			{
+				for (size_t j = i; j < counts[stream]; ++j)
+				{
+					readers[stream].refill();
+					valid &= readers[stream].decode(table, outputs[stream][j]);
+				}
+			}
+
+			// Codes read from the zeroes past the end
+			for (auto& reader : readers)
+				valid &= reader.consumed_bits <= reader.size * 8;
+			return valid ? in : nullptr;
+		}
+
+		// ---------------- Blocks ----------------
+
+		// How the literals of a block are stored
+		enum literal_coding : uint8_t
+		{
+			literals_raw = 0,
+			literals_huffman = 1,
+		};
+
+		size_t max_compressed_size(size_t size)
+		{
+			return size + size / 255 + 32;
+		}
+
+		/*
+			A compressed block:
+
+				uint8_t literal_coding, uint32_t literal count, the literals (raw, or the code
+				lengths and HUFFMAN_STREAMS times a uint32_t coded size and coded literals),
+				then the sequences without their literals, which are taken from the literals
+				in order
+		*/
+		size_t compress_block(const uint8_t* data, size_t size, uint8_t* out)
+		{
+			std::vector<uint8_t> literals(size);
+			std::vector<uint8_t> sequences(max_compressed_size(size));
+			size_t literal_count = 0;
+			uint8_t* sequence = sequences.data();
+			size_t anchor = 0;
+
+			auto write_sequence = [&](size_t end, size_t offset, size_t match_length)
+			{
+				const size_t count = end - anchor;
+				memcpy(literals.data() + literal_count, data + anchor, count);
+				literal_count += count;
+
+				uint8_t* token = sequence++;
+				*token = (uint8_t)(std::min<size_t>(count, 15) << 4);
+				if (count >= 15)
+					sequence = write_length(sequence, count - 15);
+
+				// The last sequence has no match
+				if (match_length == 0)
+					return;
+
+				*sequence++ = (uint8_t)offset;
+				*sequence++ = (uint8_t)(offset >> 8);
+				const size_t length = match_length - MIN_MATCH;
+				*token |= (uint8_t)std::min<size_t>(length, 15);
+				if (length >= 15)
+					sequence = write_length(sequence, length - 15);
+			};
+
+			if (size >= MIN_MATCH + END_LITERALS)
+			{
+				// Last position of each hash: blocks are compressed concurrently
+				std::vector<uint32_t> table(1 << HASH_BITS, 0);
+				const size_t limit = size - END_LITERALS;
+				size_t pos = 0;
+
+				while (pos + MIN_MATCH <= limit)
+				{
+					const uint32_t value = read32(data + pos);
+					const uint32_t hash = hash32(value);
+					const size_t candidate = table[hash];
+					table[hash] = (uint32_t)pos;
+
+					if (candidate < pos && pos - candidate <= MAX_OFFSET && read32(data + candidate) == value)
+					{
+						size_t length = MIN_MATCH;
+						while (pos + length < limit && data[candidate + length] == data[pos + length])
+							++length;
+
+						write_sequence(pos, pos - candidate, length);
+						pos += length;
+						anchor = pos;
+					}
+					else
+					{
+						// Skip faster through data that doesn't compress
+						pos += 1 + ((pos - anchor) >> 6);
+					}
+				}
+			}
+			write_sequence(size, 0, 0);
+
+			uint8_t* out_begin = out;
+			uint32_t counts[256] = {};
+			for (size_t i = 0; i < literal_count; ++i)
+				++counts[literals[i]];
+			uint8_t lengths[256];
+			huffman_lengths(counts, lengths);
+			uint64_t coded_bits = 0;
+			for (int symbol = 0; symbol < 256; ++symbol)
+				coded_bits += (uint64_t)counts[symbol] * lengths[symbol];
+
+			const bool huffman = HUFFMAN_TABLE_SIZE + sizeof(uint32_t) + (coded_bits + 7) / 8 < literal_count;
+			*out++ = huffman ? literals_huffman : literals_raw;
+			write32(out, (uint32_t)literal_count);
+			out += sizeof(uint32_t);
+			if (huffman)
+				out = huffman_encode(literals.data(), literal_count, lengths, out);
+			else
+			{
+				memcpy(out, literals.data(), literal_count);
+				out += literal_count;
+			}
+
+			const size_t sequences_size = (size_t)(sequence - sequences.data());
+			memcpy(out, sequences.data(), sequences_size);
+			out += sequences_size;
+			return (size_t)(out - out_begin);
+		}
+
+		bool decompress_block(const uint8_t* data, size_t size, uint8_t* out, size_t out_size)
+		{
+			const uint8_t* in = data;
+			const uint8_t* in_end = data + size;
+			if (size < 1 + sizeof(uint32_t))
+				return false;
+
+			const uint8_t coding = *in++;
+			uint32_t literal_count;
+			memcpy(&literal_count, in, sizeof(literal_count));
+			in += sizeof(literal_count);
+			if (literal_count > out_size)
+				return false;
+
+			// The literals are decoded at the end of the output: the sequences write before
+			// the next literal to read, since what they write before it is literals read
+			// already and matches, and the matches' total is out_size - literal_count.
+			uint8_t* literal = out + out_size - literal_count;
+			if (coding == literals_raw)
+			{
+				if (literal_count > (size_t)(in_end - in))
+					return false;
+				memcpy(literal, in, literal_count);
+				in += literal_count;
+			}
+			else if (coding == literals_huffman)
+			{
+				in = huffman_decode(in, in_end, literal, literal_count);
+				if (in == nullptr)
+					return false;
+			}
+			else
+				return false;
+
+			const uint8_t* literal_end = out + out_size;
+			uint8_t* out_pos = out;
+			uint8_t* out_end = out + out_size;
+
+			while (in < in_end)
+			{
+				const uint8_t token = *in++;
+
+				size_t count = token >> 4;
+				if (count == 15 && !read_length(in, in_end, count))
+					return false;
+				if (count > (size_t)(literal_end - literal) || count > (size_t)(out_end - out_pos))
+					return false;
+				memmove(out_pos, literal, count);
+				literal += count;
+				out_pos += count;
+
+				// The last sequence
+				if (in == in_end)
+					break;
+
+				if (in_end - in < 2)
+					return false;
+				const size_t offset = in[0] | ((size_t)in[1] << 8);
+				in += 2;
+				if (offset == 0 || offset > (size_t)(out_pos - out))
+					return false;
+
+				size_t length = token & 15;
+				if (length == 15 && !read_length(in, in_end, length))
+					return false;
+				length += MIN_MATCH;
+				// Matches must not overwrite the literals not read yet
+				if (length > (size_t)(literal - out_pos))
+					return false;
+
+				const uint8_t* match = out_pos - offset;
+				if (offset >= length)
+					memcpy(out_pos, match, length);
+				else
+				{
+					// Overlapping: the match repeats the bytes it is copying
+					for (size_t i = 0; i < length; ++i)
+						out_pos[i] = match[i];
+				}
+				out_pos += length;
+			}
+
+			return out_pos == out_end && literal == literal_end;
+		}
+
+		bool compress_file(const file_range& source, FILE* to, uint64_t& written, unsigned thread_count)
+		{
+			written = 0;
+
+			file_view view;
+			if (!view.open(source))
+				return false;
+
+			thread_count = std::max(thread_count, 1u);
+
+			header_t header = {};
+			memcpy(header.magic, magic, sizeof(magic));
+			header.version = current_version;
+			header.block_size = default_block_size;
+			header.raw_size = view.size();
+			header.block_count = (header.raw_size + header.block_size - 1) / header.block_size;
+
+			// The header is written again at the end, with the table's offset
+			uint64_t start = 0;
+			if (!tell_file(to, start) || fwrite(&header, sizeof(header), 1, to) != 1)
+				return false;
+
+			std::vector<uint64_t> offsets(header.block_count + 1);
+			offsets[0] = sizeof(header);
+
+			const size_t batch_blocks = thread_count * BLOCKS_PER_THREAD;
+			std::vector<std::vector<uint8_t>> compressed(std::min<uint64_t>(batch_blocks, header.block_count));
+			std::vector<size_t> compressed_sizes(compressed.size());
+			for (auto& block : compressed)
+				block.resize(max_compressed_size(header.block_size));
+
+			bool ok = true;
+			for (uint64_t first_block = 0; ok && first_block < header.block_count; first_block += batch_blocks)
+			{
+				const size_t block_count = (size_t)std::min<uint64_t>(batch_blocks, header.block_count - first_block);
+				const uint64_t raw_offset = first_block * header.block_size;
+				const size_t raw_size = (size_t)std::min<uint64_t>((uint64_t)block_count * header.block_size, header.raw_size - raw_offset);
+
+				// One read for the batch: the pointer stays valid until the next one
+				const uint8_t* raw = view.read(raw_offset, raw_size);
+				if (raw == nullptr)
+				{
+					ok = false;
+					break;
+				}
+
+				auto compress_blocks = [&](size_t first)
+				{
+					for (size_t i = first; i < block_count; i += thread_count)
+					{
+						const size_t block_offset = i * header.block_size;
+						const size_t block_size = std::min<size_t>(header.block_size, raw_size - block_offset);
+						compressed_sizes[i] = compress_block(raw + block_offset, block_size, compressed[i].data());
+						// Data that doesn't compress is stored raw
+						if (compressed_sizes[i] >= block_size)
+						{
+							memcpy(compressed[i].data(), raw + block_offset, block_size);
+							compressed_sizes[i] = block_size;
+						}
+					}
+				};
+
+				std::vector<std::thread> threads;
+				for (size_t t = 1; t < std::min<size_t>(thread_count, block_count); ++t)
+					threads.emplace_back(compress_blocks, t);
+				compress_blocks(0);
+				for (auto& thread : threads)
+					thread.join();
+
+				for (size_t i = 0; ok && i < block_count; ++i)
+				{
+					ok = fwrite(compressed[i].data(), 1, compressed_sizes[i], to) == compressed_sizes[i];
+					offsets[first_block + i + 1] = offsets[first_block + i] + compressed_sizes[i];
+				}
+			}
+
+			header.table_offset = offsets.back();
+			ok = ok && fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), to) == offsets.size();
+			ok = ok && seek_file(to, start) && fwrite(&header, sizeof(header), 1, to) == 1;
+
+			written = header.table_offset + offsets.size() * sizeof(uint64_t);
+			ok = ok && seek_file(to, start + written);
+			return ok;
+		}
+
+		bool read_table(file_view& file, header_t& header, std::vector<uint64_t>& offsets)
+		{
+			const uint8_t* data = file.read(0, sizeof(header));
+			if (data == nullptr)
+				return false;
+			memcpy(&header, data, sizeof(header));
+
+			if (memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != current_version || header.block_size == 0 ||
+				header.block_count != (header.raw_size + header.block_size - 1) / header.block_size ||
+				header.table_offset > file.size() || (file.size() - header.table_offset) / sizeof(uint64_t) < header.block_count + 1)
+				return false;
+
+			data = file.read(header.table_offset, (size_t)(header.block_count + 1) * sizeof(uint64_t));
+			if (data == nullptr)
+				return false;
+			offsets.resize((size_t)header.block_count + 1);
+			memcpy(offsets.data(), data, offsets.size() * sizeof(uint64_t));
+
+			if (offsets.front() != sizeof(header) || offsets.back() != header.table_offset)
+				return false;
+
+			// A block is never stored larger than raw
+			for (uint64_t i = 0; i < header.block_count; ++i)
+			{
+				const uint64_t raw_size = std::min<uint64_t>(header.block_size, header.raw_size - i * header.block_size);
+				if (offsets[i + 1] < offsets[i] || offsets[i + 1] - offsets[i] > raw_size)
+					return false;
+			}
+			return true;
+		}
+	}
+}
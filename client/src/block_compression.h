@@ -0,0 +1,78 @@
+#pragma once
+
+#include "file_view.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+namespace owlcat
+{
+	/*
+		Block compression of capture files (see capture_container.h): a file is cut into
+		blocks of block_size bytes, compressed independently, so that any byte range of it
+		is read by decompressing only the blocks it overlaps - a frame range of the event
+		log costs the same in a capture of any size - and blocks can be decompressed by any
+		number of threads at once.
+
+		The codec is a byte-oriented LZ77 in the spirit of LZ4, with the literals Huffman
+		coded: the event log is already packed into fixed-width columns (see event_log.cpp),
+		where repeats are rare but byte values are far from uniform. A block is its literals
+		(see block_compression.cpp), then a list of sequences:
+
+			token (literal count in the high 4 bits, match length - 4 in the low 4 bits),
+			[more literal count], match offset (2 bytes), [more match length]
+
+		where a count of 15 in the token continues in bytes added to it until one is not
+		255, and the literals of each sequence come next from the block's literals. The
+		last sequence of a block has no match.
+
+		Compressed file layout:
+
+			header_t, the compressed blocks, then block_count + 1 offsets (uint64_t,
+			relative to the header) of the blocks, the last one being where the table
+			starts. A block as large as its raw data is stored raw.
+
+		FORMAT VERSIONING RULES: same as the event log (see event_log.h).
+	*/
+	namespace block_compression
+	{
+#pragma pack(push, 1)
+		struct header_t
+		{
+			char magic[8];
+			uint32_t version;
+			// Raw size of all blocks but the last
+			uint32_t block_size;
+			// Size of the file once decompressed
+			uint64_t raw_size;
+			uint64_t block_count;
+			// Offset of the block offset table, relative to the header
+			uint64_t table_offset;
+		};
+#pragma pack(pop)
+
+		static_assert(sizeof(header_t) == 40, "unexpected compressed file header size");
+
+		static const uint32_t current_version = 1;
+		// Small enough that a range query decompresses little more than it reads: about
+		// 10000 events of the event log, a frame or less. Larger blocks compress no better,
+		// as the Huffman codes of smaller ones fit their data more closely.
+		static const uint32_t default_block_size = 64 * 1024;
+
+		// Returns the largest size compress_block can return for size bytes
+		size_t max_compressed_size(size_t size);
+		// Compresses a block into out (overwritten), returns its size. Never fails.
+		size_t compress_block(const uint8_t* data, size_t size, uint8_t* out);
+		// Decompresses a block of exactly out_size bytes. Returns false if it is damaged.
+		bool decompress_block(const uint8_t* data, size_t size, uint8_t* out, size_t out_size);
+
+		// Compresses a file (or a range of one) and writes the compressed file at the current
+		// position of to. written receives its size. Blocks are compressed by thread_count
+		// threads.
+		bool compress_file(const file_range& source, FILE* to, uint64_t& written, unsigned thread_count);
+
+		// Validates the header and reads the block offset table of a compressed file
+		bool read_table(file_view& file, header_t& header, std::vector<uint64_t>& offsets);
+	}
+}
@@ -1,27 +1,65 @@
 #include "capture_container.h"
+#include "block_compression.h"
 
+#include <algorithm>
+#include <cstddef>
 #include <cstdio>
 #include <cstdint>
 #include <cstring>
+#include <thread>
 #include <vector>
 
+#if !defined(WIN32)
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 namespace owlcat
 {
 	namespace capture_container
 	{
 		const char* entry_database = "database";
 		const char* entry_events = "events";
+		const char* entry_frame_stats = "frame_stats";
+		const char* entry_memory_stats = "memory_stats";
 
 		/*
 			On-disk format, version 1:
 
 			header_t, then header_t.entry_count of entry_t, then the entries' data
 			at the offsets recorded in their entry_t.
+
+			Version 2: same layout, but every entry's data starts at a multiple of
+			entry_alignment (the gaps are zeroes).
+
+			Version 3: entries are entry_v3_t, which have flags: an entry can hold a
+			block-compressed file (see block_compression.h).
+
+			Version 4, a journal (see journal_writer): header_t with entry_count 0, then
+			records, each a record_t followed by record_t.size bytes:
+
+				record_data: bytes of entries, which checkpoints point into
+				record_checkpoint: the directory: checkpoint_t, then for every entry a
+					checkpoint_entry_t followed by its pieces (file_piece: offset in the
+					container, size), in order
+				record_end: the offset of the last checkpoint (uint64_t), ending the file
+
+			The data record that the stream is written to has a size of open_record_size
+			until a record is written after it: a journal that was not finalized ends with
+			it, or with a record cut short, and is read from its last checkpoint with the
+			right checksum. pack still writes version 3: journals are only written by
+			journal_writer.
 		*/
 		namespace format
 		{
-			static const uint32_t current_version = 1;
+			static const uint32_t current_version = 3;
+			static const uint32_t journal_version = 4;
 			static const char magic[8] = { 'O', 'W', 'L', 'C', 'A', 'P', 'T', 0 };
+			// The largest page size mappings must be aligned to (the allocation granularity
+			// of Windows)
+			static const uint64_t entry_alignment = 64 * 1024;
 
 #pragma pack(push, 1)
 			struct header_t
@@ -40,15 +78,99 @@ namespace owlcat
 				uint64_t offset;
 				uint64_t size;
 			};
+
+			enum entry_flags : uint64_t
+			{
+				entry_compressed = 1 << 0,
+			};
+
+			struct entry_v3_t
+			{
+				// Entry name, zero-terminated
+				char name[32];
+				uint64_t offset;
+				// Size of the data in the container (compressed)
+				uint64_t size;
+				// entry_flags
+				uint64_t flags;
+			};
+
+			enum record_type : uint32_t
+			{
+				record_data = 1,
+				record_checkpoint = 2,
+				record_end = 3,
+			};
+
+			static const uint32_t record_magic = 0x524C574F; // "OWLR"
+			static const uint64_t open_record_size = UINT64_MAX;
+
+			struct record_t
+			{
+				uint32_t magic;
+				uint32_t type;
+				uint64_t size;
+				// Of the record's data (FNV-1a), 0 for data records
+				uint64_t checksum;
+			};
+
+			struct checkpoint_t
+			{
+				uint32_t entry_count;
+				uint32_t reserved;
+			};
+
+			struct checkpoint_entry_t
+			{
+				// Entry name, zero-terminated
+				char name[32];
+				uint64_t piece_count;
+			};
 #pragma pack(pop)
 
 			static_assert(sizeof(header_t) == 32, "unexpected container header size");
 			static_assert(sizeof(entry_t) == 48, "unexpected container entry size");
+			static_assert(sizeof(entry_v3_t) == 56, "unexpected container entry size");
+			static_assert(sizeof(record_t) == 24, "unexpected journal record size");
+			static_assert(sizeof(checkpoint_entry_t) == 40, "unexpected journal entry size");
+			static_assert(sizeof(file_piece) == 16, "unexpected journal piece size");
 		}
 
 		using namespace format;
 
-		// Copies count bytes between two files using a scratch buffer. Returns false on any error.
+		static uint64_t checksum(const void* data, size_t size)
+		{
+			uint64_t hash = 0xCBF29CE484222325ULL;
+			for (size_t i = 0; i < size; ++i)
+				hash = (hash ^ ((const uint8_t*)data)[i]) * 0x100000001B3ULL;
+			return hash;
+		}
+
+		// An entry's range from its pieces: a plain range if there is one
+		static file_range make_range(const std::string& path, const std::vector<file_piece>& pieces)
+		{
+			if (pieces.empty())
+				return file_range(path, 0, 0);
+			if (pieces.size() == 1)
+				return file_range(path, pieces[0].offset, pieces[0].size);
+			return file_range(path, pieces);
+		}
+
+		static bool get_file_size(FILE* file, uint64_t& size)
+		{
+#if defined(WIN32)
+			return seek_file(file, 0, SEEK_END) && tell_file(file, size);
+#else
+			struct stat st;
+			if (fstat(fileno(file), &st) != 0)
+				return false;
+			size = (uint64_t)st.st_size;
+			return true;
+#endif
+		}
+
+		// Copies count bytes between two files using a scratch buffer, from the current
+		// positions. Returns false on any error.
 		static bool copy_bytes(FILE* from, FILE* to, uint64_t count)
 		{
 			std::vector<uint8_t> buffer(1024 * 1024);
@@ -64,15 +186,76 @@ namespace owlcat
 			return true;
 		}
 
-		static uint64_t file_size(FILE* file)
+		/*
+			Copies a range of a file to an offset of another, opened for writing. Returns the
+			number of bytes copied (the range stops at the end of the source) in size.
+
+			On Linux the kernel copies the data, without it going through user space:
+			copy_file_range (which can even share the blocks on file systems that support it),
+			or sendfile where the file systems don't allow it, and only then a buffered copy.
+		*/
+		static bool copy_range(const file_range& source, FILE* to, uint64_t to_offset, uint64_t& size)
 		{
-			_fseeki64(file, 0, SEEK_END);
-			uint64_t size = (uint64_t)_ftelli64(file);
-			_fseeki64(file, 0, SEEK_SET);
-			return size;
+			if (!source.pieces.empty())
+			{
+				size = 0;
+				for (auto& piece : source.pieces)
+				{
+					uint64_t copied = 0;
+					if (!copy_range(file_range(source.path, piece.offset, piece.size), to, to_offset + size, copied))
+						return false;
+					size += copied;
+				}
+				return true;
+			}
+
+			FILE* from = fopen(source.path.c_str(), "rb");
+			if (from == nullptr)
+				return false;
+
+			uint64_t source_size = 0;
+			bool ok = get_file_size(from, source_size) && source.offset <= source_size;
+			size = ok ? std::min(source.size, source_size - source.offset) : 0;
+
+#if !defined(WIN32)
+			// Whatever was written through the FILE must be in the file first
+			ok = ok && fflush(to) == 0;
+			const int in_fd = fileno(from);
+			const int out_fd = fileno(to);
+			off_t in_offset = (off_t)source.offset;
+			off_t out_offset = (off_t)to_offset;
+			uint64_t left = size;
+
+			while (ok && left > 0)
+			{
+				const ssize_t copied = copy_file_range(in_fd, &in_offset, out_fd, &out_offset, (size_t)std::min<uint64_t>(left, 1ull << 30), 0);
+				if (copied <= 0)
+					break;
+				left -= (uint64_t)copied;
+			}
+
+			if (ok && left > 0 && lseek(out_fd, out_offset, SEEK_SET) == out_offset)
+			{
+				while (left > 0)
+				{
+					const ssize_t copied = sendfile(out_fd, in_fd, &in_offset, (size_t)std::min<uint64_t>(left, 1ull << 30));
+					if (copied <= 0)
+						break;
+					left -= (uint64_t)copied;
+				}
+			}
+
+			// Buffered copy of whatever is left
+			ok = ok && (left == 0 || (seek_file(from, (uint64_t)in_offset) && seek_file(to, (uint64_t)out_offset) && copy_bytes(from, to, left)));
+#else
+			ok = ok && seek_file(from, source.offset) && seek_file(to, to_offset) && copy_bytes(from, to, size);
+#endif
+
+			fclose(from);
+			return ok;
 		}
 
-		bool pack(const std::string& container_path, const std::map<std::string, std::string>& files)
+		bool pack(const std::string& container_path, const std::map<std::string, file_range>& files, const std::set<std::string>& compress)
 		{
 			FILE* container = fopen(container_path.c_str(), "wb");
 			if (container == nullptr)
@@ -85,40 +268,49 @@ namespace owlcat
 			header.version = current_version;
 			header.entry_count = (uint32_t)files.size();
 
-			std::vector<entry_t> entries;
-			uint64_t data_offset = sizeof(header_t) + files.size() * sizeof(entry_t);
+			std::vector<entry_v3_t> entries;
+			uint64_t data_offset = sizeof(header_t) + files.size() * sizeof(entry_v3_t);
+			const unsigned thread_count = std::max(std::thread::hardware_concurrency(), 1u);
 
-			// Write the header and a placeholder directory: sizes are filled in
-			// while copying, and the directory is rewritten at the end
+			// Write the header, then the entries, then the directory: sizes are only
+			// known once the entries are copied
 			ok = ok && fwrite(&header, sizeof(header), 1, container) == 1;
-			ok = ok && _fseeki64(container, data_offset, SEEK_SET) == 0;
 
 			for (auto& file : files)
 			{
-				entry_t entry = {};
+				entry_v3_t entry = {};
 				strncpy(entry.name, file.first.c_str(), sizeof(entry.name) - 1);
-				entry.offset = data_offset;
+				entry.offset = (data_offset + entry_alignment - 1) / entry_alignment * entry_alignment;
 
-				FILE* source = ok ? fopen(file.second.c_str(), "rb") : nullptr;
-				if (source == nullptr)
-				{
-					ok = false;
-					break;
-				}
+				// Entries compressed already (of an opened capture) are copied as they are
+				if (file.second.compressed || compress.count(file.first) == 0)
+					ok = ok && copy_range(file.second, container, entry.offset, entry.size);
+				else
+					ok = ok && seek_file(container, entry.offset) && block_compression::compress_file(file.second, container, entry.size, thread_count);
+				if (file.second.compressed || compress.count(file.first) != 0)
+					entry.flags |= entry_compressed;
 
-				entry.size = file_size(source);
-				ok = copy_bytes(source, container, entry.size);
-				fclose(source);
+				if (!ok)
+					break;
 
-				data_offset += entry.size;
+				data_offset = entry.offset + entry.size;
 				entries.push_back(entry);
 			}
 
-			// Write the directory
-			ok = ok && _fseeki64(container, sizeof(header_t), SEEK_SET) == 0;
-			ok = ok && fwrite(entries.data(), sizeof(entry_t), entries.size(), container) == entries.size();
+			ok = ok && seek_file(container, sizeof(header_t));
+			ok = ok && fwrite(entries.data(), sizeof(entry_v3_t), entries.size(), container) == entries.size();
 
-			fclose(container);
+			// The last entry may be empty and past the end of what was written
+			ok = ok && fflush(container) == 0;
+			uint64_t container_size = 0;
+			if (ok && get_file_size(container, container_size) && container_size < data_offset)
+			{
+				const uint8_t zero = 0;
+				ok = seek_file(container, data_offset - 1) && fwrite(&zero, 1, 1, container) == 1;
+			}
+
+			if (fclose(container) != 0)
+				ok = false;
 
 			if (!ok)
 				remove(container_path.c_str());
@@ -126,9 +318,90 @@ namespace owlcat
 			return ok;
 		}
 
-		bool unpack(const std::string& container_path, const std::string& destination_dir, std::map<std::string, std::string>& extracted_files)
+		// Reads the checkpoint record at offset, checking it whole
+		static bool read_checkpoint(FILE* container, const std::string& path, uint64_t container_size, uint64_t offset, std::map<std::string, file_range>& entries)
+		{
+			record_t record = {};
+			if (!seek_file(container, offset) || fread(&record, sizeof(record), 1, container) != 1 ||
+				record.magic != record_magic || record.type != record_checkpoint || record.size < sizeof(checkpoint_t) ||
+				record.size > container_size - offset - sizeof(record))
+				return false;
+
+			std::vector<uint8_t> data((size_t)record.size);
+			if (fread(data.data(), 1, data.size(), container) != data.size() || checksum(data.data(), data.size()) != record.checksum)
+				return false;
+
+			checkpoint_t checkpoint;
+			memcpy(&checkpoint, data.data(), sizeof(checkpoint));
+			size_t position = sizeof(checkpoint);
+			for (uint32_t i = 0; i < checkpoint.entry_count; ++i)
+			{
+				checkpoint_entry_t entry;
+				if (data.size() - position < sizeof(entry))
+					return false;
+				memcpy(&entry, data.data() + position, sizeof(entry));
+				position += sizeof(entry);
+				if (entry.piece_count > (data.size() - position) / sizeof(file_piece))
+					return false;
+
+				std::vector<file_piece> pieces((size_t)entry.piece_count);
+				memcpy(pieces.data(), data.data() + position, pieces.size() * sizeof(file_piece));
+				position += pieces.size() * sizeof(file_piece);
+				for (auto& piece : pieces)
+				{
+					if (piece.offset > container_size || piece.size > container_size - piece.offset)
+						return false;
+				}
+
+				entry.name[sizeof(entry.name) - 1] = 0;
+				entries[entry.name] = make_range(path, pieces);
+			}
+			return true;
+		}
+
+		static bool read_journal(FILE* container, const std::string& path, uint64_t container_size, std::map<std::string, file_range>& entries)
 		{
-			extracted_files.clear();
+			// A finalized journal ends with the offset of its last checkpoint
+			record_t record = {};
+			uint64_t checkpoint_offset = 0;
+			if (container_size >= sizeof(header_t) + sizeof(record) + sizeof(checkpoint_offset) &&
+				seek_file(container, container_size - sizeof(record) - sizeof(checkpoint_offset)) &&
+				fread(&record, sizeof(record), 1, container) == 1 && fread(&checkpoint_offset, sizeof(checkpoint_offset), 1, container) == 1 &&
+				record.magic == record_magic && record.type == record_end && record.size == sizeof(checkpoint_offset) &&
+				record.checksum == checksum(&checkpoint_offset, sizeof(checkpoint_offset)) &&
+				read_checkpoint(container, path, container_size, checkpoint_offset, entries))
+				return true;
+
+			// Otherwise the capture was cut short: find the checkpoints, and take the last one
+			// that is complete
+			std::vector<uint64_t> checkpoints;
+			uint64_t offset = sizeof(header_t);
+			while (container_size - offset >= sizeof(record) && seek_file(container, offset) && fread(&record, sizeof(record), 1, container) == 1)
+			{
+				if (record.magic != record_magic || record.size == open_record_size || record.size > container_size - offset - sizeof(record))
+					break;
+				if (record.type == record_checkpoint)
+					checkpoints.push_back(offset);
+				offset += sizeof(record) + record.size;
+			}
+
+			for (auto iter = checkpoints.rbegin(); iter != checkpoints.rend(); ++iter)
+			{
+				entries.clear();
+				if (read_checkpoint(container, path, container_size, *iter, entries))
+				{
+					printf("Capture '%s' was not saved: reading it as of its last checkpoint\n", path.c_str());
+					return true;
+				}
+			}
+
+			entries.clear();
+			return false;
+		}
+
+		bool read_directory(const std::string& container_path, std::map<std::string, file_range>& entries)
+		{
+			entries.clear();
 
 			FILE* container = fopen(container_path.c_str(), "rb");
 			if (container == nullptr)
@@ -142,48 +415,308 @@ namespace owlcat
 				return false;
 			}
 
-			if (header.version != 1)
+			if (header.version == journal_version)
 			{
-				printf("Capture container '%s' has unsupported version %u\n", container_path.c_str(), header.version);
+				uint64_t container_size = 0;
+				const bool ok = get_file_size(container, container_size) && read_journal(container, container_path, container_size, entries);
 				fclose(container);
-				return false;
+				return ok;
 			}
 
-			std::vector<entry_t> entries(header.entry_count);
-			if (fread(entries.data(), sizeof(entry_t), entries.size(), container) != entries.size())
+			// Versions 1 and 2 only differ in the alignment of the entries
+			if (header.version < 1 || header.version > 3)
 			{
+				printf("Capture container '%s' has unsupported version %u\n", container_path.c_str(), header.version);
 				fclose(container);
 				return false;
 			}
 
+			std::vector<entry_v3_t> directory(header.entry_count);
 			bool ok = true;
-			for (auto& entry : entries)
+			if (header.version >= 3)
+				ok = fread(directory.data(), sizeof(entry_v3_t), directory.size(), container) == directory.size();
+			else
 			{
-				entry.name[sizeof(entry.name) - 1] = 0;
-				const std::string destination = destination_dir + "\\" + entry.name;
+				std::vector<entry_t> entries_v1(header.entry_count);
+				ok = fread(entries_v1.data(), sizeof(entry_t), entries_v1.size(), container) == entries_v1.size();
+				for (size_t i = 0; ok && i < entries_v1.size(); ++i)
+				{
+					memcpy(directory[i].name, entries_v1[i].name, sizeof(directory[i].name));
+					directory[i].offset = entries_v1[i].offset;
+					directory[i].size = entries_v1[i].size;
+				}
+			}
 
-				FILE* out = fopen(destination.c_str(), "wb");
-				if (out == nullptr)
+			uint64_t container_size = 0;
+			ok = ok && get_file_size(container, container_size);
+			fclose(container);
+
+			for (auto& entry : directory)
+			{
+				// A truncated container
+				if (!ok || entry.offset > container_size || entry.size > container_size - entry.offset)
 				{
 					ok = false;
 					break;
 				}
 
-				ok = _fseeki64(container, entry.offset, SEEK_SET) == 0 && copy_bytes(container, out, entry.size);
-				fclose(out);
+				entry.name[sizeof(entry.name) - 1] = 0;
+				entries[entry.name] = file_range(container_path, entry.offset, entry.size, (entry.flags & entry_compressed) != 0);
+			}
 
-				if (!ok)
-					break;
+			if (!ok)
+				entries.clear();
+
+			return ok;
+		}
+
+		bool extract(const file_range& entry, const std::string& destination_path)
+		{
+			FILE* out = fopen(destination_path.c_str(), "wb");
+			if (out == nullptr)
+				return false;
 
-				extracted_files[entry.name] = destination;
+			bool ok = true;
+			if (!entry.compressed)
+			{
+				uint64_t size = 0;
+				ok = copy_range(entry, out, 0, size);
+			}
+			else
+			{
+				// Decompressed block by block
+				file_view view;
+				ok = view.open(entry);
+				for (uint64_t offset = 0; ok && offset < view.size(); offset += block_compression::default_block_size)
+				{
+					const size_t size = (size_t)std::min<uint64_t>(block_compression::default_block_size, view.size() - offset);
+					const uint8_t* data = view.read(offset, size);
+					ok = data != nullptr && fwrite(data, 1, size, out) == size;
+				}
 			}
 
-			fclose(container);
+			if (fclose(out) != 0)
+				ok = false;
 
 			if (!ok)
-				extracted_files.clear();
+				remove(destination_path.c_str());
 
 			return ok;
 		}
+
+		journal_writer::~journal_writer()
+		{
+			close();
+		}
+
+		bool journal_writer::create(const std::string& path, const std::string& stream_name)
+		{
+			close();
+
+#if defined(WIN32)
+			// _SH_DENYNO: readers must be able to open the file while we're writing it
+			m_file = _fsopen(path.c_str(), "wb", _SH_DENYNO);
+#else
+			m_file = fopen(path.c_str(), "wb");
+#endif
+			if (m_file == nullptr)
+				return false;
+
+			setvbuf(m_file, nullptr, _IOFBF, 1024 * 1024);
+			m_path = path;
+			m_stream_name = stream_name;
+
+			header_t header = {};
+			memcpy(header.magic, magic, sizeof(magic));
+			header.version = journal_version;
+			m_end = sizeof(header);
+			if (fwrite(&header, sizeof(header), 1, m_file) != 1 || !open_stream())
+			{
+				close();
+				remove(path.c_str());
+				return false;
+			}
+			return true;
+		}
+
+		bool journal_writer::finalize()
+		{
+			if (m_file == nullptr)
+				return false;
+
+			bool ok = close_stream() && write_checkpoint() &&
+				write_record(record_end, &m_last_checkpoint, sizeof(m_last_checkpoint), checksum(&m_last_checkpoint, sizeof(m_last_checkpoint)));
+			if (fclose(m_file) != 0)
+				ok = false;
+			m_file = nullptr;
+			close();
+			return ok;
+		}
+
+		void journal_writer::close()
+		{
+			if (m_file != nullptr)
+				fclose(m_file);
+			m_file = nullptr;
+			m_end = 0;
+			m_last_checkpoint = 0;
+			m_stream_pieces.clear();
+			m_stream_size = 0;
+			m_stream_record = UINT64_MAX;
+			m_entries.clear();
+		}
+
+		file_range journal_writer::get_stream_range(uint64_t size) const
+		{
+			std::vector<file_piece> pieces;
+			uint64_t left = size;
+			for (auto& piece : m_stream_pieces)
+			{
+				if (left == 0)
+					break;
+				pieces.push_back({ piece.offset, std::min(piece.size, left) });
+				left -= pieces.back().size;
+			}
+			if (left > 0 && m_stream_record != UINT64_MAX)
+				pieces.push_back({ m_stream_record + sizeof(record_t), left });
+			return make_range(m_path, pieces);
+		}
+
+		bool journal_writer::write(const std::string& name, uint64_t offset, const void* data, size_t size)
+		{
+			auto& pieces = m_entries[name];
+			const uint64_t entry_size = pieces.empty() ? 0 : pieces.rbegin()->first + pieces.rbegin()->second.size;
+			if (m_file == nullptr || offset > entry_size)
+				return false;
+			if (size == 0)
+				return true;
+
+			if (!close_stream())
+				return false;
+			const uint64_t data_offset = m_end + sizeof(record_t);
+			if (!write_record(record_data, data, size, 0))
+				return false;
+
+			// The new bytes replace the ends of the pieces they overlap, and the pieces in
+			// between
+			const uint64_t end = offset + size;
+			auto iter = pieces.lower_bound(offset);
+			if (iter != pieces.begin())
+			{
+				auto previous = std::prev(iter);
+				const uint64_t previous_end = previous->first + previous->second.size;
+				if (previous_end > offset)
+				{
+					previous->second.size = offset - previous->first;
+					if (previous_end > end)
+						pieces[end] = { previous->second.offset + (end - previous->first), previous_end - end };
+				}
+			}
+			while (iter != pieces.end() && iter->first < end)
+			{
+				const uint64_t piece_end = iter->first + iter->second.size;
+				if (piece_end > end)
+					pieces[end] = { iter->second.offset + (end - iter->first), piece_end - end };
+				iter = pieces.erase(iter);
+			}
+			pieces[offset] = { data_offset, size };
+			return true;
+		}
+
+		void journal_writer::truncate(const std::string& name, uint64_t size)
+		{
+			auto& pieces = m_entries[name];
+			pieces.erase(pieces.lower_bound(size), pieces.end());
+			if (!pieces.empty() && pieces.rbegin()->first + pieces.rbegin()->second.size > size)
+				pieces.rbegin()->second.size = size - pieces.rbegin()->first;
+		}
+
+		bool journal_writer::checkpoint()
+		{
+			return m_file != nullptr && close_stream() && write_checkpoint() && open_stream() && fflush(m_file) == 0;
+		}
+
+		bool journal_writer::open_stream()
+		{
+			const record_t record = { record_magic, record_data, open_record_size, 0 };
+			if (fwrite(&record, sizeof(record), 1, m_file) != 1)
+				return false;
+			m_stream_record = m_end;
+			m_end += sizeof(record);
+			return true;
+		}
+
+		bool journal_writer::close_stream()
+		{
+			if (m_stream_record == UINT64_MAX)
+				return true;
+
+			// The stream's writer wrote up to the end of the file
+			uint64_t end = 0;
+			if (fflush(m_file) != 0 || !seek_file(m_file, 0, SEEK_END) || !tell_file(m_file, end))
+				return false;
+
+			const uint64_t data_offset = m_stream_record + sizeof(record_t);
+			const uint64_t size = end - data_offset;
+			if (!seek_file(m_file, m_stream_record + offsetof(record_t, size)) || fwrite(&size, sizeof(size), 1, m_file) != 1 || !seek_file(m_file, end))
+				return false;
+
+			if (size > 0)
+				m_stream_pieces.push_back({ data_offset, size });
+			m_stream_size += size;
+			m_stream_record = UINT64_MAX;
+			m_end = end;
+			return true;
+		}
+
+		bool journal_writer::write_record(uint32_t type, const void* data, size_t size, uint64_t record_checksum)
+		{
+			const record_t record = { record_magic, type, size, record_checksum };
+			if (fwrite(&record, sizeof(record), 1, m_file) != 1 || (size > 0 && fwrite(data, 1, size, m_file) != size))
+				return false;
+			m_end += sizeof(record) + size;
+			return true;
+		}
+
+		bool journal_writer::write_checkpoint()
+		{
+			std::vector<uint8_t> data(sizeof(checkpoint_t));
+			auto add_entry = [&](const std::string& name, const std::vector<file_piece>& pieces)
+			{
+				checkpoint_entry_t entry = {};
+				strncpy(entry.name, name.c_str(), sizeof(entry.name) - 1);
+				entry.piece_count = pieces.size();
+				const size_t position = data.size();
+				data.resize(position + sizeof(entry) + pieces.size() * sizeof(file_piece));
+				memcpy(data.data() + position, &entry, sizeof(entry));
+				memcpy(data.data() + position + sizeof(entry), pieces.data(), pieces.size() * sizeof(file_piece));
+			};
+
+			add_entry(m_stream_name, m_stream_pieces);
+			std::vector<file_piece> pieces;
+			for (auto& entry : m_entries)
+			{
+				// Pieces that follow each other in the file too are one
+				pieces.clear();
+				for (auto& piece : entry.second)
+				{
+					if (!pieces.empty() && pieces.back().offset + pieces.back().size == piece.second.offset)
+						pieces.back().size += piece.second.size;
+					else if (piece.second.size > 0)
+						pieces.push_back(piece.second);
+				}
+				add_entry(entry.first, pieces);
+			}
+
+			checkpoint_t checkpoint = {};
+			checkpoint.entry_count = (uint32_t)(1 + m_entries.size());
+			memcpy(data.data(), &checkpoint, sizeof(checkpoint));
+
+			const uint64_t offset = m_end;
+			if (!write_record(record_checkpoint, data.data(), data.size(), checksum(data.data(), data.size())))
+				return false;
+			m_last_checkpoint = offset;
+			return true;
+		}
 	}
 }
@@ -1,7 +1,12 @@
 #pragma once
 
+#include "file_view.h"
+
+#include <cstdio>
 #include <string>
 #include <map>
+#include <set>
+#include <vector>
 
 namespace owlcat
 {
@@ -9,22 +14,118 @@ namespace owlcat
 		The capture container packs the files that make up one capture (the SQLite
 		database and the event log) into a single .owl file on save.
 
+		Entries are not extracted to be read: read_directory returns where each one is in
+		the container, and readers open that byte range of the .owl file in place (see
+		file_view). Since version 2, entries start at page-aligned offsets, so that they
+		can be memory-mapped without mapping their neighbours. Since version 3, entries can
+		be block-compressed (see block_compression.h): their file_range says so, and
+		file_view reads them decompressed, a block at a time.
+
+		A capture is written as a container while it runs, a journal (see journal_writer):
+		saving it only finalizes the journal, and it survives a crash of the client up to
+		its last checkpoint.
+
 		FORMAT VERSIONING RULES: same as the event log (see event_log.h) - pack always
-		writes the current version, unpack dispatches on the version in the header and
-		must keep support for every version ever shipped.
+		writes the current version, read_directory dispatches on the version in the header
+		and must keep support for every version ever shipped.
 	*/
 	namespace capture_container
 	{
 		// Names of the container entries used for captures
 		extern const char* entry_database;
 		extern const char* entry_events;
+		// The per-frame series of the graphs (see frame_series.h). Captures saved before they
+		// were added don't have them: the series are rebuilt from the database instead.
+		extern const char* entry_frame_stats;
+		extern const char* entry_memory_stats;
+
+		// Packs the given files (entry name -> source file, or byte range of a file such as
+		// an entry of another container) into a single container file, overwriting it if it
+		// exists. The entries named in compress are block-compressed, on all cores; entries
+		// compressed already stay so. The data of the others is copied by the kernel where
+		// the platform allows it.
+		bool pack(const std::string& container_path, const std::map<std::string, file_range>& files, const std::set<std::string>& compress = {});
+
+		// Reads the directory of a container. Returns entry name -> the entry's byte range
+		// in the container file.
+		bool read_directory(const std::string& container_path, std::map<std::string, file_range>& entries);
+
+		// Copies an entry (as returned by read_directory) into a file of its own, decompressed,
+		// for readers that need a plain file
+		bool extract(const file_range& entry, const std::string& destination_path);
+
+		/*
+			Writes a container while the capture runs, as a journal: the file only ever grows,
+			and a checkpoint appends the directory of everything written so far. A journal is
+			a container from its first checkpoint on: read_directory reads the last complete
+			one, so a capture survives a crash of the client up to it. finalize only has to
+			write a last checkpoint, whatever the size of the capture.
+
+			One entry, the stream, is written to the file by its own writer as it is produced
+			(the event log, see event_log_writer::create(FILE*)). The other entries are working
+			files that are written in place (the database) or appended to (the series): write
+			copies the bytes of them that changed, and the entry reads the latest copy of every
+			byte. Entries are not compressed: pack compresses a journal into a container like
+			any other.
+
+			Not thread-safe: the stream's writer and the calls below must not overlap.
+		*/
+		class journal_writer
+		{
+		public:
+			~journal_writer();
+
+			// Creates the journal (overwriting the file), with the named entry as its stream
+			bool create(const std::string& path, const std::string& stream_name);
+			// Writes a last checkpoint and closes the file: it is now a complete container
+			bool finalize();
+			// Closes the file as it is: readers see the last checkpoint
+			void close();
+			bool is_open() const { return m_file != nullptr; }
+			const std::string& path() const { return m_path; }
+
+			// The file the stream is written to, at its end. The stream's record is open from
+			// create or a checkpoint until the next call to write: the stream must not be
+			// written to after it.
+			FILE* stream_file() const { return m_file; }
+			// Where the first size bytes of the stream are in the file. These bytes must have
+			// been flushed to it.
+			file_range get_stream_range(uint64_t size) const;
+
+			// Copies bytes of an entry into the journal: bytes [offset, offset + size) of the
+			// entry are read from the copy from now on. Writes must not leave a gap in an
+			// entry.
+			bool write(const std::string& name, uint64_t offset, const void* data, size_t size);
+			// Cuts an entry to size bytes, or creates it empty
+			void truncate(const std::string& name, uint64_t size);
+
+			// Appends the directory: what was written so far is the container's content (the
+			// stream up to the end of the file: its writer must flush first)
+			bool checkpoint();
+
+		private:
+			// The stream's data record is written to until a record comes after it
+			bool open_stream();
+			bool close_stream();
+			bool write_record(uint32_t type, const void* data, size_t size, uint64_t checksum);
+			bool write_checkpoint();
+
+			FILE* m_file = nullptr;
+			std::string m_path;
+			std::string m_stream_name;
+			// End of the file (the stream's writer may have written past it since close_stream)
+			uint64_t m_end = 0;
+			uint64_t m_last_checkpoint = 0;
 
-		// Packs the given files (entry name -> source path) into a single container
-		// file, overwriting it if it exists
-		bool pack(const std::string& container_path, const std::map<std::string, std::string>& files);
+			// The stream's pieces in closed records, their total size, and the offset of the
+			// stream's open record (UINT64_MAX if none)
+			std::vector<file_piece> m_stream_pieces;
+			uint64_t m_stream_size = 0;
+			uint64_t m_stream_record = UINT64_MAX;
 
-		// Extracts all entries of a container into the given directory (which must
-		// exist). Returns entry name -> extracted file path.
-		bool unpack(const std::string& container_path, const std::string& destination_dir, std::map<std::string, std::string>& extracted_files);
+			// The other entries: offset in the entry -> where the bytes are in the file,
+			// covering the whole entry
+			std::map<std::string, std::map<uint64_t, file_piece>> m_entries;
+		};
 	}
 }
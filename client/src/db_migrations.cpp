@@ -75,6 +75,79 @@ namespace owlcat
                 },
             }
         },
+        //----------------------------------------------------------------
+        // Frames the server recorded only partially because it couldn't keep up (see
+        // SRV_DEGRADED), and the allocations it only counted per type in them.
+        {
+            "Add overload tables",
+            {
+                {
+                    "CREATE TABLE DegradedFrames("
+                    "frame INTEGER PRIMARY KEY NOT NULL,"
+                    "level INT NOT NULL,"
+                    "dropped_allocs INT NOT NULL,"
+                    "dropped_size INT NOT NULL"
+                    ")"
+                },
+                {
+                    "CREATE TABLE DroppedAllocs("
+                    "frame INT NOT NULL,"
+                    "type_id INT NOT NULL,"
+                    "allocs INT NOT NULL,"
+                    "size INT NOT NULL,"
+                    "PRIMARY KEY (frame, type_id)"
+                    ")"
+                },
+            }
+        },
+        //----------------------------------------------------------------
+        // Callstacks as sequences of frame ids instead of one text each: every unique line
+        // ("Class.Method" or "Module.dll+0xRVA") is stored once in Frames, and a callstack is
+        // a varint-packed array of frame ids, with a hash of the sequence to canonicalize it.
+        // Frame texts are unique by construction (the client interns them), so no UNIQUE
+        // index. The text-based Callstacks table of older captures is converted when the
+        // capture is loaded.
+        {
+            "Store callstacks as frame sequences",
+            {
+                {
+                    "CREATE TABLE Frames("
+                    "frame_id INTEGER PRIMARY KEY NOT NULL,"
+                    "text TEXT NOT NULL"
+                    ")"
+                },
+                {
+                    "CREATE TABLE CallstackFrames("
+                    "callstack_id INTEGER PRIMARY KEY NOT NULL,"
+                    "hash INT NOT NULL,"
+                    "frames BLOB NOT NULL"
+                    ")"
+                },
+            }
+        },
+        //----------------------------------------------------------------
+        // Symbolication results of native frames, so that reopening a capture doesn't resolve
+        // them all again: the display text of each frame, empty if it couldn't be resolved,
+        // and the identity of the symbols of its module they were resolved with (see
+        // symbol_resolver::get_module_identity). Results of a module whose identity differs
+        // when the capture is opened are resolved again.
+        {
+            "Add symbolication tables",
+            {
+                {
+                    "CREATE TABLE SymbolicatedFrames("
+                    "frame_id INTEGER PRIMARY KEY NOT NULL,"
+                    "text TEXT NOT NULL"
+                    ")"
+                },
+                {
+                    "CREATE TABLE SymbolModules("
+                    "module TEXT PRIMARY KEY NOT NULL,"
+                    "identity TEXT NOT NULL"
+                    ")"
+                },
+            }
+        },
     };
 
     // Important: queries are not registred before this call, so we can't use named queries here, unless we register them ourselves
@@ -136,4 +209,24 @@ namespace owlcat
 
         return true;
     }
+
+    bool database_needs_upgrade(persistent_storage::persistent_storage& db)
+    {
+        if (!db.is_open())
+            return true;
+
+        // A database older than the migrations table has them all to run
+        auto table = db.query_data_immediate("SELECT name FROM sqlite_master WHERE type = 'table' AND name = 'db_migrations';", {});
+        if (table.has_error() || !table.next())
+            return true;
+
+        std::vector<std::string> completed_migrations_ids;
+        auto completed_migrations = db.query_data_immediate("SELECT identifier FROM db_migrations;", {});
+        if (completed_migrations.has_error())
+            return true;
+        while (completed_migrations.next())
+            completed_migrations_ids.push_back(completed_migrations.get_string("identifier"));
+
+        return std::any_of(all_migrations.begin(), all_migrations.end(), [&](const migration_t& m) { return std::find(completed_migrations_ids.begin(), completed_migrations_ids.end(), m.id) == completed_migrations_ids.end(); });
+    }
 }
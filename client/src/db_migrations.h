@@ -3,4 +3,7 @@
 namespace owlcat
 {
 	bool upgrade_database(persistent_storage::persistent_storage& db);
+	// Returns true if upgrade_database has migrations to run on the database. Only reads it,
+	// so it works on read-only databases too.
+	bool database_needs_upgrade(persistent_storage::persistent_storage& db);
 }
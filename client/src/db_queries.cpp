@@ -8,44 +8,47 @@ namespace owlcat
         query_id_t id_insert_frame_stats = "insert_frame_stats";
         query_id_t id_select_min_max_frame = "select_min_max_frame";
         query_id_t id_select_frame_event_range = "select_frame_event_range";
+        query_id_t id_select_frame_end_offsets = "select_frame_end_offsets";
         query_id_t id_select_stats = "select_stats";
         query_id_t id_insert_type = "insert_type";
+        query_id_t id_insert_frame = "insert_frame";
         query_id_t id_insert_callstack = "insert_callstack";
         query_id_t id_select_types = "select_types";
+        query_id_t id_select_frames = "select_frames";
         query_id_t id_select_callstacks = "select_callstacks";
-        query_id_t id_select_last_good_size = "select_last_good_size";
+        query_id_t id_select_legacy_callstacks = "select_legacy_callstacks";
+        query_id_t id_delete_legacy_callstacks = "delete_legacy_callstacks";
         query_id_t id_insert_memstats = "insert_memstats";
         query_id_t id_select_memstats = "select_memstats";
+        query_id_t id_insert_degraded_frame = "insert_degraded_frame";
+        query_id_t id_insert_dropped_allocs = "insert_dropped_allocs";
+        query_id_t id_select_degraded_frames = "select_degraded_frames";
+        query_id_t id_select_dropped_allocs = "select_dropped_allocs";
+        query_id_t id_insert_symbolicated_frame = "insert_symbolicated_frame";
+        query_id_t id_insert_symbol_module = "insert_symbol_module";
+        query_id_t id_select_symbolicated_frames = "select_symbolicated_frames";
+        query_id_t id_select_symbol_modules = "select_symbol_modules";
+        query_id_t id_delete_symbolicated_frames = "delete_symbolicated_frames";
+        query_id_t id_delete_symbol_modules = "delete_symbol_modules";
 
         bool insert_type(db_t& db, const std::string& type, uint64_t id)
         {
-            return db.query(queries::id_insert_type,
-                {
-                    { "id", id },
-                    { "type", type }
-                });
+            return db.get_statement(queries::id_insert_type).execute(id, type);
         }
 
-        bool insert_callstack(db_t& db, const std::string& callstack, uint64_t id)
+        bool insert_frame(db_t& db, uint64_t id, const std::string& text)
         {
-            return db.query(queries::id_insert_callstack,
-                {
-                    { "id", id },
-                    { "stack", callstack }
-                });
+            return db.get_statement(queries::id_insert_frame).execute(id, text);
+        }
+
+        bool insert_callstack(db_t& db, uint64_t id, uint64_t hash, const std::vector<uint8_t>& frames)
+        {
+            return db.get_statement(queries::id_insert_callstack).execute(id, hash, frames);
         }
 
         bool insert_frame_stats(db_t& db, uint64_t frame, uint64_t allocs, uint64_t frees, int64_t size, uint64_t first_event_offset, uint64_t end_event_offset)
         {
-            return db.query(queries::id_insert_frame_stats,
-                {
-                    {"frame", frame},
-                    {"allocs", allocs},
-                    {"frees", frees},
-                    {"size", size},
-                    {"first_offset", first_event_offset},
-                    {"end_offset", end_event_offset},
-                });
+            return db.get_statement(queries::id_insert_frame_stats).execute(frame, allocs, frees, size, first_event_offset, end_event_offset);
         }
 
         cursor_t select_min_max_frame(db_t& db)
@@ -58,6 +61,11 @@ namespace owlcat
             return db.query_data(queries::id_select_frame_event_range, { {"from", from_frame}, {"to", to_frame} });
         }
 
+        cursor_t select_frame_end_offsets(db_t& db, uint64_t after_offset, uint64_t to_offset)
+        {
+            return db.query_data(queries::id_select_frame_end_offsets, { {"after", after_offset}, {"to", to_offset} });
+        }
+
         cursor_t select_stats(db_t& db, uint64_t from_frame, uint64_t to_frame)
         {
             return db.query_data(queries::id_select_stats, { {"from", from_frame}, {"to", to_frame} });
@@ -65,13 +73,7 @@ namespace owlcat
 
         bool insert_memstats(db_t& db, uint64_t frame, uint64_t working_set, uint64_t committed, uint64_t gc_heap)
         {
-            return db.query(queries::id_insert_memstats,
-                {
-                    {"frame", frame},
-                    {"working_set", working_set},
-                    {"committed", committed},
-                    {"gc_heap", gc_heap},
-                });
+            return db.get_statement(queries::id_insert_memstats).execute(frame, working_set, committed, gc_heap);
         }
 
         cursor_t select_memstats(db_t& db, uint64_t from_frame, uint64_t to_frame)
@@ -79,21 +81,78 @@ namespace owlcat
             return db.query_data(queries::id_select_memstats, { {"from", from_frame}, {"to", to_frame} });
         }
 
+        bool insert_degraded_frame(db_t& db, uint64_t frame, uint8_t level, uint64_t dropped_allocs, uint64_t dropped_size)
+        {
+            return db.get_statement(queries::id_insert_degraded_frame).execute(frame, (uint64_t)level, dropped_allocs, dropped_size);
+        }
+
+        bool insert_dropped_allocs(db_t& db, uint64_t frame, uint64_t type_id, uint64_t allocs, uint64_t size)
+        {
+            return db.get_statement(queries::id_insert_dropped_allocs).execute(frame, type_id, allocs, size);
+        }
+
+        cursor_t select_degraded_frames(db_t& db, uint64_t from_frame, uint64_t to_frame)
+        {
+            return db.query_data(queries::id_select_degraded_frames, { {"from", from_frame}, {"to", to_frame} });
+        }
+
+        cursor_t select_dropped_allocs(db_t& db, uint64_t from_frame, uint64_t to_frame)
+        {
+            return db.query_data(queries::id_select_dropped_allocs, { {"from", from_frame}, {"to", to_frame} });
+        }
+
         cursor_t select_types(db_t& db)
         {
             return db.query_data(queries::id_select_types, {});
         }
 
+        cursor_t select_frames(db_t& db)
+        {
+            return db.query_data(queries::id_select_frames, {});
+        }
+
         cursor_t select_callstacks(db_t& db)
         {
             return db.query_data(queries::id_select_callstacks, {});
         }
 
-        cursor_t select_last_good_size(db_t& db, uint64_t from_frame)
+        cursor_t select_legacy_callstacks(db_t& db)
+        {
+            return db.query_data(queries::id_select_legacy_callstacks, {});
+        }
+
+        bool delete_legacy_callstacks(db_t& db)
+        {
+            return db.query(queries::id_delete_legacy_callstacks, {});
+        }
+
+        bool insert_symbolicated_frame(db_t& db, uint64_t frame_id, const std::string& text)
+        {
+            return db.get_statement(queries::id_insert_symbolicated_frame).execute(frame_id, text);
+        }
+
+        bool insert_symbol_module(db_t& db, const std::string& module, const std::string& identity)
+        {
+            return db.get_statement(queries::id_insert_symbol_module).execute(module, identity);
+        }
+
+        cursor_t select_symbolicated_frames(db_t& db)
         {
-            return db.query_data(queries::id_select_last_good_size, { {"from", from_frame} });
+            return db.query_data(queries::id_select_symbolicated_frames, {});
         }
 
+        cursor_t select_symbol_modules(db_t& db)
+        {
+            return db.query_data(queries::id_select_symbol_modules, {});
+        }
+
+        bool delete_symbolication(db_t& db)
+        {
+            return db.query(queries::id_delete_symbolicated_frames, {}) && db.query(queries::id_delete_symbol_modules, {});
+        }
+
+        // The insert_* functions above bind the parameters by position, in the order they appear
+        // in the query text, so keep the two in sync
         bool register_queries(persistent_storage::persistent_storage& db)
         {
             if (!db.is_open())
@@ -113,20 +172,48 @@ namespace owlcat
                 "INSERT INTO ObjectTypes (type_id, name)"
                 "VALUES ($id, $type)"
             );
+            register_query(queries::id_insert_frame,
+                "INSERT INTO Frames (frame_id, text)"
+                "VALUES ($id, $text)"
+            );
             register_query(queries::id_insert_callstack,
-                "INSERT INTO Callstacks (callstack_id, callstack)"
-                "VALUES ($id, $stack)"
+                "INSERT INTO CallstackFrames (callstack_id, hash, frames)"
+                "VALUES ($id, $hash, $frames)"
             );
             register_query(queries::id_select_types,
                 "SELECT type_id, name FROM ObjectTypes"
             );
+            register_query(queries::id_select_frames,
+                "SELECT frame_id, text FROM Frames ORDER BY frame_id"
+            );
             register_query(queries::id_select_callstacks,
+                "SELECT callstack_id, hash, frames FROM CallstackFrames"
+            );
+            register_query(queries::id_select_legacy_callstacks,
                 "SELECT callstack_id, callstack FROM Callstacks"
             );
-            register_query(queries::id_select_last_good_size,
-                "SELECT size "
-                "FROM FrameStats "
-                "WHERE frame <= $from ORDER BY frame DESC LIMIT 1"
+            register_query(queries::id_delete_legacy_callstacks,
+                "DELETE FROM Callstacks"
+            );
+            register_query(queries::id_insert_symbolicated_frame,
+                "INSERT OR REPLACE INTO SymbolicatedFrames (frame_id, text)"
+                "VALUES ($id, $text)"
+            );
+            register_query(queries::id_insert_symbol_module,
+                "INSERT OR REPLACE INTO SymbolModules (module, identity)"
+                "VALUES ($module, $identity)"
+            );
+            register_query(queries::id_select_symbolicated_frames,
+                "SELECT frame_id, text FROM SymbolicatedFrames"
+            );
+            register_query(queries::id_select_symbol_modules,
+                "SELECT module, identity FROM SymbolModules"
+            );
+            register_query(queries::id_delete_symbolicated_frames,
+                "DELETE FROM SymbolicatedFrames"
+            );
+            register_query(queries::id_delete_symbol_modules,
+                "DELETE FROM SymbolModules"
             );
             register_query(queries::id_insert_frame_stats,
                 "INSERT OR REPLACE INTO FrameStats (frame, allocs, frees, size, first_event_offset, end_event_offset)"
@@ -142,6 +229,12 @@ namespace owlcat
                 "FROM FrameStats "
                 "WHERE frame >= $from AND frame <= $to"
             );
+            register_query(queries::id_select_frame_end_offsets,
+                "SELECT end_event_offset AS end_offset "
+                "FROM FrameStats "
+                "WHERE end_event_offset > $after AND end_event_offset <= $to "
+                "ORDER BY end_event_offset"
+            );
             register_query(queries::id_select_stats,
                 "SELECT frame, allocs, frees, size "
                 "FROM FrameStats "
@@ -158,6 +251,31 @@ namespace owlcat
                 "WHERE frame >= $from AND frame <= $to "
                 "ORDER BY frame"
             );
+            // A frame can be reported more than once if the worker's frame numbers were
+            // clamped (see worker_thread::do_work): the counts add up
+            register_query(queries::id_insert_degraded_frame,
+                "INSERT INTO DegradedFrames (frame, level, dropped_allocs, dropped_size)"
+                "VALUES ($frame, $level, $dropped_allocs, $dropped_size) "
+                "ON CONFLICT(frame) DO UPDATE SET level = MAX(level, excluded.level), "
+                "dropped_allocs = dropped_allocs + excluded.dropped_allocs, dropped_size = dropped_size + excluded.dropped_size"
+            );
+            register_query(queries::id_insert_dropped_allocs,
+                "INSERT INTO DroppedAllocs (frame, type_id, allocs, size)"
+                "VALUES ($frame, $type_id, $allocs, $size) "
+                "ON CONFLICT(frame, type_id) DO UPDATE SET allocs = allocs + excluded.allocs, size = size + excluded.size"
+            );
+            register_query(queries::id_select_degraded_frames,
+                "SELECT frame, level, dropped_allocs, dropped_size "
+                "FROM DegradedFrames "
+                "WHERE frame >= $from AND frame <= $to "
+                "ORDER BY frame"
+            );
+            register_query(queries::id_select_dropped_allocs,
+                "SELECT type_id, SUM(allocs) AS allocs, SUM(size) AS size "
+                "FROM DroppedAllocs "
+                "WHERE frame >= $from AND frame <= $to "
+                "GROUP BY type_id ORDER BY size DESC"
+            );
 
             return all_ok;
         }
@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include <string>
+#include <vector>
 
 namespace persistent_storage
 {
@@ -19,7 +20,10 @@ namespace owlcat
         using query_id_t = const char*;
 
         bool insert_type(db_t& db, const std::string& type, uint64_t id);
-        bool insert_callstack(db_t& db, const std::string& callstack, uint64_t id);
+        // A unique callstack frame (one line of callstack text)
+        bool insert_frame(db_t& db, uint64_t id, const std::string& text);
+        // A callstack: hash of its frame id sequence and the varint-packed frame ids
+        bool insert_callstack(db_t& db, uint64_t id, uint64_t hash, const std::vector<uint8_t>& frames);
         // Also records the byte range of the frame's events in the event log file
         bool insert_frame_stats(db_t& db, uint64_t frame, uint64_t allocs, uint64_t frees, int64_t size, uint64_t first_event_offset, uint64_t end_event_offset);
 
@@ -27,13 +31,34 @@ namespace owlcat
         // Returns the byte range (begin_offset, end_offset) of the events of the given
         // frame range in the event log file
         cursor_t select_frame_event_range(db_t& db, uint64_t from_frame, uint64_t to_frame);
+        // Returns the end offsets (end_offset) of the frames whose events end in
+        // (after_offset, to_offset] in the event log file, in order
+        cursor_t select_frame_end_offsets(db_t& db, uint64_t after_offset, uint64_t to_offset);
         cursor_t select_stats(db_t& db, uint64_t from_frame, uint64_t to_frame);
         // Per-frame whole-process memory snapshot (see SRV_MEMSTATS)
         bool insert_memstats(db_t& db, uint64_t frame, uint64_t working_set, uint64_t committed, uint64_t gc_heap);
         cursor_t select_memstats(db_t& db, uint64_t from_frame, uint64_t to_frame);
+        // Frames recorded only partially because the server was overloaded (see SRV_DEGRADED),
+        // and the allocations that were only counted per type in them
+        bool insert_degraded_frame(db_t& db, uint64_t frame, uint8_t level, uint64_t dropped_allocs, uint64_t dropped_size);
+        bool insert_dropped_allocs(db_t& db, uint64_t frame, uint64_t type_id, uint64_t allocs, uint64_t size);
+        cursor_t select_degraded_frames(db_t& db, uint64_t from_frame, uint64_t to_frame);
+        // Dropped allocations of a frame range, summed per type
+        cursor_t select_dropped_allocs(db_t& db, uint64_t from_frame, uint64_t to_frame);
         cursor_t select_types(db_t& db);
+        cursor_t select_frames(db_t& db);
         cursor_t select_callstacks(db_t& db);
-        cursor_t select_last_good_size(db_t& db, uint64_t from_frame);
+        // Callstacks stored as text by older versions (the Callstacks table), and their removal
+        // once converted
+        cursor_t select_legacy_callstacks(db_t& db);
+        bool delete_legacy_callstacks(db_t& db);
+        // Symbolication results of native frames (text empty if unresolved), and the identity
+        // of the symbols of each module they were resolved with
+        bool insert_symbolicated_frame(db_t& db, uint64_t frame_id, const std::string& text);
+        bool insert_symbol_module(db_t& db, const std::string& module, const std::string& identity);
+        cursor_t select_symbolicated_frames(db_t& db);
+        cursor_t select_symbol_modules(db_t& db);
+        bool delete_symbolication(db_t& db);
 
         bool register_queries(persistent_storage::persistent_storage& db);
     }
@@ -0,0 +1,175 @@
+#include "db_writer.h"
+#include "db_queries.h"
+#include "persistent_storage.h"
+
+#include <chrono>
+#include <optional>
+
+namespace owlcat
+{
+	// A transaction is committed once it holds this many rows...
+	static const uint64_t COMMIT_ROWS = 16 * 1024;
+	// ...or once it has been open this long
+	static const std::chrono::milliseconds COMMIT_INTERVAL(100);
+
+	void db_writer::write_row(persistent_storage::persistent_storage& db, row_t& row)
+	{
+		// By type, so that the rows follow their alternatives if the variant changes
+		if (auto type = std::get_if<type_row>(&row))
+			queries::insert_type(db, type->name, type->id);
+		else if (auto frame = std::get_if<frame_row>(&row))
+			queries::insert_frame(db, frame->id, frame->text);
+		else if (auto callstack = std::get_if<callstack_row>(&row))
+			queries::insert_callstack(db, callstack->id, callstack->hash, callstack->frames);
+		else if (auto write = std::get_if<std::function<void()>>(&row))
+			(*write)();
+	}
+
+	db_writer::~db_writer()
+	{
+		stop();
+	}
+
+	void db_writer::start(persistent_storage::persistent_storage& db)
+	{
+		stop();
+
+		m_db = &db;
+		m_queue.clear();
+		m_pushed = 0;
+		m_written = 0;
+		m_stop = false;
+		m_checkpoint = nullptr;
+		m_commits = 0;
+		m_thread = std::thread(&db_writer::write_loop, this);
+	}
+
+	void db_writer::stop()
+	{
+		if (!m_thread.joinable())
+			return;
+
+		{
+			std::scoped_lock lock(m_mutex);
+			m_stop = true;
+		}
+		m_wake.notify_one();
+		m_thread.join();
+	}
+
+	void db_writer::push(std::vector<row_t>& rows)
+	{
+		if (rows.empty())
+			return;
+
+		{
+			std::scoped_lock lock(m_mutex);
+			m_pushed += rows.size();
+			if (m_queue.empty())
+				m_queue.swap(rows);
+			else
+			{
+				for (auto& row : rows)
+					m_queue.push_back(std::move(row));
+			}
+		}
+		rows.clear();
+		m_wake.notify_one();
+	}
+
+	void db_writer::flush()
+	{
+		if (!m_thread.joinable())
+			return;
+
+		std::unique_lock lock(m_mutex);
+		const uint64_t target = m_pushed;
+		m_written_cv.wait(lock, [&]() { return m_written >= target || m_stop; });
+	}
+
+	void db_writer::checkpoint(const std::function<void()>& action)
+	{
+		if (!m_thread.joinable())
+		{
+			action();
+			return;
+		}
+
+		std::unique_lock lock(m_mutex);
+		// One checkpoint at a time
+		m_written_cv.wait(lock, [this]() { return m_checkpoint == nullptr; });
+		m_checkpoint = &action;
+		m_wake.notify_one();
+		m_written_cv.wait(lock, [&]() { return m_checkpoint != &action; });
+	}
+
+	void db_writer::write_loop()
+	{
+		std::vector<row_t> rows;
+		std::optional<persistent_storage::transaction> transaction;
+		std::chrono::steady_clock::time_point transaction_start;
+		uint64_t transaction_rows = 0;
+
+		while (true)
+		{
+			bool stop;
+			const std::function<void()>* checkpoint;
+			{
+				std::unique_lock lock(m_mutex);
+				auto ready = [this]() { return m_stop || !m_queue.empty() || m_checkpoint != nullptr; };
+				// With a transaction open, wake up in time to commit it
+				if (transaction)
+					m_wake.wait_until(lock, transaction_start + COMMIT_INTERVAL, ready);
+				else
+					m_wake.wait(lock, ready);
+
+				rows.swap(m_queue);
+				stop = m_stop;
+				checkpoint = m_checkpoint;
+			}
+
+			if (!rows.empty())
+			{
+				if (!transaction)
+				{
+					transaction.emplace(*m_db, persistent_storage::transaction_behaviour::commit);
+					transaction_start = std::chrono::steady_clock::now();
+				}
+
+				for (auto& row : rows)
+					write_row(*m_db, row);
+				transaction_rows += rows.size();
+
+				{
+					std::scoped_lock lock(m_mutex);
+					m_written += rows.size();
+				}
+				m_written_cv.notify_all();
+				rows.clear();
+			}
+
+			if (transaction && (stop || checkpoint || transaction_rows >= COMMIT_ROWS || std::chrono::steady_clock::now() - transaction_start >= COMMIT_INTERVAL))
+			{
+				transaction->commit();
+				transaction.reset();
+				transaction_rows = 0;
+				++m_commits;
+			}
+
+			if (checkpoint)
+			{
+				(*checkpoint)();
+				{
+					std::scoped_lock lock(m_mutex);
+					m_checkpoint = nullptr;
+				}
+				m_written_cv.notify_all();
+			}
+
+			if (stop)
+				break;
+		}
+
+		m_written_cv.notify_all();
+	}
+}
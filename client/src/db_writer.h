@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <variant>
+#include <vector>
+
+namespace persistent_storage
+{
+	class persistent_storage;
+};
+
+namespace owlcat
+{
+	/*
+		Writes database rows on a thread of its own, so that the ingest pipeline never waits
+		for SQLite. Rows are handed over in batches and written in the order they were pushed.
+
+		Every SQLite statement outside of a transaction is a transaction of its own, which
+		costs far more than the insert itself. The writer opens a transaction when the first
+		row arrives, and commits it once it holds enough rows or is old enough (see
+		db_writer.cpp), or when the writer stops: a few commits per second, whatever the rate.
+
+		Queries run on the same connection, which sees its own uncommitted rows, so a query
+		only needs the rows to be written, not committed: flush() waits for that.
+	*/
+	class db_writer
+	{
+	public:
+		// Definitions are by far the most frequent rows (a capture defines hundreds of
+		// thousands of frames and callstacks), so they are queued as plain rows; anything
+		// else is a closure run on the writer thread.
+		struct type_row
+		{
+			uint64_t id;
+			std::string name;
+		};
+		struct frame_row
+		{
+			uint64_t id;
+			std::string text;
+		};
+		struct callstack_row
+		{
+			uint64_t id;
+			uint64_t hash;
+			// Varint-packed frame ids
+			std::vector<uint8_t> frames;
+		};
+		using row_t = std::variant<type_row, frame_row, callstack_row, std::function<void()>>;
+
+		// Writes one row to db right away
+		static void write_row(persistent_storage::persistent_storage& db, row_t& row);
+
+		~db_writer();
+
+		// Starts the writer thread, writing to db
+		void start(persistent_storage::persistent_storage& db);
+		// Writes and commits all pushed rows, then stops the thread
+		void stop();
+		bool is_running() const { return m_thread.joinable(); }
+
+		// Queues rows for writing, in order. Leaves rows empty.
+		void push(std::vector<row_t>& rows);
+		// Returns once all rows pushed before the call are written. Returns right away if
+		// the writer is not running.
+		void flush();
+		// Writes and commits all rows pushed before the call, then calls action on the writer
+		// thread, between two transactions (e.g. to copy the database file), and returns once
+		// it has run. Calls it right away if the writer is not running. Must not be called
+		// while stop() runs.
+		void checkpoint(const std::function<void()>& action);
+
+		// Total number of transactions committed since start. Monotonic: sample it
+		// periodically to measure the commit rate.
+		uint64_t get_commits_count() const { return m_commits; }
+
+	private:
+		void write_loop();
+
+		persistent_storage::persistent_storage* m_db = nullptr;
+		std::thread m_thread;
+
+		std::mutex m_mutex;
+		// Wakes the writer up: rows were pushed, or stop() was called
+		std::condition_variable m_wake;
+		// Wakes flush() and checkpoint() up: rows were written, or a checkpoint ran
+		std::condition_variable m_written_cv;
+		std::vector<row_t> m_queue;
+		// Rows pushed, and rows written, since start
+		uint64_t m_pushed = 0;
+		uint64_t m_written = 0;
+		bool m_stop = false;
+		// The action of the pending checkpoint, if any
+		const std::function<void()>* m_checkpoint = nullptr;
+
+		std::atomic<uint64_t> m_commits = 0;
+	};
+}
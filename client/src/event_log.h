@@ -1,10 +1,13 @@
 #pragma once
 
+#include "file_view.h"
+
 #include <cstdint>
 #include <cstdio>
 #include <string>
 #include <memory>
 #include <functional>
+#include <vector>
 
 namespace owlcat
 {
@@ -36,10 +39,74 @@ namespace owlcat
 		bool is_alloc;
 	};
 
+	// Statistics of one block of events (see event_log_reader::scan)
+	struct event_block_stats
+	{
+		uint64_t first_frame;
+		uint64_t last_frame;
+		uint64_t min_addr;
+		uint64_t max_addr;
+		uint64_t alloc_bytes;
+		uint64_t free_bytes;
+		uint32_t event_count;
+		uint32_t alloc_count;
+	};
+
+	// Columns of event_columns, combined as flags in event_scan_filter::columns
+	enum event_column : uint32_t
+	{
+		event_column_frame = 1 << 0,
+		event_column_addr = 1 << 1,
+		event_column_size = 1 << 2,
+		event_column_type_id = 1 << 3,
+		event_column_callstack_id = 1 << 4,
+		event_column_is_alloc = 1 << 5,
+		event_column_all = (1 << 6) - 1,
+	};
+
+	/*
+		Tells a scan which columns to decode, and which blocks it may skip. A block is
+		skipped (without being read) only when its statistics prove that none of its
+		events can match; the events of the blocks that are delivered are NOT filtered.
+	*/
+	struct event_scan_filter
+	{
+		static constexpr uint64_t any_type = ~0ull;
+
+		// event_column flags
+		uint32_t columns = event_column_all;
+		// Skip blocks that hold no allocation of this type
+		uint64_t type_id = any_type;
+		// Skip blocks that hold no event with an address in [min_addr, max_addr]
+		uint64_t min_addr = 0;
+		uint64_t max_addr = ~0ull;
+	};
+
+	/*
+		A block of events decoded into one array per field, all of count elements: tight
+		loops over them vectorize, unlike per-event callbacks. Arrays of columns that the
+		scan did not ask for may be null. type_id and callstack_id are 0 for frees.
+	*/
+	struct event_columns
+	{
+		size_t count;
+		const uint64_t* frame;
+		const uint64_t* addr;
+		const uint32_t* size;
+		const uint64_t* type_id;
+		const uint64_t* callstack_id;
+		const uint8_t* is_alloc;
+		event_block_stats stats;
+	};
+
 	/*
 		Writes the current version of the event log format. Single writer; readers may
 		read the file concurrently, but must only rely on byte ranges that were published
 		(stored in the database) after a flush.
+
+		Events are written in blocks (see event_log.cpp): append collects them in memory,
+		and a block goes out when it is full or on flush. A flush therefore ends a block,
+		and published ranges always consist of whole blocks.
 	*/
 	class event_log_writer
 	{
@@ -48,6 +115,10 @@ namespace owlcat
 
 		// Creates a new event log file, overwriting an existing one
 		bool create(const std::string& path);
+		// Starts a new event log at the current position of a file opened for writing (the
+		// stream of a capture journal, see capture_container.h). The file stays the caller's:
+		// close doesn't close it. Positions are relative to where the log starts.
+		bool create(FILE* file);
 		void close();
 		bool is_open() const;
 
@@ -58,13 +129,30 @@ namespace owlcat
 		// Makes all appended events visible to readers of the same file
 		bool flush();
 
-		// Byte offset at which the next appended event will start. Use together with
-		// flush to publish the byte range of a frame's events.
+		// Byte offset just past the last written block: right after a flush, the offset
+		// at which the next appended event will start. Use together with flush to publish
+		// the byte range of a frame's events.
 		uint64_t position() const { return m_position; }
 
 	private:
+		// Writes the header
+		bool start();
+		void write_block();
+
 		FILE* m_file = nullptr;
+		bool m_owns_file = false;
 		uint64_t m_position = 0;
+
+		// The block being collected, column by column. Type and callstack ids are
+		// only stored for allocations, the kinds are a bitmap (1 = allocation).
+		std::vector<uint64_t> m_frames;
+		std::vector<uint64_t> m_addrs;
+		std::vector<uint64_t> m_sizes;
+		std::vector<uint64_t> m_type_ids;
+		std::vector<uint64_t> m_callstack_ids;
+		std::vector<uint64_t> m_kinds;
+		// The encoded block
+		std::vector<uint8_t> m_block;
 	};
 
 	/*
@@ -78,9 +166,11 @@ namespace owlcat
 	public:
 		virtual ~event_log_reader() {}
 
-		// Opens the log and returns a reader for the format version in its header,
-		// or null if the file is missing, damaged, or of an unknown version
-		static std::unique_ptr<event_log_reader> open(const std::string& path);
+		// Opens the log (a file, or a range of one, e.g. a container entry) and returns a
+		// reader for the format version in its header, or null if the file is missing,
+		// damaged, or of an unknown version. The file is memory-mapped unless map_file is
+		// false or mapping fails (see file_view).
+		static std::unique_ptr<event_log_reader> open(const file_range& file, bool map_file = true);
 
 		// Byte offset of the first event in the log
 		virtual uint64_t begin_offset() const = 0;
@@ -94,10 +184,39 @@ namespace owlcat
 
 		// Calls the callback for every event in [begin_offset, end_offset), in order.
 		// Stops early if the callback returns false. Returns false on read errors.
-		virtual bool read_range(uint64_t begin_offset, uint64_t end_offset, const std::function<bool(const event_view&)>& callback) = 0;
+		// Replaying many events, prefer visit_range, which spares the per-event call.
+		bool read_range(uint64_t begin_offset, uint64_t end_offset, const std::function<bool(const event_view&)>& callback);
+
+		// Same as read_range, but the events are decoded in batches, and the callback is
+		// called once per batch with an array of count events.
+		virtual bool read_batches(uint64_t begin_offset, uint64_t end_offset, const std::function<bool(const event_view* events, size_t count)>& callback) = 0;
+
+		// Same as read_range, but visitor(const event_view&) is called from a loop over each
+		// batch that the compiler sees, so it inlines: replay runs at the speed of decoding,
+		// not of calls through std::function.
+		template<typename Visitor>
+		bool visit_range(uint64_t begin_offset, uint64_t end_offset, Visitor&& visitor)
+		{
+			return read_batches(begin_offset, end_offset, [&visitor](const event_view* events, size_t count)
+			{
+				for (size_t i = 0; i < count; ++i)
+				{
+					if (!visitor(events[i]))
+						return false;
+				}
+				return true;
+			});
+		}
 
 		// Finds the latest allocation event of the given address before end_offset.
 		// Returns false if there is none.
 		virtual bool find_last_allocation(uint64_t address, uint64_t end_offset, event_view& result) = 0;
+
+		// Calls the callback for every block of events in [begin_offset, end_offset), in
+		// order, skipping the blocks that the filter rules out. Only the columns asked for
+		// are decoded - and, where the format allows, read. Stops early if the callback
+		// returns false. Returns false on read errors.
+		// Format versions without block statistics deliver every event, in chunks.
+		virtual bool scan(uint64_t begin_offset, uint64_t end_offset, const event_scan_filter& filter, const std::function<bool(const event_columns&)>& callback);
 	};
 }
@@ -0,0 +1,344 @@
+#include "file_view.h"
+#include "block_compression.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(WIN32)
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace owlcat
+{
+	bool seek_file(FILE* file, uint64_t offset, int origin)
+	{
+#if defined(WIN32)
+		return _fseeki64(file, (int64_t)offset, origin) == 0;
+#else
+		return fseeko(file, (off_t)offset, origin) == 0;
+#endif
+	}
+
+	bool tell_file(FILE* file, uint64_t& offset)
+	{
+#if defined(WIN32)
+		const int64_t position = _ftelli64(file);
+#else
+		const int64_t position = (int64_t)ftello(file);
+#endif
+		offset = (uint64_t)position;
+		return position >= 0;
+	}
+
+	file_view::~file_view()
+	{
+		close();
+	}
+
+	// Mappings must start at a multiple of this
+	static uint64_t mapping_granularity()
+	{
+#if defined(WIN32)
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return info.dwAllocationGranularity;
+#else
+		return (uint64_t)sysconf(_SC_PAGESIZE);
+#endif
+	}
+
+	bool file_view::open(const file_range& file, bool map_file)
+	{
+		close();
+
+		if (file.compressed)
+		{
+			file_range blocks = file;
+			blocks.compressed = false;
+			m_blocks = std::make_unique<file_view>();
+			block_compression::header_t header;
+			if (!m_blocks->open(blocks, map_file) ||
+				!block_compression::read_table(*m_blocks, header, m_block_offsets))
+			{
+				close();
+				return false;
+			}
+
+			m_block_size = header.block_size;
+			m_size = header.raw_size;
+			return true;
+		}
+
+		if (!file.pieces.empty())
+		{
+			m_pieces_file = std::make_unique<file_view>();
+			if (!m_pieces_file->open(file_range(file.path), map_file))
+			{
+				close();
+				return false;
+			}
+
+			for (auto& piece : file.pieces)
+			{
+				const uint64_t offset = std::min(piece.offset, m_pieces_file->size());
+				const uint64_t size = std::min(piece.size, m_pieces_file->size() - offset);
+				if (size == 0)
+					continue;
+				m_pieces.push_back({ offset, size });
+				m_piece_starts.push_back(m_size);
+				m_size += size;
+			}
+			return true;
+		}
+
+		uint64_t file_size = 0;
+#if defined(WIN32)
+		// Writers of the file (a capture in progress) must not be blocked
+		HANDLE handle = CreateFileA(file.path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (handle == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER size = {};
+		if (!GetFileSizeEx(handle, &size))
+		{
+			CloseHandle(handle);
+			return false;
+		}
+		file_size = (uint64_t)size.QuadPart;
+#else
+		int fd = ::open(file.path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+
+		struct stat st;
+		if (fstat(fd, &st) != 0)
+		{
+			::close(fd);
+			return false;
+		}
+		file_size = (uint64_t)st.st_size;
+#endif
+
+		m_offset = std::min(file.offset, file_size);
+		m_size = std::min(file.size, file_size - m_offset);
+
+		const uint64_t mapping_offset = m_offset - m_offset % mapping_granularity();
+		const uint64_t mapping_size = m_size + (m_offset - mapping_offset);
+
+#if defined(WIN32)
+		// Empty files can't be mapped. The view keeps the mapping alive after the
+		// handles are closed.
+		if (map_file && m_size > 0)
+		{
+			HANDLE mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (mapping != nullptr)
+			{
+				m_mapping = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, (DWORD)(mapping_offset >> 32), (DWORD)mapping_offset, (SIZE_T)mapping_size);
+				CloseHandle(mapping);
+			}
+		}
+		CloseHandle(handle);
+
+		if (m_mapping == nullptr)
+			m_file = _fsopen(file.path.c_str(), "rb", _SH_DENYNO);
+#else
+		if (map_file && m_size > 0)
+		{
+			void* data = mmap(nullptr, (size_t)mapping_size, PROT_READ, MAP_SHARED, fd, (off_t)mapping_offset);
+			if (data != MAP_FAILED)
+				m_mapping = (const uint8_t*)data;
+		}
+
+		if (m_mapping == nullptr)
+			m_file = fdopen(fd, "rb");
+		else
+			::close(fd);
+#endif
+
+		if (m_mapping != nullptr)
+		{
+			m_mapping_size = mapping_size;
+			m_data = m_mapping + (m_offset - mapping_offset);
+		}
+
+		if (!is_open())
+		{
+			m_size = 0;
+			m_offset = 0;
+			return false;
+		}
+
+		m_file_pos = 0;
+		if (m_file != nullptr && m_offset != 0 && !seek_file(m_file, m_offset))
+			m_file_pos = m_size;
+		return true;
+	}
+
+	void file_view::close()
+	{
+		if (m_mapping != nullptr)
+		{
+#if defined(WIN32)
+			UnmapViewOfFile(m_mapping);
+#else
+			munmap((void*)m_mapping, (size_t)m_mapping_size);
+#endif
+			m_mapping = nullptr;
+			m_mapping_size = 0;
+			m_data = nullptr;
+		}
+
+		if (m_file != nullptr)
+		{
+			fclose(m_file);
+			m_file = nullptr;
+		}
+
+		m_size = 0;
+		m_offset = 0;
+		m_buffer.clear();
+		m_buffer.shrink_to_fit();
+
+		m_blocks.reset();
+		m_block_size = 0;
+		m_block_offsets.clear();
+		for (unsigned i = 0; i < 2; ++i)
+		{
+			m_cached_blocks[i] = UINT64_MAX;
+			m_cached_data[i].clear();
+			m_cached_data[i].shrink_to_fit();
+		}
+
+		m_pieces_file.reset();
+		m_pieces.clear();
+		m_piece_starts.clear();
+	}
+
+	const uint8_t* file_view::read(uint64_t offset, size_t size)
+	{
+		if (offset > m_size || size > m_size - offset)
+			return nullptr;
+
+		if (m_data != nullptr)
+			return m_data + offset;
+
+		if (m_blocks != nullptr)
+			return read_compressed(offset, size);
+
+		if (m_pieces_file != nullptr)
+			return read_pieces(offset, size);
+
+		if (m_file == nullptr)
+			return nullptr;
+
+		if (offset != m_file_pos && !seek_file(m_file, m_offset + offset))
+		{
+			m_file_pos = m_size;
+			return nullptr;
+		}
+
+		// Never empty, so that empty reads also return a valid pointer
+		m_buffer.resize(size > 0 ? size : 1);
+		const size_t read = fread(m_buffer.data(), 1, size, m_file);
+		m_file_pos = offset + read;
+		return read == size ? m_buffer.data() : nullptr;
+	}
+
+	const std::vector<uint8_t>* file_view::decompress_block(uint64_t block)
+	{
+		for (unsigned i = 0; i < 2; ++i)
+		{
+			if (m_cached_blocks[i] == block)
+			{
+				m_last_cached = i;
+				return &m_cached_data[i];
+			}
+		}
+
+		// Replaces the older one
+		const unsigned slot = 1 - m_last_cached;
+		auto& data = m_cached_data[slot];
+		m_cached_blocks[slot] = UINT64_MAX;
+
+		const uint64_t stored_size = m_block_offsets[block + 1] - m_block_offsets[block];
+		const size_t raw_size = (size_t)std::min<uint64_t>(m_block_size, m_size - block * m_block_size);
+		const uint8_t* stored = m_blocks->read(m_block_offsets[block], (size_t)stored_size);
+		if (stored == nullptr)
+			return nullptr;
+
+		// Blocks that didn't compress are stored raw
+		data.resize(raw_size);
+		if (stored_size == raw_size)
+			memcpy(data.data(), stored, raw_size);
+		else if (!block_compression::decompress_block(stored, (size_t)stored_size, data.data(), raw_size))
+			return nullptr;
+
+		m_cached_blocks[slot] = block;
+		m_last_cached = slot;
+		return &data;
+	}
+
+	const uint8_t* file_view::read_compressed(uint64_t offset, size_t size)
+	{
+		const uint64_t first_block = offset / m_block_size;
+		const uint64_t last_block = size > 0 ? (offset + size - 1) / m_block_size : first_block;
+
+		// Most reads are within a block: point into it
+		if (first_block == last_block)
+		{
+			if (first_block == m_block_offsets.size() - 1)
+			{
+				// An empty read at the end
+				m_buffer.resize(1);
+				return m_buffer.data();
+			}
+			auto data = decompress_block(first_block);
+			return data != nullptr ? data->data() + (offset - first_block * m_block_size) : nullptr;
+		}
+
+		m_buffer.resize(size);
+		size_t copied = 0;
+		for (uint64_t block = first_block; block <= last_block; ++block)
+		{
+			auto data = decompress_block(block);
+			if (data == nullptr)
+				return nullptr;
+
+			const uint64_t block_begin = block * m_block_size;
+			const uint64_t from = std::max(offset, block_begin) - block_begin;
+			const uint64_t to = std::min<uint64_t>(offset + size - block_begin, data->size());
+			memcpy(m_buffer.data() + copied, data->data() + from, (size_t)(to - from));
+			copied += (size_t)(to - from);
+		}
+		return m_buffer.data();
+	}
+
+	const uint8_t* file_view::read_pieces(uint64_t offset, size_t size)
+	{
+		// An empty read at the end, or of an empty range
+		if (offset == m_size)
+			return m_pieces_file->read(0, 0);
+
+		size_t piece = (size_t)(std::upper_bound(m_piece_starts.begin(), m_piece_starts.end(), offset) - m_piece_starts.begin() - 1);
+		uint64_t from = offset - m_piece_starts[piece];
+		if (from + size <= m_pieces[piece].size)
+			return m_pieces_file->read(m_pieces[piece].offset + from, size);
+
+		m_buffer.resize(size);
+		for (size_t copied = 0; copied < size; ++piece, from = 0)
+		{
+			const size_t count = (size_t)std::min<uint64_t>(size - copied, m_pieces[piece].size - from);
+			const uint8_t* data = m_pieces_file->read(m_pieces[piece].offset + from, count);
+			if (data == nullptr)
+				return nullptr;
+			memcpy(m_buffer.data() + copied, data, count);
+			copied += count;
+		}
+		return m_buffer.data();
+	}
+}
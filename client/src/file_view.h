@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace owlcat
+{
+	struct file_piece
+	{
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	/*
+		A byte range of a file: a whole file, or an entry of a capture container read in
+		place (see capture_container.h)
+	*/
+	struct file_range
+	{
+		file_range() = default;
+		file_range(std::string path) : path(std::move(path)) {}
+		file_range(std::string path, uint64_t offset, uint64_t size, bool compressed = false) : path(std::move(path)), offset(offset), size(size), compressed(compressed) {}
+		file_range(std::string path, std::vector<file_piece> pieces) : path(std::move(path)), pieces(std::move(pieces)) {}
+
+		std::string path;
+		uint64_t offset = 0;
+		// Up to the end of the file by default
+		uint64_t size = UINT64_MAX;
+		// The range holds a block-compressed file (see block_compression.h)
+		bool compressed = false;
+		// If not empty, the range is these pieces of the file, one after the other (an entry
+		// of a capture journal), and offset and size are unused
+		std::vector<file_piece> pieces;
+	};
+
+	/*
+		Read-only random access to a file, for the readers of capture files. The file is
+		memory-mapped when possible, so a read is a pointer into the page cache: no copy and
+		no system call. If mapping fails (e.g. no address space left), it falls back to
+		buffered reads.
+
+		The view covers the file as it was when opened: bytes appended later (e.g. by a
+		capture in progress) are not visible. An open view doesn't prevent the file from
+		being written by others.
+
+		A view can also cover a byte range of a file: offsets are then relative to the start
+		of the range, and the range is all the view can read.
+
+		A block-compressed range is read as the file it decompresses to: a read decompresses
+		the blocks it overlaps (into a buffer, as buffered reads do). The last two blocks read
+		are kept, so that consecutive small reads - including reads on both sides of a block
+		boundary - decompress each block once.
+
+		A range made of pieces is read through a view of the whole file: a read within a
+		piece is a read of the file, a read across pieces is gathered into a buffer.
+	*/
+	class file_view
+	{
+	public:
+		file_view() = default;
+		~file_view();
+
+		file_view(const file_view&) = delete;
+		file_view& operator=(const file_view&) = delete;
+
+		// Opens the file, or the range of it. With map_file = false, always uses buffered reads.
+		bool open(const file_range& file, bool map_file = true);
+		void close();
+		bool is_open() const { return m_data != nullptr || m_file != nullptr || m_blocks != nullptr || m_pieces_file != nullptr; }
+		bool is_mapped() const { return m_data != nullptr; }
+
+		// Size of the file (or of the range, clipped to the file) when it was opened; of the
+		// decompressed file for a compressed range
+		uint64_t size() const { return m_size; }
+
+		// Returns a pointer to size bytes at the offset (even if size is 0), or null if they
+		// are past the end of the view or can't be read. Unless the file is mapped, the bytes
+		// are copied into a buffer that the next read reuses: only the latest pointer is valid.
+		const uint8_t* read(uint64_t offset, size_t size);
+
+	private:
+		// Returns the decompressed block, from the cache if it is there, or null
+		const std::vector<uint8_t>* decompress_block(uint64_t block);
+		const uint8_t* read_compressed(uint64_t offset, size_t size);
+		const uint8_t* read_pieces(uint64_t offset, size_t size);
+
+		const uint8_t* m_data = nullptr;
+		uint64_t m_size = 0;
+		// Offset of the range in the file
+		uint64_t m_offset = 0;
+		// Mappings start at a multiple of the system's granularity, at or before the range
+		const uint8_t* m_mapping = nullptr;
+		uint64_t m_mapping_size = 0;
+
+		// Buffered fallback. m_file_pos is where the file's read position is (relative to the
+		// range), so reading consecutive ranges doesn't seek.
+		FILE* m_file = nullptr;
+		uint64_t m_file_pos = 0;
+		std::vector<uint8_t> m_buffer;
+
+		// Compressed range: the view of the compressed file, its block size and block
+		// offsets, and the last two blocks decompressed, m_last_cached being the latest
+		std::unique_ptr<file_view> m_blocks;
+		uint32_t m_block_size = 0;
+		std::vector<uint64_t> m_block_offsets;
+		uint64_t m_cached_blocks[2] = { UINT64_MAX, UINT64_MAX };
+		std::vector<uint8_t> m_cached_data[2];
+		unsigned m_last_cached = 0;
+
+		// Range made of pieces: the view of the whole file, and the pieces, clipped to the
+		// file, with the offset in the range where each one starts
+		std::unique_ptr<file_view> m_pieces_file;
+		std::vector<file_piece> m_pieces;
+		std::vector<uint64_t> m_piece_starts;
+	};
+
+	// fseek and ftell with 64-bit offsets on every platform, for files over 2 GB. Return
+	// false on errors.
+	bool seek_file(FILE* file, uint64_t offset, int origin = SEEK_SET);
+	bool tell_file(FILE* file, uint64_t& offset);
+}
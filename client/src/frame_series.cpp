@@ -0,0 +1,432 @@
+#include "frame_series.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace owlcat
+{
+	namespace
+	{
+		const char MAGIC[8] = { 'O', 'W', 'L', 'S', 'E', 'R', 'S', 0 };
+		const uint32_t CURRENT_VERSION = 1;
+
+#pragma pack(push, 1)
+		struct header_t
+		{
+			char magic[8];
+			uint32_t version;
+			uint32_t column_count;
+		};
+
+		struct block_t
+		{
+			uint64_t first_frame;
+			uint32_t frame_count;
+			uint32_t reserved;
+		};
+#pragma pack(pop)
+	}
+
+	// Frames are written to the file in blocks of about this many
+	static const size_t BLOCK_FRAMES = 256;
+	// Frames are consecutive game frames: a gap this large is a broken frame number, and
+	// must not make us fill gigabytes
+	static const uint64_t MAX_GAP_FRAMES = 16ull * 1024 * 1024;
+	// The finest pyramid level summarises runs of 2^PYRAMID_FIRST_SHIFT frames: finer levels
+	// would cost more memory than reading the frames themselves saves
+	static const size_t PYRAMID_FIRST_SHIFT = 4;
+
+	frame_series::frame_series(std::vector<column_kind> columns)
+		: m_kinds(std::move(columns))
+		, m_columns(m_kinds.size())
+		, m_prefix_sums(m_kinds.size())
+		, m_pyramids(m_kinds.size())
+	{}
+
+	frame_series::~frame_series()
+	{
+		close();
+	}
+
+	bool frame_series::create(const std::string& path)
+	{
+		clear();
+
+		std::scoped_lock lock(m_mutex);
+		m_file = fopen(path.c_str(), "wb");
+		if (m_file == nullptr)
+			return false;
+
+		header_t header = {};
+		memcpy(header.magic, MAGIC, sizeof(MAGIC));
+		header.version = CURRENT_VERSION;
+		header.column_count = (uint32_t)m_kinds.size();
+		if (fwrite(&header, sizeof(header), 1, m_file) != 1 || fflush(m_file) != 0)
+		{
+			fclose(m_file);
+			m_file = nullptr;
+			return false;
+		}
+		return true;
+	}
+
+	bool frame_series::load(const file_range& file)
+	{
+		clear();
+
+		file_view view;
+		if (!view.open(file))
+			return false;
+
+		header_t header;
+		const uint8_t* data = view.read(0, sizeof(header));
+		bool ok = data != nullptr;
+		if (ok)
+		{
+			memcpy(&header, data, sizeof(header));
+			ok = memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0
+				&& header.version == CURRENT_VERSION
+				&& header.column_count == m_kinds.size();
+		}
+
+		std::vector<uint64_t> block_values;
+		std::vector<uint64_t> frame_values(m_kinds.size());
+		std::scoped_lock lock(m_mutex);
+		uint64_t offset = sizeof(header);
+		while (ok && offset < view.size())
+		{
+			block_t block;
+			data = view.read(offset, sizeof(block));
+			if (data == nullptr)
+				break;
+			memcpy(&block, data, sizeof(block));
+			offset += sizeof(block);
+
+			// Checked before sizing the buffer: a damaged count must not allocate gigabytes
+			const uint64_t values_size = (uint64_t)block.frame_count * m_kinds.size() * sizeof(uint64_t);
+			if (values_size > view.size() - offset)
+			{
+				ok = false;
+				break;
+			}
+			block_values.resize((size_t)block.frame_count * m_kinds.size());
+			data = view.read(offset, block_values.size() * sizeof(uint64_t));
+			if (data == nullptr)
+			{
+				ok = false;
+				break;
+			}
+			memcpy(block_values.data(), data, block_values.size() * sizeof(uint64_t));
+			offset += block_values.size() * sizeof(uint64_t);
+
+			for (uint32_t i = 0; ok && i < block.frame_count; ++i)
+			{
+				for (size_t column = 0; column < m_kinds.size(); ++column)
+					frame_values[column] = block_values[column * block.frame_count + i];
+				ok = set_frame(block.first_frame + i, frame_values.data());
+			}
+		}
+
+		m_pending_from = m_frame_count;
+		// Built once for the whole file rather than frame by frame
+		update_pyramids();
+		return ok;
+	}
+
+	bool frame_series::flush()
+	{
+		std::scoped_lock lock(m_mutex);
+		if (!write_pending())
+			return false;
+		return m_file == nullptr || fflush(m_file) == 0;
+	}
+
+	void frame_series::close()
+	{
+		std::scoped_lock lock(m_mutex);
+		if (m_file == nullptr)
+			return;
+
+		write_pending();
+		fclose(m_file);
+		m_file = nullptr;
+	}
+
+	void frame_series::clear()
+	{
+		close();
+
+		std::scoped_lock lock(m_mutex);
+		m_first_frame = 0;
+		m_frame_count = 0;
+		for (auto& column : m_columns)
+			column.clear();
+		for (auto& sums : m_prefix_sums)
+			sums.clear();
+		m_reported.clear();
+		for (auto& pyramid : m_pyramids)
+			pyramid.clear();
+		m_pending_from = 0;
+		m_pyramid_from = 0;
+	}
+
+	bool frame_series::append(uint64_t frame, const uint64_t* values)
+	{
+		std::scoped_lock lock(m_mutex);
+		if (!set_frame(frame, values))
+			return false;
+		update_pyramids();
+
+		if (m_file != nullptr && m_frame_count - m_pending_from >= BLOCK_FRAMES)
+			return write_pending();
+		return true;
+	}
+
+	bool frame_series::get_frame_range(uint64_t& first, uint64_t& last) const
+	{
+		std::scoped_lock lock(m_mutex);
+		if (m_frame_count == 0)
+			return false;
+
+		first = m_first_frame;
+		last = m_first_frame + m_frame_count - 1;
+		return true;
+	}
+
+	void frame_series::get_values(size_t column, uint64_t from, uint64_t to, std::vector<uint64_t>& values) const
+	{
+		values.clear();
+
+		std::scoped_lock lock(m_mutex);
+		if (m_frame_count == 0 || from > to)
+			return;
+
+		const uint64_t last_frame = m_first_frame + m_frame_count - 1;
+		if (from > last_frame || to < m_first_frame)
+			return;
+		to = std::min(to, last_frame);
+
+		// Frames before the first one, then a straight copy
+		values.resize((size_t)(to - from + 1), 0);
+		const uint64_t copy_from = std::max(from, m_first_frame);
+		memcpy(values.data() + (copy_from - from), m_columns[column].data() + (copy_from - m_first_frame), (size_t)(to - copy_from + 1) * sizeof(uint64_t));
+	}
+
+	uint64_t frame_series::get_total(size_t column, uint64_t from, uint64_t to) const
+	{
+		std::scoped_lock lock(m_mutex);
+		if (m_kinds[column] != column_kind::counter || m_frame_count == 0 || from > to)
+			return 0;
+
+		// Prefix sums are indexed by the number of frames before
+		auto index_of = [this](uint64_t frame)
+		{
+			if (frame < m_first_frame)
+				return (size_t)0;
+			return (size_t)std::min<uint64_t>(frame - m_first_frame, m_frame_count);
+		};
+		const auto& sums = m_prefix_sums[column];
+		return sums[index_of(to == ~0ull ? to : to + 1)] - sums[index_of(from)];
+	}
+
+	bool frame_series::set_frame(uint64_t frame, const uint64_t* values)
+	{
+		if (m_frame_count == 0)
+		{
+			m_first_frame = frame;
+			for (size_t column = 0; column < m_kinds.size(); ++column)
+			{
+				if (m_kinds[column] == column_kind::counter)
+					m_prefix_sums[column].assign(1, 0);
+			}
+		}
+		else if (frame < m_first_frame || (frame >= m_first_frame + m_frame_count && frame - (m_first_frame + m_frame_count) > MAX_GAP_FRAMES))
+			return false;
+
+		size_t index = (size_t)(frame - m_first_frame);
+		if (index < m_frame_count)
+		{
+			// A frame appended again (normally the last one): replace it, and redo the
+			// prefix sums, or the levels carried into the frames never reported, from there
+			for (size_t column = 0; column < m_kinds.size(); ++column)
+			{
+				auto& data = m_columns[column];
+				data[index] = values[column];
+				if (m_kinds[column] == column_kind::counter)
+				{
+					auto& sums = m_prefix_sums[column];
+					for (size_t i = index; i < m_frame_count; ++i)
+						sums[i + 1] = sums[i] + data[i];
+				}
+				else
+				{
+					for (size_t i = index + 1; i < m_frame_count && !m_reported[i]; ++i)
+						data[i] = values[column];
+				}
+			}
+			m_reported[index] = true;
+			m_pending_from = std::min(m_pending_from, index);
+			m_pyramid_from = std::min(m_pyramid_from, index);
+			return true;
+		}
+
+		// Fill the frames never reported, then add this one
+		const size_t new_count = index + 1;
+		for (size_t column = 0; column < m_kinds.size(); ++column)
+		{
+			auto& data = m_columns[column];
+			if (m_kinds[column] == column_kind::counter)
+			{
+				data.resize(new_count, 0);
+				data[index] = values[column];
+
+				auto& sums = m_prefix_sums[column];
+				const uint64_t total = sums.back();
+				sums.resize(new_count + 1, total);
+				sums[new_count] = total + values[column];
+			}
+			else
+			{
+				const uint64_t last = data.empty() ? 0 : data.back();
+				data.resize(new_count, last);
+				data[index] = values[column];
+			}
+		}
+		m_reported.resize(new_count, false);
+		m_reported[index] = true;
+		m_pyramid_from = std::min(m_pyramid_from, m_frame_count);
+		m_frame_count = new_count;
+		return true;
+	}
+
+	void frame_series::get_buckets(size_t column, uint64_t from, uint64_t to, size_t bucket_frames, std::vector<bucket_t>& buckets) const
+	{
+		buckets.clear();
+
+		std::scoped_lock lock(m_mutex);
+		if (m_frame_count == 0 || from > to)
+			return;
+
+		const uint64_t last_frame = m_first_frame + m_frame_count - 1;
+		if (from > last_frame || to < m_first_frame)
+			return;
+		const size_t first_index = (size_t)(std::max(from, m_first_frame) - m_first_frame);
+		const size_t last_index = (size_t)(std::min(to, last_frame) - m_first_frame);
+
+		size_t shift = 0;
+		while (((size_t)2 << shift) <= bucket_frames)
+			++shift;
+
+		buckets.reserve((last_index >> shift) - (first_index >> shift) + 1);
+		for (size_t bucket = first_index >> shift; bucket <= last_index >> shift; ++bucket)
+		{
+			const size_t bucket_from = std::max(bucket << shift, first_index);
+			const size_t bucket_to = std::min(((bucket + 1) << shift) - 1, last_index);
+			const summary_t summary = summarise(column, bucket_from, bucket_to);
+			buckets.push_back({ m_first_frame + bucket_from, m_first_frame + bucket_to, summary.min, summary.max, summary.sum });
+		}
+	}
+
+	void frame_series::update_pyramids()
+	{
+		if (m_pyramid_from >= m_frame_count)
+			return;
+
+		for (size_t column = 0; column < m_kinds.size(); ++column)
+		{
+			const auto& data = m_columns[column];
+			auto& pyramid = m_pyramids[column];
+			for (size_t level = 0, shift = PYRAMID_FIRST_SHIFT; ; ++level, ++shift)
+			{
+				const size_t count = ((m_frame_count - 1) >> shift) + 1;
+				if (level == pyramid.size())
+					pyramid.emplace_back();
+				pyramid[level].resize(count);
+
+				for (size_t bucket = m_pyramid_from >> shift; bucket < count; ++bucket)
+				{
+					summary_t& summary = pyramid[level][bucket];
+					if (level == 0)
+					{
+						const size_t end = std::min((bucket + 1) << shift, m_frame_count);
+						summary = { (int64_t)data[bucket << shift], (int64_t)data[bucket << shift], 0 };
+						for (size_t i = bucket << shift; i < end; ++i)
+						{
+							summary.min = std::min(summary.min, (int64_t)data[i]);
+							summary.max = std::max(summary.max, (int64_t)data[i]);
+							summary.sum += (int64_t)data[i];
+						}
+					}
+					else
+					{
+						const auto& children = pyramid[level - 1];
+						summary = children[bucket * 2];
+						if (bucket * 2 + 1 < children.size())
+						{
+							const summary_t& right = children[bucket * 2 + 1];
+							summary.min = std::min(summary.min, right.min);
+							summary.max = std::max(summary.max, right.max);
+							summary.sum += right.sum;
+						}
+					}
+				}
+
+				if (count == 1)
+					break;
+			}
+		}
+		m_pyramid_from = m_frame_count;
+	}
+
+	frame_series::summary_t frame_series::summarise(size_t column, size_t from, size_t to) const
+	{
+		const auto& data = m_columns[column];
+		const auto& pyramid = m_pyramids[column];
+		summary_t result = { (int64_t)data[from], (int64_t)data[from], 0 };
+		while (from <= to)
+		{
+			// The largest pyramid bucket starting at from and ending by to, if any...
+			summary_t part;
+			size_t shift = PYRAMID_FIRST_SHIFT + pyramid.size();
+			while (shift-- > PYRAMID_FIRST_SHIFT)
+			{
+				const size_t size = (size_t)1 << shift;
+				if ((from & (size - 1)) == 0 && to - from + 1 >= size)
+					break;
+			}
+
+			if (shift >= PYRAMID_FIRST_SHIFT && shift < PYRAMID_FIRST_SHIFT + pyramid.size())
+			{
+				part = pyramid[shift - PYRAMID_FIRST_SHIFT][from >> shift];
+				from += (size_t)1 << shift;
+			}
+			else
+			{
+				// ...or a single frame
+				part = { (int64_t)data[from], (int64_t)data[from], (int64_t)data[from] };
+				++from;
+			}
+
+			result.min = std::min(result.min, part.min);
+			result.max = std::max(result.max, part.max);
+			result.sum += part.sum;
+		}
+		return result;
+	}
+
+	bool frame_series::write_pending()
+	{
+		if (m_file == nullptr || m_pending_from >= m_frame_count)
+			return true;
+
+		block_t block = {};
+		block.first_frame = m_first_frame + m_pending_from;
+		block.frame_count = (uint32_t)(m_frame_count - m_pending_from);
+		bool ok = fwrite(&block, sizeof(block), 1, m_file) == 1;
+		for (size_t column = 0; ok && column < m_kinds.size(); ++column)
+			ok = fwrite(m_columns[column].data() + m_pending_from, sizeof(uint64_t), block.frame_count, m_file) == block.frame_count;
+
+		m_pending_from = m_frame_count;
+		return ok;
+	}
+}
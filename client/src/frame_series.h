@@ -0,0 +1,144 @@
+#pragma once
+
+#include "file_view.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace owlcat
+{
+	/*
+		Per-frame counters of a capture (allocations, frees, size, process memory...), kept
+		in memory one array per column, indexed by frame, so that the series of a frame range
+		is a copy and the total of a counter over a frame range is the difference of two
+		prefix sums. This is what the graphs read on every repaint, instead of querying the
+		database and filling the gaps between the frames it returns.
+
+		Frames never reported are filled in when a later frame is appended: counters read 0
+		in them, levels (sizes) carry the last value.
+
+		The series is also written to an append-only file, so that it is saved with the
+		capture and loaded as is when the capture is opened. The file is a header, then blocks
+		of consecutive frames, each holding one array per column:
+
+			header_t, then any number of (block_t, block_t.frame_count values of column 0,
+			... of the last column)
+
+		A block may start at a frame that an earlier block already holds: a frame can be
+		appended again (e.g. the current frame is published more than once), and the later
+		values win. FORMAT VERSIONING RULES: same as the event log (see event_log.h).
+
+		For the graphs of a long capture zoomed out, every column also keeps a pyramid of
+		summaries (min, max and sum) of aligned runs of 2^k frames, k >= 4, updated as frames
+		are appended. get_buckets summarises any frame range in buckets of any power of two
+		frames from the pyramid levels, so the graphs draw about one bucket per pixel in the
+		same time whether the capture holds ten thousand frames or ten million. The
+		pyramid costs about 3 bytes per frame and column.
+
+		Appended on one thread, read on any: all functions are thread-safe.
+	*/
+	class frame_series
+	{
+	public:
+		enum class column_kind
+		{
+			// A count per frame: 0 in frames never reported, summed by get_total
+			counter,
+			// A value at the end of the frame: frames never reported carry the previous one
+			level,
+		};
+
+		// Summary of a column over consecutive frames [first_frame, last_frame]. Values are
+		// signed, as level columns may be.
+		struct bucket_t
+		{
+			uint64_t first_frame;
+			uint64_t last_frame;
+			int64_t min;
+			int64_t max;
+			int64_t sum;
+		};
+
+		explicit frame_series(std::vector<column_kind> columns);
+		~frame_series();
+
+		frame_series(const frame_series&) = delete;
+		void operator=(const frame_series&) = delete;
+
+		// Empties the series and starts writing it to a new file at path (overwriting it).
+		// Without a file, the series only lives in memory.
+		bool create(const std::string& path);
+		// Empties the series and loads the frames of a file (or of a range of one, e.g. a
+		// container entry) written by a series with the same columns. The file is not
+		// written to afterwards.
+		bool load(const file_range& file);
+		// Writes the frames appended since the last write to the file
+		bool flush();
+		// Writes the pending frames and closes the file. The frames stay in memory.
+		void close();
+		// Closes the file and forgets all frames
+		void clear();
+
+		// Sets the values (one per column) of a frame. A frame appended again replaces its
+		// values; frames before the first one are refused.
+		bool append(uint64_t frame, const uint64_t* values);
+
+		// Returns false if no frame was appended yet
+		bool get_frame_range(uint64_t& first, uint64_t& last) const;
+
+		// Copies a column's values for frames [from, to] into values, one per frame: frames
+		// before the first one read as 0, and the range stops at the last frame. A level
+		// column may hold signed values: the caller casts them back.
+		void get_values(size_t column, uint64_t from, uint64_t to, std::vector<uint64_t>& values) const;
+
+		// Returns the sum of a counter column over frames [from, to], in constant time
+		uint64_t get_total(size_t column, uint64_t from, uint64_t to) const;
+
+		// Summarises a column over frames [from, to], clipped to the frames appended, in
+		// buckets of bucket_frames frames (rounded down to a power of two) aligned on the
+		// first frame of the series: the buckets at the ends of the range are cut short.
+		// Takes time proportional to the number of buckets plus the log of the series length.
+		void get_buckets(size_t column, uint64_t from, uint64_t to, size_t bucket_frames, std::vector<bucket_t>& buckets) const;
+
+	private:
+		struct summary_t
+		{
+			int64_t min;
+			int64_t max;
+			int64_t sum;
+		};
+
+		bool set_frame(uint64_t frame, const uint64_t* values);
+		bool write_pending();
+		// Recomputes the pyramid buckets holding the frames changed since the last call
+		void update_pyramids();
+		// Summary of a column over frame indexes [from, to], from the largest pyramid buckets
+		// that fit
+		summary_t summarise(size_t column, size_t from, size_t to) const;
+
+		std::vector<column_kind> m_kinds;
+
+		mutable std::mutex m_mutex;
+		uint64_t m_first_frame = 0;
+		size_t m_frame_count = 0;
+		// One array per column, indexed by frame - m_first_frame
+		std::vector<std::vector<uint64_t>> m_columns;
+		// For counter columns: m_prefix_sums[column][i] is the sum of the first i frames
+		std::vector<std::vector<uint64_t>> m_prefix_sums;
+		// Frames appended, as opposed to filled in
+		std::vector<bool> m_reported;
+		// m_pyramids[column][level][i] summarises frame indexes [i << shift, (i + 1) << shift),
+		// with shift = level + PYRAMID_FIRST_SHIFT (see frame_series.cpp). The last bucket of a
+		// level may be partial; the last level has a single bucket.
+		std::vector<std::vector<std::vector<summary_t>>> m_pyramids;
+		// Index of the first frame changed since the pyramids were last updated
+		size_t m_pyramid_from = 0;
+
+		FILE* m_file = nullptr;
+		// Index of the first frame changed since the last write to the file
+		size_t m_pending_from = 0;
+	};
+}
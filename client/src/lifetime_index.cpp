@@ -0,0 +1,382 @@
+#include "lifetime_index.h"
+
+#include <algorithm>
+
+namespace owlcat
+{
+	// Report progress and check for cancellation this often, not on every event
+	static const uint64_t PROGRESS_EVENTS = 64 * 1024;
+	// A query starts from the last answer if the frames it adds hold at most 1/DELTA_MAX_SHARE
+	// of its allocations
+	static const uint64_t DELTA_MAX_SHARE = 2;
+
+	void lifetime_index::reset()
+	{
+		m_entries.clear();
+		m_entries.shrink_to_fit();
+		m_frame_starts.clear();
+		m_frame_starts.shrink_to_fit();
+		m_chunks.clear();
+		m_chunks.shrink_to_fit();
+		m_last = {};
+		m_spare = {};
+		m_addresses.reset();
+		m_addresses_indexed = false;
+		m_open_groups = {};
+		m_previous = {};
+		m_indexed_end = 0;
+		m_valid = true;
+	}
+
+	bool lifetime_index::update(event_log_reader& reader, uint64_t end_offset)
+	{
+		if (!m_valid)
+			return false;
+
+		if (m_indexed_end == 0)
+			m_indexed_end = reader.begin_offset();
+		if (end_offset <= m_indexed_end)
+			return true;
+
+		m_chunks.push_back({ m_indexed_end, m_entries.size() });
+		bool ok = reader.visit_range(m_indexed_end, end_offset, [this](const event_view& e)
+		{
+			if (m_frame_starts.empty() || e.frame != m_frame_starts.back().first)
+			{
+				if (!m_frame_starts.empty() && e.frame < m_frame_starts.back().first)
+				{
+					m_valid = false;
+					return false;
+				}
+				m_frame_starts.push_back({ e.frame, m_entries.size() });
+			}
+
+			if (e.is_alloc)
+				add_allocation(e);
+			else
+				add_free(e);
+
+			return m_valid;
+		});
+
+		if (!ok)
+			m_valid = false;
+		if (!m_valid)
+			return false;
+
+		m_indexed_end = end_offset;
+		return true;
+	}
+
+	void lifetime_index::add_allocation(const event_view& e)
+	{
+		const uint64_t index = m_entries.size();
+		uint32_t entry = NOT_FREED;
+
+		auto group = m_open_groups.find(e.addr);
+		if (group == m_open_groups.end())
+		{
+			m_open_groups.emplace(e.addr, std::make_pair(index, e.frame));
+		}
+		else
+		{
+			// Another allocation at a live address
+			entry |= HAS_PREVIOUS;
+			m_previous.emplace(index, group->second);
+			group->second = { index, e.frame };
+		}
+
+		m_entries.push_back(entry);
+		if (m_addresses_indexed)
+			m_addresses.add(e.addr, e.type_id, e.callstack_id);
+	}
+
+	void lifetime_index::add_free(const event_view& e)
+	{
+		// Frees of unknown addresses end nothing
+		auto group = m_open_groups.find(e.addr);
+		if (group == m_open_groups.end())
+			return;
+
+		// The free ends every allocation of the group
+		uint64_t index = group->second.first;
+		uint64_t frame = group->second.second;
+		for (;;)
+		{
+			// Lifetimes longer than the entry can hold: no capture is that long, but
+			// answering wrong is not an option
+			const uint64_t lifetime = e.frame - frame;
+			if (lifetime >= NOT_FREED)
+			{
+				m_valid = false;
+				return;
+			}
+
+			uint32_t& entry = m_entries[index];
+			entry = (entry & HAS_PREVIOUS) | (uint32_t)lifetime;
+			if (!(entry & HAS_PREVIOUS))
+				break;
+
+			auto previous = m_previous.find(index);
+			index = previous->second.first;
+			frame = previous->second.second;
+		}
+
+		m_open_groups.erase(group);
+	}
+
+	size_t lifetime_index::find_frame(uint64_t frame) const
+	{
+		auto iter = std::lower_bound(m_frame_starts.begin(), m_frame_starts.end(), frame,
+			[](const std::pair<uint64_t, uint64_t>& start, uint64_t value) { return start.first < value; });
+		return iter - m_frame_starts.begin();
+	}
+
+	bool lifetime_index::is_live(uint64_t index, uint64_t frame, uint64_t from_frame, uint64_t to_frame) const
+	{
+		const uint32_t entry = m_entries[index];
+
+		// Freed within the range
+		const uint32_t lifetime = entry & ~HAS_PREVIOUS;
+		if (lifetime != NOT_FREED && frame + lifetime <= to_frame)
+			return false;
+
+		// Dropped by the replay, because the previous allocation of its group is in the range
+		if ((entry & HAS_PREVIOUS) && m_previous.find(index)->second.second >= from_frame)
+			return false;
+
+		return true;
+	}
+
+	uint64_t lifetime_index::frame_allocations(size_t frame_pos) const
+	{
+		return frame_pos < m_frame_starts.size() ? m_frame_starts[frame_pos].second : m_entries.size();
+	}
+
+	bool lifetime_index::find_live(size_t first_frame, size_t end_frame, uint64_t from_frame, uint64_t to_frame,
+		std::vector<uint64_t>& live, const progress_func_t& progress_func) const
+	{
+		const uint64_t first = frame_allocations(first_frame);
+		const uint64_t count = frame_allocations(end_frame) - first;
+		uint64_t checked = 0;
+		for (size_t f = first_frame; f < end_frame; ++f)
+		{
+			const uint64_t frame = m_frame_starts[f].first;
+			const uint64_t end = frame_allocations(f + 1);
+
+			// Most allocations are freed soon, without anomalies: their entries are a
+			// lifetime no longer than limit, and one comparison rules them out
+			const uint32_t limit = (uint32_t)std::min<uint64_t>(to_frame - frame, NOT_FREED - 1);
+			const uint32_t* entries = m_entries.data();
+			for (uint64_t index = m_frame_starts[f].second; index < end; ++index)
+			{
+				if (entries[index] > limit && is_live(index, frame, from_frame, to_frame))
+					live.push_back(index);
+			}
+
+			// The entries go fast: only check for cancellation once in a while
+			checked += end - m_frame_starts[f].second;
+			if (progress_func != nullptr && checked >= PROGRESS_EVENTS)
+			{
+				checked = 0;
+				if (!progress_func((size_t)(end - first), (size_t)count))
+					return false;
+			}
+		}
+		return true;
+	}
+
+	bool lifetime_index::read_objects(event_log_reader& reader, const std::vector<uint64_t>& indices, std::vector<live_object>& objects,
+		bool& cancelled, const progress_func_t& progress_func)
+	{
+		// Visit only the chunks that hold some of the allocations, merging runs of such
+		// chunks into one read
+		auto chunk_of = [this](uint64_t index)
+		{
+			return (size_t)(std::upper_bound(m_chunks.begin(), m_chunks.end(), index,
+				[](uint64_t value, const std::pair<uint64_t, uint64_t>& chunk) { return value < chunk.second; }) - m_chunks.begin()) - 1;
+		};
+
+		objects.reserve(objects.size() + indices.size());
+		cancelled = false;
+		size_t next = 0;
+		while (next < indices.size())
+		{
+			const size_t first_chunk = chunk_of(indices[next]);
+			size_t last_chunk = first_chunk;
+			size_t run_end = next + 1;
+			for (; run_end < indices.size(); ++run_end)
+			{
+				const size_t chunk = chunk_of(indices[run_end]);
+				if (chunk > last_chunk + 1)
+					break;
+				last_chunk = chunk;
+			}
+
+			const uint64_t begin_offset = m_chunks[first_chunk].first;
+			const uint64_t run_end_offset = last_chunk + 1 < m_chunks.size() ? m_chunks[last_chunk + 1].first : m_indexed_end;
+			const uint64_t run_allocs_end = last_chunk + 1 < m_chunks.size() ? m_chunks[last_chunk + 1].second : m_entries.size();
+			uint64_t index = m_chunks[first_chunk].second;
+
+			bool ok = reader.visit_range(begin_offset, run_end_offset, [&](const event_view& e)
+			{
+				if (!e.is_alloc)
+					return true;
+
+				if (next < run_end && index == indices[next])
+				{
+					objects.emplace_back(e.addr, e.size, e.frame, e.type_id, e.callstack_id);
+					++next;
+
+					if (progress_func != nullptr && next % PROGRESS_EVENTS == 0 && !progress_func(next, indices.size()))
+					{
+						cancelled = true;
+						return false;
+					}
+				}
+				++index;
+				return true;
+			});
+
+			if (cancelled)
+				return true;
+
+			// The log must hold exactly the allocations indexed for these chunks
+			if (!ok || next != run_end || index != run_allocs_end)
+				return false;
+		}
+
+		return true;
+	}
+
+	bool lifetime_index::get_live_objects(event_log_reader& reader, uint64_t end_offset, uint64_t from_frame, uint64_t to_frame,
+		std::vector<live_object>& objects, const progress_func_t& progress_func)
+	{
+		if (!m_valid || end_offset > m_indexed_end || to_frame < from_frame)
+			return false;
+
+		const size_t first_frame = find_frame(from_frame);
+		const size_t end_frame = find_frame(to_frame + 1);
+
+		// Find the live allocations. If the range only grew since the last query, nothing
+		// in the old range can come back to life: the last answer, minus what the new
+		// frames free or shadow, plus what is live in the new frames is the answer. Unless
+		// the new frames are most of the range, then looking at everything is as fast.
+		std::vector<uint64_t> live = std::move(m_spare.allocations);
+		live.clear();
+		bool grown = false;
+		if (m_last.valid && from_frame <= m_last.from_frame && to_frame >= m_last.to_frame)
+		{
+			const size_t last_first_frame = find_frame(m_last.from_frame);
+			const size_t last_end_frame = find_frame(m_last.to_frame + 1);
+			const uint64_t new_allocations = (frame_allocations(last_first_frame) - frame_allocations(first_frame)) +
+				(frame_allocations(end_frame) - frame_allocations(last_end_frame));
+			grown = new_allocations * DELTA_MAX_SHARE <= frame_allocations(end_frame) - frame_allocations(first_frame);
+
+			if (grown)
+			{
+				if (!find_live(first_frame, last_first_frame, from_frame, to_frame, live, progress_func))
+					return true;
+
+				for (size_t i = 0; i < m_last.allocations.size(); ++i)
+				{
+					if (is_live(m_last.allocations[i], m_last.objects[i].frame, from_frame, to_frame))
+						live.push_back(m_last.allocations[i]);
+				}
+
+				if (!find_live(last_end_frame, end_frame, from_frame, to_frame, live, progress_func))
+					return true;
+			}
+		}
+
+		if (!grown && !find_live(first_frame, end_frame, from_frame, to_frame, live, progress_func))
+			return true;
+
+		// Objects of the last answer are still at hand: only read the others from the log
+		std::vector<uint64_t> missing;
+		size_t last_pos = 0;
+		for (uint64_t index : live)
+		{
+			while (last_pos < m_last.allocations.size() && m_last.allocations[last_pos] < index)
+				++last_pos;
+			if (!m_last.valid || last_pos == m_last.allocations.size() || m_last.allocations[last_pos] != index)
+				missing.push_back(index);
+		}
+
+		std::vector<live_object> read;
+		bool cancelled = false;
+		if (!read_objects(reader, missing, read, cancelled, progress_func))
+		{
+			m_last = {};
+			return false;
+		}
+		if (cancelled)
+			return true;
+
+		// Assemble the answer in allocation order, and keep it for the next query. The
+		// answer before the last one lends its memory: answers are big, and fresh memory
+		// means page faults.
+		last_answer answer = std::move(m_spare);
+		answer.objects.clear();
+		answer.valid = true;
+		answer.from_frame = from_frame;
+		answer.to_frame = to_frame;
+		answer.objects.reserve(live.size());
+		last_pos = 0;
+		size_t read_pos = 0;
+		for (uint64_t index : live)
+		{
+			while (last_pos < m_last.allocations.size() && m_last.allocations[last_pos] < index)
+				++last_pos;
+			if (m_last.valid && last_pos < m_last.allocations.size() && m_last.allocations[last_pos] == index)
+				answer.objects.push_back(m_last.objects[last_pos]);
+			else
+				answer.objects.push_back(read[read_pos++]);
+		}
+		answer.allocations.swap(live);
+		m_spare = std::move(m_last);
+		m_last = std::move(answer);
+
+		objects.insert(objects.end(), m_last.objects.begin(), m_last.objects.end());
+		return true;
+	}
+
+	bool lifetime_index::find_allocations(event_log_reader& reader, uint64_t end_offset, const std::vector<uint64_t>& addresses,
+		std::vector<uint64_t>& type_ids, std::vector<uint64_t>& callstack_ids)
+	{
+		if (!m_valid || end_offset != m_indexed_end)
+			return false;
+
+		// Index the addresses of what is indexed already; update does the rest
+		if (!m_addresses_indexed)
+		{
+			uint64_t count = 0;
+			bool ok = m_chunks.empty() || reader.visit_range(m_chunks.front().first, m_indexed_end, [&](const event_view& e)
+			{
+				if (e.is_alloc)
+				{
+					m_addresses.add(e.addr, e.type_id, e.callstack_id);
+					++count;
+				}
+				return true;
+			});
+
+			if (!ok || count != m_entries.size())
+			{
+				m_addresses.reset();
+				return false;
+			}
+			m_addresses_indexed = true;
+		}
+
+		type_ids.resize(addresses.size());
+		callstack_ids.resize(addresses.size());
+		for (size_t i = 0; i < addresses.size(); ++i)
+		{
+			const address_index::allocation found = m_addresses.find(addresses[i]);
+			type_ids[i] = found.type_id;
+			callstack_ids[i] = found.callstack_id;
+		}
+		return true;
+	}
+}
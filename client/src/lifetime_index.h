@@ -0,0 +1,128 @@
+#pragma once
+
+#include "address_index.h"
+#include "event_log.h"
+#include "mono_profiler_client.h"
+
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace owlcat
+{
+	/*
+		Allocation lifetime index: for every allocation in the event log, the frame of the
+		free that ends it. With it, the live objects of a frame range come from a scan of
+		4-byte entries (an allocation is live unless freed before the range ends), and only
+		the parts of the log holding live objects are read, instead of replaying every event
+		of the range into a hash map.
+
+		The answer is exactly the replay's (mono_profiler_client's get_live_objects),
+		including its handling of anomalies: a second allocation at a live address is
+		dropped while the first one is in the range, and a free ends whatever object is at
+		its address. For that, allocations at the same address with no free in between
+		(a group) all end at the group's free, and an allocation that is not first in its
+		group knows the frame of the previous one.
+
+		The last answer is kept, for the next query: scrubbing a range changes it a few
+		frames at a time. Its objects need not be read again, and if the range only grows,
+		only the new frames' allocations need looking at.
+
+		The log is indexed in chunks, one per update call, and a query reads whole chunks:
+		frames make good chunks. A capture in progress is indexed as it grows. The index
+		relies on frames never going backwards in the log, which the client guarantees:
+		otherwise it refuses to answer, and the caller falls back to the replay.
+
+		The index also feeds the address index (see address_index.h), which shares its
+		updates.
+
+		Memory: 4 bytes per allocation, plus the allocations not freed yet, plus the last
+		answer, plus the address index once used.
+		Not thread-safe.
+	*/
+	class lifetime_index
+	{
+	public:
+		// Forgets everything, for another event log
+		void reset();
+
+		// Byte offset in the log up to which the index is built
+		uint64_t indexed_end() const { return m_indexed_end; }
+
+		// Indexes the events from indexed_end() to end_offset, which must be a block
+		// boundary (the end of a frame), as one chunk. Returns false if the log can't be
+		// read, or can't be indexed.
+		bool update(event_log_reader& reader, uint64_t end_offset);
+
+		// Appends the objects allocated in frames [from_frame, to_frame] and still live at
+		// the end of to_frame, in allocation order. The log must be indexed up to end_offset,
+		// the end of to_frame. Returns false if the index can't answer: objects are then
+		// left as they were. If progress_func cancels, returns true with no objects appended.
+		// Best when the range is close to the last query's.
+		bool get_live_objects(event_log_reader& reader, uint64_t end_offset, uint64_t from_frame, uint64_t to_frame,
+			std::vector<live_object>& objects, const progress_func_t& progress_func);
+
+		// Finds the latest allocation of every address, in the log up to end_offset, which
+		// must be where the index ends: type_ids and callstack_ids get the allocations'
+		// ids, in the same order, or address_index::NONE for addresses never allocated.
+		// Returns false if the index can't answer. The first call indexes the addresses
+		// too, from then on they are indexed with the rest.
+		bool find_allocations(event_log_reader& reader, uint64_t end_offset, const std::vector<uint64_t>& addresses,
+			std::vector<uint64_t>& type_ids, std::vector<uint64_t>& callstack_ids);
+
+	private:
+		void add_allocation(const event_view& e);
+		void add_free(const event_view& e);
+		// Position in m_frame_starts of the first frame >= frame
+		size_t find_frame(uint64_t frame) const;
+		// Allocations before the frame at a position in m_frame_starts
+		uint64_t frame_allocations(size_t frame_pos) const;
+		// Whether the allocation, made in frame, is live in the answer for [from_frame, to_frame]
+		bool is_live(uint64_t index, uint64_t frame, uint64_t from_frame, uint64_t to_frame) const;
+		// Appends the live allocations of the frames at positions [first_frame, end_frame)
+		// in m_frame_starts. Returns false if progress_func cancels.
+		bool find_live(size_t first_frame, size_t end_frame, uint64_t from_frame, uint64_t to_frame,
+			std::vector<uint64_t>& live, const progress_func_t& progress_func) const;
+		// Appends the objects of the allocations, in order, reading them from the log.
+		// Returns false if the log doesn't match the index.
+		bool read_objects(event_log_reader& reader, const std::vector<uint64_t>& indices, std::vector<live_object>& objects,
+			bool& cancelled, const progress_func_t& progress_func);
+
+		// Per allocation, in log order: frames from the allocation to the free that ends
+		// it, or NOT_FREED, and the HAS_PREVIOUS flag
+		static constexpr uint32_t HAS_PREVIOUS = 0x80000000;
+		static constexpr uint32_t NOT_FREED = 0x7FFFFFFF;
+		std::vector<uint32_t> m_entries;
+
+		// (frame, allocations before it) for every frame with events, in order
+		std::vector<std::pair<uint64_t, uint64_t>> m_frame_starts;
+		// (byte offset, allocations before it) for every chunk, in order
+		std::vector<std::pair<uint64_t, uint64_t>> m_chunks;
+
+		// The latest allocation of every group not freed yet: address -> (allocation, frame)
+		std::unordered_map<uint64_t, std::pair<uint64_t, uint64_t>> m_open_groups;
+		// Allocation -> (previous allocation of its group, its frame), for the allocations
+		// with HAS_PREVIOUS
+		std::unordered_map<uint64_t, std::pair<uint64_t, uint64_t>> m_previous;
+
+		// Address -> latest allocation, once an address lookup needed it
+		address_index m_addresses;
+		bool m_addresses_indexed = false;
+
+		// The last query's answer: its live allocations, in order, and their objects
+		struct last_answer
+		{
+			bool valid = false;
+			uint64_t from_frame = 0;
+			uint64_t to_frame = 0;
+			std::vector<uint64_t> allocations;
+			std::vector<live_object> objects;
+		};
+		last_answer m_last;
+		last_answer m_spare;
+
+		uint64_t m_indexed_end = 0;
+		bool m_valid = true;
+	};
+}
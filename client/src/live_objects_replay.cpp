@@ -0,0 +1,266 @@
+#include "live_objects_replay.h"
+#include "event_log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace owlcat
+{
+	// What a chunk leaves at an address
+	struct chunk_object
+	{
+		live_object object;
+		// Allocation order: the chunk's index in the high bits, the allocation's number in
+		// the chunk in the low ones
+		uint64_t order;
+		// The chunk frees the address, so the state before the chunk doesn't matter
+		bool freed;
+		// object is valid
+		bool live;
+	};
+
+	using object_map = std::unordered_map<uint64_t, chunk_object, std::hash<uint64_t>, std::equal_to<uint64_t>,
+		pool_allocator<std::pair<const uint64_t, chunk_object>>>;
+
+	struct chunk_result
+	{
+		node_pool pool;
+		std::vector<object_map> shards;
+	};
+
+	static const int ORDER_CHUNK_SHIFT = 40;
+	// Chunks per thread: more than one, so that threads done early pick up the slack
+	static const size_t CHUNKS_PER_THREAD = 4;
+	// The live set (allocs still outstanding) is far smaller than the event count, so
+	// reserving buckets for every event would allocate tens of GB for nothing. Past the
+	// cap the maps grow geometrically, which is cheap with pooled nodes.
+	static const uint64_t RESERVE_CAP = 16ull * 1024 * 1024;
+	// Workers publish their progress, and check for cancellation, this often (in events)
+	static const uint64_t PROGRESS_EVENTS = 4096;
+	static const std::chrono::milliseconds PROGRESS_INTERVAL(50);
+
+	static size_t shard_of(uint64_t addr, size_t shard_count)
+	{
+		return (size_t)(((addr * 0x9E3779B97F4A7C15ULL) >> 32) % shard_count);
+	}
+
+	// Runs task(index, worker) for every index in [0, count) on up to thread_count threads.
+	// The calling thread waits, calling poll every PROGRESS_INTERVAL; once poll returns
+	// false, stop is set and no more tasks start. Returns false if poll did.
+	static bool run_tasks(size_t count, size_t thread_count, std::atomic<bool>& stop,
+		const std::function<void(size_t index, size_t worker)>& task, const std::function<bool()>& poll)
+	{
+		std::atomic<size_t> next = 0;
+		std::mutex mutex;
+		std::condition_variable done;
+		size_t running = std::min(thread_count, count);
+
+		std::vector<std::thread> threads;
+		const size_t worker_count = running;
+		for (size_t worker = 0; worker < worker_count; ++worker)
+		{
+			threads.emplace_back([&, worker]()
+			{
+				for (size_t index = next++; index < count && !stop; index = next++)
+					task(index, worker);
+
+				{
+					std::scoped_lock lock(mutex);
+					--running;
+				}
+				done.notify_one();
+			});
+		}
+
+		bool ok = true;
+		{
+			std::unique_lock lock(mutex);
+			while (!done.wait_for(lock, PROGRESS_INTERVAL, [&]() { return running == 0; }))
+			{
+				lock.unlock();
+				if (ok && !poll())
+				{
+					ok = false;
+					stop = true;
+				}
+				lock.lock();
+			}
+		}
+
+		for (auto& thread : threads)
+			thread.join();
+		return ok;
+	}
+
+	bool replay_live_objects(const file_range& event_log, const std::vector<uint64_t>& boundaries, size_t thread_count,
+		std::vector<live_object>& objects, const progress_func_t& progress_func)
+	{
+		objects.clear();
+		if (boundaries.size() < 2 || boundaries.back() <= boundaries.front())
+			return true;
+		if (thread_count == 0)
+			thread_count = 1;
+
+		auto reader = event_log_reader::open(event_log);
+		if (reader == nullptr)
+			return false;
+
+		const uint64_t begin_offset = boundaries.front();
+		const uint64_t end_offset = boundaries.back();
+		const uint64_t events_count = reader->count_events(begin_offset, end_offset);
+
+		// Split the range into chunks of about the same size, at the given boundaries
+		std::vector<uint64_t> chunk_offsets = { begin_offset };
+		const size_t target_count = thread_count == 1 ? 1 : thread_count * CHUNKS_PER_THREAD;
+		for (size_t i = 1; i < target_count; ++i)
+		{
+			const uint64_t target = begin_offset + (end_offset - begin_offset) * i / target_count;
+			auto boundary = std::lower_bound(boundaries.begin(), boundaries.end(), target);
+			if (boundary != boundaries.end() && *boundary > chunk_offsets.back() && *boundary < end_offset)
+				chunk_offsets.push_back(*boundary);
+		}
+		chunk_offsets.push_back(end_offset);
+
+		const size_t chunk_count = chunk_offsets.size() - 1;
+		const size_t shard_count = thread_count;
+		std::vector<chunk_result> chunks(chunk_count);
+		std::vector<std::unique_ptr<event_log_reader>> readers(thread_count);
+
+		std::atomic<bool> stop = false;
+		std::atomic<bool> failed = false;
+		std::atomic<uint64_t> events_done = 0;
+		auto poll = [&]()
+		{
+			return progress_func == nullptr || progress_func((size_t)events_done.load(), (size_t)events_count);
+		};
+
+		// Replay the chunks. The first one starts from nothing, so it can drop freed
+		// objects right away; the others have to remember the frees for the merge.
+		bool ok = run_tasks(chunk_count, thread_count, stop, [&](size_t index, size_t worker)
+		{
+			if (readers[worker] == nullptr)
+				readers[worker] = event_log_reader::open(event_log);
+			if (readers[worker] == nullptr)
+			{
+				failed = true;
+				stop = true;
+				return;
+			}
+
+			chunk_result& chunk = chunks[index];
+			const uint64_t chunk_begin = chunk_offsets[index];
+			const uint64_t chunk_end = chunk_offsets[index + 1];
+			const uint64_t chunk_events = events_count * (chunk_end - chunk_begin) / (end_offset - begin_offset);
+			const uint64_t reserve = std::min(chunk_events / 4, RESERVE_CAP / chunk_count) / shard_count;
+
+			using map_alloc = pool_allocator<std::pair<const uint64_t, chunk_object>>;
+			chunk.shards.reserve(shard_count);
+			for (size_t shard = 0; shard < shard_count; ++shard)
+			{
+				chunk.shards.emplace_back(0, std::hash<uint64_t>(), std::equal_to<uint64_t>(), map_alloc(&chunk.pool));
+				chunk.shards.back().reserve((size_t)reserve);
+			}
+
+			const bool first = index == 0;
+			uint64_t order = (uint64_t)index << ORDER_CHUNK_SHIFT;
+			uint64_t events = 0;
+			bool read = readers[worker]->visit_range(chunk_begin, chunk_end, [&](const event_view& e)
+			{
+				object_map& shard = chunk.shards[shard_of(e.addr, shard_count)];
+				if (e.is_alloc)
+				{
+					// An allocation only fills an address with no live object
+					auto result = shard.try_emplace(e.addr, chunk_object{ live_object(e.addr, e.size, e.frame, e.type_id, e.callstack_id), order, false, true });
+					if (!result.second && !result.first->second.live)
+					{
+						result.first->second.object = live_object(e.addr, e.size, e.frame, e.type_id, e.callstack_id);
+						result.first->second.order = order;
+						result.first->second.live = true;
+					}
+					++order;
+				}
+				else if (first)
+				{
+					shard.erase(e.addr);
+				}
+				else
+				{
+					auto result = shard.try_emplace(e.addr, chunk_object{ live_object(0, 0, 0, 0, 0), 0, true, false });
+					result.first->second.freed = true;
+					result.first->second.live = false;
+				}
+
+				if (++events % PROGRESS_EVENTS == 0)
+				{
+					events_done += PROGRESS_EVENTS;
+					if (stop)
+						return false;
+				}
+				return true;
+			});
+
+			if (!read && !stop)
+			{
+				failed = true;
+				stop = true;
+			}
+		}, poll);
+
+		// Merge the chunks in log order, one shard (a set of addresses) per task
+		std::vector<node_pool> merged_pools(shard_count);
+		std::vector<object_map> merged;
+		merged.reserve(shard_count);
+		for (size_t shard = 0; shard < shard_count; ++shard)
+			merged.emplace_back(0, std::hash<uint64_t>(), std::equal_to<uint64_t>(), pool_allocator<std::pair<const uint64_t, chunk_object>>(&merged_pools[shard]));
+
+		if (ok && !failed)
+		{
+			ok = run_tasks(shard_count, thread_count, stop, [&](size_t shard, size_t)
+			{
+				object_map& result = merged[shard];
+				for (auto& chunk : chunks)
+				{
+					if (stop)
+						return;
+
+					for (auto& pair : chunk.shards[shard])
+					{
+						const chunk_object& object = pair.second;
+						if (!object.freed)
+							result.emplace(pair.first, object);
+						else if (object.live)
+							result.insert_or_assign(pair.first, object);
+						else
+							result.erase(pair.first);
+					}
+				}
+			}, poll);
+		}
+
+		if (failed)
+			return false;
+		if (!ok)
+			return true;
+
+		// Flatten the maps, in allocation order
+		std::vector<const chunk_object*> live;
+		for (auto& shard : merged)
+		{
+			for (auto& pair : shard)
+				live.push_back(&pair.second);
+		}
+		std::sort(live.begin(), live.end(), [](const chunk_object* a, const chunk_object* b) { return a->order < b->order; });
+
+		objects.reserve(live.size());
+		for (auto object : live)
+			objects.push_back(object->object);
+		return true;
+	}
+}
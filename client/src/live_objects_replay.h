@@ -0,0 +1,133 @@
+#pragma once
+
+#include "mono_profiler_client.h"
+#include "file_view.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace owlcat
+{
+	/*
+		A node-recycling allocator for the live-objects replay (replay_live_objects). A
+		std::unordered_map allocates one node per element and frees it on erase; replaying a
+		huge capture is then billions of malloc/free calls (the profiled bottleneck - operator
+		new inside emplace). This pools fixed-size node blocks on a free list, so an erased
+		node is reused by the next emplace: the churn becomes O(1) list ops, and total memory
+		is bounded by the PEAK number of simultaneously-live objects, not the event count.
+		Single-threaded (a map and its pool belong to one thread at a time); bucket-array
+		allocations (n > 1) go straight to operator new.
+	*/
+	class node_pool
+	{
+		struct free_block { free_block* next; };
+		free_block* m_free = nullptr;
+		size_t m_node_size = 0;
+		std::vector<char*> m_slabs;
+		char* m_cursor = nullptr;
+		size_t m_remaining = 0;
+		static const size_t k_nodes_per_slab = 64 * 1024;
+
+	public:
+		node_pool() = default;
+		node_pool(const node_pool&) = delete;
+		node_pool& operator=(const node_pool&) = delete;
+		~node_pool()
+		{
+			for (char* s : m_slabs)
+				::operator delete(s);
+		}
+
+		void* allocate_node(size_t size)
+		{
+			// Only the (fixed-size) map nodes are pooled; anything else falls back to the heap.
+			if (m_node_size == 0)
+				m_node_size = size;
+			if (size != m_node_size)
+				return ::operator new(size);
+
+			if (m_free != nullptr)
+			{
+				void* p = m_free;
+				m_free = m_free->next;
+				return p;
+			}
+			if (m_remaining == 0)
+			{
+				m_cursor = (char*)::operator new(m_node_size * k_nodes_per_slab);
+				m_slabs.push_back(m_cursor);
+				m_remaining = k_nodes_per_slab;
+			}
+			void* p = m_cursor;
+			m_cursor += m_node_size;
+			--m_remaining;
+			return p;
+		}
+
+		void free_node(void* p, size_t size)
+		{
+			if (size != m_node_size)
+			{
+				::operator delete(p);
+				return;
+			}
+			free_block* b = (free_block*)p;
+			b->next = m_free;
+			m_free = b;
+		}
+	};
+
+	template<typename T>
+	class pool_allocator
+	{
+		node_pool* m_pool;
+	public:
+		using value_type = T;
+		pool_allocator(node_pool* pool) noexcept : m_pool(pool) {}
+		template<typename U> pool_allocator(const pool_allocator<U>& o) noexcept : m_pool(o.pool()) {}
+		node_pool* pool() const noexcept { return m_pool; }
+		template<typename U> struct rebind { using other = pool_allocator<U>; };
+
+		T* allocate(size_t n)
+		{
+			// n == 1 is a map node (pooled); n > 1 is the bucket array (plain heap)
+			if (n == 1)
+				return (T*)m_pool->allocate_node(sizeof(T));
+			return (T*)::operator new(n * sizeof(T));
+		}
+		void deallocate(T* p, size_t n) noexcept
+		{
+			if (n == 1)
+				m_pool->free_node(p, sizeof(T));
+			else
+				::operator delete(p);
+		}
+	};
+	template<class T, class U> bool operator==(const pool_allocator<T>& a, const pool_allocator<U>& b) noexcept { return a.pool() == b.pool(); }
+	template<class T, class U> bool operator!=(const pool_allocator<T>& a, const pool_allocator<U>& b) noexcept { return a.pool() != b.pool(); }
+
+	/*
+		The live-objects replay: the objects allocated in a byte range of the event log and
+		not freed by its end. An allocation at an address that already holds a live object
+		is ignored, and a free removes whatever object is at its address. Objects come out
+		in allocation order.
+
+		The range is split into chunks replayed in parallel. Per address, a chunk is a
+		function of the state the chunk starts with: if the chunk frees the address, what
+		follows doesn't depend on the state before; otherwise a live object stays, and the
+		chunk's first allocation fills an empty address. So every chunk records, per
+		address it touches, whether it frees it and the object it leaves there, and the
+		chunk results are merged in log order - sharded by address, so the merge runs in
+		parallel too. The answer does not depend on the thread count: one thread is the
+		plain sequential replay.
+
+		boundaries are byte offsets in the log, in order: the first and last ones are the
+		range, and the others are where it may be split (block boundaries, e.g. frame ends).
+		progress_func is only called on the calling thread. Returns false if the log can't
+		be read; if progress_func cancels, returns true with no objects.
+	*/
+	bool replay_live_objects(const file_range& event_log, const std::vector<uint64_t>& boundaries, size_t thread_count,
+		std::vector<live_object>& objects, const progress_func_t& progress_func);
+}
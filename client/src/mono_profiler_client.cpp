@@ -8,7 +8,15 @@
 #include "event_log.h"
 #include "capture_container.h"
 #include "symbol_resolver.h"
-
+#include "spool_file.h"
+#include "ingest_pipeline.h"
+#include "server_id_table.h"
+#include "lifetime_index.h"
+#include "live_objects_replay.h"
+#include "db_writer.h"
+#include "frame_series.h"
+
+#include <algorithm>
 #include <memory>
 #include <string>
 #include <thread>
@@ -16,12 +24,16 @@
 #include <cassert>
 #include <atomic>
 #include <map>
+#include <set>
 #include <deque>
 #include <mutex>
+#include <shared_mutex>
 #include <condition_variable>
 #include <unordered_map>
 #include <unordered_set>
 #include <filesystem>
+#include <chrono>
+#include <functional>
 
 #if defined(WIN32)
 #include <Windows.h>
@@ -43,19 +55,101 @@ namespace owlcat
 		uint64_t frame;
 		uint64_t addr;
 		uint32_t size;
-		// Database ids (already translated from server-side ids when the message was read)
+		// Server-side ids when decoded, database ids after the translate stage
 		uint64_t type_id;
 		uint64_t callstack_id;
 	};
 
+	/*
+		Incoming data is processed by a pipeline of four threads, so that reading the
+		socket never waits for disk or database writes, and each stage works on its own
+		state without locks:
+
+		  decode     reads messages, decodes events, answers command replies (but the
+		             references replies, answered by the log stage, see log_loop)
+		  translate  handles definitions, translates server ids to database ids
+		  log        detects frame boundaries, appends events to the event log
+		  db         writes database rows (definitions, frame stats, memstats...)
+
+		The db stage is a db_writer: the log stage hands it the rows and recycles the batch
+		right away, so a slow commit never holds batches back (see db_writer.h).
+
+		Stages hand whole batches to each other through bounded queues (batch_queue), and
+		a fixed number of batches circulate: a full pipeline stalls the decode stage, which
+		leaves the backlog in the network layer as before.
+	*/
+
+	// A non-event message, in the position it arrived in relative to the batch's events
+	struct ingest_message
+	{
+		// Number of events of the batch that arrived before this message
+		size_t position;
+		message msg;
+	};
+
+	// A database write, queued by the translate and log stages and executed by the db writer
+	struct ingest_row
+	{
+		// Number of events of the batch that arrived before the row was produced
+		size_t position;
+		db_writer::row_t write;
+	};
+
+	// A command reply that has to wait until the events that arrived before it are published
+	// (see log_loop), run by the log stage
+	struct ingest_reply
+	{
+		// Number of events of the batch that arrived before the reply
+		size_t position;
+		std::function<void()> run;
+	};
+
+	struct ingest_batch
+	{
+		std::vector<profiler_event> events;
+		std::vector<ingest_message> messages;
+		// In the order they must be written
+		std::vector<ingest_row> rows;
+		std::vector<ingest_reply> replies;
+
+		bool empty() const { return events.empty() && messages.empty() && rows.empty() && replies.empty(); }
+
+		void clear()
+		{
+			events.clear();
+			messages.clear();
+			rows.clear();
+			replies.clear();
+		}
+	};
+
+	// Events per batch handed from the decode stage to the next one. A batch is also handed
+	// off early when the input runs dry, so latency stays low at low event rates.
+	static const size_t INGEST_BATCH_EVENTS = 4096;
+	// Non-event messages (definitions...) per batch, so a definition burst doesn't build a
+	// huge batch either
+	static const size_t INGEST_BATCH_MESSAGES = 1024;
+	// Batches in circulation, which also bounds each queue
+	static const size_t INGEST_BATCH_COUNT = 16;
+	// Events published to the database at most this late within a long frame
+	static const uint64_t INGEST_PUBLISH_EVENTS = 100000;
+	// A capture survives a crash of the client up to its last checkpoint, at most this old
+	static const std::chrono::seconds JOURNAL_CHECKPOINT_INTERVAL(10);
+	// Symbolication threads at most: loading symbols is mostly disk-bound, and the first
+	// reference to a big module loads it while the other threads wait for it anyway
+	static const size_t SYMBOL_THREADS_MAX = 4;
+
 	struct base_command
 	{
 		const protocol::command type;
 		const uint64_t request_id;
+		// When the command was sent, to measure the round-trip time of its reply
+		const std::chrono::steady_clock::time_point sent_time;
 
 		base_command(protocol::command _type, uint64_t _request_id)
 			: type(_type)
 			, request_id(_request_id)
+			, sent_time(std::chrono::steady_clock::now())
 		{}
 
 		virtual ~base_command() {}
@@ -93,104 +187,6 @@ namespace owlcat
 		resume_app_callback callback;
 	};
 
-	/*
-		A node-recycling allocator for the live-objects replay (get_live_objects). A
-		std::unordered_map allocates one node per element and frees it on erase; replaying a
-		huge capture is then billions of malloc/free calls (the profiled bottleneck - operator
-		new inside emplace). This pools fixed-size node blocks on a free list, so an erased
-		node is reused by the next emplace: the churn becomes O(1) list ops, and total memory
-		is bounded by the PEAK number of simultaneously-live objects, not the event count.
-		Single-threaded (the map is built on one thread); bucket-array allocations (n > 1) go
-		straight to operator new.
-	*/
-	class node_pool
-	{
-		struct free_block { free_block* next; };
-		free_block* m_free = nullptr;
-		size_t m_node_size = 0;
-		std::vector<char*> m_slabs;
-		char* m_cursor = nullptr;
-		size_t m_remaining = 0;
-		static const size_t k_nodes_per_slab = 64 * 1024;
-
-	public:
-		node_pool() = default;
-		node_pool(const node_pool&) = delete;
-		node_pool& operator=(const node_pool&) = delete;
-		~node_pool()
-		{
-			for (char* s : m_slabs)
-				::operator delete(s);
-		}
-
-		void* allocate_node(size_t size)
-		{
-			// Only the (fixed-size) map nodes are pooled; anything else falls back to the heap.
-			if (m_node_size == 0)
-				m_node_size = size;
-			if (size != m_node_size)
-				return ::operator new(size);
-
-			if (m_free != nullptr)
-			{
-				void* p = m_free;
-				m_free = m_free->next;
-				return p;
-			}
-			if (m_remaining == 0)
-			{
-				m_cursor = (char*)::operator new(m_node_size * k_nodes_per_slab);
-				m_slabs.push_back(m_cursor);
-				m_remaining = k_nodes_per_slab;
-			}
-			void* p = m_cursor;
-			m_cursor += m_node_size;
-			--m_remaining;
-			return p;
-		}
-
-		void free_node(void* p, size_t size)
-		{
-			if (size != m_node_size)
-			{
-				::operator delete(p);
-				return;
-			}
-			free_block* b = (free_block*)p;
-			b->next = m_free;
-			m_free = b;
-		}
-	};
-
-	template<typename T>
-	class pool_allocator
-	{
-		node_pool* m_pool;
-	public:
-		using value_type = T;
-		pool_allocator(node_pool* pool) noexcept : m_pool(pool) {}
-		template<typename U> pool_allocator(const pool_allocator<U>& o) noexcept : m_pool(o.pool()) {}
-		node_pool* pool() const noexcept { return m_pool; }
-		template<typename U> struct rebind { using other = pool_allocator<U>; };
-
-		T* allocate(size_t n)
-		{
-			// n == 1 is a map node (pooled); n > 1 is the bucket array (plain heap)
-			if (n == 1)
-				return (T*)m_pool->allocate_node(sizeof(T));
-			return (T*)::operator new(n * sizeof(T));
-		}
-		void deallocate(T* p, size_t n) noexcept
-		{
-			if (n == 1)
-				m_pool->free_node(p, sizeof(T));
-			else
-				::operator delete(p);
-		}
-	};
-	template<class T, class U> bool operator==(const pool_allocator<T>& a, const pool_allocator<U>& b) noexcept { return a.pool() == b.pool(); }
-	template<class T, class U> bool operator!=(const pool_allocator<T>& a, const pool_allocator<U>& b) noexcept { return a.pool() != b.pool(); }
-
 	class mono_profiler_client::details
 	{
 		network m_network;
@@ -202,6 +198,9 @@ namespace owlcat
 		};
 
 		network_settings m_network_settings;
+		// Name of the shared-memory channel the server offered in the launch handshake
+		// (launch_executable), empty to connect over TCP
+		std::string m_shm_name;
 		uint64_t m_next_request_id = 0;
 
 		// List of commands pending responses
@@ -219,6 +218,7 @@ namespace owlcat
 			assert((*iter)->type == type);
 
 			auto result = std::static_pointer_cast<T>(*iter);
+			m_last_command_round_trip_us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - result->sent_time).count();
 
 			m_commands.erase(iter);
 			return result;
@@ -231,10 +231,32 @@ namespace owlcat
 		}
 
 		bool m_stop = false;
+		// The decode stage (process_messages), and the other stages of the ingest pipeline
 		std::thread m_thread;
+		std::thread m_translate_thread;
+		std::thread m_log_thread;
+		db_writer m_db_writer;
+
+		// decode -> translate -> log, and the empty batches going back to decode
+		batch_queue<ingest_batch> m_translate_queue{ INGEST_BATCH_COUNT };
+		batch_queue<ingest_batch> m_log_queue{ INGEST_BATCH_COUNT };
+		batch_queue<ingest_batch> m_free_batches{ INGEST_BATCH_COUNT };
+
+		// Translate stage: rows produced while translating the current batch
+		std::vector<ingest_row>* m_translate_rows = nullptr;
+		size_t m_translate_position = 0;
+		// Log stage: rows of the current batch, merged with the frame stats it produces
+		std::vector<db_writer::row_t> m_log_rows;
+		// Log stage: events appended to the event log, but not published to the database yet
+		uint64_t m_unpublished_events = 0;
+
+		// Set while importing a spool written by the server (import_spool): messages are read
+		// from it instead of the network. If m_spool_follow is set, the spool is still being
+		// written and we keep reading until stop(); otherwise we stop at its end.
+		spool_reader m_spool_reader;
+		bool m_spool_follow = false;
 		persistent_storage::persistent_storage m_db;
 
-		std::vector<profiler_event> m_frame_events;
 		uint64_t m_prev_frame = 0xFFFFFFFFFFFFFFFF;
 
 		// Number of allocation and free events this frame
@@ -243,17 +265,206 @@ namespace owlcat
 		// Running total of allocated memory
 		int64_t m_size_running_total = 0;
 
-		// Total number of events stored (written to the event log). Atomic: updated on
-		// the processing thread, read from the UI thread to display the storage rate.
+		// Total number of events stored (written to the event log and published to the
+		// database). Atomic: updated on the db writer, read from the UI thread to display
+		// the storage rate.
 		std::atomic<uint64_t> m_db_inserted_events = 0;
 
+		// Round-trip time of the last answered command (request sent -> reply read), in
+		// microseconds. Commands and replies use the network's priority lane, so this should
+		// stay low even when the event stream is saturated.
+		std::atomic<uint64_t> m_last_command_round_trip_us = 0;
+
+		// The container the capture is written to while it runs (see capture_container.h):
+		// the event log is its stream, the database and the series are copied into it at
+		// every checkpoint. Saving the capture finalizes it. Declared before the event log,
+		// which writes to its file.
+		capture_container::journal_writer m_journal;
+		// The journal while it is not saved: removed with the capture
+		std::string m_unsaved_journal_path;
+		// Set if a checkpoint failed: the journal can't be finalized, saving packs a container
+		bool m_journal_failed = false;
+		// Log stage: when the last checkpoint was written
+		std::chrono::steady_clock::time_point m_last_checkpoint_time;
+		// Bytes of the series files copied into the journal
+		uint64_t m_frame_stats_copied = 0;
+		uint64_t m_memory_stats_copied = 0;
+
 		// The event log of the current capture: events live here, not in the database
 		// (see event_log.h)
 		event_log_writer m_event_log;
-		std::string m_event_log_file_name;
+		// The event log in the journal, or its entry in the container of an opened capture.
+		// A capture extends it as it publishes frames: read it with get_event_log_file.
+		file_range m_event_log_file;
+		mutable std::mutex m_event_log_file_mutex;
+
+		file_range get_event_log_file() const
+		{
+			std::scoped_lock lock(m_event_log_file_mutex);
+			return m_event_log_file;
+		}
+
+		void set_event_log_file(file_range file)
+		{
+			std::scoped_lock lock(m_event_log_file_mutex);
+			m_event_log_file = std::move(file);
+		}
+
+		// Copies into the journal what changed in the database and the series since the last
+		// checkpoint. Between transactions only: on the db writer, or once it is stopped.
+		bool copy_to_journal()
+		{
+			std::vector<persistent_storage::byte_range> ranges;
+			uint64_t db_size = 0;
+			if (!m_db.take_written_ranges(ranges, db_size))
+				return false;
+
+			// In chunks, so the first checkpoint doesn't hold the whole database in memory
+			const uint64_t chunk_size = 4 * 1024 * 1024;
+			std::vector<uint8_t> buffer;
+			for (auto& range : ranges)
+			{
+				const uint64_t end = std::min(range.offset + range.size, db_size);
+				for (uint64_t offset = range.offset; offset < end; offset += chunk_size)
+				{
+					const size_t size = (size_t)std::min(chunk_size, end - offset);
+					buffer.resize(size);
+					if (!m_db.read_file(offset, buffer.data(), size) || !m_journal.write(capture_container::entry_database, offset, buffer.data(), size))
+						return false;
+				}
+			}
+			m_journal.truncate(capture_container::entry_database, db_size);
+
+			return m_frame_stats.flush() && m_memory_stats.flush() &&
+				copy_series_tail(m_frame_stats_file.path, capture_container::entry_frame_stats, m_frame_stats_copied) &&
+				copy_series_tail(m_memory_stats_file.path, capture_container::entry_memory_stats, m_memory_stats_copied);
+		}
+
+		// Series files are only appended to: copies what was appended since the last copy
+		bool copy_series_tail(const std::string& path, const char* entry, uint64_t& copied)
+		{
+			file_view view;
+			if (!view.open(file_range(path), false) || view.size() < copied)
+				return false;
+
+			const size_t size = (size_t)(view.size() - copied);
+			const uint8_t* data = view.read(copied, size);
+			if (data == nullptr || !m_journal.write(entry, copied, data, size))
+				return false;
+			copied = view.size();
+			return true;
+		}
+
+		// Writes a checkpoint of the journal: everything published so far survives a crash.
+		// Log stage: the event log is flushed here, and the database and the series are copied
+		// on the db writer, between two transactions.
+		void checkpoint_journal()
+		{
+			m_last_checkpoint_time = std::chrono::steady_clock::now();
+			if (!m_journal.is_open() || m_journal_failed)
+				return;
+
+			bool ok = m_event_log.flush();
+			m_db_writer.checkpoint([&]()
+			{
+				ok = ok && copy_to_journal() && m_journal.checkpoint();
+			});
+
+			// The stream goes on in a new record of the journal
+			set_event_log_file(m_journal.get_stream_range(m_event_log.position()));
+			if (!ok)
+			{
+				printf("Failed to write a checkpoint of the capture: it will be saved as a whole\n");
+				m_journal_failed = true;
+			}
+		}
+
+		// Removes the journal of a capture that was not saved
+		void discard_journal()
+		{
+			m_journal.close();
+			if (!m_unsaved_journal_path.empty())
+			{
+				std::error_code ec;
+				std::filesystem::remove(m_unsaved_journal_path, ec);
+				m_unsaved_journal_path.clear();
+			}
+		}
 		// Byte offset in the event log where the current frame's events begin
 		uint64_t m_current_frame_begin = 0;
 
+		// The per-frame series the graphs read (see frame_series.h). Appended by the db writer
+		// along with the FrameStats and MemStats rows, and saved in files next to the database.
+		enum { stats_allocs, stats_frees, stats_size };
+		enum { memory_committed, memory_working_set, memory_gc_heap };
+		frame_series m_frame_stats{ { frame_series::column_kind::counter, frame_series::column_kind::counter, frame_series::column_kind::level } };
+		frame_series m_memory_stats{ { frame_series::column_kind::level, frame_series::column_kind::level, frame_series::column_kind::level } };
+		file_range m_frame_stats_file;
+		file_range m_memory_stats_file;
+
+		// Loads the series of an opened capture, or rebuilds them from the database for
+		// captures saved without them
+		bool load_frame_series(const std::map<std::string, file_range>& entries)
+		{
+			auto frames_entry = entries.find(capture_container::entry_frame_stats);
+			auto memory_entry = entries.find(capture_container::entry_memory_stats);
+			if (frames_entry != entries.end() && memory_entry != entries.end() &&
+				m_frame_stats.load(frames_entry->second) && m_memory_stats.load(memory_entry->second))
+			{
+				m_frame_stats_file = frames_entry->second;
+				m_memory_stats_file = memory_entry->second;
+				return true;
+			}
+
+			m_frame_stats.clear();
+			m_memory_stats.clear();
+			m_frame_stats_file = file_range();
+			m_memory_stats_file = file_range();
+
+			auto stats_cursor = queries::select_stats(m_db, 0, (uint64_t)INT64_MAX);
+			if (stats_cursor.has_error())
+				return false;
+			while (stats_cursor.next())
+			{
+				const uint64_t values[] = { stats_cursor.get_uint64("allocs"), stats_cursor.get_uint64("frees"), (uint64_t)stats_cursor.get_int64("size") };
+				m_frame_stats.append(stats_cursor.get_uint64("frame"), values);
+			}
+
+			auto memstats_cursor = queries::select_memstats(m_db, 0, (uint64_t)INT64_MAX);
+			if (memstats_cursor.has_error())
+				return false;
+			while (memstats_cursor.next())
+			{
+				const uint64_t values[] = { memstats_cursor.get_uint64("committed"), memstats_cursor.get_uint64("working_set"), memstats_cursor.get_uint64("gc_heap") };
+				m_memory_stats.append(memstats_cursor.get_uint64("frame"), values);
+			}
+			return true;
+		}
+
+		static void get_buckets(const frame_series& series, size_t column, uint64_t from_frame, uint64_t to_frame, size_t bucket_frames, std::vector<frame_bucket_t>& buckets)
+		{
+			std::vector<frame_series::bucket_t> summaries;
+			series.get_buckets(column, from_frame, to_frame, bucket_frames, summaries);
+
+			buckets.resize(summaries.size());
+			for (size_t i = 0; i < summaries.size(); ++i)
+				buckets[i] = { summaries[i].first_frame, summaries[i].last_frame, summaries[i].min, summaries[i].max, summaries[i].sum };
+		}
+
+		// Allocation lifetimes of the event log, built on the first live-objects query and
+		// extended by the later ones (see lifetime_index.h). Reset with the event log.
+		lifetime_index m_lifetime_index;
+		std::mutex m_lifetime_index_mutex;
+
+		void reset_lifetime_index()
+		{
+			std::scoped_lock lock(m_lifetime_index_mutex);
+			m_lifetime_index.reset();
+		}
+
+		// The container file of an opened capture: its entries are read in place
+		std::string m_container_path;
+
 		// Files extracted from an opened capture container into a temporary directory,
 		// and the directory itself; cleaned up when the capture is closed
 		std::vector<std::string> m_extracted_files;
@@ -284,118 +495,200 @@ namespace owlcat
 		std::unordered_map<std::string, uint64_t> m_type_to_id_map;
 		std::unordered_map<uint64_t, std::string> m_id_to_type_map;
 		
-		// Maps between callstack ID and callstack text (raw, as received - native frames
-		// are "Module.dll+0xRVA")
-		std::unordered_map<std::string, uint64_t> m_callstacks_to_id_map;
-		std::unordered_map<uint64_t, std::string> m_id_to_callstacks_map;
+		// Callstacks are stored as sequences of frame ids, never as one text each: captures
+		// have hundreds of thousands of callstacks sharing a few thousand unique lines. The
+		// text is only put together for display (get_callstack).
+		//
+		// Only the translate stage (or the loading thread) adds frames and callstacks, and it
+		// reads them without a lock. The UI thread reads them in get_callstack while they
+		// grow (and reallocate), so the writer changes them under an exclusive lock of
+		// m_callstacks_mutex and get_callstack reads them under a shared one. Only new
+		// definitions take the lock, not events.
+		std::shared_mutex m_callstacks_mutex;
+
+		// Unique callstack frames (lines, with their '\n', raw as received - native frames
+		// are "Module.dll+0xRVA"), indexed by frame id. A deque, so the lookup map can use
+		// string views of its elements.
+		std::deque<std::string> m_frames;
+		std::unordered_map<std::string_view, uint64_t> m_frame_to_id_map;
+
+		// Callstacks, indexed by callstack id: a range of m_callstack_frame_ids
+		struct callstack_entry
+		{
+			uint64_t offset = 0;
+			uint32_t count = 0;
+		};
+		std::vector<callstack_entry> m_callstacks;
+		std::vector<uint32_t> m_callstack_frame_ids;
+		// Hash of a frame id sequence -> callstack ids with that hash
+		std::unordered_multimap<uint64_t, uint64_t> m_callstack_hash_to_id;
+		std::atomic<size_t> m_callstacks_count{ 0 };
+
+		// Callstack frames of a definition being translated, reused across messages
+		std::vector<uint32_t> m_scratch_frame_ids;
 
 		// ---- Client-side symbolication ----
-		// Native callstack frames arrive as "Module.dll+0xRVA"; a background thread resolves
-		// them to function names via local PDBs (see symbol_resolver). Kept off the network
-		// processing thread so PDB loads never stall event ingestion.
+		// Native callstack frames arrive as "Module.dll+0xRVA"; a pool of background threads
+		// resolves them to function names via symbol maps or local PDBs (see symbol_resolver).
+		// Kept off the network processing thread so PDB loads never stall event ingestion.
+		// Frames are unique (see m_frames), so each native frame is resolved once, whatever
+		// the number of callstacks it is part of.
 		std::unique_ptr<symbol_resolver> m_symbol_resolver;
-		std::thread m_symbol_thread;
+		std::vector<std::thread> m_symbol_threads;
 		bool m_symbol_stop = false;
-		// Work queue of (callstack id, raw text) to symbolicate
+		// Work queue of (frame id, raw text) to symbolicate
 		std::deque<std::pair<uint64_t, std::string>> m_symbol_queue;
+		// All native frames seen this session, kept so we can re-resolve them when the
+		// symbol path changes
+		std::vector<std::pair<uint64_t, std::string>> m_symbol_known;
 		std::mutex m_symbol_mutex;
 		std::condition_variable m_symbol_cv;
-		// A pending symbol-path change, applied on the symbol thread (all DbgHelp use stays there)
+		// A pending symbol-path change, applied by the first symbol thread to see it while the
+		// others wait, so that no frame of the new generation is resolved against the old path
 		std::string m_pending_symbol_path;
 		bool m_symbol_path_changed = false;
-		// Set when a new session/capture begins: the symbol thread drops its per-session
-		// state (callstack ids restart from zero each session, so it must not carry over)
-		bool m_symbol_reset = false;
-		// Symbolicated callstack text, id -> display text. Written by the symbol thread,
-		// read (copied) by the UI thread; guarded by m_display_mutex.
-		std::unordered_map<uint64_t, std::string> m_id_to_display_callstack;
+		bool m_symbol_applying_path = false;
+		// Bumped when a new session/capture begins or the symbol path changes: results of
+		// frames taken from the queue before are dropped (frame ids restart from zero each
+		// session, and the old path may resolve differently). Guarded by m_symbol_mutex for
+		// writes, read under m_display_mutex.
+		std::atomic<uint64_t> m_symbol_generation{ 0 };
+		// Symbolicated frame text, frame id -> display text. Written by the symbol threads,
+		// read by the UI thread; guarded by m_display_mutex.
+		std::unordered_map<uint64_t, std::string> m_id_to_display_frame;
+		// Native frames resolved without a result, and the identity of the symbols of each
+		// module frames were resolved against (see symbol_resolver::get_module_identity):
+		// saved with the capture along with the results. Guarded by m_display_mutex.
+		std::unordered_set<uint64_t> m_unresolved_frames;
+		std::unordered_map<std::string, std::string> m_symbol_modules;
 		std::mutex m_display_mutex;
 
-		// Queues a callstack for background symbolication
-		void queue_for_symbolication(uint64_t callstack_id, const std::string& raw)
+		// Queues a callstack frame for background symbolication
+		void queue_for_symbolication(uint64_t frame_id, const std::string& raw)
 		{
-			// Nothing to resolve if there are no native frames
-			if (raw.find("+0x") == std::string::npos)
+			// Nothing to resolve for managed frames
+			if (!symbol_resolver::is_native_frame(raw))
 				return;
 
 			std::scoped_lock lock(m_symbol_mutex);
-			m_symbol_queue.push_back({ callstack_id, raw });
+			m_symbol_known.push_back({ frame_id, raw });
+			m_symbol_queue.push_back({ frame_id, raw });
 			m_symbol_cv.notify_one();
 		}
 
-		// The symbolication thread body
-		void symbolication_loop()
+		// Restores the symbolication result of a frame saved with the capture
+		void restore_symbolication(uint64_t frame_id, const std::string& raw, std::string display)
 		{
-			// All symbol callstacks seen this session, kept so we can re-resolve them all
-			// when the symbol path changes
-			std::vector<std::pair<uint64_t, std::string>> known;
+			{
+				std::scoped_lock lock(m_symbol_mutex);
+				m_symbol_known.push_back({ frame_id, raw });
+			}
 
+			std::scoped_lock lock(m_display_mutex);
+			if (display.empty())
+				m_unresolved_frames.insert(frame_id);
+			else
+				m_id_to_display_frame[frame_id] = std::move(display);
+		}
+
+		// Applies a symbol path change: the results of the modules whose symbols are the same
+		// under the new path are kept, the frames of the other modules are queued again, as
+		// well as those whose resolution was dropped by the change
+		void apply_symbol_path(const std::string& path)
+		{
+			// Waits for the resolutions in progress, whose results are dropped
+			m_symbol_resolver->set_search_path(path);
+
+			std::unordered_map<std::string, std::string> modules;
+			{
+				std::scoped_lock lock(m_display_mutex);
+				modules = m_symbol_modules;
+			}
+			std::unordered_set<std::string_view> changed;
+			for (auto& module : modules)
+			{
+				if (m_symbol_resolver->get_module_identity(module.first) != module.second)
+					changed.insert(module.first);
+			}
+
+			std::scoped_lock lock(m_symbol_mutex, m_display_mutex);
+			for (auto& module : changed)
+				m_symbol_modules.erase(std::string(module));
+			m_symbol_queue.clear();
+			for (auto& frame : m_symbol_known)
+			{
+				if (changed.count(symbol_resolver::get_frame_module(frame.second)) != 0)
+				{
+					m_id_to_display_frame.erase(frame.first);
+					m_unresolved_frames.erase(frame.first);
+				}
+				else if (m_id_to_display_frame.count(frame.first) != 0 || m_unresolved_frames.count(frame.first) != 0)
+					continue;
+				m_symbol_queue.push_back(frame);
+			}
+			m_symbol_applying_path = false;
+			m_symbol_cv.notify_all();
+		}
+
+		// The body of the symbolication threads
+		void symbolication_loop()
+		{
+			std::string display;
 			while (true)
 			{
 				std::pair<uint64_t, std::string> item;
-				bool path_changed = false;
-				bool reset = false;
+				uint64_t generation;
 				std::string new_path;
+				bool path_changed = false;
 				{
 					std::unique_lock<std::mutex> lock(m_symbol_mutex);
-					m_symbol_cv.wait(lock, [&] { return m_symbol_stop || m_symbol_reset || m_symbol_path_changed || !m_symbol_queue.empty(); });
+					m_symbol_cv.wait(lock, [&] { return m_symbol_stop || (!m_symbol_applying_path && (m_symbol_path_changed || !m_symbol_queue.empty())); });
 					if (m_symbol_stop)
 						break;
-					if (m_symbol_reset)
-					{
-						m_symbol_reset = false;
-						reset = true;
-					}
-					else if (m_symbol_path_changed)
+					generation = m_symbol_generation;
+					if (m_symbol_path_changed)
 					{
 						m_symbol_path_changed = false;
+						m_symbol_applying_path = true;
 						path_changed = true;
 						new_path = m_pending_symbol_path;
 					}
 					else
 					{
-						item = m_symbol_queue.front();
+						item = std::move(m_symbol_queue.front());
 						m_symbol_queue.pop_front();
 					}
 				}
 
-				if (reset)
-				{
-					known.clear();
-					std::scoped_lock lock(m_display_mutex);
-					m_id_to_display_callstack.clear();
-					continue;
-				}
-
 				if (path_changed)
 				{
-					m_symbol_resolver->set_search_path(new_path);
-					// Re-resolve everything seen so far under the new path
-					{
-						std::scoped_lock lock(m_display_mutex);
-						m_id_to_display_callstack.clear();
-					}
-					for (auto& k : known)
-					{
-						std::string display = m_symbol_resolver->symbolicate(k.second);
-						if (display != k.second)
-						{
-							std::scoped_lock lock(m_display_mutex);
-							m_id_to_display_callstack[k.first] = std::move(display);
-						}
-					}
+					apply_symbol_path(new_path);
 					continue;
 				}
 
-				known.push_back(item);
-				std::string display = m_symbol_resolver->symbolicate(item.second);
-				// Only store if symbolication actually changed the text; otherwise
-				// get_callstack falls back to the raw text
-				if (display != item.second)
+				// The identity of the module's symbols is looked up once per module
+				const std::string_view module = symbol_resolver::get_frame_module(item.second);
+				bool has_identity;
 				{
 					std::scoped_lock lock(m_display_mutex);
-					m_id_to_display_callstack[item.first] = std::move(display);
+					has_identity = m_symbol_modules.count(std::string(module)) != 0;
 				}
+				std::string identity;
+				if (!has_identity)
+					identity = m_symbol_resolver->get_module_identity(std::string(module));
+
+				const bool resolved = m_symbol_resolver->symbolicate_frame(item.second, display);
+
+				std::scoped_lock lock(m_display_mutex);
+				if (generation != m_symbol_generation)
+					continue;
+				if (!has_identity)
+					m_symbol_modules.emplace(module, std::move(identity));
+				// get_callstack shows the raw text of unresolved frames
+				if (resolved)
+					m_id_to_display_frame[item.first] = std::move(display);
+				else
+					m_unresolved_frames.insert(item.first);
 			}
 		}
 
@@ -407,18 +700,30 @@ namespace owlcat
 		// for the same name (e.g. different instantiations of a generic type), and its
 		// id space restarts when the profiler in the game restarts. Database ids are
 		// canonicalized by name, so we translate every server id on arrival.
-		std::unordered_map<uint64_t, uint64_t> m_server_type_map;
-		std::unordered_map<uint64_t, uint64_t> m_server_callstack_map;
+		// Indexed by server id (see server_id_table): this is a per-event lookup.
+		static constexpr uint64_t UNKNOWN_ID = ~0ull;
+		server_id_table<uint64_t> m_server_type_map{ UNKNOWN_ID };
+		server_id_table<uint64_t> m_server_callstack_map{ UNKNOWN_ID };
 
 		// Callstack frames are interned server-side: each unique line ("Class.Method" or
 		// "Module.dll+0xRVA") is sent once (SRV_FRAME), and a callstack (SRV_CALLSTACK) is a
-		// sequence of frame ids. We reassemble the full callstack text here on arrival and
-		// feed it into the existing pipeline unchanged, so nothing downstream needs to know.
-		std::unordered_map<uint64_t, std::string> m_server_frame_map;
+		// sequence of frame ids. Server frame ids map to our frame ids, so callstacks never
+		// need to be turned into text on arrival.
+		server_id_table<uint64_t> m_server_frame_map{ UNKNOWN_ID };
 
 		std::string m_db_file_name;
 
-		// Inserts a new type ID into database, or returns one already present from memory cache
+		// Queues a database write on the translate stage, in the position of the current event.
+		// Outside of the pipeline (loading a capture), writes right away.
+		void add_translate_row(db_writer::row_t write)
+		{
+			if (m_translate_rows == nullptr)
+				db_writer::write_row(m_db, write);
+			else
+				m_translate_rows->push_back({ m_translate_position, std::move(write) });
+		}
+
+		// Creates a new type ID (queueing its database row), or returns one already present from memory cache
 		uint64_t get_or_create_type_id(const std::string& type)
 		{
 			auto iter = m_type_to_id_map.find(type);
@@ -429,92 +734,165 @@ namespace owlcat
 			m_type_to_id_map.insert(std::make_pair(type, type_id));
 			m_id_to_type_map.insert(std::make_pair(type_id, type));
 
-			queries::insert_type(m_db, type, type_id);
+			add_translate_row(db_writer::type_row{ type_id, type });
 
 			return type_id;
 		}
 
-		// Inserts a new callstack ID into database, or returns one already present from memory cache
-		uint64_t get_or_create_callstack_id(const std::string& callstack)
+		// Creates a new callstack frame ID (queueing its database row), or returns one already present from memory cache
+		uint64_t get_or_create_frame_id(const std::string& text)
 		{
-			auto iter = m_callstacks_to_id_map.find(callstack);
-			if (iter != m_callstacks_to_id_map.end())
+			auto iter = m_frame_to_id_map.find(text);
+			if (iter != m_frame_to_id_map.end())
 				return iter->second;
 
-			uint64_t callstack_id = m_next_callstack_id++;
-			m_callstacks_to_id_map.insert(std::make_pair(callstack, callstack_id));
-			m_id_to_callstacks_map.insert(std::make_pair(callstack_id, callstack));
+			uint64_t frame_id = m_frames.size();
+			std::unique_lock lock(m_callstacks_mutex);
+			const std::string& stored = m_frames.emplace_back(text);
+			lock.unlock();
+			m_frame_to_id_map.emplace(std::string_view(stored), frame_id);
+
+			add_translate_row(db_writer::frame_row{ frame_id, text });
+
+			// Resolve native frames to symbols in the background
+			queue_for_symbolication(frame_id, text);
+
+			return frame_id;
+		}
+
+		static uint64_t hash_frame_ids(const std::vector<uint32_t>& frame_ids)
+		{
+			// FNV-1a over the ids
+			uint64_t hash = 14695981039346656037ULL;
+			for (uint32_t id : frame_ids)
+			{
+				hash ^= id;
+				hash *= 1099511628211ULL;
+			}
+			return hash;
+		}
+
+		// Stores a callstack under the given id in memory
+		void add_callstack(uint64_t callstack_id, uint64_t hash, const std::vector<uint32_t>& frame_ids)
+		{
+			std::scoped_lock lock(m_callstacks_mutex);
+			if (callstack_id >= m_callstacks.size())
+				m_callstacks.resize(callstack_id + 1);
+
+			m_callstacks[callstack_id] = { m_callstack_frame_ids.size(), (uint32_t)frame_ids.size() };
+			m_callstack_frame_ids.insert(m_callstack_frame_ids.end(), frame_ids.begin(), frame_ids.end());
+			m_callstack_hash_to_id.emplace(hash, callstack_id);
+			++m_callstacks_count;
+		}
 
-			queries::insert_callstack(m_db, callstack, callstack_id);
+		// Creates a new callstack ID (queueing its database row), or returns one already present from memory cache
+		uint64_t get_or_create_callstack_id(const std::vector<uint32_t>& frame_ids)
+		{
+			const uint64_t hash = hash_frame_ids(frame_ids);
+			auto range = m_callstack_hash_to_id.equal_range(hash);
+			for (auto iter = range.first; iter != range.second; ++iter)
+			{
+				const auto& entry = m_callstacks[iter->second];
+				if (entry.count == frame_ids.size() && std::equal(frame_ids.begin(), frame_ids.end(), m_callstack_frame_ids.begin() + entry.offset))
+					return iter->second;
+			}
 
-			// Resolve its native frames to symbols in the background
-			queue_for_symbolication(callstack_id, callstack);
+			uint64_t callstack_id = m_next_callstack_id++;
+			add_callstack(callstack_id, hash, frame_ids);
+
+			std::vector<uint8_t> packed;
+			memory_writer writer(packed);
+			for (uint32_t id : frame_ids)
+				writer.write_varint(id);
+			add_translate_row(db_writer::callstack_row{ callstack_id, hash, std::move(packed) });
 
 			return callstack_id;
 		}
 
+		// Forgets all callstacks and frames, for a new session or database
+		void clear_callstacks()
+		{
+			std::scoped_lock lock(m_callstacks_mutex);
+			m_frame_to_id_map.clear();
+			m_frames.clear();
+			m_callstacks.clear();
+			m_callstack_frame_ids.clear();
+			m_callstack_hash_to_id.clear();
+			m_callstacks_count = 0;
+		}
+
 		// Translates a server-side type id into a database id
 		uint64_t translate_server_type_id(uint64_t server_id)
 		{
-			auto iter = m_server_type_map.find(server_id);
-			if (iter != m_server_type_map.end())
-				return iter->second;
+			uint64_t type_id = m_server_type_map.get(server_id);
+			if (type_id != UNKNOWN_ID)
+				return type_id;
 
 			// Should never happen: definitions always precede allocations that reference them
 			printf("Allocation references unknown type id %llu\n", (unsigned long long)server_id);
-			uint64_t type_id = get_or_create_type_id("<unknown type>");
-			m_server_type_map.emplace(server_id, type_id);
+			type_id = get_or_create_type_id("<unknown type>");
+			m_server_type_map.set(server_id, type_id);
 			return type_id;
 		}
 
 		// Translates a server-side callstack id into a database id
 		uint64_t translate_server_callstack_id(uint64_t server_id)
 		{
-			auto iter = m_server_callstack_map.find(server_id);
-			if (iter != m_server_callstack_map.end())
-				return iter->second;
+			uint64_t callstack_id = m_server_callstack_map.get(server_id);
+			if (callstack_id != UNKNOWN_ID)
+				return callstack_id;
 
 			// Should never happen: definitions always precede allocations that reference them
 			printf("Allocation references unknown callstack id %llu\n", (unsigned long long)server_id);
-			uint64_t callstack_id = get_or_create_callstack_id("<unknown callstack>");
-			m_server_callstack_map.emplace(server_id, callstack_id);
+			m_scratch_frame_ids.assign(1, (uint32_t)get_or_create_frame_id("<unknown callstack>"));
+			callstack_id = get_or_create_callstack_id(m_scratch_frame_ids);
+			m_server_callstack_map.set(server_id, callstack_id);
 			return callstack_id;
 		}
 
-		// Saves events from the current frame: the events themselves go to the event
-		// log file, the frame's stats and its byte range in the log go to the database
+		// Publishes the events of the current frame appended to the event log so far: the
+		// frame's stats and its byte range in the log go to the database. Log stage.
 		void save_frame_events()
 		{
-			// There should be no events before we receice the first frame
+			// There are no events before we receive the first frame
 			if (m_prev_frame == 0xFFFFFFFFFFFFFFFF)
-			{
-#ifdef WIN32
-				if (!m_frame_events.empty())
-					__debugbreak();
-#endif
 				return;
-			}
-
-			for (auto& e : m_frame_events)
-				m_event_log.append(e.frame, e.addr, e.type_id, e.callstack_id, e.size, e.type == profiler_event::alloc);
 
 			// The events must hit the file before the frame's byte range is published
 			// to the database, or a concurrent reader could read past the valid data
 			m_event_log.flush();
+			if (m_journal.is_open())
+				set_event_log_file(m_journal.get_stream_range(m_event_log.position()));
+
+			const uint64_t frame = m_prev_frame;
+			const uint64_t allocs = m_frame_allocs;
+			const uint64_t frees = m_frame_frees;
+			const int64_t size = m_size_running_total;
+			const uint64_t begin = m_current_frame_begin;
+			const uint64_t end = m_event_log.position();
+			const uint64_t events = m_unpublished_events;
+			m_log_rows.push_back([this, frame, allocs, frees, size, begin, end, events]()
+			{
+				queries::insert_frame_stats(m_db, frame, allocs, frees, size, begin, end);
+				const uint64_t values[] = { allocs, frees, (uint64_t)size };
+				m_frame_stats.append(frame, values);
+				m_db_inserted_events += events;
+			});
 
-			queries::insert_frame_stats(m_db, m_prev_frame, m_frame_allocs, m_frame_frees, m_size_running_total, m_current_frame_begin, m_event_log.position());
-
-			m_db_inserted_events += m_frame_events.size();
-
-			m_frame_events.clear();
+			m_unpublished_events = 0;
 		}
 
-		// Check if the last received event's frame is different from the previous event's frame,
-		// and saves the current frame events if it is.
+		// Check if the event's frame is different from the previous event's frame,
+		// and publishes the previous frame if it is. Log stage.
 		void try_save_events(uint64_t frame)
 		{
 			if (frame != m_prev_frame)
 			{
+#ifdef WIN32
+				// Frames should always be sequential
+				if (frame < m_prev_frame && m_prev_frame != 0xFFFFFFFFFFFFFFFF)
+					__debugbreak();
+#endif
 				if (!m_has_min_frame) 
 				{
 					m_min_frame = frame;
@@ -531,6 +909,51 @@ namespace owlcat
 			}
 		}
 
+		// Converts callstacks stored as text by older versions (Callstacks table) into frame
+		// sequences, keeping their ids: the event log references them
+		bool convert_legacy_callstacks()
+		{
+			auto cursor = queries::select_legacy_callstacks(m_db);
+			if (cursor.has_error())
+				return false;
+
+			bool converted = false;
+			persistent_storage::transaction t(m_db, persistent_storage::transaction_behaviour::rollback);
+			while (cursor.next())
+			{
+				auto callstack_id = cursor.get_uint64("callstack_id");
+				auto callstack = cursor.get_string("callstack");
+
+				// Every line ends in '\n', except possibly the last one
+				m_scratch_frame_ids.clear();
+				size_t begin = 0;
+				while (begin < callstack.size())
+				{
+					size_t end = callstack.find('\n', begin);
+					end = end == std::string::npos ? callstack.size() : end + 1;
+					m_scratch_frame_ids.push_back((uint32_t)get_or_create_frame_id(callstack.substr(begin, end - begin)));
+					begin = end;
+				}
+
+				const uint64_t hash = hash_frame_ids(m_scratch_frame_ids);
+				add_callstack(callstack_id, hash, m_scratch_frame_ids);
+
+				std::vector<uint8_t> packed;
+				memory_writer writer(packed);
+				for (uint32_t id : m_scratch_frame_ids)
+					writer.write_varint(id);
+				if (!queries::insert_callstack(m_db, callstack_id, hash, packed))
+					return false;
+
+				converted = true;
+			}
+
+			if (!converted)
+				return true;
+
+			return queries::delete_legacy_callstacks(m_db) && t.commit();
+		}
+
 		// Loads object types and callstacks from opened database into memory caches
 		bool load_types_and_callstacks()
 		{
@@ -547,6 +970,39 @@ namespace owlcat
 				m_id_to_type_map.insert(std::make_pair(type_id, type));
 			}
 
+			// Symbolication results saved with the capture (see save_symbolication)
+			std::unordered_map<uint64_t, std::string> symbolicated_frames;
+			std::unordered_set<std::string> symbolicated_modules;
+			if (!load_symbolication(symbolicated_frames, symbolicated_modules))
+				return false;
+
+			auto frame_texts_cursor = queries::select_frames(m_db);
+			if (frame_texts_cursor.has_error())
+				return false;
+
+			while (frame_texts_cursor.next())
+			{
+				auto frame_id = frame_texts_cursor.get_uint64("frame_id");
+				auto text = frame_texts_cursor.get_string("text");
+
+				// Frame ids are dense; the lookup map must not see the gap fillers
+				std::unique_lock lock(m_callstacks_mutex);
+				while (m_frames.size() < frame_id)
+					m_frames.emplace_back();
+				const std::string& stored = m_frames.emplace_back(std::move(text));
+				lock.unlock();
+				m_frame_to_id_map.emplace(std::string_view(stored), frame_id);
+
+				// Frames of the modules whose symbols are the same as when the capture was
+				// saved keep their results, the others are resolved again (PDBs may be
+				// available now)
+				auto symbolicated = symbolicated_frames.find(frame_id);
+				if (symbolicated != symbolicated_frames.end() && symbolicated_modules.count(std::string(symbol_resolver::get_frame_module(stored))) != 0)
+					restore_symbolication(frame_id, stored, std::move(symbolicated->second));
+				else
+					queue_for_symbolication(frame_id, stored);
+			}
+
 			auto callstacks_cursor = queries::select_callstacks(m_db);
 			if (callstacks_cursor.has_error())
 				return false;
@@ -554,15 +1010,22 @@ namespace owlcat
 			while (callstacks_cursor.next())
 			{
 				auto callstack_id = callstacks_cursor.get_uint64("callstack_id");
-				auto callstack = callstacks_cursor.get_string("callstack");
+				auto hash = callstacks_cursor.get_uint64("hash");
+				auto packed = callstacks_cursor.get_blob("frames");
 
-				m_callstacks_to_id_map.insert(std::make_pair(callstack, callstack_id));
-				m_id_to_callstacks_map.insert(std::make_pair(callstack_id, callstack));
+				memory_reader reader(packed);
+				m_scratch_frame_ids.clear();
+				uint64_t frame_id;
+				while (reader.read_varint(frame_id))
+					m_scratch_frame_ids.push_back((uint32_t)frame_id);
 
-				// Re-resolve symbols for a loaded capture (PDBs may be available now)
-				queue_for_symbolication(callstack_id, callstack);
+				add_callstack(callstack_id, hash, m_scratch_frame_ids);
 			}
 
+			if (!convert_legacy_callstacks())
+				return false;
+			m_next_callstack_id = m_callstacks.size();
+
 			auto frames_cursor = queries::select_min_max_frame(m_db);
 			if (!frames_cursor.next())
 				return false;
@@ -573,15 +1036,46 @@ namespace owlcat
 			return true;
 		}
 
+		bool read_next_message(message& msg)
+		{
+			if (!m_spool_reader.is_open())
+				return m_network.read_message(msg);
+
+			if (m_spool_reader.read_message(msg))
+				return true;
+
+			// At the current end of the spool
+			if (m_spool_follow)
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			else
+				m_stop = true;
+			return false;
+		}
+
+		// Decode stage: hands the current batch to the translate stage and takes an empty one
+		void hand_off_batch(std::unique_ptr<ingest_batch>& batch)
+		{
+			m_translate_queue.push(std::move(batch));
+			m_free_batches.pop(batch);
+		}
+
 	public:
+		// Decode stage. Command replies are answered right here, so their latency does not
+		// depend on how far behind the rest of the pipeline is.
 		void process_messages()
 		{
-			m_frame_events.reserve(1024);
+			std::unique_ptr<ingest_batch> batch;
+			m_free_batches.pop(batch);
+
 			while (true)
 			{
 				message msg;
-				if (!m_network.read_message(msg))
+				if (!read_next_message(msg))
 				{
+					// Input ran dry: let the next stages work on what we have
+					if (!batch->empty())
+						hand_off_batch(batch);
+
 					if (m_stop)
 						break;
 
@@ -605,19 +1099,8 @@ namespace owlcat
 						reader.read_varint(server_type_id) &&
 						reader.read_varint(server_callstack_id);
 
-#ifdef WIN32
-					// Frames should always be sequential
-					if (frame < m_prev_frame && m_prev_frame != 0xFFFFFFFFFFFFFFFF)
-						__debugbreak();
-#endif
-
 					if (all_ok)
-					{
-						try_save_events(frame);
-						m_frame_events.push_back({profiler_event::alloc, frame, addr, size, translate_server_type_id(server_type_id), translate_server_callstack_id(server_callstack_id)});
-						++m_frame_allocs;
-						m_size_running_total += size;
-					}
+						batch->events.push_back({ profiler_event::alloc, frame, addr, size, server_type_id, server_callstack_id });
 					else
 						printf("Received alloc, but msg is broken\n");
 				}
@@ -632,12 +1115,7 @@ namespace owlcat
 						reader.read_uint32(size);
 
 					if (all_ok)
-					{
-						try_save_events(frame);
-						m_frame_events.push_back({ profiler_event::free, frame, addr, size, 0, 0 });		
-						++m_frame_frees;
-						m_size_running_total -= size;
-					}
+						batch->events.push_back({ profiler_event::free, frame, addr, size, 0, 0 });
 					else
 						printf("Received free, but msg is broken\n");
 				}
@@ -687,7 +1165,9 @@ namespace owlcat
 						result.push_back(obj);
 					}
 
-					cmd->callback(cmd->addresses, "", result);
+					// The objects may have been allocated by the events just before the reply:
+					// answered once they are in the event log
+					batch->replies.push_back({ batch->events.size(), [cmd, result = std::move(result)]() { cmd->callback(cmd->addresses, "", result); } });
 				}
 				else if (msg.header.type == protocol::message::SRV_PAUSE)
 				{
@@ -733,92 +1213,257 @@ namespace owlcat
 
 					cmd->callback(error == 0);
 				}
-				else if (msg.header.type == protocol::message::SRV_TYPE)
+				else if (msg.header.type == protocol::message::SRV_TYPE ||
+					msg.header.type == protocol::message::SRV_FRAME ||
+					msg.header.type == protocol::message::SRV_CALLSTACK ||
+					msg.header.type == protocol::message::SRV_MEMSTATS ||
+					msg.header.type == protocol::message::SRV_DEGRADED)
 				{
-					uint64_t server_id;
-					std::string name;
-					bool all_ok =
-						reader.read_varint(server_id) &&
-						reader.read_string(name);
-
-					if (all_ok)
-						m_server_type_map[server_id] = get_or_create_type_id(name);
-					else
-						printf("Received type definition, but msg is broken\n");
+					// Handled by the translate stage, in order with the events
+					const size_t position = batch->events.size();
+					batch->messages.push_back({ position, std::move(msg) });
 				}
-				else if (msg.header.type == protocol::message::SRV_FRAME)
+				else
 				{
-					uint64_t frame_id;
-					std::string text;
-					bool all_ok =
-						reader.read_varint(frame_id) &&
-						reader.read_string(text);
-
-					if (all_ok)
-						m_server_frame_map[frame_id] = std::move(text);
-					else
-						printf("Received frame definition, but msg is broken\n");
+					printf("Received bad message\n");
+#ifdef WIN32
+					__debugbreak();
+#endif
 				}
-				else if (msg.header.type == protocol::message::SRV_CALLSTACK)
-				{
-					// A callstack is a sequence of frame ids; reassemble the full text from
-					// the frame table (each line already ends in '\n', as the old wire format did).
-					uint64_t server_id;
-					uint64_t count;
-					bool all_ok =
-						reader.read_varint(server_id) &&
-						reader.read_varint(count);
 
-					std::string callstack;
-					for (uint64_t i = 0; all_ok && i < count; ++i)
+				if (batch->events.size() >= INGEST_BATCH_EVENTS || batch->messages.size() >= INGEST_BATCH_MESSAGES)
+					hand_off_batch(batch);
+			}
+
+			// Pass on the last events; the other stages finish once their input is closed
+			if (!batch->empty())
+				m_translate_queue.push(std::move(batch));
+			m_translate_queue.close();
+		}
+
+	private:
+		// Translate stage: translates server ids of events [begin, end) into database ids
+		void translate_events(ingest_batch& batch, size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				auto& e = batch.events[i];
+				if (e.type != profiler_event::alloc)
+					continue;
+
+				m_translate_position = i;
+				e.type_id = translate_server_type_id(e.type_id);
+				e.callstack_id = translate_server_callstack_id(e.callstack_id);
+			}
+		}
+
+		// Translate stage: handles a definition or other non-event message
+		void handle_message(message& msg)
+		{
+			memory_reader reader(msg.data);
+
+			if (msg.header.type == protocol::message::SRV_TYPE)
+			{
+				uint64_t server_id;
+				std::string name;
+				bool all_ok =
+					reader.read_varint(server_id) &&
+					reader.read_string(name);
+
+				if (all_ok)
+					all_ok = m_server_type_map.set(server_id, get_or_create_type_id(name));
+				if (!all_ok)
+					printf("Received type definition, but msg is broken\n");
+			}
+			else if (msg.header.type == protocol::message::SRV_FRAME)
+			{
+				uint64_t frame_id;
+				std::string text;
+				bool all_ok =
+					reader.read_varint(frame_id) &&
+					reader.read_string(text);
+
+				if (all_ok)
+					all_ok = m_server_frame_map.set(frame_id, get_or_create_frame_id(text));
+				if (!all_ok)
+					printf("Received frame definition, but msg is broken\n");
+			}
+			else if (msg.header.type == protocol::message::SRV_CALLSTACK)
+			{
+				// A callstack is a sequence of server frame ids; translate them into ours
+				uint64_t server_id;
+				uint64_t count;
+				bool all_ok =
+					reader.read_varint(server_id) &&
+					reader.read_varint(count);
+
+				m_scratch_frame_ids.clear();
+				for (uint64_t i = 0; all_ok && i < count; ++i)
+				{
+					uint64_t server_frame_id;
+					if (!reader.read_varint(server_frame_id))
 					{
-						uint64_t frame_id;
-						if (!reader.read_varint(frame_id))
-						{
-							all_ok = false;
-							break;
-						}
-						auto iter = m_server_frame_map.find(frame_id);
-						if (iter != m_server_frame_map.end())
-							callstack.append(iter->second);
+						all_ok = false;
+						break;
 					}
+					uint64_t frame_id = m_server_frame_map.get(server_frame_id);
+					if (frame_id != UNKNOWN_ID)
+						m_scratch_frame_ids.push_back((uint32_t)frame_id);
+				}
 
+				if (all_ok)
+					all_ok = m_server_callstack_map.set(server_id, get_or_create_callstack_id(m_scratch_frame_ids));
+				if (!all_ok)
+					printf("Received callstack definition, but msg is broken\n");
+			}
+			else if (msg.header.type == protocol::message::SRV_MEMSTATS)
+			{
+				uint64_t frame, working_set, committed, gc_heap;
+				bool all_ok =
+					reader.read_uint64(frame) &&
+					reader.read_uint64(working_set) &&
+					reader.read_uint64(committed) &&
+					reader.read_uint64(gc_heap);
+
+				if (all_ok)
+					add_translate_row([this, frame, working_set, committed, gc_heap]()
+					{
+						queries::insert_memstats(m_db, frame, working_set, committed, gc_heap);
+						const uint64_t values[] = { committed, working_set, gc_heap };
+						m_memory_stats.append(frame, values);
+					});
+				else
+					printf("Received memstats, but msg is broken\n");
+			}
+			else if (msg.header.type == protocol::message::SRV_DEGRADED)
+			{
+				uint64_t frame, dropped_count, dropped_size, types_count;
+				uint8_t level;
+				bool all_ok =
+					reader.read_uint64(frame) &&
+					reader.read_uint8(level) &&
+					reader.read_varint(dropped_count) &&
+					reader.read_varint(dropped_size) &&
+					reader.read_varint(types_count);
+
+				if (all_ok)
+					add_translate_row([this, frame, level, dropped_count, dropped_size]() { queries::insert_degraded_frame(m_db, frame, level, dropped_count, dropped_size); });
+
+				for (uint64_t i = 0; all_ok && i < types_count; ++i)
+				{
+					uint64_t server_type_id, count, size;
+					all_ok =
+						reader.read_varint(server_type_id) &&
+						reader.read_varint(count) &&
+						reader.read_varint(size);
 					if (all_ok)
-						m_server_callstack_map[server_id] = get_or_create_callstack_id(callstack);
-					else
-						printf("Received callstack definition, but msg is broken\n");
+					{
+						const uint64_t type_id = translate_server_type_id(server_type_id);
+						add_translate_row([this, frame, type_id, count, size]() { queries::insert_dropped_allocs(m_db, frame, type_id, count, size); });
+					}
 				}
-				else if (msg.header.type == protocol::message::SRV_MEMSTATS)
+
+				if (!all_ok)
+					printf("Received degraded frame, but msg is broken\n");
+			}
+		}
+
+		// Translate stage: handles definitions, and turns server ids in events into database
+		// ids. Definitions always precede the events that use them, so messages are handled
+		// exactly between the events they arrived between.
+		void translate_loop()
+		{
+			std::unique_ptr<ingest_batch> batch;
+			while (m_translate_queue.pop(batch))
+			{
+				m_translate_rows = &batch->rows;
+
+				size_t next_event = 0;
+				for (auto& m : batch->messages)
 				{
-					uint64_t frame, working_set, committed, gc_heap;
-					bool all_ok =
-						reader.read_uint64(frame) &&
-						reader.read_uint64(working_set) &&
-						reader.read_uint64(committed) &&
-						reader.read_uint64(gc_heap);
+					translate_events(*batch, next_event, m.position);
+					next_event = m.position;
 
-					if (all_ok)
-						queries::insert_memstats(m_db, frame, working_set, committed, gc_heap);
-					else
-						printf("Received memstats, but msg is broken\n");
+					m_translate_position = m.position;
+					handle_message(m.msg);
 				}
-				else
+				translate_events(*batch, next_event, batch->events.size());
+
+				m_translate_rows = nullptr;
+				batch->messages.clear();
+				m_log_queue.push(std::move(batch));
+			}
+			m_log_queue.close();
+		}
+
+		// Log stage: runs a references reply once everything that arrived before it is
+		// published and written, so the objects it lists can be looked up by the UI
+		void answer_reply(ingest_reply& reply)
+		{
+			save_frame_events();
+			m_db_writer.push(m_log_rows);
+			m_db_writer.flush();
+			reply.run();
+		}
+
+		// Log stage: appends events to the event log and publishes frames to the database,
+		// keeping the rows of the batch in order with the frame stats produced here (a frame
+		// must never be published before the definitions its events use).
+		void log_loop()
+		{
+			std::unique_ptr<ingest_batch> batch;
+			while (m_log_queue.pop(batch))
+			{
+				auto& rows = batch->rows;
+				auto& replies = batch->replies;
+				size_t next_row = 0;
+				size_t next_reply = 0;
+				for (size_t i = 0; i < batch->events.size(); ++i)
 				{
-					printf("Received bad message\n");
-#ifdef WIN32
-					__debugbreak();
-#endif
+					while (next_row < rows.size() && rows[next_row].position <= i)
+						m_log_rows.push_back(std::move(rows[next_row++].write));
+					while (next_reply < replies.size() && replies[next_reply].position <= i)
+						answer_reply(replies[next_reply++]);
+
+					const auto& e = batch->events[i];
+					try_save_events(e.frame);
+					m_event_log.append(e.frame, e.addr, e.type_id, e.callstack_id, e.size, e.type == profiler_event::alloc);
+					++m_unpublished_events;
+
+					if (e.type == profiler_event::alloc)
+					{
+						++m_frame_allocs;
+						m_size_running_total += e.size;
+					}
+					else
+					{
+						++m_frame_frees;
+						m_size_running_total -= e.size;
+					}
+
+					// Don't keep a long frame invisible for too long
+					if (m_unpublished_events > INGEST_PUBLISH_EVENTS)
+						save_frame_events();
 				}
+				while (next_row < rows.size())
+					m_log_rows.push_back(std::move(rows[next_row++].write));
+				while (next_reply < replies.size())
+					answer_reply(replies[next_reply++]);
 
-				// Avoid storing too many events in queue
-				if (m_frame_events.size() > 100000)
-					save_frame_events();
+				m_db_writer.push(m_log_rows);
+				batch->clear();
+				m_free_batches.push(std::move(batch));
+
+				if (std::chrono::steady_clock::now() - m_last_checkpoint_time >= JOURNAL_CHECKPOINT_INTERVAL)
+					checkpoint_journal();
 			}
 
-			// Submit last events before quitting. save_frame_events is called directly:
-			// all buffered events belong to the current frame, so try_save_events would
-			// consider them already saved and drop them.
+			// Publish the last events before quitting. save_frame_events is called directly:
+			// the current frame's events are not published yet, try_save_events would only
+			// do it when the next frame begins.
 			save_frame_events();
+			m_db_writer.push(m_log_rows);
+			checkpoint_journal();
 		}
 
 	public:
@@ -826,44 +1471,115 @@ namespace owlcat
 		{
 			m_data_interface.reset(new mono_profiler_client_data(this));
 
+			// DbgHelp lookups are serialized by the resolver, symbol map lookups run in parallel
 			m_symbol_resolver = std::make_unique<symbol_resolver>();
-			m_symbol_thread = std::thread(&mono_profiler_client::details::symbolication_loop, this);
+			const size_t symbol_thread_count = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, SYMBOL_THREADS_MAX);
+			for (size_t i = 0; i < symbol_thread_count; ++i)
+				m_symbol_threads.emplace_back(&mono_profiler_client::details::symbolication_loop, this);
 		}
 
 		~details()
 		{
 			stop();
 
-			// Stop the symbolication thread
+			// Stop the symbolication threads
 			{
 				std::scoped_lock lock(m_symbol_mutex);
 				m_symbol_stop = true;
-				m_symbol_cv.notify_one();
+				m_symbol_cv.notify_all();
+			}
+			for (auto& thread : m_symbol_threads)
+				thread.join();
+
+			m_db.close();
+			cleanup_extracted_files();
+		}
+
+		// Sets the symbol search path (';'-separated directories) and re-resolves the known
+		// native frames whose symbols it changes (see apply_symbol_path). Thread-safe; the
+		// change is applied on a symbol thread.
+		void set_symbol_paths(const std::string& path)
+		{
+			std::scoped_lock lock(m_symbol_mutex);
+			m_pending_symbol_path = path;
+			m_symbol_path_changed = true;
+			++m_symbol_generation;
+			m_symbol_cv.notify_all();
+		}
+
+		// Drops the symbolication state when a new session/capture begins
+		void reset_symbolication()
+		{
+			{
+				std::scoped_lock lock(m_symbol_mutex);
+				m_symbol_queue.clear();
+				m_symbol_known.clear();
+				++m_symbol_generation;
+			}
+			std::scoped_lock lock(m_display_mutex);
+			m_id_to_display_frame.clear();
+			m_unresolved_frames.clear();
+			m_symbol_modules.clear();
+		}
+
+		// Stores the symbolication results so far in a capture database, replacing the ones
+		// it had, so that opening the capture doesn't resolve its frames again
+		bool save_symbolication(persistent_storage::persistent_storage& db)
+		{
+			std::vector<std::pair<uint64_t, std::string>> frames;
+			std::unordered_map<std::string, std::string> modules;
+			{
+				std::scoped_lock lock(m_display_mutex);
+				frames.reserve(m_id_to_display_frame.size() + m_unresolved_frames.size());
+				frames.assign(m_id_to_display_frame.begin(), m_id_to_display_frame.end());
+				for (uint64_t frame_id : m_unresolved_frames)
+					frames.push_back({ frame_id, std::string() });
+				modules = m_symbol_modules;
 			}
-			if (m_symbol_thread.joinable())
-				m_symbol_thread.join();
 
-			m_db.close();
-			cleanup_extracted_files();
+			persistent_storage::transaction t(db, persistent_storage::transaction_behaviour::rollback);
+			if (!queries::delete_symbolication(db))
+				return false;
+			for (auto& module : modules)
+			{
+				if (!queries::insert_symbol_module(db, module.first, module.second))
+					return false;
+			}
+			for (auto& frame : frames)
+			{
+				if (!queries::insert_symbolicated_frame(db, frame.first, frame.second))
+					return false;
+			}
+			return t.commit();
 		}
 
-		// Sets the symbol search path (';'-separated directories) and re-resolves all known
-		// callstacks against it. Thread-safe; the change is applied on the symbol thread.
-		void set_symbol_paths(const std::string& path)
+		// Reads the symbolication results saved with an opened capture: those of the modules
+		// whose symbols are the same under the current search path are kept
+		bool load_symbolication(std::unordered_map<uint64_t, std::string>& frames, std::unordered_set<std::string>& modules)
 		{
-			std::scoped_lock lock(m_symbol_mutex);
-			m_pending_symbol_path = path;
-			m_symbol_path_changed = true;
-			m_symbol_cv.notify_one();
-		}
+			auto modules_cursor = queries::select_symbol_modules(m_db);
+			if (modules_cursor.has_error())
+				return false;
+			while (modules_cursor.next())
+			{
+				auto module = modules_cursor.get_string("module");
+				auto identity = modules_cursor.get_string("identity");
+				if (m_symbol_resolver->get_module_identity(module) != identity)
+					continue;
 
-		// Drops the symbolication thread's per-session state when a new session/capture begins
-		void reset_symbolication()
-		{
-			std::scoped_lock lock(m_symbol_mutex);
-			m_symbol_queue.clear();
-			m_symbol_reset = true;
-			m_symbol_cv.notify_one();
+				modules.insert(module);
+				std::scoped_lock lock(m_display_mutex);
+				m_symbol_modules.emplace(std::move(module), std::move(identity));
+			}
+			if (modules.empty())
+				return true;
+
+			auto frames_cursor = queries::select_symbolicated_frames(m_db);
+			if (frames_cursor.has_error())
+				return false;
+			while (frames_cursor.next())
+				frames.emplace(frames_cursor.get_uint64("frame_id"), frames_cursor.get_string("text"));
+			return true;
 		}
 
 #if defined(WIN32)
@@ -893,10 +1609,16 @@ namespace owlcat
 			sprintf(port_str, "%d", port);
 			SetEnvironmentVariableA("OWLCAT_PROFILER_PORT", port_str);
 
+			// The app runs on this machine, so offer the shared-memory transport. The DLL
+			// answers error_ok_shm in the handshake if it has created the channel.
+			std::string shm_name = "OwlcatMonoProfiler_" + std::to_string(GetCurrentProcessId()) + "_" + std::to_string(port);
+			SetEnvironmentVariableA("OWLCAT_PROFILER_SHM", shm_name.c_str());
+
 			bool created = DetourCreateProcessWithDlls(executable.c_str(), (char*)commandline.c_str(), nullptr, nullptr, true, CREATE_DEFAULT_ERROR_MODE | CREATE_SUSPENDED, nullptr, cwd.c_str(), &si, &pi, 1, &dllLoc, nullptr);
 
-			// Don't leave it lingering in our own environment
+			// Don't leave them lingering in our own environment
 			SetEnvironmentVariableA("OWLCAT_PROFILER_PORT", nullptr);
+			SetEnvironmentVariableA("OWLCAT_PROFILER_SHM", nullptr);
 
 			if (!created)
 			{
@@ -939,11 +1661,16 @@ namespace owlcat
 			if (strncmp(error_code, owlcat::protocol::error_detour_late, sizeof(error_code)) == 0)
 				return mono_profiler_client::DETOUR_FAILED_LATE;
 
+			if (strncmp(error_code, owlcat::protocol::error_ok_shm, sizeof(error_code)) == 0)
+				m_shm_name = shm_name;
+
 			// We only support launching applications on the same computer, so use loopback IP
-			return start("127.0.0.1", port, db_file_name.c_str(), capture_flags, native_config) ? mono_profiler_client::OK : mono_profiler_client::CONNECT_FAILED;
+			bool started = start("127.0.0.1", port, db_file_name.c_str(), capture_flags, native_config);
+			m_shm_name.clear();
+			return started ? mono_profiler_client::OK : mono_profiler_client::CONNECT_FAILED;
 		}
 #else
-		mono_profiler_client::LaunchResult launch_executable(const std::string& executable, const std::string& commandline, int port, const std::string& db_file_name, const std::string& dll_location)
+		mono_profiler_client::LaunchResult launch_executable(const std::string& executable, const std::string& commandline, int port, const std::string& db_file_name, const std::string& dll_location, uint32_t, const std::string&)
 		{
 			std::filesystem::path exec_path(executable);
 			std::string cwd = exec_path.parent_path().string();
@@ -957,7 +1684,26 @@ namespace owlcat
 			m_network_settings.addr = addr;
 			m_network_settings.port = server_port;
 
-			if (!m_network.connect(addr, server_port))
+			// When the server offered a shared-memory channel during the launch handshake, it
+			// waits for us there instead of on the port
+			bool connected = false;
+			if (!m_shm_name.empty())
+			{
+				connected = m_network.connect_shared_memory(m_shm_name);
+
+				// The server only listens on the port once it has given up on the channel
+				// (SHM_ATTACH_TIMEOUT_MS), so keep trying a bit longer than that
+				const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(SHM_ATTACH_TIMEOUT_MS) + std::chrono::seconds(5);
+				while (!connected && std::chrono::steady_clock::now() < deadline)
+				{
+					connected = m_network.connect(addr, server_port);
+					if (!connected)
+						std::this_thread::sleep_for(std::chrono::milliseconds(250));
+				}
+			}
+			else
+				connected = m_network.connect(addr, server_port);
+			if (!connected)
 				return false;
 
 			// Tell the server what to capture. This is the first thing sent; the in-game
@@ -970,23 +1716,38 @@ namespace owlcat
 				m_network.write_message(protocol::command::CMD_CONFIGURE, (uint32_t)cmd.size(), cmd.data());
 			}
 
+			m_spool_reader.close();
+			return begin_capture(db_file_name);
+		}
+
+		bool import_spool(const std::string& spool_prefix, const std::string& db_file_name, bool follow)
+		{
+			if (!m_spool_reader.open(spool_prefix))
+				return false;
+			m_spool_follow = follow;
+
+			return begin_capture(db_file_name);
+		}
+
+		// Creates a new capture (database and event log) and starts processing messages
+		bool begin_capture(const std::string& db_file_name)
+		{
 			m_db.close();
 
 			// This is a new session with a new database: reset id maps and frame-tracking
 			// state possibly left over from a previous session or a previously opened database
 			m_type_to_id_map.clear();
 			m_id_to_type_map.clear();
-			m_callstacks_to_id_map.clear();
-			m_id_to_callstacks_map.clear();
-			m_server_type_map.clear();
-			m_server_callstack_map.clear();
-			m_server_frame_map.clear();
+			clear_callstacks();
+			m_server_type_map.reset();
+			m_server_callstack_map.reset();
+			m_server_frame_map.reset();
 			m_next_type_id = 0;
 			m_next_callstack_id = 0;
 			reset_symbolication();
 
-			m_frame_events.clear();
 			m_prev_frame = 0xFFFFFFFFFFFFFFFF;
+			m_unpublished_events = 0;
 			m_frame_allocs = 0;
 			m_frame_frees = 0;
 			m_size_running_total = 0;
@@ -997,14 +1758,28 @@ namespace owlcat
 			m_db_inserted_events = 0;
 
 			m_event_log.close();
+			discard_journal();
 			cleanup_extracted_files();
+			m_container_path.clear();
 
 			m_db_file_name = db_file_name;
 
+			// Checkpoints copy the database file as it changes, so it must be a file: a capture
+			// without one (a launched executable) gets one in a temporary directory
+			if (m_db_file_name.empty())
+			{
+				std::filesystem::path directory;
+				if (!create_temp_directory(directory))
+					return false;
+				m_db_file_name = (directory / capture_container::entry_database).string();
+				m_extracted_files = { m_db_file_name, m_db_file_name + ".frames", m_db_file_name + ".memory" };
+			}
+
 			// Remove existing database (if we use a non-temporary one)
 			if (std::filesystem::exists(m_db_file_name))
 				std::filesystem::remove(m_db_file_name);
-			if (!m_db.open(m_db_file_name, true))
+			// The writes to the file are tracked: checkpoints only copy what changed
+			if (!m_db.open_tracked(m_db_file_name, true))
 				return false;
 
 			m_db.pragma("PRAGMA locking_mode = EXCLUSIVE");
@@ -1031,15 +1806,42 @@ namespace owlcat
 			if (!queries::register_queries(m_db))
 				return false;
 
-			// The events themselves are stored in the event log file next to the
-			// database (see event_log.h)
-			m_event_log_file_name = m_db_file_name + ".events";
-			if (std::filesystem::exists(m_event_log_file_name))
-				std::filesystem::remove(m_event_log_file_name);
-			if (!m_event_log.create(m_event_log_file_name))
+			// The capture is written to a journal next to the database, which is what saving
+			// it keeps. The events themselves go straight into it, in the event log (see
+			// event_log.h). Without a database name, the journal is in the temporary directory:
+			// saving it to another volume packs it again (see move_journal).
+			if (!m_journal.create(m_db_file_name + ".journal", capture_container::entry_events))
+				return false;
+			m_unsaved_journal_path = m_journal.path();
+			m_journal_failed = false;
+			if (!m_event_log.create(m_journal.stream_file()))
+				return false;
+			set_event_log_file(m_journal.get_stream_range(m_event_log.position()));
+			reset_lifetime_index();
+
+			m_frame_stats_file = file_range(m_db_file_name + ".frames");
+			m_memory_stats_file = file_range(m_db_file_name + ".memory");
+			if (!m_frame_stats.create(m_frame_stats_file.path) || !m_memory_stats.create(m_memory_stats_file.path))
 				return false;
+			m_frame_stats_copied = 0;
+			m_memory_stats_copied = 0;
 			m_current_frame_begin = m_event_log.position();
+			m_last_checkpoint_time = std::chrono::steady_clock::now();
 
+			// The pipeline's queues are left closed by the previous session
+			m_translate_queue.reset();
+			m_log_queue.reset();
+			m_free_batches.reset();
+			for (size_t i = 0; i < INGEST_BATCH_COUNT; ++i)
+			{
+				auto batch = std::make_unique<ingest_batch>();
+				batch->events.reserve(INGEST_BATCH_EVENTS);
+				m_free_batches.push(std::move(batch));
+			}
+
+			m_db_writer.start(m_db);
+			m_log_thread = std::thread(&mono_profiler_client::details::log_loop, this);
+			m_translate_thread = std::thread(&mono_profiler_client::details::translate_loop, this);
 			m_thread = std::thread(&mono_profiler_client::details::process_messages, this);
 
 			return true;
@@ -1048,21 +1850,35 @@ namespace owlcat
 		void stop()
 		{
 			m_stop = true;
+			// The decode stage stops first; every following stage stops once it has
+			// processed everything the previous one passed on
 			if (m_thread.joinable())
 				m_thread.join();
+			if (m_translate_thread.joinable())
+				m_translate_thread.join();
+			if (m_log_thread.joinable())
+				m_log_thread.join();
+			m_db_writer.stop();
 			m_network.stop();
+			m_spool_reader.close();
 
-			// No more events will be written. The log file stays on disk: readers
-			// open it by name for analysis queries.
+			// No more events will be written. The journal stays open until the capture is
+			// saved: readers open it by name for analysis queries. The series stay in memory.
 			m_event_log.close();
+			m_frame_stats.close();
+			m_memory_stats.close();
 		}
 
 		void close_db()
 		{
 			assert(!m_thread.joinable() && (!is_connected() || is_connecting()));
 			m_event_log.close();
+			discard_journal();
 			m_db.close();
+			m_frame_stats.clear();
+			m_memory_stats.clear();
 			cleanup_extracted_files();
+			m_container_path.clear();
 		}
 
 		bool save_db(const std::string& new_db_file_name, bool move)
@@ -1071,70 +1887,196 @@ namespace owlcat
 			if (m_thread.joinable())
 				return false;
 
+			// An opened capture is never modified: saving it over its own container has
+			// nothing to do (and packing would truncate the entries it reads from)
+			std::error_code ec;
+			if (!m_container_path.empty() && std::filesystem::exists(new_db_file_name, ec) &&
+				std::filesystem::equivalent(m_container_path, new_db_file_name, ec))
+				return true;
+
+			// A capture is in its journal already: saving it copies the last changes of the
+			// database and the series, and moves the journal where it is saved to
+			if (m_journal.is_open() && !m_journal_failed && save_symbolication(m_db) && copy_to_journal() && m_journal.finalize())
+				return move_journal(new_db_file_name);
+
 			// The working files stay in place and open: saving packs a snapshot of them
 			// into a single container file. The database is snapshotted through the
 			// backup API first, because the live connection can hold dirty pages that
-			// are not in the file yet.
+			// are not in the file yet. The other entries are copied from wherever they
+			// are, including the container of an opened capture.
 			const std::string db_snapshot = new_db_file_name + ".dbtmp";
-			if (!m_db.save(db_snapshot))
+			if (!m_db.save(db_snapshot) || !save_snapshot_symbolication(db_snapshot))
+			{
+				std::filesystem::remove(db_snapshot, ec);
 				return false;
+			}
 
-			std::map<std::string, std::string> files;
-			files[capture_container::entry_database] = db_snapshot;
-			files[capture_container::entry_events] = m_event_log_file_name;
-			bool ok = capture_container::pack(new_db_file_name, files);
+			std::map<std::string, file_range> files;
+			files[capture_container::entry_database] = file_range(db_snapshot);
+			files[capture_container::entry_events] = get_event_log_file();
+			if (!m_frame_stats_file.path.empty() && !m_memory_stats_file.path.empty())
+			{
+				files[capture_container::entry_frame_stats] = m_frame_stats_file;
+				files[capture_container::entry_memory_stats] = m_memory_stats_file;
+			}
+			bool ok = capture_container::pack(new_db_file_name, files, get_compressed_entries());
 
-			std::error_code ec;
 			std::filesystem::remove(db_snapshot, ec);
 
 			return ok;
 		}
 
-		bool open_data(const std::string& file)
+		// Stores the symbolication results in a database snapshot: the database of an opened
+		// capture is read-only
+		bool save_snapshot_symbolication(const std::string& db_snapshot)
 		{
-			if (m_thread.joinable())
-				return false;
+			persistent_storage::persistent_storage snapshot;
+			return snapshot.open(db_snapshot, false) && queries::register_queries(snapshot) && save_symbolication(snapshot);
+		}
 
-			m_event_log.close();
-			if (m_db.is_open())
-				m_db.close();
-			cleanup_extracted_files();
+		// The entries saved block-compressed. The database stays uncompressed, to be opened
+		// in place (see open_data).
+		static std::set<std::string> get_compressed_entries()
+		{
+			return { capture_container::entry_events, capture_container::entry_frame_stats, capture_container::entry_memory_stats };
+		}
 
-			// Don't mix ids from a previously opened database or session
-			m_type_to_id_map.clear();
-			m_id_to_type_map.clear();
-			m_callstacks_to_id_map.clear();
-			m_id_to_callstacks_map.clear();
-			reset_symbolication();
+		/*
+			Moves the finalized journal to where the capture is saved, which is then read from
+			there. Within a volume, this is a rename: the capture is saved as it was written,
+			uncompressed, whatever its size.
+
+			Across volumes - e.g. a capture made without a database name, whose journal is in
+			the temporary directory, saved to another drive - every byte has to be written
+			again anyway: the journal is packed into a container instead of copied, leaving out
+			the stale copies of database pages and block-compressing the events and the series.
+		*/
+		bool move_journal(const std::string& new_db_file_name)
+		{
+			std::error_code ec;
+			const std::string journal_path = m_unsaved_journal_path;
+			file_range events = get_event_log_file();
+			std::filesystem::rename(journal_path, new_db_file_name, ec);
+			if (!ec)
+				events.path = new_db_file_name;
+			else
+			{
+				std::map<std::string, file_range> entries;
+				if (!capture_container::read_directory(journal_path, entries) ||
+					!capture_container::pack(new_db_file_name, entries, get_compressed_entries()) ||
+					!capture_container::read_directory(new_db_file_name, entries))
+					return false;
+				events = entries[capture_container::entry_events];
+				std::filesystem::remove(journal_path, ec);
+			}
+
+			m_unsaved_journal_path.clear();
+			m_container_path = new_db_file_name;
+			set_event_log_file(std::move(events));
+			return true;
+		}
+
+		// Opens the database entry of a container in place, read-only. Fails for a database
+		// that has migrations to run, which has to be extracted (see open_data).
+		bool open_database_in_place(const file_range& db_entry)
+		{
+			bool ok;
+			if (db_entry.pieces.empty())
+				ok = m_db.open_range(db_entry.path, db_entry.offset, db_entry.size);
+			else
+			{
+				// A journal's database is in pieces (see capture_container.h)
+				std::vector<persistent_storage::byte_range> pieces;
+				for (auto& piece : db_entry.pieces)
+					pieces.push_back({ piece.offset, piece.size });
+				ok = m_db.open_range(db_entry.path, pieces);
+			}
+			return ok && !database_needs_upgrade(m_db) && queries::register_queries(m_db) && load_types_and_callstacks();
+		}
 
-			// Unpack the container into a temporary directory: SQLite needs a plain
-			// file, and the event log is addressed by byte offsets
+		// Creates a directory of its own in the temporary directory, for the files of a
+		// capture, removed with them (see cleanup_extracted_files)
+		bool create_temp_directory(std::filesystem::path& directory)
+		{
 			std::error_code ec;
 			auto temp_root = std::filesystem::temp_directory_path(ec) / "OwlcatMonoProfiler";
 			char unique_name[64];
 			sprintf(unique_name, "capture_%llu", (unsigned long long)std::chrono::steady_clock::now().time_since_epoch().count());
-			auto extract_dir = temp_root / unique_name;
-			std::filesystem::create_directories(extract_dir, ec);
+			directory = temp_root / unique_name;
+			std::filesystem::create_directories(directory, ec);
 			if (ec)
 				return false;
+			m_extract_dir = directory.string();
+			return true;
+		}
 
-			std::map<std::string, std::string> extracted;
-			if (!capture_container::unpack(file, extract_dir.string(), extracted))
+		// Extracts the database entry of a container into a temporary file and opens it,
+		// for databases that have to be written to when opened
+		bool open_extracted_database(const file_range& db_entry)
+		{
+			std::filesystem::path extract_dir;
+			if (!create_temp_directory(extract_dir))
 				return false;
 
-			auto db_entry = extracted.find(capture_container::entry_database);
-			auto events_entry = extracted.find(capture_container::entry_events);
-			if (db_entry == extracted.end() || events_entry == extracted.end())
+			m_db_file_name = (extract_dir / capture_container::entry_database).string();
+			if (!capture_container::extract(db_entry, m_db_file_name))
 				return false;
+			m_extracted_files.push_back(m_db_file_name);
 
-			m_extract_dir = extract_dir.string();
-			for (auto& entry : extracted)
-				m_extracted_files.push_back(entry.second);
+			return m_db.open(m_db_file_name, false) && upgrade_database(m_db) && queries::register_queries(m_db) && load_types_and_callstacks();
+		}
 
-			m_db_file_name = db_entry->second;
-			m_event_log_file_name = events_entry->second;
+		void reset_loaded_ids()
+		{
+			// Don't mix ids from a previously opened database or session
+			m_type_to_id_map.clear();
+			m_id_to_type_map.clear();
+			clear_callstacks();
+			reset_symbolication();
+		}
 
-			return m_db.open(m_db_file_name, false) && upgrade_database(m_db) && queries::register_queries(m_db) && load_types_and_callstacks();
+		bool open_data(const std::string& file)
+		{
+			if (m_thread.joinable())
+				return false;
+
+			m_event_log.close();
+			discard_journal();
+			if (m_db.is_open())
+				m_db.close();
+			cleanup_extracted_files();
+			m_container_path.clear();
+			reset_loaded_ids();
+
+			// The entries are read where they are in the container: the event log and the
+			// series through file_view, the database through a read-only SQLite VFS that
+			// shifts its reads by the entry's offset (see persistent_storage.h)
+			std::map<std::string, file_range> entries;
+			if (!capture_container::read_directory(file, entries))
+				return false;
+
+			auto db_entry = entries.find(capture_container::entry_database);
+			auto events_entry = entries.find(capture_container::entry_events);
+			if (db_entry == entries.end() || events_entry == entries.end())
+				return false;
+
+			m_container_path = file;
+			set_event_log_file(events_entry->second);
+			reset_lifetime_index();
+
+			// A database written by an older version has to be migrated, which can't be
+			// done in place: it alone is extracted. Its migrations are read to tell, rather
+			// than tried on the read-only database. The database is a small part of the
+			// capture next to the event log.
+			if (!open_database_in_place(db_entry->second))
+			{
+				m_db.close();
+				reset_loaded_ids();
+				if (!open_extracted_database(db_entry->second))
+					return false;
+			}
+
+			return load_frame_series(entries);
 		}
 
 		bool is_connected() const
@@ -1167,7 +2109,7 @@ namespace owlcat
 			writer.write_uint64(addresses.size());
 			for(auto addr : addresses)
 				writer.write_uint64(addr);
-			m_network.write_message(protocol::command::CMD_REFERENCES, (uint32_t)cmd.size(), cmd.data());
+			m_network.write_priority_message(protocol::command::CMD_REFERENCES, (uint32_t)cmd.size(), cmd.data());
 		}
 
 		void pause_app(pause_app_callback callback)
@@ -1177,7 +2119,7 @@ namespace owlcat
 			std::vector<uint8_t> cmd;
 			memory_writer writer(cmd);
 			writer.write_uint64(request_id);
-			m_network.write_message(protocol::command::CMD_PAUSE, (uint32_t)cmd.size(), cmd.data());
+			m_network.write_priority_message(protocol::command::CMD_PAUSE, (uint32_t)cmd.size(), cmd.data());
 		}
 
 		void resume_app(resume_app_callback callback)
@@ -1187,7 +2129,7 @@ namespace owlcat
 			std::vector<uint8_t> cmd;
 			memory_writer writer(cmd);
 			writer.write_uint64(request_id);
-			m_network.write_message(protocol::command::CMD_RESUME, (uint32_t)cmd.size(), cmd.data());
+			m_network.write_priority_message(protocol::command::CMD_RESUME, (uint32_t)cmd.size(), cmd.data());
 		}
 
 		const char* get_type_name(uint64_t type_id) const
@@ -1199,21 +2141,24 @@ namespace owlcat
 			return "";
 		}
 
+		// Puts the callstack's text together from its frames. Symbolicated frames are used
+		// where the background resolver has produced them.
 		std::string get_callstack(uint64_t callstack_id)
 		{
-			// Prefer the symbolicated text if the background resolver has produced it
+			std::shared_lock callstacks_lock(m_callstacks_mutex);
+			if (callstack_id >= m_callstacks.size())
+				return std::string();
+
+			const auto entry = m_callstacks[callstack_id];
+			std::string result;
+			std::scoped_lock lock(m_display_mutex);
+			for (uint32_t i = 0; i < entry.count; ++i)
 			{
-				std::scoped_lock lock(m_display_mutex);
-				auto disp = m_id_to_display_callstack.find(callstack_id);
-				if (disp != m_id_to_display_callstack.end())
-					return disp->second;
+				uint32_t frame_id = m_callstack_frame_ids[entry.offset + i];
+				auto disp = m_id_to_display_frame.find(frame_id);
+				result.append(disp != m_id_to_display_frame.end() ? disp->second : m_frames[frame_id]);
 			}
-
-			auto iter = m_id_to_callstacks_map.find(callstack_id);
-			if (iter != m_id_to_callstacks_map.end())
-				return iter->second;
-
-			return std::string();
+			return result;
 		}
 
 		size_t get_types_count() const
@@ -1223,30 +2168,55 @@ namespace owlcat
 
 		size_t get_callstacks_count() const
 		{
-			return m_id_to_callstacks_map.size();
+			return m_callstacks_count;
 		}
 
 		bool get_allocation_type_and_stack(uint64_t address, uint64_t& type_id, uint64_t& stack_id)
 		{
+			std::vector<uint64_t> type_ids, stack_ids;
+			get_allocations_type_and_stack({ address }, type_ids, stack_ids);
+			if (type_ids[0] == address_index::NONE)
+				return false;
+
+			type_id = type_ids[0];
+			stack_id = stack_ids[0];
+			return true;
+		}
+
+		void get_allocations_type_and_stack(const std::vector<uint64_t>& addresses, std::vector<uint64_t>& type_ids, std::vector<uint64_t>& stack_ids)
+		{
+			type_ids.assign(addresses.size(), address_index::NONE);
+			stack_ids.assign(addresses.size(), address_index::NONE);
+
 			// Only the byte range published to the database is guaranteed to be readable
+			m_db_writer.flush();
 			auto range_cursor = queries::select_frame_event_range(m_db, 0, (uint64_t)INT64_MAX);
 			if (range_cursor.has_error() || !range_cursor.next())
-				return false;
+				return;
 
 			uint64_t end_offset = range_cursor.get_uint64("end_offset");
 
-			auto reader = event_log_reader::open(m_event_log_file_name);
+			auto reader = event_log_reader::open(get_event_log_file());
 			if (reader == nullptr)
-				return false;
-
-			event_view found;
-			if (!reader->find_last_allocation(address, end_offset, found))
-				return false;
+				return;
 
-			type_id = found.type_id;
-			stack_id = found.callstack_id;
+			// The lifetime index knows the latest allocation of every address
+			{
+				std::scoped_lock lock(m_lifetime_index_mutex);
+				if (update_lifetime_index(*reader, end_offset) && m_lifetime_index.find_allocations(*reader, end_offset, addresses, type_ids, stack_ids))
+					return;
+			}
 
-			return true;
+			// If it can't answer, scan the log backward for each address
+			for (size_t i = 0; i < addresses.size(); ++i)
+			{
+				event_view found;
+				if (reader->find_last_allocation(addresses[i], end_offset, found))
+				{
+					type_ids[i] = found.type_id;
+					stack_ids[i] = found.callstack_id;
+				}
+			}
 		}
 
 public:
@@ -1258,76 +2228,31 @@ public:
 
 		void get_stats(std::vector<uint64_t>& alloc_counts, std::vector<uint64_t>& free_counts, uint64_t& max_allocs, uint64_t& max_frees, std::vector<uint64_t>& size_points, int64_t& max_size, uint64_t from_frame, uint64_t to_frame)
 		{
-			// If the starting frame falls into an area where no events were reported,
-			// we need to query last known size of allocated memory before the starting frame
-			uint64_t last_known_frame_size = 0;
-			auto result_last_known = queries::select_last_good_size(m_db, from_frame);
-			if (result_last_known.next())
-			{
-				last_known_frame_size = result_last_known.get_uint64("size");
-			}
-
-			max_allocs = 0;
-			max_frees = 0;
-			max_size = 0;
-			auto result = queries::select_stats(m_db, from_frame, to_frame);
-			alloc_counts.clear();
-			free_counts.clear();
-			size_points.clear();
-			
-			uint64_t prev_frame = from_frame;
-			bool first_frame = true;
+			// The graphs follow the newest frames, whose rows may still be queued in the writer
+			m_db_writer.flush();
 
-			while (result.next())
-			{
-				uint64_t frame = result.get_uint64("frame");
-				uint64_t allocs = result.get_uint64("allocs");
-				uint64_t frees = result.get_uint64("frees");
-				int64_t size = result.get_int64("size");
-
-				if (allocs > max_allocs) max_allocs = allocs;
-				if (frees > max_frees) max_frees = frees;
-				if (size > max_size) max_size = size;
-				
-				// Fill gaps if the first reported frame greater than the first requested frame
-				if (first_frame && frame > prev_frame)
-				{					
-					for (auto f = from_frame; f < frame; ++f)
-					{
-						alloc_counts.push_back(0);
-						free_counts.push_back(0);
-						size_points.push_back(last_known_frame_size);
-					}
-				}
-				// Fill gaps if no events were reported in some frame
-				else if (frame > prev_frame + 1)
-				{
-					for (auto f = prev_frame + 1; f < frame; ++f)
-					{
-						alloc_counts.push_back(0);
-						free_counts.push_back(0);
-						size_points.push_back(size_points.back());
-					}
-				}
+			// Stop at the same frame in all columns, even if a frame is appended meanwhile
+			uint64_t first_frame = 0, last_frame = 0;
+			if (!m_frame_stats.get_frame_range(first_frame, last_frame))
+				last_frame = 0;
+			to_frame = std::min(to_frame, last_frame);
 
-				first_frame = false;
-				prev_frame = frame;
+			m_frame_stats.get_values(stats_allocs, from_frame, to_frame, alloc_counts);
+			m_frame_stats.get_values(stats_frees, from_frame, to_frame, free_counts);
+			m_frame_stats.get_values(stats_size, from_frame, to_frame, size_points);
 
-				alloc_counts.push_back(allocs);
-				free_counts.push_back(frees);
-				size_points.push_back(size);
-			}
+			max_allocs = alloc_counts.empty() ? 0 : *std::max_element(alloc_counts.begin(), alloc_counts.end());
+			max_frees = free_counts.empty() ? 0 : *std::max_element(free_counts.begin(), free_counts.end());
+			max_size = 0;
+			for (uint64_t size : size_points)
+				max_size = std::max(max_size, (int64_t)size);
+		}
 
-			// Fill gaps to the last requested frame
-			if (prev_frame < to_frame && !size_points.empty())
-			{
-				for (auto f = prev_frame + 1; f <= to_frame && f <= m_max_frame; ++f)
-				{
-					alloc_counts.push_back(0);
-					free_counts.push_back(0);
-					size_points.push_back(size_points.back());
-				}
-			}
+		void get_frame_totals(uint64_t& allocs, uint64_t& frees, uint64_t from_frame, uint64_t to_frame)
+		{
+			m_db_writer.flush();
+			allocs = m_frame_stats.get_total(stats_allocs, from_frame, to_frame);
+			frees = m_frame_stats.get_total(stats_frees, from_frame, to_frame);
 		}
 
 		// Per-frame whole-process memory (committed, working set, GC heap). Aligned exactly like
@@ -1335,54 +2260,104 @@ public:
 		// UI can overlay it on the size graph. Empty for captures that predate MemStats.
 		void get_memory_series(std::vector<uint64_t>& committed_points, std::vector<uint64_t>& working_set_points, std::vector<uint64_t>& gc_heap_points, uint64_t& max_committed, uint64_t from_frame, uint64_t to_frame)
 		{
-			committed_points.clear();
-			working_set_points.clear();
-			gc_heap_points.clear();
-			max_committed = 0;
+			m_db_writer.flush();
 
-			auto result = queries::select_memstats(m_db, from_frame, to_frame);
-			uint64_t prev_frame = from_frame;
-			bool first_frame = true;
-			uint64_t last_committed = 0, last_ws = 0, last_gc = 0;
+			uint64_t first_frame = 0, last_frame = 0;
+			if (!m_memory_stats.get_frame_range(first_frame, last_frame))
+				last_frame = 0;
+			to_frame = std::min(to_frame, last_frame);
 
-			auto carry_gap = [&](uint64_t begin, uint64_t end)
-			{
-				for (auto f = begin; f < end; ++f)
-				{
-					committed_points.push_back(last_committed);
-					working_set_points.push_back(last_ws);
-					gc_heap_points.push_back(last_gc);
-				}
-			};
+			m_memory_stats.get_values(memory_committed, from_frame, to_frame, committed_points);
+			m_memory_stats.get_values(memory_working_set, from_frame, to_frame, working_set_points);
+			m_memory_stats.get_values(memory_gc_heap, from_frame, to_frame, gc_heap_points);
 
-			while (result.next())
-			{
-				uint64_t frame = result.get_uint64("frame");
-				uint64_t committed = result.get_uint64("committed");
-				uint64_t ws = result.get_uint64("working_set");
-				uint64_t gc = result.get_uint64("gc_heap");
+			max_committed = committed_points.empty() ? 0 : *std::max_element(committed_points.begin(), committed_points.end());
+		}
+
+		void get_stats_buckets(std::vector<frame_bucket_t>& allocs, std::vector<frame_bucket_t>& frees, std::vector<frame_bucket_t>& sizes, uint64_t from_frame, uint64_t to_frame, size_t bucket_frames)
+		{
+			m_db_writer.flush();
+
+			uint64_t first_frame = 0, last_frame = 0;
+			if (!m_frame_stats.get_frame_range(first_frame, last_frame))
+				last_frame = 0;
+			to_frame = std::min(to_frame, last_frame);
 
-				if (committed > max_committed) max_committed = committed;
+			get_buckets(m_frame_stats, stats_allocs, from_frame, to_frame, bucket_frames, allocs);
+			get_buckets(m_frame_stats, stats_frees, from_frame, to_frame, bucket_frames, frees);
+			get_buckets(m_frame_stats, stats_size, from_frame, to_frame, bucket_frames, sizes);
+		}
+
+		void get_memory_buckets(std::vector<frame_bucket_t>& committed, std::vector<frame_bucket_t>& working_set, std::vector<frame_bucket_t>& gc_heap, uint64_t from_frame, uint64_t to_frame, size_t bucket_frames)
+		{
+			m_db_writer.flush();
+
+			uint64_t first_frame = 0, last_frame = 0;
+			if (!m_memory_stats.get_frame_range(first_frame, last_frame))
+				last_frame = 0;
+			to_frame = std::min(to_frame, last_frame);
+
+			get_buckets(m_memory_stats, memory_committed, from_frame, to_frame, bucket_frames, committed);
+			get_buckets(m_memory_stats, memory_working_set, from_frame, to_frame, bucket_frames, working_set);
+			get_buckets(m_memory_stats, memory_gc_heap, from_frame, to_frame, bucket_frames, gc_heap);
+		}
+
+		void get_degraded_frames(std::vector<degraded_frame_t>& frames, uint64_t from_frame, uint64_t to_frame)
+		{
+			frames.clear();
 
-				if (first_frame && frame > prev_frame)
-					carry_gap(from_frame, frame);           // leading gap (carries 0)
-				else if (frame > prev_frame + 1)
-					carry_gap(prev_frame + 1, frame);       // interior gap (carries last value)
+			m_db_writer.flush();
+			auto result = queries::select_degraded_frames(m_db, from_frame, to_frame);
+			while (result.next())
+			{
+				degraded_frame_t frame;
+				frame.frame = result.get_uint64("frame");
+				frame.level = (uint8_t)result.get_uint64("level");
+				frame.dropped_allocs = result.get_uint64("dropped_allocs");
+				frame.dropped_size = result.get_uint64("dropped_size");
+				frames.push_back(frame);
+			}
+		}
 
-				first_frame = false;
-				prev_frame = frame;
-				last_committed = committed; last_ws = ws; last_gc = gc;
+		void get_dropped_allocations(std::vector<dropped_allocations_t>& types, uint64_t from_frame, uint64_t to_frame)
+		{
+			types.clear();
 
-				committed_points.push_back(committed);
-				working_set_points.push_back(ws);
-				gc_heap_points.push_back(gc);
+			m_db_writer.flush();
+			auto result = queries::select_dropped_allocs(m_db, from_frame, to_frame);
+			while (result.next())
+			{
+				dropped_allocations_t type;
+				type.type_id = result.get_uint64("type_id");
+				type.allocs = result.get_uint64("allocs");
+				type.size = result.get_uint64("size");
+				types.push_back(type);
 			}
+		}
 
-			if (prev_frame < to_frame && !committed_points.empty())
+		// Brings the lifetime index up to end_offset, a frame at a time (frames are the
+		// index's chunks). The caller holds m_lifetime_index_mutex.
+		bool update_lifetime_index(event_log_reader& reader, uint64_t end_offset)
+		{
+			if (m_lifetime_index.indexed_end() >= end_offset)
+				return true;
+
+			auto offsets_cursor = queries::select_frame_end_offsets(m_db, m_lifetime_index.indexed_end(), end_offset);
+			if (offsets_cursor.has_error())
+				return false;
+			while (offsets_cursor.next())
 			{
-				for (auto f = prev_frame + 1; f <= to_frame && f <= m_max_frame; ++f)
-					carry_gap(f, f + 1);
+				if (!m_lifetime_index.update(reader, offsets_cursor.get_uint64("end_offset")))
+					return false;
 			}
+			return m_lifetime_index.update(reader, end_offset);
+		}
+
+		bool get_live_objects_from_index(event_log_reader& reader, uint64_t end_offset, int from_frame, int to_frame, std::vector<live_object>& objects, const progress_func_t& progress_func)
+		{
+			std::scoped_lock lock(m_lifetime_index_mutex);
+			return update_lifetime_index(reader, end_offset) &&
+				m_lifetime_index.get_live_objects(reader, end_offset, (uint64_t)from_frame, (uint64_t)to_frame, objects, progress_func);
 		}
 
 		/*
@@ -1392,12 +2367,17 @@ public:
 			We build the list by starting from an empty list, and then processing all events that fall into the timeframe.
 			When we encounter an allocation event, we add the object to the list, and when we encounter a free event,
 			we remove it. Therefore, in the end, only objects that were allocated, but not freed are left.
+
+			That replay (see live_objects_replay.h) is the reference, and the fallback: normally the answer comes
+			from the lifetime index (see lifetime_index.h), which gives the same objects, in the same order, without
+			the replay.
 		*/
 		void get_live_objects(std::vector<live_object>& objects, int from_frame, int to_frame, progress_func_t progress_func)
 		{
 			objects.clear();
 
 			// Find the byte range of the requested frames in the event log
+			m_db_writer.flush();
 			auto range_cursor = queries::select_frame_event_range(m_db, from_frame, to_frame);
 			if (range_cursor.has_error() || !range_cursor.next())
 				return;
@@ -1405,60 +2385,48 @@ public:
 			uint64_t begin_offset = range_cursor.get_uint64("begin_offset");
 			uint64_t end_offset = range_cursor.get_uint64("end_offset");
 
-			auto reader = event_log_reader::open(m_event_log_file_name);
+			auto reader = event_log_reader::open(get_event_log_file());
 			if (reader == nullptr)
 				return;
 
-			uint64_t events_count = reader->count_events(begin_offset, end_offset);
-			uint64_t row_num = 0;
-			bool cancelled = false;
-
-			// Map of address -> live object info. Nodes come from a recycling pool, so the
-			// per-event emplace/erase churn doesn't hit the heap (see node_pool) and memory is
-			// bounded by the peak live-object count.
-			node_pool pool;
-			using map_alloc = pool_allocator<std::pair<const uint64_t, live_object>>;
-			using live_map = std::unordered_map<uint64_t, live_object, std::hash<uint64_t>, std::equal_to<uint64_t>, map_alloc>;
-			live_map live_objects_map(0, std::hash<uint64_t>(), std::equal_to<uint64_t>(), map_alloc(&pool));
-			// Size the bucket array up front to avoid repeated rehashes, but cap it: the live set
-			// (allocs still outstanding) is far smaller than the event count, so reserving the
-			// full count would allocate tens of GB of buckets for nothing. Past the cap the map
-			// grows geometrically, which is cheap now that nodes are pooled.
-			const uint64_t reserve_cap = 16ull * 1024 * 1024;
-			live_objects_map.reserve((size_t)(events_count / 4 < reserve_cap ? events_count / 4 : reserve_cap));
-
-			reader->read_range(begin_offset, end_offset, [&](const event_view& e)
-			{
-				// Allocation: write object to map. Deallocation: remove object from map.
-				if (e.is_alloc)
-					live_objects_map.emplace(e.addr, live_object(e.addr, e.size, e.frame, e.type_id, e.callstack_id));
-				else
-					live_objects_map.erase(e.addr);
-
-				if (progress_func != nullptr && !progress_func((size_t)row_num++, (size_t)events_count))
-				{
-					cancelled = true;
-					return false;
-				}
-
-				return true;
-			});
-
-			if (cancelled)
+			// The lifetime index answers in time proportional to the range's allocations, not
+			// to its events. It can refuse (e.g. if the log can't be indexed): then replay.
+			if (get_live_objects_from_index(*reader, end_offset, from_frame, to_frame, objects, progress_func))
 				return;
 
-			// Flatten the map
-			for (auto& pair : live_objects_map)
-			{
-				objects.push_back(pair.second);
-			}
+			// The replay runs on all cores, split at frame boundaries (see live_objects_replay.h)
+			std::vector<uint64_t> boundaries = { begin_offset };
+			auto offsets_cursor = queries::select_frame_end_offsets(m_db, begin_offset, end_offset);
+			while (!offsets_cursor.has_error() && offsets_cursor.next())
+				boundaries.push_back(offsets_cursor.get_uint64("end_offset"));
+			if (boundaries.back() != end_offset)
+				boundaries.push_back(end_offset);
+
+			const size_t thread_count = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+			if (!replay_live_objects(get_event_log_file(), boundaries, thread_count, objects, progress_func))
+				objects.clear();
 		}
 
 		size_t get_network_messages_count() const { return m_network.get_read_messages_count(); }
 
 		uint64_t get_db_inserted_events_count() const { return m_db_inserted_events; }
 
-		const char* get_event_log_path() const { return m_event_log_file_name.c_str(); }
+		uint64_t get_db_commits_count() const { return m_db_writer.get_commits_count(); }
+
+		uint64_t get_last_command_round_trip_us() const { return m_last_command_round_trip_us; }
+
+		const char* get_event_log_path() const { return m_event_log_file.path.c_str(); }
+
+		void get_event_log_ranges(std::vector<std::pair<uint64_t, uint64_t>>& ranges, bool& compressed) const
+		{
+			const file_range file = get_event_log_file();
+			ranges.clear();
+			if (file.pieces.empty())
+				ranges.push_back({ file.offset, file.size });
+			for (auto& piece : file.pieces)
+				ranges.push_back({ piece.offset, piece.size });
+			compressed = file.compressed;
+		}
 	};
 
 	mono_profiler_client::mono_profiler_client()
@@ -1481,6 +2449,11 @@ public:
 		return m_details->start(addr, server_port, db_file_name, capture_flags, native_config);
 	}
 
+	bool mono_profiler_client::import_spool(const std::string& spool_prefix, const std::string& db_file_name, bool follow)
+	{
+		return m_details->import_spool(spool_prefix, db_file_name, follow);
+	}
+
 	void mono_profiler_client::stop()
 	{
 		m_details->stop();
@@ -1528,11 +2501,26 @@ public:
 		return m_details->get_db_inserted_events_count();
 	}
 
+	uint64_t mono_profiler_client::get_db_commits_count() const
+	{
+		return m_details->get_db_commits_count();
+	}
+
+	uint64_t mono_profiler_client::get_last_command_round_trip_us() const
+	{
+		return m_details->get_last_command_round_trip_us();
+	}
+
 	const char* mono_profiler_client::get_event_log_path() const
 	{
 		return m_details->get_event_log_path();
 	}
 
+	void mono_profiler_client::get_event_log_ranges(std::vector<std::pair<uint64_t, uint64_t>>& ranges, bool& compressed) const
+	{
+		m_details->get_event_log_ranges(ranges, compressed);
+	}
+
 	mono_profiler_client_data* mono_profiler_client::get_data()
 	{
 		return m_details->get_data();
@@ -1572,6 +2560,11 @@ public:
 		m_source->get_frame_boundaries(min, max);
 	}
 
+	void mono_profiler_client_data::get_frame_totals(uint64_t& allocs, uint64_t& frees, uint64_t from_frame, uint64_t to_frame)
+	{
+		m_source->get_frame_totals(allocs, frees, from_frame, to_frame);
+	}
+
 	void mono_profiler_client_data::get_frame_stats(std::vector<uint64_t>& alloc_counts, std::vector<uint64_t>& free_counts, uint64_t& max_allocs, uint64_t& max_frees, std::vector<uint64_t>& size_points, int64_t& max_size, uint64_t from_frame, uint64_t to_frame)
 	{
 		m_source->get_stats(alloc_counts, free_counts, max_allocs, max_frees, size_points, max_size, from_frame, to_frame);
@@ -1582,6 +2575,26 @@ public:
 		m_source->get_memory_series(committed_points, working_set_points, gc_heap_points, max_committed, from_frame, to_frame);
 	}
 
+	void mono_profiler_client_data::get_frame_stats_buckets(std::vector<frame_bucket_t>& allocs, std::vector<frame_bucket_t>& frees, std::vector<frame_bucket_t>& sizes, uint64_t from_frame, uint64_t to_frame, size_t bucket_frames)
+	{
+		m_source->get_stats_buckets(allocs, frees, sizes, from_frame, to_frame, bucket_frames);
+	}
+
+	void mono_profiler_client_data::get_memory_buckets(std::vector<frame_bucket_t>& committed, std::vector<frame_bucket_t>& working_set, std::vector<frame_bucket_t>& gc_heap, uint64_t from_frame, uint64_t to_frame, size_t bucket_frames)
+	{
+		m_source->get_memory_buckets(committed, working_set, gc_heap, from_frame, to_frame, bucket_frames);
+	}
+
+	void mono_profiler_client_data::get_degraded_frames(std::vector<degraded_frame_t>& frames, uint64_t from_frame, uint64_t to_frame)
+	{
+		m_source->get_degraded_frames(frames, from_frame, to_frame);
+	}
+
+	void mono_profiler_client_data::get_dropped_allocations(std::vector<dropped_allocations_t>& types, uint64_t from_frame, uint64_t to_frame)
+	{
+		m_source->get_dropped_allocations(types, from_frame, to_frame);
+	}
+
 	void mono_profiler_client_data::get_live_objects(std::vector<live_object>& objects, int from, int to, progress_func_t progress_func)
 	{
 		m_source->get_live_objects(objects, from, to, progress_func);
@@ -1611,4 +2624,9 @@ public:
 	{
 		return m_source->get_allocation_type_and_stack(address, type_id, stack_id);
 	}
+
+	void mono_profiler_client_data::get_allocations_type_and_stack(const std::vector<uint64_t>& addresses, std::vector<uint64_t>& type_ids, std::vector<uint64_t>& stack_ids) const
+	{
+		m_source->get_allocations_type_and_stack(addresses, type_ids, stack_ids);
+	}
 }
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace owlcat
+{
+	/*
+		Maps ids assigned by the profiler server (types, callstacks, callstack frames) to
+		client-side values. The server hands out each kind of id densely from zero, so a
+		vector indexed by server id replaces a hash map: translating an event is a bounds
+		check and a load, which matters at millions of events per second.
+
+		Ids that have not been defined map to the table's unknown value. The server's id
+		space restarts with every connection, so reset the table whenever a new connection
+		(capture session) begins.
+	*/
+	template<typename T>
+	class server_id_table
+	{
+		std::vector<T> m_values;
+		T m_unknown;
+
+	public:
+		// Server ids are 32-bit and dense: anything far beyond what a capture could define
+		// is a broken message, and must not make us allocate gigabytes
+		static constexpr uint64_t MAX_ID = 64ull * 1024 * 1024;
+
+		explicit server_id_table(T unknown)
+			: m_unknown(unknown)
+		{}
+
+		// Returns the value of the id, or the unknown value if it was never defined
+		const T& get(uint64_t server_id) const
+		{
+			return server_id < m_values.size() ? m_values[server_id] : m_unknown;
+		}
+
+		// Defines (or redefines) an id. Returns false if the id is out of range.
+		bool set(uint64_t server_id, T value)
+		{
+			if (server_id >= MAX_ID)
+				return false;
+
+			if (server_id >= m_values.size())
+			{
+				// Grow geometrically: ids arrive in increasing order, mostly one at a time
+				size_t new_size = m_values.size() < 1024 ? 1024 : m_values.size();
+				while (new_size <= server_id)
+					new_size *= 2;
+				m_values.resize(new_size, m_unknown);
+			}
+
+			m_values[server_id] = std::move(value);
+			return true;
+		}
+
+		// Forgets all ids, for a new connection
+		void reset()
+		{
+			m_values.clear();
+		}
+	};
+}
@@ -1,5 +1,10 @@
 #include "symbol_resolver.h"
 
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <shared_mutex>
 #include <unordered_map>
 #include <cstdlib>
 #include <cstring>
@@ -13,19 +18,253 @@
 
 namespace owlcat
 {
+	// Splits a ';'-separated search path into its directories
+	static std::vector<std::string> split_search_path(const std::string& path)
+	{
+		std::vector<std::string> dirs;
+		size_t pos = 0;
+		while (pos <= path.size())
+		{
+			size_t end = path.find(';', pos);
+			if (end == std::string::npos)
+				end = path.size();
+			if (end > pos)
+				dirs.push_back(path.substr(pos, end - pos));
+			pos = end + 1;
+		}
+		return dirs;
+	}
+
+	// Parses a hexadecimal number with an optional "0x" at the start of text, advancing
+	// past it. Returns false if there are no digits.
+	static bool parse_hex(std::string_view& text, uint64_t& value)
+	{
+		if (text.size() >= 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X'))
+			text.remove_prefix(2);
+
+		value = 0;
+		size_t digits = 0;
+		for (; digits < text.size(); ++digits)
+		{
+			const char c = text[digits];
+			uint64_t digit;
+			if (c >= '0' && c <= '9')
+				digit = c - '0';
+			else if (c >= 'a' && c <= 'f')
+				digit = c - 'a' + 10;
+			else if (c >= 'A' && c <= 'F')
+				digit = c - 'A' + 10;
+			else
+				break;
+			value = (value << 4) | digit;
+		}
+		text.remove_prefix(digits);
+		return digits != 0;
+	}
+
+	// Describes a file for module identities: its path, size and modification time.
+	// Empty if it doesn't exist.
+	static std::string describe_file(const std::filesystem::path& path)
+	{
+		std::error_code ec;
+		const uint64_t size = std::filesystem::file_size(path, ec);
+		if (ec)
+			return std::string();
+		const auto time = std::filesystem::last_write_time(path, ec);
+		if (ec)
+			return std::string();
+
+		char tmp[64];
+		snprintf(tmp, sizeof(tmp), "|%llu|%lld", (unsigned long long)size, (long long)time.time_since_epoch().count());
+		return path.u8string() + tmp;
+	}
+
+	// Returns the first of the names found in one of the directories, or an empty path
+	static std::filesystem::path find_file(const std::vector<std::string>& dirs, const std::vector<std::string>& names)
+	{
+		std::error_code ec;
+		for (auto& dir : dirs)
+		{
+			for (auto& name : names)
+			{
+				auto path = std::filesystem::u8path(dir) / std::filesystem::u8path(name);
+				if (std::filesystem::is_regular_file(path, ec))
+					return path;
+			}
+		}
+		return std::filesystem::path();
+	}
+
+	// Names of a module's symbol file with the given extension: after the module name,
+	// then after its name without extension ("GameAssembly.dll.map", "GameAssembly.map")
+	static std::vector<std::string> symbol_file_names(const std::string& module, const char* extension)
+	{
+		std::vector<std::string> names = { module + extension };
+		const size_t dot = module.rfind('.');
+		if (dot != std::string::npos && dot != 0)
+			names.push_back(module.substr(0, dot) + extension);
+		return names;
+	}
+
+	static void skip_spaces(std::string_view& text)
+	{
+		while (!text.empty() && (text.front() == ' ' || text.front() == '\t'))
+			text.remove_prefix(1);
+	}
+
+	// ---- Symbol map files ----
+
+	class symbol_map_backend : public symbol_backend
+	{
+		// The symbols of a module, sorted by address. Names are kept in one buffer rather
+		// than a string each: maps of IL2CPP builds have a few hundred thousand symbols.
+		struct symbol_table
+		{
+			struct symbol_t
+			{
+				uint64_t start;
+				uint64_t size;
+				uint32_t name_offset;
+				uint32_t name_length;
+			};
+			std::vector<symbol_t> symbols;
+			std::string names;
+		};
+
+		// A module's symbols, loaded on the first reference to it by one thread while the
+		// others needing it wait. table is nullptr if the module has no map (so a missing map
+		// isn't looked for again for every frame). Tables never change once loaded, so they
+		// are searched without locks.
+		struct module_t
+		{
+			std::once_flag loaded;
+			std::shared_ptr<const symbol_table> table;
+		};
+
+		std::vector<std::string> m_dirs;
+		std::unordered_map<std::string, std::shared_ptr<module_t>> m_modules;
+		std::mutex m_modules_mutex;
+
+		std::shared_ptr<const symbol_table> load_table(const std::string& module) const
+		{
+			const auto path = find_file(m_dirs, symbol_file_names(module, ".map"));
+			if (path.empty())
+				return nullptr;
+			std::ifstream file(path);
+			if (!file)
+				return nullptr;
+
+			auto table = std::make_shared<symbol_table>();
+			std::string line;
+			while (std::getline(file, line))
+			{
+				std::string_view text = line;
+				skip_spaces(text);
+				uint64_t start, size;
+				if (!parse_hex(text, start))
+					continue;
+				skip_spaces(text);
+				if (!parse_hex(text, size))
+					continue;
+				skip_spaces(text);
+				while (!text.empty() && (text.back() == '\r' || text.back() == ' '))
+					text.remove_suffix(1);
+				if (text.empty())
+					continue;
+
+				table->symbols.push_back({ start, size, (uint32_t)table->names.size(), (uint32_t)text.size() });
+				table->names.append(text);
+			}
+
+			// Maps written by tools are sorted already, which makes this cheap
+			std::stable_sort(table->symbols.begin(), table->symbols.end(), [](const symbol_table::symbol_t& a, const symbol_table::symbol_t& b)
+			{
+				return a.start < b.start;
+			});
+			return table;
+		}
+
+		const symbol_table* get_table(const std::string& module)
+		{
+			std::shared_ptr<module_t> entry;
+			{
+				std::scoped_lock lock(m_modules_mutex);
+				auto& slot = m_modules[module];
+				if (slot == nullptr)
+					slot = std::make_shared<module_t>();
+				entry = slot;
+			}
+
+			// Loaded outside of the lock, so lookups in other modules go on meanwhile
+			std::call_once(entry->loaded, [&] { entry->table = load_table(module); });
+			return entry->table.get();
+		}
+
+	public:
+		void set_search_path(const std::string& path) override
+		{
+			std::scoped_lock lock(m_modules_mutex);
+			m_dirs = split_search_path(path);
+			m_modules.clear();
+		}
+
+		bool resolve(const std::string& module, uint64_t rva, std::string& symbol) override
+		{
+			const symbol_table* table = get_table(module);
+			if (table == nullptr)
+				return false;
+
+			// The last symbol starting at or before the address
+			auto it = std::upper_bound(table->symbols.begin(), table->symbols.end(), rva, [](uint64_t value, const symbol_table::symbol_t& s)
+			{
+				return value < s.start;
+			});
+			if (it == table->symbols.begin())
+				return false;
+			--it;
+			// A size of 0 is unknown: the symbol extends to the next one
+			if (it->size != 0 && rva - it->start >= it->size)
+				return false;
+
+			symbol.assign(table->names, it->name_offset, it->name_length);
+			if (rva != it->start)
+			{
+				char tmp[32];
+				snprintf(tmp, sizeof(tmp), "+0x%llX", (unsigned long long)(rva - it->start));
+				symbol += tmp;
+			}
+			return true;
+		}
+
+		std::string get_module_identity(const std::string& module) override
+		{
+			return describe_file(find_file(m_dirs, symbol_file_names(module, ".map")));
+		}
+	};
+
+	std::unique_ptr<symbol_backend> create_symbol_map_backend()
+	{
+		return std::make_unique<symbol_map_backend>();
+	}
+
+	// ---- DbgHelp ----
+
 #if defined(WIN32)
 
-	struct symbol_resolver::impl
+	class dbghelp_backend : public symbol_backend
 	{
 		// A unique, fake "process" handle keying this DbgHelp session (we are not the
 		// target process; modules are loaded manually at synthetic bases).
-		HANDLE process = nullptr;
-		bool initialized = false;
-		std::string search_path;
+		HANDLE m_process = nullptr;
+		bool m_initialized = false;
+		// DbgHelp is single-threaded: all calls to it are made under this lock
+		std::mutex m_mutex;
+		std::string m_search_path;
+		std::vector<std::string> m_dirs;
 
 		// module name -> synthetic load base, or 0 if its symbols couldn't be loaded
 		// (cached so a missing PDB isn't retried for every frame)
-		std::unordered_map<std::string, uint64_t> modules;
+		std::unordered_map<std::string, uint64_t> m_modules;
 		// Synthetic address space per module. We register each module with an explicit,
 		// generously-large span (rather than letting DbgHelp derive the size from the image,
 		// which we may not have) so that base+rva always lands inside the module's range.
@@ -33,23 +272,23 @@ namespace owlcat
 		// a huge GameAssembly.dll.
 		static const uint64_t module_span = 0x80000000ULL;   // 2 GB
 		static const uint64_t module_stride = 0x100000000ULL; // 4 GB
-		uint64_t next_base = module_stride;
+		uint64_t m_next_base = module_stride;
 
 		// Loads (once) the symbols for a module and returns its synthetic base, or 0 on failure.
 		uint64_t get_module_base(const std::string& name)
 		{
-			auto it = modules.find(name);
-			if (it != modules.end())
+			auto it = m_modules.find(name);
+			if (it != m_modules.end())
 				return it->second;
 
-			uint64_t base = next_base;
-			next_base += module_stride;
+			uint64_t base = m_next_base;
+			m_next_base += module_stride;
 
 			// ImageName = module name; DbgHelp searches the path for the image and/or its PDB.
 			// An explicit non-zero DllSize is essential: with 0, DbgHelp registers a zero-length
 			// range when it can't read the image's SizeOfImage (e.g. only the PDB is present),
 			// and SymFromAddr then fails with ERROR_MOD_NOT_FOUND for every address.
-			DWORD64 loaded = SymLoadModuleEx(process, nullptr, name.c_str(), nullptr, base, (DWORD)module_span, nullptr, 0);
+			DWORD64 loaded = SymLoadModuleEx(m_process, nullptr, name.c_str(), nullptr, base, (DWORD)module_span, nullptr, 0);
 			uint64_t result = (loaded != 0) ? base : 0;
 
 			// SymLoadModuleEx returns 0 both on error and when the module is already loaded;
@@ -58,24 +297,51 @@ namespace owlcat
 			if (loaded == 0 && GetLastError() == ERROR_SUCCESS)
 				result = base;
 
-			modules[name] = result;
+			m_modules[name] = result;
 			return result;
 		}
 
-		// Symbolicates a single callstack line. Returns it unchanged if it isn't a native
-		// "Module+0xRVA" frame or its symbols aren't available.
-		std::string symbolicate_line(const std::string& line)
+	public:
+		dbghelp_backend()
 		{
-			const size_t plus = line.find("+0x");
-			if (plus == std::string::npos)
-				return line;
+			// The instance address is a convenient unique key for this DbgHelp session.
+			m_process = (HANDLE)this;
+			SymSetOptions(SYMOPT_UNDNAME | SYMOPT_LOAD_LINES | SYMOPT_DEFERRED_LOADS | SYMOPT_FAIL_CRITICAL_ERRORS | SYMOPT_NO_PROMPTS);
+			m_initialized = SymInitialize(m_process, nullptr, FALSE) != FALSE;
+		}
 
-			std::string module = line.substr(0, plus);
-			const uint64_t rva = strtoull(line.c_str() + plus + 3, nullptr, 16);
+		~dbghelp_backend()
+		{
+			if (m_initialized)
+				SymCleanup(m_process);
+		}
+
+		void set_search_path(const std::string& path) override
+		{
+			std::scoped_lock lock(m_mutex);
+			if (!m_initialized)
+				return;
+
+			for (auto& m : m_modules)
+				if (m.second != 0)
+					SymUnloadModule64(m_process, m.second);
+			m_modules.clear();
+			m_next_base = module_stride;
+			m_search_path = path;
+			m_dirs = split_search_path(path);
+
+			SymSetSearchPath(m_process, path.empty() ? nullptr : path.c_str());
+		}
+
+		bool resolve(const std::string& module, uint64_t rva, std::string& symbol) override
+		{
+			std::scoped_lock lock(m_mutex);
+			if (!m_initialized)
+				return false;
 
 			const uint64_t base = get_module_base(module);
 			if (base == 0)
-				return line;
+				return false;
 
 			const DWORD64 addr = base + rva;
 
@@ -86,108 +352,226 @@ namespace owlcat
 			sym->MaxNameLen = MAX_SYM_NAME;
 
 			DWORD64 sym_disp = 0;
-			if (!SymFromAddr(process, addr, &sym_disp, sym))
-				return line;
+			if (!SymFromAddr(m_process, addr, &sym_disp, sym))
+				return false;
 
-			std::string out = module + "!" + sym->Name;
+			symbol = sym->Name;
 			if (sym_disp != 0)
 			{
 				char tmp[32];
 				snprintf(tmp, sizeof(tmp), "+0x%llX", (unsigned long long)sym_disp);
-				out += tmp;
+				symbol += tmp;
 			}
 
 			// Optional source location
 			IMAGEHLP_LINE64 li = {};
 			li.SizeOfStruct = sizeof(li);
 			DWORD line_disp = 0;
-			if (SymGetLineFromAddr64(process, addr, &line_disp, &li) && li.FileName != nullptr)
+			if (SymGetLineFromAddr64(m_process, addr, &line_disp, &li) && li.FileName != nullptr)
 			{
 				const char* fn = strrchr(li.FileName, '\\');
 				fn = (fn != nullptr) ? fn + 1 : li.FileName;
 				char tmp[MAX_PATH + 32];
 				snprintf(tmp, sizeof(tmp), " (%s:%lu)", fn, (unsigned long)li.LineNumber);
-				out += tmp;
+				symbol += tmp;
 			}
+			return true;
+		}
 
-			// Bound the line length. Demangled C++ names (templates) can be up to
-			// MAX_SYM_NAME (~2000) chars each; with up to 64 frames a callstack cell would
-			// balloon to ~100KB, which makes the Qt table's text layout pathologically slow
-			// (it lays each cell out at unbounded width). Such names are unreadable in a
-			// list anyway, so truncate.
-			static const size_t max_line_length = 300;
-			if (out.size() > max_line_length)
+		// The PDB or the image DbgHelp would find in the search path directories. Symbol
+		// servers and the default paths are not looked into: without a local file, the
+		// search path itself identifies the symbols.
+		std::string get_module_identity(const std::string& module) override
+		{
+			std::scoped_lock lock(m_mutex);
+			if (!m_initialized)
+				return std::string();
+
+			auto names = symbol_file_names(module, ".pdb");
+			names.push_back(module);
+			const auto path = find_file(m_dirs, names);
+			if (!path.empty())
+				return describe_file(path);
+			return "path|" + m_search_path;
+		}
+	};
+
+	std::unique_ptr<symbol_backend> create_dbghelp_backend()
+	{
+		return std::make_unique<dbghelp_backend>();
+	}
+
+#else // non-Windows: DbgHelp is Windows-only
+
+	std::unique_ptr<symbol_backend> create_dbghelp_backend()
+	{
+		return nullptr;
+	}
+
+#endif
+
+	// ---- Resolver ----
+
+	struct symbol_resolver::impl
+	{
+		std::vector<std::unique_ptr<symbol_backend>> backends;
+
+		// Held shared by resolutions, exclusively by set_search_path
+		std::shared_mutex path_mutex;
+
+		// "Module+RVA" -> the symbolicated frame (without '\n'), or an empty string if it
+		// couldn't be resolved
+		std::unordered_map<std::string, std::string> cache;
+		std::mutex cache_mutex;
+
+		// Bound the line length. Demangled C++ names (templates) can be up to
+		// MAX_SYM_NAME (~2000) chars each; with up to 64 frames a callstack cell would
+		// balloon to ~100KB, which makes the Qt table's text layout pathologically slow
+		// (it lays each cell out at unbounded width). Such names are unreadable in a
+		// list anyway, so truncate.
+		static const size_t max_line_length = 300;
+
+		// Resolves a native frame (without its '\n') through the cache. Returns an empty
+		// string if it can't be resolved.
+		std::string resolve_line(std::string_view line)
+		{
+			const size_t plus = line.find("+0x");
+			std::string module(line.substr(0, plus));
+			std::string_view rva_text = line.substr(plus + 1);
+			uint64_t rva = 0;
+			parse_hex(rva_text, rva);
+
+			// Keyed by the parsed address, so differently padded RVAs share an entry
+			char rva_key[24];
+			snprintf(rva_key, sizeof(rva_key), "+%llX", (unsigned long long)rva);
+			std::string key = module + rva_key;
+			{
+				std::scoped_lock lock(cache_mutex);
+				auto it = cache.find(key);
+				if (it != cache.end())
+					return it->second;
+			}
+
+			std::string out;
+			std::string symbol;
+			for (auto& backend : backends)
 			{
-				out.resize(max_line_length);
-				out += "...";
+				if (backend->resolve(module, rva, symbol))
+				{
+					out = module + "!" + symbol;
+					if (out.size() > max_line_length)
+					{
+						out.resize(max_line_length);
+						out += "...";
+					}
+					break;
+				}
 			}
 
+			std::scoped_lock lock(cache_mutex);
+			cache.emplace(std::move(key), out);
 			return out;
 		}
 	};
 
+	static std::vector<std::unique_ptr<symbol_backend>> default_backends()
+	{
+		std::vector<std::unique_ptr<symbol_backend>> backends;
+		backends.push_back(create_symbol_map_backend());
+		if (auto dbghelp = create_dbghelp_backend())
+			backends.push_back(std::move(dbghelp));
+		return backends;
+	}
+
 	symbol_resolver::symbol_resolver()
+		: symbol_resolver(default_backends())
+	{
+	}
+
+	symbol_resolver::symbol_resolver(std::vector<std::unique_ptr<symbol_backend>> backends)
 		: m_impl(new impl())
 	{
-		// The instance address is a convenient unique key for this DbgHelp session.
-		m_impl->process = (HANDLE)this;
-		SymSetOptions(SYMOPT_UNDNAME | SYMOPT_LOAD_LINES | SYMOPT_DEFERRED_LOADS | SYMOPT_FAIL_CRITICAL_ERRORS | SYMOPT_NO_PROMPTS);
-		m_impl->initialized = SymInitialize(m_impl->process, nullptr, FALSE) != FALSE;
+		m_impl->backends = std::move(backends);
 	}
 
 	symbol_resolver::~symbol_resolver()
 	{
-		if (m_impl->initialized)
-			SymCleanup(m_impl->process);
 		delete m_impl;
 	}
 
 	void symbol_resolver::set_search_path(const std::string& path)
 	{
-		m_impl->search_path = path;
-		if (!m_impl->initialized)
-			return;
+		std::unique_lock lock(m_impl->path_mutex);
+		for (auto& backend : m_impl->backends)
+			backend->set_search_path(path);
 
-		for (auto& m : m_impl->modules)
-			if (m.second != 0)
-				SymUnloadModule64(m_impl->process, m.second);
-		m_impl->modules.clear();
-		m_impl->next_base = 0x100000000ULL;
+		std::scoped_lock cache_lock(m_impl->cache_mutex);
+		m_impl->cache.clear();
+	}
 
-		SymSetSearchPath(m_impl->process, path.empty() ? nullptr : path.c_str());
+	bool symbol_resolver::is_native_frame(std::string_view frame)
+	{
+		return frame.find("+0x") != std::string_view::npos;
 	}
 
-	std::string symbol_resolver::symbolicate(const std::string& raw)
+	std::string_view symbol_resolver::get_frame_module(std::string_view frame)
 	{
-		if (!m_impl->initialized)
-			return raw;
+		return frame.substr(0, frame.find("+0x"));
+	}
+
+	std::string symbol_resolver::get_module_identity(const std::string& module)
+	{
+		std::shared_lock lock(m_impl->path_mutex);
+		std::string identity;
+		for (auto& backend : m_impl->backends)
+		{
+			// One line per backend, so a file appearing for one of them is a change
+			identity += backend->get_module_identity(module);
+			identity += '\n';
+		}
+		return identity.find_first_not_of('\n') == std::string::npos ? std::string() : identity;
+	}
 
+	bool symbol_resolver::symbolicate_frame(std::string_view frame, std::string& display)
+	{
+		const bool has_newline = !frame.empty() && frame.back() == '\n';
+		if (has_newline)
+			frame.remove_suffix(1);
+		if (!is_native_frame(frame))
+			return false;
+
+		std::shared_lock lock(m_impl->path_mutex);
+		std::string out = m_impl->resolve_line(frame);
+		if (out.empty())
+			return false;
+
+		display = std::move(out);
+		if (has_newline)
+			display += '\n';
+		return true;
+	}
+
+	std::string symbol_resolver::symbolicate(const std::string& raw)
+	{
 		std::string result;
 		result.reserve(raw.size() + 64);
 
+		std::string display;
 		size_t pos = 0;
 		while (pos < raw.size())
 		{
 			const size_t nl = raw.find('\n', pos);
-			const size_t end = (nl == std::string::npos) ? raw.size() : nl;
+			const size_t end = (nl == std::string::npos) ? raw.size() : nl + 1;
 
-			result += m_impl->symbolicate_line(raw.substr(pos, end - pos));
-			if (nl != std::string::npos)
-				result += '\n';
+			const std::string_view line(raw.data() + pos, end - pos);
+			if (symbolicate_frame(line, display))
+				result += display;
+			else
+				result += line;
 
-			pos = (nl == std::string::npos) ? raw.size() : nl + 1;
+			pos = end;
 		}
 
 		return result;
 	}
-
-#else // non-Windows: symbolication is a no-op (DbgHelp is Windows-only)
-
-	struct symbol_resolver::impl {};
-	symbol_resolver::symbol_resolver() : m_impl(nullptr) {}
-	symbol_resolver::~symbol_resolver() {}
-	void symbol_resolver::set_search_path(const std::string&) {}
-	std::string symbol_resolver::symbolicate(const std::string& raw) { return raw; }
-
-#endif
 }
@@ -1,31 +1,97 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
 
 namespace owlcat
 {
 	/*
-		Resolves native "Module.dll+0xRVA" frames in a callstack text into
-		"Module.dll!Function+0xNN (file:line)" using DbgHelp against local PDBs/DLLs
-		found in a configured search path.
+		A source of symbols for native modules: resolves an address of a module (relative to
+		its load base) to "Function+0xNN", optionally followed by " (file:line)".
+
+		resolve may be called from any number of threads at once; a backend that can't run
+		lookups in parallel serializes them itself. set_search_path is never called while a
+		resolve is in progress (symbol_resolver guarantees it).
+	*/
+	class symbol_backend
+	{
+	public:
+		virtual ~symbol_backend() {}
+
+		// Sets the ';'-separated symbol search path and forgets any modules loaded so far,
+		// so they reload from the new path.
+		virtual void set_search_path(const std::string& path) = 0;
+
+		// Resolves an address of a module. Returns false if the module's symbols can't be
+		// found or none covers the address.
+		virtual bool resolve(const std::string& module, uint64_t rva, std::string& symbol) = 0;
+
+		// Describes the symbol files the backend would read for a module under the current
+		// search path (their paths, sizes and modification times), without loading them.
+		// Empty if it has none.
+		virtual std::string get_module_identity(const std::string& module) = 0;
+	};
+
+	/*
+		Reads symbol map files: text files listing the symbols of one module, a line per
+		symbol, in the perf map format:
+
+			START SIZE name
+
+		where START (the address relative to the module base) and SIZE are hexadecimal, with
+		or without "0x". A module's map is "<module>.map" or, without the module extension,
+		"<name>.map" in one of the search path directories (e.g. GameAssembly.dll.map). It is
+		loaded on the first reference to the module and sorted, then looked up by binary
+		search without locks. Available on every platform.
+	*/
+	std::unique_ptr<symbol_backend> create_symbol_map_backend();
+
+	// DbgHelp against local PDBs/DLLs. Windows only: returns nullptr elsewhere.
+	std::unique_ptr<symbol_backend> create_dbghelp_backend();
+
+	/*
+		Resolves native "Module.dll+0xRVA" callstack frames into
+		"Module.dll!Function+0xNN (file:line)" with the first of its backends that knows the
+		module: symbol maps, then DbgHelp on Windows.
 
 		Managed frames (already "Namespace.Class.Method") and markers ("<no stack>")
 		contain no "+0x" token and pass through unchanged.
 
-		Not thread-safe: a single owner thread (the client's symbolication thread) must
-		perform all calls, including set_search_path. PDBs are loaded lazily on first
-		reference to a module (the loading cost falls on that thread only).
+		Results are cached per module address, so the same frame is resolved once until the
+		search path changes. Thread-safe: frames can be symbolicated from any number of
+		threads; set_search_path waits for the resolutions in progress.
 	*/
 	class symbol_resolver
 	{
 	public:
+		// Uses the default backends (see above)
 		symbol_resolver();
+		// Uses the given backends, in order of preference
+		explicit symbol_resolver(std::vector<std::unique_ptr<symbol_backend>> backends);
 		~symbol_resolver();
 
-		// Sets the ';'-separated symbol search path (directories with PDBs/DLLs) and
-		// forgets any modules loaded so far, so they reload from the new path.
+		// Sets the ';'-separated symbol search path (directories with symbol maps and
+		// PDBs/DLLs) and forgets any modules and results so far.
 		void set_search_path(const std::string& path);
 
+		// Returns true if the frame (one callstack line) is a native frame to resolve
+		static bool is_native_frame(std::string_view frame);
+		// Returns the module of a native frame
+		static std::string_view get_frame_module(std::string_view frame);
+
+		// Identifies the symbols of a module under the current search path, for all backends:
+		// frames resolved against the same identity resolve the same, so their results can
+		// be kept (see the SymbolicatedFrames table).
+		std::string get_module_identity(const std::string& module);
+
+		// Symbolicates one callstack line, keeping its '\n' if it has one. Returns false,
+		// leaving display untouched, if it is not a native frame or its module's symbols
+		// can't be found.
+		bool symbolicate_frame(std::string_view frame, std::string& display);
+
 		// Returns the callstack text with its native frames symbolicated. If a module's
 		// symbols can't be found, its frames are left as "Module.dll+0xRVA".
 		std::string symbolicate(const std::string& raw);
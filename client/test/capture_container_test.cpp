@@ -0,0 +1,246 @@
+#include "capture_container.h"
+#include "file_view.h"
+#include "test_helpers.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace owlcat;
+
+/*
+	Capture journal test: writes a journal like a capture does (a stream, a database written
+	in place, a series appended to, a checkpoint every so often), then reads it back whole,
+	packed into a compressed container, cut short at many offsets, and with a byte damaged
+	in its records. Every read must give
+	exactly the entries as of the last checkpoint that is complete and intact in the file,
+	and fail if there is none. Run as
+
+		capture_container_test [checkpoint count]
+*/
+
+static const char* ENTRY_STREAM = "events";
+static const char* ENTRY_DATABASE = "database";
+static const char* ENTRY_SERIES = "series";
+
+// The entries as of a checkpoint, and where the checkpoint record ends in the file
+struct snapshot_t
+{
+	std::map<std::string, std::vector<uint8_t>> entries;
+	uint64_t checkpoint_end = 0;
+};
+
+static test_random g_random;
+
+static void random_bytes(std::vector<uint8_t>& data, size_t size)
+{
+	data.resize(size);
+	for (auto& byte : data)
+		byte = (uint8_t)g_random.next();
+}
+
+// Writes the journal, returning the entries at every checkpoint, the last one being the
+// one finalize writes
+static bool write_journal(const std::string& path, uint32_t checkpoint_count, std::vector<snapshot_t>& snapshots)
+{
+	capture_container::journal_writer journal;
+	if (!journal.create(path, ENTRY_STREAM))
+		return false;
+
+	std::map<std::string, std::vector<uint8_t>> entries;
+	entries[ENTRY_STREAM];
+	std::vector<uint8_t> data;
+	for (uint32_t c = 0; c <= checkpoint_count; ++c)
+	{
+		// The stream's writer appends to the file first: like in a capture, the other
+		// entries are only copied in right before the checkpoint
+		auto& stream = entries[ENTRY_STREAM];
+		for (int step = 0; step < 20; ++step)
+		{
+			random_bytes(data, 1 + (size_t)(g_random.next() % 4000));
+			if (fwrite(data.data(), 1, data.size(), journal.stream_file()) != data.size())
+				return false;
+			stream.insert(stream.end(), data.begin(), data.end());
+		}
+
+		// The database is written over and grows, and is cut down now and then; the series
+		// only grows
+		for (int step = 0; step < 20; ++step)
+		{
+			auto& database = entries[ENTRY_DATABASE];
+			const uint64_t offset = database.empty() ? 0 : g_random.next() % (database.size() + 1);
+			random_bytes(data, 1 + (size_t)(g_random.next() % 3000));
+			if (!journal.write(ENTRY_DATABASE, offset, data.data(), data.size()))
+				return false;
+			if (database.size() < offset + data.size())
+				database.resize((size_t)offset + data.size());
+			std::copy(data.begin(), data.end(), database.begin() + (size_t)offset);
+			if (g_random.next() % 10 == 0)
+			{
+				database.resize(database.size() / 2);
+				journal.truncate(ENTRY_DATABASE, database.size());
+			}
+
+			auto& series = entries[ENTRY_SERIES];
+			random_bytes(data, (size_t)(g_random.next() % 500));
+			if (!journal.write(ENTRY_SERIES, series.size(), data.data(), data.size()))
+				return false;
+			series.insert(series.end(), data.begin(), data.end());
+		}
+
+		// A checkpoint is followed by the header of the stream's next record, finalize by
+		// the end record: a record_t, then the checkpoint's offset
+		const bool last = c == checkpoint_count;
+		if (!(last ? journal.finalize() : journal.checkpoint()))
+			return false;
+
+		std::error_code ec;
+		snapshots.push_back({ entries, std::filesystem::file_size(path, ec) - (last ? 24 + 8 : 24) });
+	}
+	return true;
+}
+
+// Reads the container and checks it holds the snapshot's entries
+static bool matches(const std::string& path, const snapshot_t& snapshot)
+{
+	std::map<std::string, file_range> ranges;
+	if (!capture_container::read_directory(path, ranges) || ranges.size() != snapshot.entries.size())
+		return false;
+
+	for (auto& entry : snapshot.entries)
+	{
+		auto range = ranges.find(entry.first);
+		if (range == ranges.end())
+			return false;
+
+		file_view view;
+		if (!view.open(range->second) || view.size() != entry.second.size())
+			return false;
+		const uint8_t* data = view.read(0, entry.second.size());
+		if (data == nullptr || !std::equal(entry.second.begin(), entry.second.end(), data))
+			return false;
+	}
+	return true;
+}
+
+// Checks a damaged copy of the journal: it must read as the expected snapshot, or fail to
+// read if expected is null
+static bool check_copy(const std::string& path, const snapshot_t* expected, const char* damage, uint64_t offset)
+{
+	std::map<std::string, file_range> ranges;
+	const bool ok = expected != nullptr ? matches(path, *expected) : !capture_container::read_directory(path, ranges);
+	if (!ok)
+		printf("FAILED: journal %s at %llu\n", damage, (unsigned long long)offset);
+	return ok;
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t checkpoint_count = argc > 1 ? (uint32_t)strtoul(argv[1], nullptr, 10) : 8;
+	if (checkpoint_count == 0)
+	{
+		printf("Usage: capture_container_test [checkpoint count]\n");
+		return 1;
+	}
+
+	std::error_code ec;
+	const auto dir = std::filesystem::temp_directory_path(ec) / "owlcat_capture_container_test";
+	std::filesystem::remove_all(dir, ec);
+	std::filesystem::create_directories(dir, ec);
+	const std::string path = (dir / "capture.owl").string();
+	const std::string copy_path = (dir / "damaged.owl").string();
+
+	std::vector<snapshot_t> snapshots;
+	if (!write_journal(path, checkpoint_count, snapshots))
+	{
+		printf("FAILED: can't write the journal\n");
+		return 1;
+	}
+
+	const uint64_t size = std::filesystem::file_size(path, ec);
+	int result = 0;
+	if (!matches(path, snapshots.back()))
+	{
+		printf("FAILED: the finalized journal doesn't read back as written\n");
+		result = 1;
+	}
+
+	// Packed into a container, compressed, as saving to another volume does
+	std::map<std::string, file_range> ranges;
+	const std::string packed_path = (dir / "packed.owl").string();
+	if (!capture_container::read_directory(path, ranges) || !capture_container::pack(packed_path, ranges, { ENTRY_STREAM, ENTRY_SERIES }) ||
+		!matches(packed_path, snapshots.back()))
+	{
+		printf("FAILED: the packed journal doesn't read back as written\n");
+		result = 1;
+	}
+
+	// Cut short: at even steps through the file, and around the end of every checkpoint
+	std::vector<uint64_t> cuts;
+	for (uint64_t i = 0; i < 64; ++i)
+		cuts.push_back(size * i / 64);
+	for (auto& snapshot : snapshots)
+	{
+		cuts.push_back(snapshot.checkpoint_end - 1);
+		cuts.push_back(snapshot.checkpoint_end);
+		cuts.push_back(snapshot.checkpoint_end + 1);
+	}
+	cuts.push_back(size - 1);
+
+	size_t checked = 0;
+	for (uint64_t cut : cuts)
+	{
+		const snapshot_t* expected = nullptr;
+		for (auto& snapshot : snapshots)
+		{
+			if (snapshot.checkpoint_end <= cut)
+				expected = &snapshot;
+		}
+
+		std::filesystem::copy_file(path, copy_path, std::filesystem::copy_options::overwrite_existing, ec);
+		std::filesystem::resize_file(copy_path, cut, ec);
+		if (!check_copy(copy_path, expected, "cut", cut))
+			result = 1;
+		++checked;
+	}
+
+	// Damaged: a byte of a record, in the whole journal or in one cut short by a byte (no
+	// longer finalized, so that it is scanned)
+	auto damage = [&](uint64_t offset, bool cut, const snapshot_t* expected, const char* what)
+	{
+		std::filesystem::copy_file(path, copy_path, std::filesystem::copy_options::overwrite_existing, ec);
+		if (cut)
+			std::filesystem::resize_file(copy_path, size - 1, ec);
+		if (FILE* file = fopen(copy_path.c_str(), "r+b"))
+		{
+			uint8_t byte = 0;
+			if (seek_file(file, offset) && fread(&byte, 1, 1, file) == 1)
+			{
+				byte ^= 0x5A;
+				seek_file(file, offset);
+				fwrite(&byte, 1, 1, file);
+			}
+			fclose(file);
+		}
+		if (!check_copy(copy_path, expected, what, offset))
+			result = 1;
+		++checked;
+	};
+
+	// The end record: the journal is scanned, and the last checkpoint is intact
+	damage(size - 1, false, &snapshots.back(), "end record damaged");
+	// The last checkpoint: the one before it is read
+	damage(snapshots.back().checkpoint_end - 1, false, &snapshots[snapshots.size() - 2], "last checkpoint damaged");
+	// The header of the stream record after each checkpoint: the scan stops there
+	for (size_t i = 0; i + 1 < snapshots.size(); ++i)
+		damage(snapshots[i].checkpoint_end, true, &snapshots[i], "record header damaged");
+
+	printf("%u checkpoints, %llu bytes: %zu damaged copies checked\n", checkpoint_count, (unsigned long long)size, checked);
+
+	std::filesystem::remove_all(dir, ec);
+	return result;
+}
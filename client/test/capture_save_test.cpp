@@ -0,0 +1,316 @@
+#include "mono_profiler_client.h"
+#include "capture_container.h"
+#include "network.h"
+#include "persistent_storage.h"
+#include "spool_file.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "memory_writer.h"
+
+using namespace owlcat;
+
+/*
+	Capture save test: imports a spool whose callstacks have native frames, resolved
+	against a symbol map, and saves the capture. The saved capture is opened and saved
+	again (a snapshot of an opened capture, written while its database is open), and so is
+	a copy of it as saved before the symbolication tables existed, which is migrated when
+	opened. Every capture must open with its callstacks symbolicated, and every saved
+	database must hold the results. Run as
+
+		capture_save_test [callstack count]
+*/
+
+static const char* MODULE_NAME = "GameAssembly.dll";
+static const uint64_t SYMBOL_START = 0x1000;
+static const uint64_t SYMBOL_SIZE = 0x100;
+static const double SYMBOLICATION_TIMEOUT = 30.0;
+
+// Callstack i is a managed frame called by function i of the module
+static std::string native_frame(uint64_t i)
+{
+	char text[64];
+	snprintf(text, sizeof(text), "%s+0x%llX\n", MODULE_NAME, (unsigned long long)(SYMBOL_START + i * SYMBOL_SIZE + 0x10));
+	return text;
+}
+
+static std::string managed_frame(uint64_t i)
+{
+	return "Game.Behaviour" + std::to_string(i) + ".Update()\n";
+}
+
+static std::string expected_callstack(uint64_t i)
+{
+	return managed_frame(i) + MODULE_NAME + "!Game_Function" + std::to_string(i) + "+0x10\n";
+}
+
+static bool write_map(const std::string& path, uint64_t callstack_count)
+{
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == nullptr)
+		return false;
+	for (uint64_t i = 0; i < callstack_count; ++i)
+		fprintf(file, "%llx %llx Game_Function%llu\n", (unsigned long long)(SYMBOL_START + i * SYMBOL_SIZE), (unsigned long long)SYMBOL_SIZE, (unsigned long long)i);
+	return fclose(file) == 0;
+}
+
+static void write(spool_writer& spool, protocol::message type, const std::vector<uint8_t>& data)
+{
+	spool.write_message(type, (uint32_t)data.size(), data.data());
+}
+
+// A type, the frames and callstacks, and an allocation from every callstack in a frame
+// of its own, like the server sends them
+static bool write_spool(const std::string& prefix, uint64_t callstack_count)
+{
+	spool_writer spool;
+	if (!spool.open(prefix))
+		return false;
+
+	std::vector<uint8_t> data;
+	{
+		memory_writer writer(data);
+		writer.write_varint(0);
+		writer.write_string("Game.Component");
+		write(spool, protocol::message::SRV_TYPE, data);
+	}
+
+	for (uint64_t i = 0; i < callstack_count; ++i)
+	{
+		const std::string frames[2] = { managed_frame(i), native_frame(i) };
+		for (uint64_t f = 0; f < 2; ++f)
+		{
+			data.clear();
+			memory_writer writer(data);
+			writer.write_varint(i * 2 + f);
+			writer.write_string(frames[f].c_str());
+			write(spool, protocol::message::SRV_FRAME, data);
+		}
+
+		data.clear();
+		{
+			memory_writer writer(data);
+			writer.write_varint(i);
+			writer.write_varint(2);
+			writer.write_varint(i * 2);
+			writer.write_varint(i * 2 + 1);
+			write(spool, protocol::message::SRV_CALLSTACK, data);
+		}
+
+		data.clear();
+		memory_writer writer(data);
+		writer.write_uint64(i);
+		writer.write_uint64(0x10000 + i * 64);
+		writer.write_uint32(64);
+		writer.write_varint(0);
+		writer.write_varint(i);
+		write(spool, protocol::message::SRV_ALLOC, data);
+	}
+
+	spool.close();
+	return !spool.has_failed();
+}
+
+// Waits for the callstacks of the open capture to be symbolicated: resolved in the
+// background, or restored from the capture
+static bool wait_for_symbols(mono_profiler_client& client, uint64_t callstack_count, const char* what)
+{
+	std::vector<std::string> expected;
+	for (uint64_t i = 0; i < callstack_count; ++i)
+		expected.push_back(expected_callstack(i));
+	std::sort(expected.begin(), expected.end());
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::string> callstacks;
+	while (true)
+	{
+		// Client callstack ids are not the server's: compare the texts as a set
+		callstacks.clear();
+		for (uint64_t id = 0; id < callstack_count; ++id)
+			callstacks.push_back(client.get_data()->get_callstack(id));
+		std::sort(callstacks.begin(), callstacks.end());
+		if (callstacks == expected)
+			return true;
+
+		if (std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() > SYMBOLICATION_TIMEOUT)
+			break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	printf("FAILED: %s: callstacks are not symbolicated, e.g. \"%s\"\n", what, callstacks.empty() ? "" : callstacks.front().c_str());
+	return false;
+}
+
+// Extracts the database of a saved capture
+static bool extract_database(const std::string& container_path, const std::string& db_path)
+{
+	std::map<std::string, file_range> entries;
+	if (!capture_container::read_directory(container_path, entries))
+		return false;
+	auto db_entry = entries.find(capture_container::entry_database);
+	return db_entry != entries.end() && capture_container::extract(db_entry->second, db_path);
+}
+
+// Checks the saved capture's database holds a result for every native frame, and the
+// identity of the module's symbols
+static bool check_saved(const std::string& container_path, const std::string& db_path, uint64_t callstack_count, const char* what)
+{
+	persistent_storage::persistent_storage db;
+	if (!extract_database(container_path, db_path) || !db.open(db_path, false))
+	{
+		printf("FAILED: %s: can't open the saved database\n", what);
+		return false;
+	}
+
+	uint64_t resolved = 0;
+	auto frames = db.query_data_immediate("SELECT text FROM SymbolicatedFrames;", {});
+	while (frames.next())
+	{
+		if (frames.get_string("text").find(std::string(MODULE_NAME) + "!Game_Function") == 0)
+			++resolved;
+	}
+
+	std::string identity;
+	auto modules = db.query_data_immediate("SELECT identity FROM SymbolModules WHERE module = :module;", { { "module", std::string(MODULE_NAME) } });
+	if (modules.next())
+		identity = modules.get_string("identity");
+
+	if (resolved != callstack_count || identity.empty())
+	{
+		printf("FAILED: %s: %llu of %llu frames saved resolved, module identity \"%s\"\n", what, (unsigned long long)resolved,
+			(unsigned long long)callstack_count, identity.c_str());
+		return false;
+	}
+	return true;
+}
+
+// Opens a saved capture, waits for its symbols and saves it to another file, which
+// snapshots the open database
+static bool reopen_and_save(const std::string& symbol_dir, const std::string& path, const std::string& saved_path, uint64_t callstack_count, const char* what)
+{
+	mono_profiler_client client;
+	client.set_symbol_paths(symbol_dir);
+	if (!client.open_data(path))
+	{
+		printf("FAILED: %s: can't open the capture\n", what);
+		return false;
+	}
+	if (!wait_for_symbols(client, callstack_count, what))
+		return false;
+	if (!client.save_db(saved_path, false))
+	{
+		printf("FAILED: %s: can't save the capture\n", what);
+		return false;
+	}
+
+	// The database is still open and readable after the save: every object allocated is
+	// alive, found through the database's frame index
+	std::vector<live_object> objects;
+	client.get_data()->get_live_objects(objects, 0, (int)callstack_count - 1, [](size_t, size_t) { return true; });
+	client.close_db();
+	if (objects.size() != callstack_count)
+	{
+		printf("FAILED: %s: %zu live objects after the save, expected %llu\n", what, objects.size(), (unsigned long long)callstack_count);
+		return false;
+	}
+	return true;
+}
+
+// Makes a copy of a saved capture as it would have been saved before the symbolication
+// tables were added: without them, and without their migration
+static bool make_old_capture(const std::string& path, const std::string& db_path, const std::string& old_path)
+{
+	{
+		persistent_storage::persistent_storage db;
+		if (!extract_database(path, db_path) || !db.open(db_path, false) ||
+			!db.query_immediate("DROP TABLE SymbolicatedFrames;", {}) ||
+			!db.query_immediate("DROP TABLE SymbolModules;", {}) ||
+			!db.query_immediate("DELETE FROM db_migrations WHERE identifier = 'Add symbolication tables';", {}))
+			return false;
+	}
+
+	std::map<std::string, file_range> entries;
+	if (!capture_container::read_directory(path, entries))
+		return false;
+	entries[capture_container::entry_database] = file_range(db_path);
+	return capture_container::pack(old_path, entries);
+}
+
+int main(int argc, char** argv)
+{
+	uint64_t callstack_count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 64;
+	if (callstack_count == 0)
+	{
+		printf("Usage: capture_save_test [callstack count]\n");
+		return 1;
+	}
+
+	std::error_code ec;
+	const auto dir = std::filesystem::temp_directory_path(ec) / "owlcat_capture_save_test";
+	std::filesystem::remove_all(dir, ec);
+	std::filesystem::create_directories(dir, ec);
+	const std::string symbol_dir = dir.string();
+	const std::string spool_prefix = (dir / "capture").string();
+	const std::string capture_path = (dir / "capture.owl").string();
+	const std::string saved_path = (dir / "saved.owl").string();
+	const std::string resaved_path = (dir / "resaved.owl").string();
+	const std::string old_path = (dir / "old.owl").string();
+	const std::string old_resaved_path = (dir / "old_resaved.owl").string();
+	const std::string db_path = (dir / "database.db").string();
+	const std::string old_db_path = (dir / "old_database.db").string();
+
+	if (!write_map((dir / (std::string(MODULE_NAME) + ".map")).string(), callstack_count) || !write_spool(spool_prefix, callstack_count))
+	{
+		printf("FAILED: can't write the symbol map and the spool\n");
+		return 1;
+	}
+
+	int result = 0;
+	{
+		mono_profiler_client client;
+		client.set_symbol_paths(symbol_dir);
+		if (!client.import_spool(spool_prefix, capture_path, false))
+		{
+			printf("FAILED: can't import the spool\n");
+			return 1;
+		}
+		client.stop();
+
+		if (!wait_for_symbols(client, callstack_count, "capture") || !client.save_db(saved_path, true))
+		{
+			printf("FAILED: can't save the capture\n");
+			return 1;
+		}
+		client.close_db();
+	}
+	if (!check_saved(saved_path, db_path, callstack_count, "saved capture"))
+		result = 1;
+
+	// An opened capture saved to another file
+	if (!reopen_and_save(symbol_dir, saved_path, resaved_path, callstack_count, "opened capture") ||
+		!check_saved(resaved_path, db_path, callstack_count, "opened capture saved"))
+		result = 1;
+
+	// A capture saved before the symbolication tables: migrated, which opens it extracted
+	if (!make_old_capture(saved_path, old_db_path, old_path))
+	{
+		printf("FAILED: can't make the old capture\n");
+		result = 1;
+	}
+	else if (!reopen_and_save(symbol_dir, old_path, old_resaved_path, callstack_count, "old capture") ||
+		!check_saved(old_resaved_path, db_path, callstack_count, "old capture saved"))
+		result = 1;
+
+	printf("%llu callstacks: saved, opened and saved, migrated and saved\n", (unsigned long long)callstack_count);
+
+	std::filesystem::remove_all(dir, ec);
+	return result;
+}
@@ -0,0 +1,204 @@
+#include "mono_profiler_client.h"
+#include "network.h"
+#include "spool_file.h"
+#include "test_helpers.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "memory_writer.h"
+
+using namespace owlcat;
+
+/*
+	Client ingestion benchmark: measures the sustained rate at which the client stores
+	incoming events (decode, id translation, event log and database writes), without a
+	game or a network in the way. A synthetic server stream is written to a spool first,
+	then imported exactly like a live capture. Run as
+
+		client_ingest_benchmark [event count] [events per frame]
+
+	The reported rate counts events published to the database, i.e. fully stored.
+*/
+
+static const uint64_t TYPE_COUNT = 2000;
+static const uint64_t CALLSTACK_COUNT = 20000;
+static const uint64_t FRAMES_PER_CALLSTACK = 12;
+static const uint64_t FRAME_COUNT = 5000;
+
+static void write(spool_writer& spool, protocol::message type, const std::vector<uint8_t>& data)
+{
+	spool.write_message(type, (uint32_t)data.size(), data.data());
+}
+
+static bool write_spool(const std::string& prefix, uint64_t event_count, uint64_t events_per_frame)
+{
+	spool_writer spool;
+	if (!spool.open(prefix))
+		return false;
+
+	std::vector<uint8_t> data;
+	test_random rng;
+
+	// Definitions go out on first use, like the server does
+	std::vector<bool> type_defined(TYPE_COUNT, false);
+	std::vector<bool> callstack_defined(CALLSTACK_COUNT, false);
+	std::vector<bool> frame_defined(FRAME_COUNT, false);
+
+	// Live allocations to free later, so the stream has a realistic alloc/free mix
+	std::vector<std::pair<uint64_t, uint32_t>> live;
+	uint64_t next_addr = 0x10000;
+
+	for (uint64_t i = 0; i < event_count; ++i)
+	{
+		uint64_t frame = i / events_per_frame;
+
+		if (!live.empty() && rng.next() % 2 == 0)
+		{
+			size_t index = rng.next() % live.size();
+			auto object = live[index];
+			live[index] = live.back();
+			live.pop_back();
+
+			data.clear();
+			memory_writer writer(data);
+			writer.write_uint64(frame);
+			writer.write_uint64(object.first);
+			writer.write_uint32(object.second);
+			write(spool, protocol::message::SRV_FREE, data);
+			continue;
+		}
+
+		uint64_t type_id = rng.next() % TYPE_COUNT;
+		uint64_t callstack_id = rng.next() % CALLSTACK_COUNT;
+
+		if (!type_defined[type_id])
+		{
+			type_defined[type_id] = true;
+			std::string name = "Benchmark.Type" + std::to_string(type_id);
+			data.clear();
+			memory_writer writer(data);
+			writer.write_varint(type_id);
+			writer.write_string(name.c_str());
+			write(spool, protocol::message::SRV_TYPE, data);
+		}
+
+		if (!callstack_defined[callstack_id])
+		{
+			callstack_defined[callstack_id] = true;
+			std::vector<uint64_t> frames;
+			for (uint64_t f = 0; f < FRAMES_PER_CALLSTACK; ++f)
+			{
+				uint64_t frame_id = (callstack_id * 7 + f * 13) % FRAME_COUNT;
+				if (!frame_defined[frame_id])
+				{
+					frame_defined[frame_id] = true;
+					std::string text = "Benchmark.Class" + std::to_string(frame_id) + ".Method()\n";
+					data.clear();
+					memory_writer writer(data);
+					writer.write_varint(frame_id);
+					writer.write_string(text.c_str());
+					write(spool, protocol::message::SRV_FRAME, data);
+				}
+				frames.push_back(frame_id);
+			}
+
+			data.clear();
+			memory_writer writer(data);
+			writer.write_varint(callstack_id);
+			writer.write_varint(frames.size());
+			for (auto frame_id : frames)
+				writer.write_varint(frame_id);
+			write(spool, protocol::message::SRV_CALLSTACK, data);
+		}
+
+		uint32_t size = 16 + (uint32_t)(rng.next() % 256);
+		uint64_t addr = next_addr;
+		next_addr += size;
+		live.push_back({ addr, size });
+
+		data.clear();
+		memory_writer writer(data);
+		writer.write_uint64(frame);
+		writer.write_uint64(addr);
+		writer.write_uint32(size);
+		writer.write_varint(type_id);
+		writer.write_varint(callstack_id);
+		write(spool, protocol::message::SRV_ALLOC, data);
+	}
+
+	spool.close();
+	return !spool.has_failed();
+}
+
+static void remove_files(const std::filesystem::path& dir, const std::string& stem)
+{
+	std::error_code ec;
+	for (auto& entry : std::filesystem::directory_iterator(dir, ec))
+	{
+		if (entry.path().filename().string().rfind(stem, 0) == 0)
+			std::filesystem::remove(entry.path(), ec);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	uint64_t event_count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 10000000;
+	uint64_t events_per_frame = argc > 2 ? strtoull(argv[2], nullptr, 10) : 20000;
+	if (event_count == 0 || events_per_frame == 0)
+	{
+		printf("Usage: client_ingest_benchmark [event count] [events per frame]\n");
+		return 1;
+	}
+
+	std::error_code ec;
+	auto dir = std::filesystem::temp_directory_path(ec);
+	const std::string stem = "owlcat_ingest_benchmark";
+	const std::string spool_prefix = (dir / stem).string();
+	const std::string db_file_name = (dir / (stem + ".db")).string();
+	remove_files(dir, stem);
+
+	auto write_start = std::chrono::steady_clock::now();
+	if (!write_spool(spool_prefix, event_count, events_per_frame))
+	{
+		printf("Failed to write the spool at %s\n", spool_prefix.c_str());
+		return 1;
+	}
+	double write_seconds = seconds_since(write_start);
+	printf("Spool with %llu events written in %.2f s\n", (unsigned long long)event_count, write_seconds);
+
+	int result = 0;
+	{
+		mono_profiler_client client;
+
+		auto start = std::chrono::steady_clock::now();
+		if (!client.import_spool(spool_prefix, db_file_name, false))
+		{
+			printf("Failed to import the spool\n");
+			return 1;
+		}
+		// Without follow, stop waits until the whole spool is stored
+		client.stop();
+		double seconds = seconds_since(start);
+
+		uint64_t stored = client.get_db_inserted_events_count();
+		printf("Ingested %llu events in %.2f s: %.2f M events/s\n", (unsigned long long)stored, seconds, stored / seconds / 1e6);
+		printf("Database rows written in %llu transactions\n", (unsigned long long)client.get_db_commits_count());
+
+		if (stored != event_count)
+		{
+			printf("FAILED: %llu events were written, but %llu were stored\n", (unsigned long long)event_count, (unsigned long long)stored);
+			result = 1;
+		}
+
+		client.close_db();
+	}
+
+	remove_files(dir, stem);
+	return result;
+}
@@ -0,0 +1,189 @@
+#include "capture_container.h"
+#include "event_log.h"
+#include "live_objects_replay.h"
+#include "test_helpers.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace owlcat;
+
+/*
+	Capture container benchmark: generates a synthetic event log, packs it into a container
+	as is and block-compressed, and reports the compression ratio and packing time, the
+	latency of frame range queries (what scrubbing the timeline does), and the throughput
+	of the live-objects replay of the whole log on 1, 2, 4... threads, up to the number of
+	cores, for both. Every query must see the same events in both containers. Run as
+
+		container_benchmark [event count] [events per frame] [max threads]
+
+	"cold" queries evict the container from the page cache first (Linux only), which is
+	what opening a capture from a network share or a slow disk looks like.
+*/
+
+// Random frame ranges queried per range length
+static const int RANGE_QUERIES = 200;
+
+// Reads frames [first_frame, first_frame + frame_count) with a new reader, like the
+// client does for every query. Returns the time taken, or a negative value on errors.
+static double range_query_seconds(const file_range& log, const std::vector<uint64_t>& boundaries, size_t first_frame, size_t frame_count, bool cold, uint64_t& checksum)
+{
+	if (cold)
+		evict_from_cache(log.path);
+
+	auto start = std::chrono::steady_clock::now();
+	auto reader = event_log_reader::open(log);
+	if (reader == nullptr)
+		return -1.0;
+
+	bool ok = reader->visit_range(boundaries[first_frame], boundaries[first_frame + frame_count], [&](const event_view& e)
+	{
+		checksum += e.addr ^ e.size ^ e.type_id ^ e.frame;
+		return true;
+	});
+	return ok ? seconds_since(start) : -1.0;
+}
+
+int main(int argc, char** argv)
+{
+	uint64_t event_count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 50000000;
+	uint64_t events_per_frame = argc > 2 ? strtoull(argv[2], nullptr, 10) : 20000;
+	size_t max_threads = argc > 3 ? (size_t)strtoull(argv[3], nullptr, 10) : std::max<size_t>(std::thread::hardware_concurrency(), 1);
+	if (event_count == 0 || events_per_frame == 0 || max_threads == 0)
+	{
+		printf("Usage: container_benchmark [event count] [events per frame] [max threads]\n");
+		return 1;
+	}
+
+	std::error_code ec;
+	auto dir = std::filesystem::temp_directory_path(ec);
+	const std::string log_path = (dir / "owlcat_container_benchmark.events").string();
+	const std::string raw_path = (dir / "owlcat_container_benchmark_raw.owl").string();
+	const std::string compressed_path = (dir / "owlcat_container_benchmark_compressed.owl").string();
+
+	printf("Generating %llu events, %llu per frame\n", (unsigned long long)event_count, (unsigned long long)events_per_frame);
+	std::vector<uint64_t> boundaries;
+	if (!write_log(log_path, event_count, events_per_frame, heap_model::skewed_callstacks, boundaries))
+	{
+		printf("Failed to write the event log\n");
+		return 1;
+	}
+
+	const std::map<std::string, file_range> files = { { capture_container::entry_events, file_range(log_path) } };
+	struct container_t
+	{
+		const char* name;
+		std::string path;
+		bool compressed;
+		file_range log;
+	};
+	container_t containers[] = { { "raw       ", raw_path, false, {} }, { "compressed", compressed_path, true, {} } };
+
+	const uint64_t log_size = std::filesystem::file_size(log_path, ec);
+	for (auto& container : containers)
+	{
+		auto start = std::chrono::steady_clock::now();
+		std::set<std::string> compress;
+		if (container.compressed)
+			compress.insert(capture_container::entry_events);
+		std::map<std::string, file_range> entries;
+		if (!capture_container::pack(container.path, files, compress) || !capture_container::read_directory(container.path, entries))
+		{
+			printf("Failed to pack the %s container\n", container.name);
+			return 1;
+		}
+		const double pack_time = seconds_since(start);
+
+		container.log = entries[capture_container::entry_events];
+		printf("%s: event log %.1f MB -> %.1f MB (ratio %.2f, %.2f bytes/event), packed in %.2f s (%.0f MB/s)\n",
+			container.name, log_size / (1024.0 * 1024.0), container.log.size / (1024.0 * 1024.0), (double)log_size / container.log.size,
+			(double)container.log.size / event_count, pack_time, log_size / (1024.0 * 1024.0) / pack_time);
+	}
+	std::filesystem::remove(log_path, ec);
+
+	int result = 0;
+
+	// Frame range queries: the same random ranges in both containers
+	for (size_t range_frames : { (size_t)1, (size_t)10, (size_t)100 })
+	{
+		const size_t frame_count = boundaries.size() - 1;
+		if (range_frames > frame_count)
+			break;
+
+		for (bool cold : { false, true })
+		{
+			uint64_t checksums[2] = {};
+			double latencies[2][RANGE_QUERIES] = {};
+			for (size_t c = 0; c < 2; ++c)
+			{
+				uint64_t seed = 12345;
+				for (int query = 0; query < RANGE_QUERIES; ++query)
+				{
+					seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+					const size_t first_frame = (size_t)((seed >> 33) % (frame_count - range_frames + 1));
+					latencies[c][query] = range_query_seconds(containers[c].log, boundaries, first_frame, range_frames, cold, checksums[c]);
+					if (latencies[c][query] < 0)
+					{
+						printf("FAILED: %s range query\n", containers[c].name);
+						return 1;
+					}
+				}
+			}
+
+			if (checksums[0] != checksums[1])
+			{
+				printf("FAILED: range queries of %zu frames see different events\n", range_frames);
+				result = 1;
+			}
+
+			for (size_t c = 0; c < 2; ++c)
+			{
+				std::sort(latencies[c], latencies[c] + RANGE_QUERIES);
+				double total = 0;
+				for (double latency : latencies[c])
+					total += latency;
+				printf("%s: %zu frame range queries (%s): mean %.3f ms, median %.3f ms, p99 %.3f ms\n",
+					containers[c].name, range_frames, cold ? "cold" : "warm", total / RANGE_QUERIES * 1000.0,
+					latencies[c][RANGE_QUERIES / 2] * 1000.0, latencies[c][RANGE_QUERIES * 99 / 100] * 1000.0);
+			}
+		}
+	}
+
+	// Live-objects replay of the whole log, split at frame boundaries: each thread only
+	// decompresses the blocks of its frames
+	std::vector<live_object> expected;
+	for (size_t threads = 1; threads <= max_threads; threads *= 2)
+	{
+		for (auto& container : containers)
+		{
+			std::vector<live_object> objects;
+			auto start = std::chrono::steady_clock::now();
+			if (!replay_live_objects(container.log, boundaries, threads, objects, nullptr))
+			{
+				printf("FAILED: %s replay\n", container.name);
+				return 1;
+			}
+			const double time = seconds_since(start);
+			printf("%s: replay on %zu threads %.2f s, %.1f M events/s\n", container.name, threads, time, event_count / time / 1e6);
+
+			if (expected.empty())
+				expected = objects;
+			else if (objects.size() != expected.size() || !std::equal(objects.begin(), objects.end(), expected.begin(), [](const live_object& a, const live_object& b)
+				{ return a.addr == b.addr && a.size == b.size && a.type_id == b.type_id && a.callstack_id == b.callstack_id; }))
+			{
+				printf("FAILED: %s replay on %zu threads has different live objects\n", container.name, threads);
+				result = 1;
+			}
+		}
+	}
+
+	std::filesystem::remove(raw_path, ec);
+	std::filesystem::remove(compressed_path, ec);
+	return result;
+}
@@ -0,0 +1,353 @@
+#include "event_log.h"
+#include "memory_writer.h"
+#include "test_helpers.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+using namespace owlcat;
+
+/*
+	Event log benchmark: generates a synthetic capture (a realistic alloc/free mix over a
+	growing heap), writes it in the current event log format and, for reference, in format
+	versions 1 and 2, checks that all read back exactly, and reports size, full replay throughput
+	(per-event callback, batched visitor, and batched visitor without memory mapping) and
+	the throughput of a scan for the allocations of one type. Run as
+
+		event_log_benchmark [event count] [events per frame]
+
+	268M events make a 10 GB capture in format version 1. Events are generated on the fly,
+	so any count fits in memory. "cold" reads evict the file from the page cache first
+	(Linux only), which is what reading a capture bigger than RAM looks like.
+*/
+
+// The type the scan looks for: a phase type, allocated in a few percent of the frames
+static const uint64_t SCANNED_TYPE = event_generator::COMMON_TYPES + 500;
+
+// Format version 1, as documented in event_log.cpp: the reference for size and speed
+#pragma pack(push, 1)
+struct header_v1
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint8_t reserved[16];
+};
+
+struct record_v1
+{
+	uint64_t frame;
+	uint64_t addr;
+	uint64_t type_id;
+	uint64_t callstack_id;
+	uint32_t size;
+	uint32_t event_type;
+};
+
+// Format version 2, as documented in event_log.cpp
+struct block_header_v2
+{
+	uint32_t block_size;
+	uint32_t event_count;
+	uint64_t first_frame;
+};
+#pragma pack(pop)
+
+// Writes format version 2, one block per frame (at most 64K events), like the writer did
+class event_log_writer_v2
+{
+	FILE* m_file = nullptr;
+	std::vector<uint8_t> m_events;
+	uint32_t m_event_count = 0;
+	uint64_t m_first_frame = 0;
+	uint64_t m_prev_frame = 0;
+	uint64_t m_prev_addr = 0;
+
+public:
+	bool create(const std::string& path)
+	{
+		m_file = fopen(path.c_str(), "wb");
+		if (m_file == nullptr)
+			return false;
+
+		header_v1 header = {};
+		memcpy(header.magic, "OWLEVTS", 8);
+		header.version = 2;
+		return fwrite(&header, sizeof(header), 1, m_file) == 1;
+	}
+
+	void append(const event_view& e)
+	{
+		if (m_event_count == 0)
+		{
+			m_first_frame = m_prev_frame = e.frame;
+			m_prev_addr = 0;
+		}
+
+		memory_writer writer(m_events);
+		writer.write_varint((e.frame - m_prev_frame) << 1 | (e.is_alloc ? 1 : 0));
+		const int64_t delta = (int64_t)(e.addr - m_prev_addr);
+		writer.write_varint((uint64_t)(delta << 1) ^ (uint64_t)(delta >> 63));
+		writer.write_varint(e.size);
+		if (e.is_alloc)
+		{
+			writer.write_varint(e.type_id);
+			writer.write_varint(e.callstack_id);
+		}
+		m_prev_frame = e.frame;
+		m_prev_addr = e.addr;
+
+		if (++m_event_count == 64 * 1024)
+			flush();
+	}
+
+	bool flush()
+	{
+		if (m_event_count == 0)
+			return true;
+
+		block_header_v2 header = { (uint32_t)(sizeof(header) + m_events.size() + sizeof(uint32_t)), m_event_count, m_first_frame };
+		bool ok = fwrite(&header, sizeof(header), 1, m_file) == 1
+			&& fwrite(m_events.data(), 1, m_events.size(), m_file) == m_events.size()
+			&& fwrite(&header.block_size, sizeof(header.block_size), 1, m_file) == 1;
+		m_events.clear();
+		m_event_count = 0;
+		return ok;
+	}
+
+	bool close()
+	{
+		bool ok = flush();
+		fclose(m_file);
+		return ok;
+	}
+};
+
+static bool write_logs(const std::string& path, const std::string& v1_path, const std::string& v2_path, uint64_t event_count, uint64_t events_per_frame)
+{
+	event_log_writer writer;
+	if (!writer.create(path))
+		return false;
+
+	event_log_writer_v2 writer_v2;
+	if (!writer_v2.create(v2_path))
+		return false;
+
+	FILE* file = fopen(v1_path.c_str(), "wb");
+	if (file == nullptr)
+		return false;
+
+	header_v1 header = {};
+	memcpy(header.magic, "OWLEVTS", 8);
+	header.version = 1;
+	header.record_size = sizeof(record_v1);
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+	std::vector<record_v1> records;
+	records.reserve(64 * 1024);
+
+	event_generator generator(event_count, events_per_frame, heap_model::phased_types);
+	event_view e;
+	uint64_t frame = 0;
+	while (ok && generator.next(e))
+	{
+		// Flush on every frame boundary, like the client does
+		if (e.frame != frame)
+		{
+			writer.flush();
+			ok = writer_v2.flush();
+			frame = e.frame;
+		}
+		writer.append(e.frame, e.addr, e.type_id, e.callstack_id, e.size, e.is_alloc);
+		writer_v2.append(e);
+
+		records.push_back({ e.frame, e.addr, e.type_id, e.callstack_id, e.size, e.is_alloc ? 1u : 2u });
+		if (records.size() == records.capacity())
+		{
+			ok = fwrite(records.data(), sizeof(record_v1), records.size(), file) == records.size();
+			records.clear();
+		}
+	}
+
+	if (ok && !records.empty())
+		ok = fwrite(records.data(), sizeof(record_v1), records.size(), file) == records.size();
+
+	fclose(file);
+	ok = writer_v2.close() && ok;
+	return writer.flush() && ok;
+}
+
+// Replays the whole log, checking every event against the generated ones
+static bool verify(const std::string& path, uint64_t event_count, uint64_t events_per_frame)
+{
+	auto reader = event_log_reader::open(path);
+	if (reader == nullptr)
+		return false;
+
+	event_generator generator(event_count, events_per_frame, heap_model::phased_types);
+	uint64_t index = 0;
+	bool ok = reader->read_range(reader->begin_offset(), reader->end_offset(), [&](const event_view& e)
+	{
+		event_view expected;
+		if (!generator.next(expected))
+			return false;
+		++index;
+		return e.frame == expected.frame && e.addr == expected.addr && e.size == expected.size && e.is_alloc == expected.is_alloc
+			&& (!e.is_alloc || (e.type_id == expected.type_id && e.callstack_id == expected.callstack_id));
+	});
+
+	return ok && index == event_count && reader->count_events(reader->begin_offset(), reader->end_offset()) == event_count;
+}
+
+enum class replay_mode
+{
+	callback,
+	visitor,
+	visitor_buffered,
+};
+
+static double replay_seconds(const std::string& path, replay_mode mode, bool cold, uint64_t& checksum)
+{
+	if (cold)
+		evict_from_cache(path);
+
+	auto start = std::chrono::steady_clock::now();
+	auto reader = event_log_reader::open(path, mode != replay_mode::visitor_buffered);
+	if (reader == nullptr)
+		return 0.0;
+
+	checksum = 0;
+	auto visitor = [&](const event_view& e)
+	{
+		checksum += e.addr ^ e.size ^ e.type_id;
+		return true;
+	};
+	if (mode == replay_mode::callback)
+		reader->read_range(reader->begin_offset(), reader->end_offset(), visitor);
+	else
+		reader->visit_range(reader->begin_offset(), reader->end_offset(), visitor);
+	return seconds_since(start);
+}
+
+// Counts the allocations of SCANNED_TYPE and their bytes
+static double type_scan_seconds(const std::string& path, bool cold, uint64_t& allocs, uint64_t& bytes)
+{
+	if (cold)
+		evict_from_cache(path);
+
+	auto start = std::chrono::steady_clock::now();
+	auto reader = event_log_reader::open(path);
+	if (reader == nullptr)
+		return 0.0;
+
+	event_scan_filter filter;
+	filter.type_id = SCANNED_TYPE;
+	filter.columns = event_column_type_id | event_column_size;
+
+	allocs = 0;
+	bytes = 0;
+	reader->scan(reader->begin_offset(), reader->end_offset(), filter, [&](const event_columns& block)
+	{
+		// type_id is 0 for frees, and SCANNED_TYPE is not 0
+		for (size_t i = 0; i < block.count; ++i)
+		{
+			const bool match = block.type_id[i] == SCANNED_TYPE;
+			allocs += match;
+			bytes += match ? block.size[i] : 0;
+		}
+		return true;
+	});
+	return seconds_since(start);
+}
+
+int main(int argc, char** argv)
+{
+	uint64_t event_count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 50000000;
+	uint64_t events_per_frame = argc > 2 ? strtoull(argv[2], nullptr, 10) : 20000;
+	if (event_count == 0 || events_per_frame == 0)
+	{
+		printf("Usage: event_log_benchmark [event count] [events per frame]\n");
+		return 1;
+	}
+
+	std::error_code ec;
+	auto dir = std::filesystem::temp_directory_path(ec);
+	const std::string current_path = (dir / "owlcat_event_log_benchmark.events").string();
+	const std::string v1_path = (dir / "owlcat_event_log_benchmark_v1.events").string();
+	const std::string v2_path = (dir / "owlcat_event_log_benchmark_v2.events").string();
+
+	printf("Generating %llu events, %llu per frame\n", (unsigned long long)event_count, (unsigned long long)events_per_frame);
+	auto write_start = std::chrono::steady_clock::now();
+	if (!write_logs(current_path, v1_path, v2_path, event_count, events_per_frame))
+	{
+		printf("Failed to write the event logs\n");
+		return 1;
+	}
+	printf("Event logs written in %.2f s\n", seconds_since(write_start));
+
+	int result = 0;
+	uint64_t expected_allocs = 0, expected_bytes = 0;
+	for (const auto& path : { v1_path, v2_path, current_path })
+	{
+		const char* name = path == v1_path ? "v1     " : path == v2_path ? "v2     " : "current";
+		if (!verify(path, event_count, events_per_frame))
+		{
+			printf("FAILED: %s log does not read back as written\n", name);
+			result = 1;
+			continue;
+		}
+
+		const uint64_t size = std::filesystem::file_size(path, ec);
+		printf("%s: %.1f MB, %.2f bytes/event\n", name, size / (1024.0 * 1024.0), (double)size / event_count);
+
+		const std::pair<replay_mode, const char*> modes[] = {
+			{ replay_mode::callback, "per-event callback" },
+			{ replay_mode::visitor, "batched visitor" },
+			{ replay_mode::visitor_buffered, "batched visitor, buffered reads" },
+		};
+		uint64_t expected_checksum = 0;
+		for (const auto& mode : modes)
+		{
+			uint64_t checksum = 0;
+			const double warm = replay_seconds(path, mode.first, false, checksum);
+			const double cold = replay_seconds(path, mode.first, true, checksum);
+			printf("%s: replay (%s) %.1f M events/s (warm), %.1f M events/s (cold)\n",
+				name, mode.second, event_count / warm / 1e6, event_count / cold / 1e6);
+
+			if (mode.first == replay_mode::callback)
+				expected_checksum = checksum;
+			else if (checksum != expected_checksum)
+			{
+				printf("FAILED: replay (%s) does not see the same events\n", mode.second);
+				result = 1;
+			}
+		}
+
+		uint64_t allocs = 0, bytes = 0;
+		const double scan_warm = type_scan_seconds(path, false, allocs, bytes);
+		const double scan_cold = type_scan_seconds(path, true, allocs, bytes);
+		printf("%s: type scan found %llu allocations (%llu bytes), %.1f M events/s (warm), %.1f M events/s (cold)\n",
+			name, (unsigned long long)allocs, (unsigned long long)bytes, event_count / scan_warm / 1e6, event_count / scan_cold / 1e6);
+
+		if (path == v1_path)
+		{
+			expected_allocs = allocs;
+			expected_bytes = bytes;
+		}
+		else if (allocs != expected_allocs || bytes != expected_bytes)
+		{
+			printf("FAILED: the type scans of the logs disagree\n");
+			result = 1;
+		}
+	}
+
+	std::filesystem::remove(current_path, ec);
+	std::filesystem::remove(v1_path, ec);
+	std::filesystem::remove(v2_path, ec);
+	return result;
+}
@@ -0,0 +1,233 @@
+#include "frame_series.h"
+#include "test_helpers.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+using namespace owlcat;
+
+/*
+	Frame series test: appends random frames (with gaps, and frames appended again) to a
+	series with a counter and a signed level column, and checks get_values, get_total and
+	get_buckets over random frame ranges and bucket sizes against a brute-force scan of the
+	same frames. The series is then saved, loaded back and checked again, and a file with a
+	damaged block must fail to load. Run as
+
+		frame_series_test [frame count] [query count]
+*/
+
+// The frames as the series must see them: counters read 0 in frames never reported,
+// levels carry the previous value
+struct reference_t
+{
+	uint64_t first_frame = 0;
+	std::vector<bool> reported;
+	std::vector<uint64_t> columns[2];
+
+	void append(uint64_t frame, const uint64_t* values)
+	{
+		if (reported.empty())
+			first_frame = frame;
+		const size_t index = (size_t)(frame - first_frame);
+		if (index >= reported.size())
+		{
+			const uint64_t level = columns[1].empty() ? 0 : columns[1].back();
+			reported.resize(index + 1, false);
+			columns[0].resize(index + 1, 0);
+			columns[1].resize(index + 1, level);
+		}
+		reported[index] = true;
+		columns[0][index] = values[0];
+		columns[1][index] = values[1];
+		for (size_t i = index + 1; i < reported.size() && !reported[i]; ++i)
+			columns[1][i] = values[1];
+	}
+};
+
+static test_random g_random;
+
+// Checks the series against the reference over query_count random ranges. Returns the
+// number of mismatches.
+static size_t check(const frame_series& s, const reference_t& reference, uint64_t query_count)
+{
+	size_t errors = 0;
+	const uint64_t frame_count = reference.reported.size();
+	const uint64_t first = reference.first_frame;
+
+	uint64_t first_frame = 0, last_frame = 0;
+	if (!s.get_frame_range(first_frame, last_frame) || first_frame != first || last_frame != first + frame_count - 1)
+	{
+		printf("FAILED: frame range [%llu, %llu], expected [%llu, %llu]\n", (unsigned long long)first_frame, (unsigned long long)last_frame,
+			(unsigned long long)first, (unsigned long long)(first + frame_count - 1));
+		return 1;
+	}
+
+	std::vector<uint64_t> values;
+	std::vector<frame_series::bucket_t> buckets;
+	for (uint64_t q = 0; q < query_count; ++q)
+	{
+		// Ranges may start before the first frame and end after the last one
+		uint64_t from = first + g_random.next() % (frame_count + 20) - 10;
+		uint64_t to = from + g_random.next() % (q % 4 == 0 ? frame_count + 20 : 200);
+		const size_t column = (size_t)(q % 2);
+		const auto& data = reference.columns[column];
+
+		// Brute force over the frames of the range that exist
+		const uint64_t clip_from = std::max(from, first);
+		const uint64_t clip_to = std::min(to, first + frame_count - 1);
+
+		if (column == 0)
+		{
+			uint64_t total = 0;
+			for (uint64_t f = clip_from; f <= clip_to; ++f)
+				total += data[(size_t)(f - first)];
+			if (s.get_total(column, from, to) != total)
+			{
+				printf("FAILED: get_total [%llu, %llu]\n", (unsigned long long)from, (unsigned long long)to);
+				++errors;
+			}
+		}
+
+		s.get_values(column, from, to, values);
+		bool values_ok = clip_from <= clip_to ? values.size() == clip_to - from + 1 : values.empty();
+		for (uint64_t f = from; values_ok && f <= clip_to; ++f)
+			values_ok = values[(size_t)(f - from)] == (f < first ? 0 : data[(size_t)(f - first)]);
+		if (!values_ok)
+		{
+			printf("FAILED: get_values column %zu [%llu, %llu]\n", column, (unsigned long long)from, (unsigned long long)to);
+			++errors;
+		}
+
+		// Buckets of any size, rounded down to a power of two and aligned on the first frame
+		const size_t bucket_frames = 1 + (size_t)(g_random.next() % 4096);
+		size_t bucket_size = 1;
+		while (bucket_size * 2 <= bucket_frames)
+			bucket_size *= 2;
+
+		s.get_buckets(column, from, to, bucket_frames, buckets);
+		std::vector<frame_series::bucket_t> expected;
+		for (uint64_t f = clip_from; f <= clip_to; )
+		{
+			const uint64_t bucket_end = std::min(first + ((f - first) / bucket_size + 1) * bucket_size - 1, clip_to);
+			frame_series::bucket_t bucket = { f, bucket_end, (int64_t)data[(size_t)(f - first)], (int64_t)data[(size_t)(f - first)], 0 };
+			for (; f <= bucket_end; ++f)
+			{
+				const int64_t value = (int64_t)data[(size_t)(f - first)];
+				bucket.min = std::min(bucket.min, value);
+				bucket.max = std::max(bucket.max, value);
+				bucket.sum += value;
+			}
+			expected.push_back(bucket);
+		}
+
+		bool buckets_ok = buckets.size() == expected.size();
+		for (size_t i = 0; buckets_ok && i < buckets.size(); ++i)
+		{
+			buckets_ok = buckets[i].first_frame == expected[i].first_frame && buckets[i].last_frame == expected[i].last_frame
+				&& buckets[i].min == expected[i].min && buckets[i].max == expected[i].max && buckets[i].sum == expected[i].sum;
+		}
+		if (!buckets_ok)
+		{
+			printf("FAILED: get_buckets column %zu [%llu, %llu] by %zu frames: %zu buckets, expected %zu\n", column,
+				(unsigned long long)from, (unsigned long long)to, bucket_frames, buckets.size(), expected.size());
+			++errors;
+		}
+	}
+	return errors;
+}
+
+int main(int argc, char** argv)
+{
+	uint64_t frame_count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 100000;
+	uint64_t query_count = argc > 2 ? strtoull(argv[2], nullptr, 10) : 20000;
+	if (frame_count == 0 || query_count == 0)
+	{
+		printf("Usage: frame_series_test [frame count] [query count]\n");
+		return 1;
+	}
+
+	std::error_code ec;
+	const auto dir = std::filesystem::temp_directory_path(ec) / "owlcat_frame_series_test";
+	std::filesystem::create_directories(dir, ec);
+	const std::string path = (dir / "series.bin").string();
+
+	const std::vector<frame_series::column_kind> kinds = { frame_series::column_kind::counter, frame_series::column_kind::level };
+	frame_series s(kinds);
+	if (!s.create(path))
+	{
+		printf("FAILED: can't create %s\n", path.c_str());
+		return 1;
+	}
+
+	// Frames mostly in order, some skipped (filled in), and the last one often appended
+	// again, like the client publishes a long frame more than once. The level goes up and
+	// down, below zero too.
+	reference_t reference;
+	uint64_t frame = 1000;
+	int64_t level = 0;
+	for (uint64_t i = 0; ; ++i)
+	{
+		// The same frame again (one in 8), the next one, or one after a gap
+		const uint64_t r = g_random.next();
+		if (i == 0 || r % 8 != 0)
+			frame += r % 16 == 1 ? 1 + (r >> 8) % 40 : 1;
+		if (i > 0 && frame - reference.first_frame >= frame_count)
+			break;
+
+		level += (int64_t)((r >> 16) % 2001) - 1000;
+		const uint64_t values[2] = { (r >> 24) % 10000, (uint64_t)level };
+		if (!s.append(frame, values))
+		{
+			printf("FAILED: append of frame %llu\n", (unsigned long long)frame);
+			return 1;
+		}
+		reference.append(frame, values);
+	}
+
+	int result = 0;
+	size_t errors = check(s, reference, query_count);
+	printf("%zu frames, %llu queries: %zu errors in memory\n", reference.reported.size(), (unsigned long long)query_count, errors);
+	if (errors != 0)
+		result = 1;
+
+	s.close();
+	frame_series loaded(kinds);
+	if (!loaded.load(file_range(path)))
+	{
+		printf("FAILED: can't load the saved series\n");
+		result = 1;
+	}
+	else
+	{
+		errors = check(loaded, reference, query_count);
+		printf("%zu errors after loading\n", errors);
+		if (errors != 0)
+			result = 1;
+	}
+
+	// A block claiming more frames than the file holds must fail the load, not allocate
+	// for them. The first block follows the 16-byte header; its frame count is at 8.
+	const std::string damaged_path = (dir / "damaged.bin").string();
+	std::filesystem::copy_file(path, damaged_path, std::filesystem::copy_options::overwrite_existing, ec);
+	if (FILE* file = fopen(damaged_path.c_str(), "r+b"))
+	{
+		const uint32_t frame_count_field = 0xFFFFFFF0u;
+		fseek(file, 16 + 8, SEEK_SET);
+		fwrite(&frame_count_field, sizeof(frame_count_field), 1, file);
+		fclose(file);
+	}
+	frame_series damaged(kinds);
+	if (damaged.load(file_range(damaged_path)))
+	{
+		printf("FAILED: a damaged series loaded\n");
+		result = 1;
+	}
+
+	std::filesystem::remove_all(dir, ec);
+	return result;
+}
@@ -0,0 +1,148 @@
+#include "event_log.h"
+#include "lifetime_index.h"
+#include "live_objects_replay.h"
+#include "test_helpers.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace owlcat;
+
+/*
+	Live-objects benchmark: generates a synthetic capture, then computes the live objects
+	of the whole capture with the replay on 1, 2, 4... threads, up to the number of cores,
+	and with the lifetime index, then scrubs the end of the range with the lifetime index.
+	Every answer must be identical to the single-threaded replay, objects and order. Run as
+
+		live_objects_benchmark [event count] [events per frame] [max threads]
+
+	Most objects die young, but some live for the rest of the capture, and freed addresses
+	are reused, like in a garbage-collected heap.
+*/
+
+// Frames the end of the range moves by, a frame at a time, in the scrubbing test
+static const uint64_t SCRUB_FRAMES = 50;
+
+static bool same_objects(const std::vector<live_object>& a, const std::vector<live_object>& b)
+{
+	if (a.size() != b.size())
+		return false;
+	for (size_t i = 0; i < a.size(); ++i)
+	{
+		if (a[i].addr != b[i].addr || a[i].size != b[i].size || a[i].frame != b[i].frame || a[i].type_id != b[i].type_id || a[i].callstack_id != b[i].callstack_id)
+			return false;
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	uint64_t event_count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 50000000;
+	uint64_t events_per_frame = argc > 2 ? strtoull(argv[2], nullptr, 10) : 20000;
+	size_t max_threads = argc > 3 ? (size_t)strtoull(argv[3], nullptr, 10) : std::thread::hardware_concurrency();
+	if (event_count == 0 || events_per_frame == 0)
+	{
+		printf("Usage: live_objects_benchmark [event count] [events per frame] [max threads]\n");
+		return 1;
+	}
+	if (max_threads == 0)
+		max_threads = 1;
+
+	std::error_code ec;
+	const std::string path = (std::filesystem::temp_directory_path(ec) / "owlcat_live_objects_benchmark.events").string();
+
+	printf("Generating %llu events, %llu per frame\n", (unsigned long long)event_count, (unsigned long long)events_per_frame);
+	std::vector<uint64_t> boundaries;
+	if (!write_log(path, event_count, events_per_frame, heap_model::reused_addresses, boundaries))
+	{
+		printf("Failed to write the event log\n");
+		return 1;
+	}
+
+	int result = 0;
+	std::vector<live_object> expected;
+	double sequential_seconds = 0.0;
+	for (size_t threads = 1; ; threads = threads * 2 < max_threads ? threads * 2 : max_threads)
+	{
+		std::vector<live_object> objects;
+		auto start = std::chrono::steady_clock::now();
+		if (!replay_live_objects(path, boundaries, threads, objects, nullptr))
+		{
+			printf("FAILED: replay on %zu threads could not read the log\n", threads);
+			result = 1;
+			break;
+		}
+		const double seconds = seconds_since(start);
+
+		if (threads == 1)
+		{
+			expected = std::move(objects);
+			sequential_seconds = seconds;
+			printf("replay, 1 thread: %zu live objects, %.1f M events/s\n", expected.size(), event_count / seconds / 1e6);
+		}
+		else
+		{
+			printf("replay, %zu threads: %.1f M events/s, %.2fx\n", threads, event_count / seconds / 1e6, sequential_seconds / seconds);
+			if (!same_objects(objects, expected))
+			{
+				printf("FAILED: replay on %zu threads differs from the sequential one\n", threads);
+				result = 1;
+			}
+		}
+
+		if (threads == max_threads)
+			break;
+	}
+
+	// The lifetime index, built a frame at a time like the client does
+	auto reader = event_log_reader::open(path);
+	if (reader != nullptr)
+	{
+		lifetime_index index;
+		auto start = std::chrono::steady_clock::now();
+		bool ok = true;
+		for (size_t i = 1; ok && i < boundaries.size(); ++i)
+			ok = index.update(*reader, boundaries[i]);
+		const double build_seconds = seconds_since(start);
+
+		std::vector<live_object> objects;
+		start = std::chrono::steady_clock::now();
+		ok = ok && index.get_live_objects(*reader, boundaries.back(), 0, (event_count - 1) / events_per_frame, objects, nullptr);
+		const double query_seconds = seconds_since(start);
+
+		printf("lifetime index: built in %.2f s, queried in %.3f s\n", build_seconds, query_seconds);
+		if (!ok || !same_objects(objects, expected))
+		{
+			printf("FAILED: the lifetime index differs from the replay\n");
+			result = 1;
+		}
+
+		// Scrubbing: the end of the range moves back, then forward again, a frame at a time
+		const uint64_t last_frame = (event_count - 1) / events_per_frame;
+		const uint64_t steps = last_frame < SCRUB_FRAMES ? last_frame : SCRUB_FRAMES;
+		start = std::chrono::steady_clock::now();
+		for (uint64_t step = 1; ok && step <= 2 * steps; ++step)
+		{
+			const uint64_t to_frame = step <= steps ? last_frame - step : last_frame - (2 * steps - step);
+			objects.clear();
+			ok = index.get_live_objects(*reader, boundaries[(size_t)to_frame + 1], 0, to_frame, objects, nullptr);
+		}
+		const double scrub_seconds = seconds_since(start);
+
+		printf("lifetime index: scrubbing the range end, %.2f ms per step\n", steps > 0 ? scrub_seconds * 1000 / (2 * steps) : 0.0);
+		if (!ok || !same_objects(objects, expected))
+		{
+			printf("FAILED: scrubbing back to the whole capture differs from the replay\n");
+			result = 1;
+		}
+	}
+
+	reader.reset();
+	std::filesystem::remove(path, ec);
+	return result;
+}
@@ -0,0 +1,153 @@
+#include "symbol_resolver.h"
+#include "test_helpers.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace owlcat;
+
+/*
+	Symbol resolver benchmark: writes a synthetic symbol map (see symbol_resolver.h) for a
+	module, then symbolicates random native frames of it on 1, 2, 4... threads, up to the
+	number of cores, with a new resolver each time (so the map load is part of the time),
+	then again with the results cached. Every frame must resolve to the symbol that covers
+	it, and addresses between symbols must stay unresolved. Run as
+
+		symbol_resolver_benchmark [symbol count] [frame count] [max threads]
+*/
+
+static const char* MODULE_NAME = "GameAssembly.dll";
+
+// Symbol i covers [i * 0x100, i * 0x100 + 0xC0): the rest of each 0x100 is a gap
+static uint64_t symbol_start(uint64_t index) { return 0x1000 + index * 0x100; }
+static const uint64_t SYMBOL_SIZE = 0xC0;
+
+static bool write_map(const std::string& path, uint64_t symbol_count)
+{
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == nullptr)
+		return false;
+	for (uint64_t i = 0; i < symbol_count; ++i)
+		fprintf(file, "%llx %llx Namespace_Class%llu_Method_m%llX\n", (unsigned long long)symbol_start(i), (unsigned long long)SYMBOL_SIZE,
+			(unsigned long long)(i % 1000), (unsigned long long)i);
+	return fclose(file) == 0;
+}
+
+// Symbolicates the frames on thread_count threads, counting the wrong results
+static double symbolicate_seconds(symbol_resolver& resolver, const std::vector<std::string>& frames, const std::vector<uint64_t>& rvas, size_t thread_count, size_t& errors)
+{
+	std::atomic<size_t> next{ 0 };
+	std::atomic<size_t> wrong{ 0 };
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < thread_count; ++t)
+	{
+		threads.emplace_back([&]()
+		{
+			std::string display;
+			char expected[128];
+			for (size_t i = next++; i < frames.size(); i = next++)
+			{
+				const uint64_t index = (rvas[i] - 0x1000) / 0x100;
+				const uint64_t offset = rvas[i] - symbol_start(index);
+				const bool resolved = resolver.symbolicate_frame(frames[i], display);
+				if (offset >= SYMBOL_SIZE)
+				{
+					if (resolved)
+						++wrong;
+					continue;
+				}
+
+				if (offset == 0)
+					snprintf(expected, sizeof(expected), "%s!Namespace_Class%llu_Method_m%llX\n", MODULE_NAME, (unsigned long long)(index % 1000), (unsigned long long)index);
+				else
+					snprintf(expected, sizeof(expected), "%s!Namespace_Class%llu_Method_m%llX+0x%llX\n", MODULE_NAME, (unsigned long long)(index % 1000), (unsigned long long)index, (unsigned long long)offset);
+				if (!resolved || display != expected)
+					++wrong;
+			}
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+
+	errors += wrong;
+	return seconds_since(start);
+}
+
+int main(int argc, char** argv)
+{
+	uint64_t symbol_count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 500000;
+	uint64_t frame_count = argc > 2 ? strtoull(argv[2], nullptr, 10) : 1000000;
+	size_t max_threads = argc > 3 ? (size_t)strtoull(argv[3], nullptr, 10) : std::max<size_t>(std::thread::hardware_concurrency(), 1);
+	if (symbol_count == 0 || frame_count == 0 || max_threads == 0)
+	{
+		printf("Usage: symbol_resolver_benchmark [symbol count] [frame count] [max threads]\n");
+		return 1;
+	}
+
+	std::error_code ec;
+	const auto dir = std::filesystem::temp_directory_path(ec) / "owlcat_symbol_resolver_benchmark";
+	std::filesystem::create_directories(dir, ec);
+	const std::string map_path = (dir / (std::string(MODULE_NAME) + ".map")).string();
+
+	auto start = std::chrono::steady_clock::now();
+	if (!write_map(map_path, symbol_count))
+	{
+		printf("Failed to write the symbol map\n");
+		return 1;
+	}
+	printf("Wrote %llu symbols in %.2f s\n", (unsigned long long)symbol_count, seconds_since(start));
+
+	// Unique frames, like the client queues them, with some of them in gaps between symbols
+	std::vector<std::string> frames(frame_count);
+	std::vector<uint64_t> rvas(frame_count);
+	uint64_t seed = 12345;
+	char text[64];
+	for (uint64_t i = 0; i < frame_count; ++i)
+	{
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		rvas[i] = symbol_start((seed >> 33) % symbol_count) + (seed >> 20) % 0x100;
+		snprintf(text, sizeof(text), "%s+0x%llX\n", MODULE_NAME, (unsigned long long)rvas[i]);
+		frames[i] = text;
+	}
+
+	int result = 0;
+	for (size_t threads = 1; threads <= max_threads; threads *= 2)
+	{
+		symbol_resolver resolver;
+		resolver.set_search_path("C:\\no such directory;" + dir.string());
+
+		size_t errors = 0;
+		const double cold = symbolicate_seconds(resolver, frames, rvas, threads, errors);
+		const double cached = symbolicate_seconds(resolver, frames, rvas, threads, errors);
+		printf("%zu threads: %.2f s (%.2f M frames/s) with the map load, %.2f s (%.2f M frames/s) cached\n",
+			threads, cold, frame_count / cold / 1e6, cached, frame_count / cached / 1e6);
+		if (errors != 0)
+		{
+			printf("FAILED: %zu frames resolved wrong on %zu threads\n", errors, threads);
+			result = 1;
+		}
+	}
+
+	// Managed frames and unknown modules pass through
+	symbol_resolver resolver;
+	resolver.set_search_path(dir.string());
+	const std::string passed = "Game.Player.Update\nOther.dll+0x1000\n";
+	const std::string symbolicated = resolver.symbolicate(passed + MODULE_NAME + "+0x1010\n");
+	if (symbolicated.compare(0, passed.size(), passed) != 0 || symbolicated.compare(passed.size(), std::string::npos, std::string(MODULE_NAME) + "!Namespace_Class0_Method_m0+0x10\n") != 0)
+	{
+		printf("FAILED: symbolicate changed the managed or unknown frames: %s\n", symbolicated.c_str());
+		result = 1;
+	}
+
+	std::filesystem::remove_all(dir, ec);
+	return result;
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+#include "event_log.h"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if !defined(WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*
+	Helpers shared by the client tests and benchmarks: a reproducible random sequence, a
+	synthetic event stream with a choice of heap behaviour, writing it as an event log, and
+	timing and page cache helpers.
+*/
+
+namespace owlcat
+{
+	// xorshift64: the same sequence on every run and platform
+	class test_random
+	{
+		uint64_t m_seed = 0x9E3779B97F4A7C15ULL;
+
+	public:
+		uint64_t next()
+		{
+			m_seed ^= m_seed << 13;
+			m_seed ^= m_seed >> 7;
+			m_seed ^= m_seed << 17;
+			return m_seed;
+		}
+	};
+
+	// How the generated heap allocates. Half of the events free a random live object in
+	// every model.
+	enum class heap_model
+	{
+		// A few callstacks (and their types) make most of the allocations, like in a game
+		skewed_callstacks,
+		// The set of allocated types drifts over time: every phase of PHASE_FRAMES frames
+		// allocates its own types, besides the common ones
+		phased_types,
+		// Most objects die young, but some live for the rest of the capture, and freed
+		// addresses are reused, like in a garbage-collected heap
+		reused_addresses,
+	};
+
+	// Generates the same event sequence every time for the same arguments
+	class event_generator
+	{
+	public:
+		static constexpr uint64_t TYPE_COUNT = 2000;
+		static constexpr uint64_t CALLSTACK_COUNT = 20000;
+		// phased_types: types allocated throughout the capture, and the types of a phase
+		static constexpr uint64_t COMMON_TYPES = 64;
+		static constexpr uint64_t PHASE_FRAMES = 25;
+		static constexpr uint64_t PHASE_TYPES = 48;
+
+		event_generator(uint64_t count, uint64_t events_per_frame, heap_model model)
+			: m_count(count)
+			, m_events_per_frame(events_per_frame)
+			, m_model(model)
+		{}
+
+		bool next(event_view& e)
+		{
+			if (m_index == m_count)
+				return false;
+
+			const uint64_t frame = m_index++ / m_events_per_frame;
+			if (!m_live.empty() && m_random.next() % 2 == 0)
+			{
+				size_t index = (size_t)(m_random.next() % m_live.size());
+				e = { frame, m_live[index].first, 0, 0, m_live[index].second, false };
+				if (m_model == heap_model::reused_addresses)
+					m_free_addrs.push_back(m_live[index].first);
+				m_live[index] = m_live.back();
+				m_live.pop_back();
+				return true;
+			}
+
+			switch (m_model)
+			{
+			case heap_model::skewed_callstacks:
+				allocate_skewed(frame, e);
+				break;
+			case heap_model::phased_types:
+				allocate_phased(frame, e);
+				break;
+			case heap_model::reused_addresses:
+				allocate_reused(frame, e);
+				break;
+			}
+			return true;
+		}
+
+	private:
+		uint64_t m_count;
+		uint64_t m_events_per_frame;
+		heap_model m_model;
+		uint64_t m_index = 0;
+		uint64_t m_next_addr = 0x7F0000000000ULL;
+		test_random m_random;
+		std::vector<std::pair<uint64_t, uint32_t>> m_live;
+		std::vector<uint64_t> m_free_addrs;
+
+		void allocate_skewed(uint64_t frame, event_view& e)
+		{
+			// The product of two uniform values is skewed towards 0
+			const uint64_t r = m_random.next();
+			const uint64_t callstack_id = ((r & 0xFFFF) % 1000) * (((r >> 16) & 0xFFFF) % 1000) / 50;
+			const uint64_t type_id = callstack_id % TYPE_COUNT;
+			uint32_t size = 16 + (uint32_t)(((r >> 32) & 0xFF) % 16 * ((r >> 40) & 0xFF) % 16) * 8;
+			m_next_addr += size;
+			m_live.push_back({ m_next_addr, size });
+			e = { frame, m_next_addr, type_id, callstack_id, size, true };
+		}
+
+		void allocate_phased(uint64_t frame, event_view& e)
+		{
+			const uint64_t phase = frame / PHASE_FRAMES;
+			const uint64_t r = m_random.next();
+			const uint64_t type_id = r % 8 == 0
+				? (r >> 8) % COMMON_TYPES
+				: COMMON_TYPES + (phase * (PHASE_TYPES / 3) + (r >> 8) % PHASE_TYPES) % (TYPE_COUNT - COMMON_TYPES);
+
+			uint32_t size = 16 + (uint32_t)(m_random.next() % 32) * 8;
+			m_next_addr += size;
+			m_live.push_back({ m_next_addr, size });
+			e = { frame, m_next_addr, type_id, m_random.next() % CALLSTACK_COUNT, size, true };
+		}
+
+		void allocate_reused(uint64_t frame, event_view& e)
+		{
+			const uint32_t size = 16 + (uint32_t)(m_random.next() % 32) * 8;
+			uint64_t addr;
+			if (!m_free_addrs.empty() && m_random.next() % 4 != 0)
+			{
+				addr = m_free_addrs.back();
+				m_free_addrs.pop_back();
+			}
+			else
+			{
+				m_next_addr += 512;
+				addr = m_next_addr;
+			}
+
+			// One object in 32 is never freed
+			if (m_random.next() % 32 != 0)
+				m_live.push_back({ addr, size });
+			e = { frame, addr, m_random.next() % TYPE_COUNT, m_random.next() % CALLSTACK_COUNT, size, true };
+		}
+	};
+
+	// Writes the generated events as an event log, flushing on every frame boundary like
+	// the client does. boundaries receives the offset of the first event, then the offset
+	// of the end of every frame.
+	inline bool write_log(const std::string& path, uint64_t event_count, uint64_t events_per_frame, heap_model model, std::vector<uint64_t>& boundaries)
+	{
+		event_log_writer writer;
+		if (!writer.create(path))
+			return false;
+
+		boundaries = { writer.position() };
+		event_generator generator(event_count, events_per_frame, model);
+		event_view e = {};
+		uint64_t frame = 0;
+		while (generator.next(e))
+		{
+			if (e.frame != frame)
+			{
+				if (!writer.flush())
+					return false;
+				boundaries.push_back(writer.position());
+				frame = e.frame;
+			}
+			writer.append(e.frame, e.addr, e.type_id, e.callstack_id, e.size, e.is_alloc);
+		}
+
+		if (!writer.flush())
+			return false;
+		boundaries.push_back(writer.position());
+		return true;
+	}
+
+	// Drops the file from the page cache, so the next read comes from the disk. Linux only:
+	// does nothing elsewhere.
+	inline void evict_from_cache(const std::string& path)
+	{
+#if !defined(WIN32)
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return;
+		fdatasync(fd);
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(fd);
+#else
+		(void)path;
+#endif
+	}
+
+	inline double seconds_since(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+}
@@ -35,6 +35,10 @@ namespace owlcat
 			// GC heap). Lets the UI graph total committed memory against the tracked allocations
 			// - the gap is native allocator pool overhead the per-allocation view can't show.
 			SRV_MEMSTATS,
+			// Sent at the end of a frame during which the server recorded less than everything
+			// because it couldn't keep up (see overload_level): the frame's degradation level,
+			// and the allocations that were only counted per type instead of recorded.
+			SRV_DEGRADED,
 		};
 
 		enum command
@@ -53,6 +57,9 @@ namespace owlcat
 		extern const char* pipe_name;
 
 		extern const char* error_ok;
+		// Same as error_ok, but the server also offers the shared-memory channel named by
+		// the client in OWLCAT_PROFILER_SHM
+		extern const char* error_ok_shm;
 		extern const char* error_symbols;
 		extern const char* error_detour;
 		extern const char* error_deque;
@@ -68,6 +75,23 @@ namespace owlcat
 		CAPTURE_NATIVE  = 1 << 1, // native heap, via hooked allocators (see native_hooks)
 	};
 
+	// How much the server degraded recording of a frame because the client (or the disk)
+	// couldn't keep up, instead of blocking the game's threads. Sent in SRV_DEGRADED. Each
+	// level also applies the ones below it.
+	enum overload_level : uint8_t
+	{
+		OVERLOAD_NONE = 0,
+		OVERLOAD_NO_STACKS,  // allocations are recorded without callstacks
+		OVERLOAD_SAMPLING,   // only one in OVERLOAD_SAMPLE_INTERVAL allocations is recorded, the rest are counted per type
+		OVERLOAD_COUNTERS,   // allocations are only counted per type
+	};
+
+	static constexpr uint32_t OVERLOAD_SAMPLE_INTERVAL = 16;
+
+	// How long the server waits for the client to open a shared-memory channel before it
+	// gives up on it (see network::listen_shared_memory) and falls back to TCP
+	static constexpr uint32_t SHM_ATTACH_TIMEOUT_MS = 10000;
+
 	struct message
 	{
 #ifdef DEBUG_NETWORK
@@ -91,8 +115,13 @@ uint32_t id;
 #endif
 			uint32_t length = 0;
 			uint8_t type = 0;
+			// FLAG_PRIORITY for messages sent with write_priority_message. Occupies what
+			// used to be padding (always zero), so the header size is unchanged.
+			uint8_t flags = 0;
 		};
 
+		static constexpr uint8_t FLAG_PRIORITY = 1;
+
 		header header;
 		std::vector<uint8_t> data;
 	};
@@ -110,6 +139,17 @@ uint32_t id;
 		void listen_sync(int port);
 		bool connect(const std::string& address, int port);
 
+		// Same-machine transport over a shared-memory ring (see shm_channel.h) instead of
+		// TCP. The server creates the named channel and accepts one client on it, the client
+		// opens it. Both return false if the channel can't be set up, so the caller can fall
+		// back to TCP. If the client doesn't open the channel within SHM_ATTACH_TIMEOUT_MS,
+		// the server stops listening on it (is_listening() turns false): stop() and listen on
+		// TCP, where the client goes when it can't open the channel. After a shared-memory
+		// connection is lost, stop() and listen again.
+		bool listen_shared_memory(const std::string& name);
+		bool connect_shared_memory(const std::string& name);
+		bool is_shared_memory() const;
+
 		bool is_connected() const;
 		bool is_connecting() const;
 		bool is_listening() const;
@@ -120,6 +160,10 @@ uint32_t id;
 		void stop();
 
 		void write_message(uint8_t type, uint32_t length, const uint8_t* data);
+		// Same as write_message, but the message goes to the priority lane, which is sent
+		// ahead of everything queued with write_message (command replies, memstats). Messages
+		// within each lane keep their order; there is no ordering between the lanes.
+		void write_priority_message(uint8_t type, uint32_t length, const uint8_t* data);
 		bool read_message(message& msg);
 
 		size_t get_read_messages_count() const;
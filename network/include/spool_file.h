@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "network.h"
+
+namespace owlcat
+{
+	/*
+		Spool files: the server->client message stream (exactly as framed on the wire,
+		message::header + body) written to local disk instead of, or in addition to, the
+		network. The client imports a spool later, or follows it while it is being written,
+		at its own pace - so a slow client never makes the game wait.
+
+		A spool is a sequence of segment files "<prefix>.000000.spool", "<prefix>.000001.spool"
+		and so on. Each segment starts with a segment_header and holds whole messages only, so
+		segments can be rolled over (and copied away) independently. Together they form one
+		stream: definitions are only written once, so all segments are needed for an import.
+	*/
+	struct spool_segment_header
+	{
+		char magic[8]; // "OWLSPOOL"
+		uint32_t version;
+		uint32_t segment_index;
+	};
+
+	std::string spool_segment_path(const std::string& prefix, uint32_t index);
+
+	/*
+		Writes a spool. write_message only copies the message into the current buffer; a
+		background thread writes full buffers out with large sequential writes.
+	*/
+	class spool_writer
+	{
+		static constexpr size_t BUFFER_SIZE = 4 * 1024 * 1024;
+
+		std::string m_prefix;
+		uint64_t m_segment_size = 0;
+		FILE* m_file = nullptr;
+		uint32_t m_segment_index = 0;
+		uint64_t m_segment_bytes = 0;
+
+		std::mutex m_mutex;
+		std::condition_variable m_cv;
+		// The buffer being filled, and the full ones waiting for the writer thread
+		std::vector<uint8_t> m_current;
+		std::vector<std::vector<uint8_t>> m_full;
+		std::vector<std::vector<uint8_t>> m_free;
+		std::atomic<uint64_t> m_pending_bytes{ 0 };
+		bool m_flush_requested = false;
+		// True while the spool is not open: messages written then are dropped
+		bool m_stop = true;
+		std::atomic<bool> m_failed{ false };
+		std::thread m_thread;
+
+		bool open_segment();
+		void write_loop();
+
+	public:
+		spool_writer() = default;
+		~spool_writer();
+
+		// Starts a new spool with the given prefix. A new segment is started once the
+		// current one exceeds segment_size bytes.
+		bool open(const std::string& prefix, uint64_t segment_size = 1024ull * 1024 * 1024);
+		// Writes out everything buffered and closes the spool
+		void close();
+		bool is_open() const { return m_thread.joinable(); }
+
+		// Messages written while the spool is not open (e.g. by a thread still reporting
+		// after close) are dropped
+		void write_message(uint8_t type, uint32_t length, const uint8_t* data);
+		// Asks the writer thread to write out the partially filled buffer, so a reader
+		// following the spool sees recent messages (e.g. at the end of every frame)
+		void flush();
+
+		// Bytes buffered in memory, not yet written to disk
+		uint64_t pending_bytes() const { return m_pending_bytes.load(std::memory_order_relaxed); }
+		// True if a write to disk has failed; the spool is incomplete from then on
+		bool has_failed() const { return m_failed; }
+	};
+
+	/*
+		Reads a spool, possibly while it is still being written. read_message returns false
+		when no complete message is available (yet); call it again later to continue.
+	*/
+	class spool_reader
+	{
+		std::string m_prefix;
+		FILE* m_file = nullptr;
+		uint32_t m_segment_index = 0;
+		uint64_t m_offset = 0;
+		std::vector<uint8_t> m_buffer;
+		size_t m_buffer_pos = 0;
+
+		// Opens a segment and checks its header, without switching to it
+		FILE* open_segment_file(uint32_t index) const;
+		// Switches to a segment opened by open_segment_file
+		void use_segment(FILE* file, uint32_t index);
+		bool open_segment(uint32_t index);
+		// Makes at least size bytes available at m_buffer_pos, reading more of the file
+		bool fill(size_t size);
+		// Takes the next message if the current segment has it complete
+		bool take_message(message& msg);
+
+	public:
+		spool_reader() = default;
+		~spool_reader();
+
+		bool open(const std::string& prefix);
+		void close();
+		bool is_open() const { return m_file != nullptr; }
+
+		bool read_message(message& msg);
+	};
+}
@@ -5,9 +5,11 @@
 #include <deque>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 
 #include "concurrentqueue.h"
 #include "profiler_thread.h"
+#include "shm_channel.h"
 
 #include <asio/io_context.hpp>
 #include <asio/ip/tcp.hpp>
@@ -25,6 +27,7 @@ namespace owlcat
 	{
 		const char* pipe_name = "\\\\.\\pipe\\OwlcatMonoProfiler";
 		const char* error_ok = "OK";
+		const char* error_ok_shm = "OKSHM";
 		const char* error_symbols = "SYMBOLS";
 		const char* error_detour = "DETOUR";
 		const char* error_deque = "DEQUE";
@@ -34,6 +37,9 @@ namespace owlcat
 	class network::details
 	{
 		moodycamel::ConcurrentQueue<message> m_read_buffer;
+		// Received priority-lane messages. read_message returns these first, so a command
+		// reply doesn't wait behind a backlog of events the reader hasn't processed yet.
+		moodycamel::ConcurrentQueue<message> m_priority_read_buffer;
 
 #ifdef DEBUG_NETWORK
 		int write_count = 0, read_count = 0;
@@ -54,8 +60,9 @@ namespace owlcat
 			connection_disconnected,
 		};
 
-		connection_status m_connected = connection_not_init;
-		bool m_listening = false;
+		// Also written by the shared-memory threads
+		std::atomic<connection_status> m_connected{ connection_not_init };
+		std::atomic<bool> m_listening{ false };
 		// Incremented on every new connection. Read from other threads to detect reconnects.
 		std::atomic<uint64_t> m_generation{0};
 
@@ -69,8 +76,21 @@ namespace owlcat
 		std::mutex m_write_mutex;
 		// Messages accumulated while the current write is in flight
 		std::vector<uint8_t> m_pending_writes;
-		// The buffer currently being sent
+		// The buffer currently being sent. It is sent in slices of at most MAX_WRITE_SLICE
+		// bytes (cut at message boundaries), m_writing_offset is where the next slice starts.
 		std::vector<uint8_t> m_writing;
+		size_t m_writing_offset = 0;
+		/*
+			Priority lane (write_priority_message). Command replies and memstats used to be
+			queued behind hundreds of megabytes of allocation events, so answering "Pause"
+			could take many seconds under load. Priority messages are accumulated separately
+			and sent at the next slice boundary, ahead of any bulk data that hasn't been
+			handed to the socket yet. Bulk data is sent in bounded slices so that a priority
+			message never waits for more than one slice.
+		*/
+		std::vector<uint8_t> m_pending_priority_writes;
+		std::vector<uint8_t> m_writing_priority;
+		static constexpr size_t MAX_WRITE_SLICE = 1024 * 1024;
 		// True if an async_write is in flight
 		bool m_write_in_progress = false;
 		// Total bytes currently buffered on the send side (pending + in-flight). Maintained
@@ -81,7 +101,7 @@ namespace owlcat
 #ifdef DEBUG_NETWORK
 		FILE* m_debug_file;
 #endif
-		bool m_stop = false;
+		std::atomic<bool> m_stop{ false };
 
 		void run()
 		{
@@ -128,7 +148,10 @@ namespace owlcat
 #endif			
 
 			//m_read_buffer.enqueue(m_current_message);
-			m_read_buffer.enqueue(*msg);
+			if (msg->header.flags & message::FLAG_PRIORITY)
+				m_priority_read_buffer.enqueue(*msg);
+			else
+				m_read_buffer.enqueue(*msg);
 			read_message_header_from_socket();
 		}
 
@@ -190,44 +213,306 @@ namespace owlcat
 			read_message_header_from_socket();
 		}
 
-		// Starts sending everything accumulated in m_pending_writes.
-		// Called on the network thread only.
-		void start_write()
+		// Bytes buffered on the send side. Must be called with m_write_mutex held.
+		uint64_t buffered_bytes_locked() const
+		{
+			return m_pending_writes.size() + m_pending_priority_writes.size() + m_writing_priority.size() + (m_writing.size() - m_writing_offset);
+		}
+
+		// Returns the end of the next bulk slice: as many whole messages from m_writing_offset
+		// as fit into MAX_WRITE_SLICE (but at least one, messages can be bigger than a slice).
+		size_t next_slice_end() const
 		{
+			size_t end = m_writing_offset;
+			while (end < m_writing.size())
 			{
-				std::scoped_lock lock(m_write_mutex);
-				m_writing.clear();
-				if (m_pending_writes.empty())
+				struct message::header hdr;
+				memcpy(&hdr, m_writing.data() + end, sizeof(hdr));
+				size_t next = end + sizeof(hdr) + hdr.length;
+				if (end != m_writing_offset && next - m_writing_offset > MAX_WRITE_SLICE)
+					break;
+				end = next;
+			}
+			return end;
+		}
+
+		// Picks the next chunk to send: all pending priority messages if there are any,
+		// otherwise the next slice of bulk messages. Returns false (and marks the writer
+		// idle) if there is nothing to send. Called on the writing thread only.
+		bool take_next_write(const uint8_t*& buffer, size_t& size, bool& priority)
+		{
+			std::scoped_lock lock(m_write_mutex);
+			m_writing_priority.clear();
+			priority = false;
+			if (!m_pending_priority_writes.empty())
+			{
+				m_writing_priority.swap(m_pending_priority_writes);
+				buffer = m_writing_priority.data();
+				size = m_writing_priority.size();
+				priority = true;
+			}
+			else
+			{
+				if (m_writing_offset == m_writing.size())
 				{
-					m_write_in_progress = false;
-					m_buffered_bytes.store(0, std::memory_order_relaxed);
-					return;
+					m_writing.clear();
+					m_writing_offset = 0;
+					if (m_pending_writes.empty())
+					{
+						m_write_in_progress = false;
+						m_buffered_bytes.store(0, std::memory_order_relaxed);
+						return false;
+					}
+					m_writing.swap(m_pending_writes);
 				}
-				m_writing.swap(m_pending_writes);
-				// pending is now empty; the buffered bytes are the in-flight m_writing
-				m_buffered_bytes.store(m_writing.size(), std::memory_order_relaxed);
+
+				size_t end = next_slice_end();
+				buffer = m_writing.data() + m_writing_offset;
+				size = end - m_writing_offset;
+			}
+			m_buffered_bytes.store(buffered_bytes_locked(), std::memory_order_relaxed);
+			return true;
+		}
+
+		void complete_write(bool priority, size_t size)
+		{
+			if (!priority)
+			{
+				// m_writing_offset is only touched on the writing thread, but
+				// buffered_bytes_locked reads it under the mutex
+				std::scoped_lock lock(m_write_mutex);
+				m_writing_offset += size;
 			}
+		}
 
-			asio::async_write(m_socket, asio::buffer(m_writing.data(), m_writing.size()), [this](const asio::error_code& ec, size_t) { on_write_complete(ec); });
+		// Drops everything buffered for sending after the connection is lost
+		void abort_writes()
+		{
+			std::scoped_lock lock(m_write_mutex);
+			m_write_in_progress = false;
+			m_pending_writes.clear();
+			m_pending_priority_writes.clear();
+			m_writing.clear();
+			m_writing_offset = 0;
+			m_buffered_bytes.store(0, std::memory_order_relaxed);
+		}
+
+		// Starts sending the next chunk. Called on the network thread only.
+		void start_write()
+		{
+			const uint8_t* buffer = nullptr;
+			size_t size = 0;
+			bool priority = false;
+			if (!take_next_write(buffer, size, priority))
+				return;
+
+			asio::async_write(m_socket, asio::buffer(buffer, size), [this, priority, size](const asio::error_code& ec, size_t) { on_write_complete(ec, priority, size); });
 		}
 
-		void on_write_complete(const asio::error_code& ec)
+		void on_write_complete(const asio::error_code& ec, bool priority, size_t size)
 		{
 			if (ec)
 			{
 				set_disconnected_status(ec);
-
-				std::scoped_lock lock(m_write_mutex);
-				m_write_in_progress = false;
-				m_pending_writes.clear();
-				m_buffered_bytes.store(0, std::memory_order_relaxed);
+				abort_writes();
 				return;
 			}
 
+			complete_write(priority, size);
+
 			// Send whatever has accumulated while this write was in flight
 			start_write();
 		}
 
+		/*
+			Shared-memory transport (see shm_channel). Used instead of the socket when the
+			client launched the app on this machine and both sides agreed on it during the
+			launch handshake. Messages are framed exactly as on the socket, and the same
+			pending buffers and priority lane are used; only the threads that move the bytes
+			differ: a writer thread copies the pending data into the outbound ring, and a
+			reader thread parses messages out of the inbound ring.
+		*/
+		std::unique_ptr<shm_channel> m_shm;
+		std::thread m_shm_writer;
+		std::thread m_shm_reader;
+		std::condition_variable m_write_cv;
+		// Doorbell wait timeout. Also how often a dead peer is noticed.
+		static constexpr int SHM_WAIT_MS = 50;
+
+		void shm_disconnect()
+		{
+			m_connected = connection_disconnected;
+			abort_writes();
+		}
+
+		void shm_write_loop()
+		{
+			t_profiler_internal_thread = true;
+
+			while (!m_stop)
+			{
+				if (m_connected != connection_connected)
+				{
+					std::this_thread::sleep_for(std::chrono::milliseconds(SHM_WAIT_MS));
+					continue;
+				}
+
+				const uint8_t* buffer = nullptr;
+				size_t size = 0;
+				bool priority = false;
+				if (!take_next_write(buffer, size, priority))
+				{
+					std::unique_lock lock(m_write_mutex);
+					m_write_cv.wait_for(lock, std::chrono::milliseconds(SHM_WAIT_MS), [this]() { return m_write_in_progress || m_stop; });
+					continue;
+				}
+
+				size_t written = 0;
+				while (written < size && !m_stop)
+				{
+					size_t count = m_shm->write(buffer + written, size - written);
+					written += count;
+					if (count == 0 && !m_shm->wait_writable(SHM_WAIT_MS) && !m_shm->is_peer_alive())
+						break;
+				}
+
+				if (written < size)
+				{
+					if (!m_stop)
+						shm_disconnect();
+					continue;
+				}
+
+				complete_write(priority, size);
+			}
+		}
+
+		void shm_read_loop()
+		{
+			t_profiler_internal_thread = true;
+
+			// Server side: wait for the client to open the segment. If it doesn't, it has gone
+			// for TCP instead (or isn't coming): stop listening, so the caller switches to TCP.
+			const auto attach_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(SHM_ATTACH_TIMEOUT_MS);
+			while (!m_stop && !m_shm->is_peer_attached())
+			{
+				if (std::chrono::steady_clock::now() >= attach_deadline)
+				{
+					printf("Shared memory channel was not opened in time\n");
+					m_connected = connection_disconnected;
+					m_listening = false;
+					return;
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+
+			if (m_stop)
+				return;
+
+			if (m_connected != connection_connected)
+			{
+				m_connected = connection_connected;
+				++m_generation;
+				m_listening = false;
+			}
+
+			// Reads whatever the ring holds in one go and parses all complete messages out of
+			// it; an incomplete message at the end stays in the buffer until the rest arrives.
+			std::vector<uint8_t> buffer(1024 * 1024);
+			size_t filled = 0;
+			while (!m_stop)
+			{
+				size_t count = m_shm->read(buffer.data() + filled, buffer.size() - filled);
+				if (count == 0)
+				{
+					if (!m_shm->wait_readable(SHM_WAIT_MS) && !m_shm->is_peer_alive())
+						break;
+					continue;
+				}
+				filled += count;
+
+				size_t offset = 0;
+				while (filled - offset >= sizeof(message::header))
+				{
+					message msg;
+					memcpy(&msg.header, buffer.data() + offset, sizeof(msg.header));
+					size_t total = sizeof(msg.header) + msg.header.length;
+					if (filled - offset < total)
+					{
+						// Make sure a message bigger than the buffer fits once we compact it
+						if (total > buffer.size())
+							buffer.resize(total);
+						break;
+					}
+
+					assert(msg.header.length > 0);
+					msg.data.assign(buffer.data() + offset + sizeof(msg.header), buffer.data() + offset + total);
+					offset += total;
+
+					if (msg.header.flags & message::FLAG_PRIORITY)
+						m_priority_read_buffer.enqueue(std::move(msg));
+					else
+						m_read_buffer.enqueue(std::move(msg));
+				}
+
+				memmove(buffer.data(), buffer.data() + offset, filled - offset);
+				filled -= offset;
+			}
+
+			if (!m_stop)
+				shm_disconnect();
+		}
+
+		void start_shm_threads()
+		{
+			m_shm_writer = std::thread([this]() { shm_write_loop(); });
+			m_shm_reader = std::thread([this]() { shm_read_loop(); });
+		}
+
+		// Appends a framed message to the given pending buffer and kicks the writer if idle
+		void append_message(std::vector<uint8_t>& pending, uint8_t type, uint8_t flags, uint32_t length, const uint8_t* data)
+		{
+			if (m_shm ? m_connected != connection_connected : !m_socket.is_open())
+				return;
+
+			assert(length > 0);
+
+			bool kick_writer = false;
+			{
+				std::scoped_lock lock(m_write_mutex);
+
+				// "struct" is required: message has both a nested type and a member named "header"
+				struct message::header hdr{};
+#ifdef DEBUG_NETWORK
+				hdr.id = message::next_id++;
+#endif
+				hdr.length = length;
+				hdr.type = type;
+				hdr.flags = flags;
+
+				size_t old_size = pending.size();
+				pending.resize(old_size + sizeof(hdr) + length);
+				memcpy(pending.data() + old_size, &hdr, sizeof(hdr));
+				memcpy(pending.data() + old_size + sizeof(hdr), data, length);
+				m_buffered_bytes.store(buffered_bytes_locked(), std::memory_order_relaxed);
+
+				if (!m_write_in_progress)
+				{
+					m_write_in_progress = true;
+					kick_writer = true;
+				}
+			}
+
+			// All socket operations must happen on the network thread
+			if (kick_writer)
+			{
+				if (m_shm)
+					m_write_cv.notify_one();
+				else
+					asio::post(m_context, [this]() { start_write(); });
+			}
+		}
+
 	public:
 		details()
 			: m_socket(m_context)
@@ -294,12 +579,14 @@ namespace owlcat
 
 			asio::error_code ec;
 			m_socket.connect(m_endpoint, ec);
-			m_socket.non_blocking(true);
 			if (ec)
 			{
 				printf("Failed to connect: %i (%s)\n", ec.value(), ec.message().c_str());
+				// Leave the socket closed, so connect can be retried
+				m_socket.close();
 				return false;
 			}
+			m_socket.non_blocking(true);
 
 			read_message_header_from_socket();
 
@@ -308,8 +595,51 @@ namespace owlcat
 			return true;
 		}
 
+		// Server side: creates the shared-memory segment and waits (asynchronously) for the
+		// client to open it. Returns false if the segment can't be created.
+		bool listen_shared_memory(const std::string& name)
+		{
+			m_stop = false;
+
+			auto shm = std::make_unique<shm_channel>();
+			if (!shm->create(name, shm_channel::DEFAULT_RING_SIZE))
+				return false;
+
+			m_shm = std::move(shm);
+			m_connected = connection_not_init;
+			m_listening = true;
+			start_shm_threads();
+			return true;
+		}
+
+		// Client side: opens the segment created by the server's listen_shared_memory
+		bool connect_shared_memory(const std::string& name)
+		{
+			m_stop = false;
+
+			auto shm = std::make_unique<shm_channel>();
+			if (!shm->open(name))
+			{
+				printf("Failed to open shared memory channel %s\n", name.c_str());
+				return false;
+			}
+
+			m_shm = std::move(shm);
+			m_connected = connection_connected;
+			++m_generation;
+			start_shm_threads();
+			return true;
+		}
+
+		bool is_shared_memory() const
+		{
+			return m_shm != nullptr;
+		}
+
 		bool is_connected() const
-		{			
+		{
+			if (m_shm)
+				return m_connected == connection_connected;
 			return m_socket.is_open() && m_connected == connection_connected;
 		}
 
@@ -320,6 +650,8 @@ namespace owlcat
 
 		bool is_listening() const
 		{
+			if (m_shm)
+				return m_listening;
 			return m_acceptor.is_open() && m_listening;
 		}
 
@@ -334,6 +666,14 @@ namespace owlcat
 			if (m_thread.joinable())
 				m_thread.join();
 
+			m_write_cv.notify_all();
+			if (m_shm_writer.joinable())
+				m_shm_writer.join();
+			if (m_shm_reader.joinable())
+				m_shm_reader.join();
+			m_shm.reset();
+			m_listening = false;
+
 			m_socket.close();
 			m_acceptor.close();
 
@@ -345,7 +685,10 @@ namespace owlcat
 
 			m_write_in_progress = false;
 			m_pending_writes.clear();
+			m_pending_priority_writes.clear();
 			m_writing.clear();
+			m_writing_priority.clear();
+			m_writing_offset = 0;
 			m_buffered_bytes.store(0, std::memory_order_relaxed);
 
 			m_connected = connection_not_init;
@@ -353,49 +696,22 @@ namespace owlcat
 
 		void write_message(uint8_t type, uint32_t length, const uint8_t* data)
 		{
-			if (!m_socket.is_open())
-				return;
-
-			assert(length > 0);
-
-			bool kick_writer = false;
-			{
-				std::scoped_lock lock(m_write_mutex);
-
-				// "struct" is required: message has both a nested type and a member named "header"
-				struct message::header hdr{};
-#ifdef DEBUG_NETWORK
-				hdr.id = message::next_id++;
-#endif
-				hdr.length = length;
-				hdr.type = type;
-
-				size_t old_size = m_pending_writes.size();
-				m_pending_writes.resize(old_size + sizeof(hdr) + length);
-				memcpy(m_pending_writes.data() + old_size, &hdr, sizeof(hdr));
-				memcpy(m_pending_writes.data() + old_size + sizeof(hdr), data, length);
-				m_buffered_bytes.store(m_pending_writes.size() + m_writing.size(), std::memory_order_relaxed);
-
-				if (!m_write_in_progress)
-				{
-					m_write_in_progress = true;
-					kick_writer = true;
-				}
-			}
+			append_message(m_pending_writes, type, 0, length, data);
+		}
 
-			// All socket operations must happen on the network thread
-			if (kick_writer)
-				asio::post(m_context, [this]() { start_write(); });
+		void write_priority_message(uint8_t type, uint32_t length, const uint8_t* data)
+		{
+			append_message(m_pending_priority_writes, type, message::FLAG_PRIORITY, length, data);
 		}
 
 		bool read_message(message& msg)
 		{
-			return m_read_buffer.try_dequeue(msg);
+			return m_priority_read_buffer.try_dequeue(msg) || m_read_buffer.try_dequeue(msg);
 		}
 
 		size_t get_read_messages_count() const
 		{
-			return m_read_buffer.size_approx();
+			return m_read_buffer.size_approx() + m_priority_read_buffer.size_approx();
 		}
 
 		size_t get_pending_write_bytes()
@@ -430,6 +746,21 @@ namespace owlcat
 		return m_details->connect(address, port);
 	}
 
+	bool network::listen_shared_memory(const std::string& name)
+	{
+		return m_details->listen_shared_memory(name);
+	}
+
+	bool network::connect_shared_memory(const std::string& name)
+	{
+		return m_details->connect_shared_memory(name);
+	}
+
+	bool network::is_shared_memory() const
+	{
+		return m_details->is_shared_memory();
+	}
+
 	bool network::is_connected() const
 	{
 		return m_details->is_connected();
@@ -460,6 +791,11 @@ namespace owlcat
 		m_details->write_message(type, length, data);
 	}
 
+	void network::write_priority_message(uint8_t type, uint32_t length, const uint8_t* data)
+	{
+		m_details->write_priority_message(type, length, data);
+	}
+
 	bool network::read_message(message& msg)
 	{
 		return m_details->read_message(msg);
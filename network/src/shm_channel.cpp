@@ -0,0 +1,411 @@
+#include "shm_channel.h"
+
+#include <atomic>
+#include <cstring>
+#include <chrono>
+#include <thread>
+
+#if defined(WIN32)
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <cerrno>
+#include <climits>
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+namespace owlcat
+{
+	static constexpr uint64_t SHM_MAGIC = 0x4D48534C574F; // "OWLSHM"
+	static constexpr uint32_t SHM_VERSION = 1;
+	// The client->server ring only carries commands
+	static constexpr size_t COMMAND_RING_SIZE = 1024 * 1024;
+	static constexpr size_t DATA_ALIGNMENT = 4096;
+
+	enum doorbell
+	{
+		doorbell_data = 0,
+		doorbell_space = 1,
+	};
+
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared-memory rings need lock-free 64-bit atomics");
+	static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared-memory rings need lock-free 32-bit atomics");
+
+	// Positions are monotonic byte counters; the offset in the ring is position % size.
+	// The producer and consumer fields live on separate cache lines.
+	struct shm_channel::ring_header
+	{
+		alignas(64) std::atomic<uint64_t> write_pos;
+		alignas(64) std::atomic<uint64_t> read_pos;
+		// Doorbell sequence numbers (futex words on Linux), bumped on every write/read,
+		// and flags set while the other side sleeps on them.
+		alignas(64) std::atomic<uint32_t> doorbell_seq[2];
+		std::atomic<uint32_t> waiting[2];
+	};
+
+	struct shm_channel::control_block
+	{
+		uint64_t magic;
+		uint32_t version;
+		uint32_t reserved;
+		// [0] = server->client, [1] = client->server
+		uint64_t ring_sizes[2];
+		std::atomic<uint32_t> pids[2];
+		std::atomic<uint32_t> closed[2];
+		std::atomic<uint32_t> client_attached;
+		ring_header rings[2];
+	};
+
+	// The ring data starts at the first page after the control block
+	size_t shm_channel::header_size()
+	{
+		return (sizeof(control_block) + DATA_ALIGNMENT - 1) / DATA_ALIGNMENT * DATA_ALIGNMENT;
+	}
+
+	static uint32_t current_pid()
+	{
+#if defined(WIN32)
+		return (uint32_t)GetCurrentProcessId();
+#else
+		return (uint32_t)getpid();
+#endif
+	}
+
+	shm_channel::~shm_channel()
+	{
+		close();
+	}
+
+	shm_channel::ring_header& shm_channel::outbound() const
+	{
+		return m_control->rings[outbound_index()];
+	}
+
+	shm_channel::ring_header& shm_channel::inbound() const
+	{
+		return m_control->rings[inbound_index()];
+	}
+
+	uint64_t shm_channel::ring_size(int ring) const
+	{
+		return m_control->ring_sizes[ring];
+	}
+
+	uint8_t* shm_channel::ring_data(int ring) const
+	{
+		uint8_t* base = (uint8_t*)m_control + header_size();
+		return ring == 0 ? base : base + m_control->ring_sizes[0];
+	}
+
+	bool shm_channel::map(const std::string& name, size_t size, bool create)
+	{
+#if defined(WIN32)
+		std::string mapping_name = "Local\\" + name;
+		if (create)
+			m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)(size & 0xFFFFFFFF), mapping_name.c_str());
+		else
+			m_mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, mapping_name.c_str());
+		if (m_mapping == nullptr)
+			return false;
+
+		void* view = MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, create ? size : 0);
+		if (view == nullptr)
+		{
+			CloseHandle(m_mapping);
+			m_mapping = nullptr;
+			return false;
+		}
+
+		if (!create)
+		{
+			MEMORY_BASIC_INFORMATION info;
+			VirtualQuery(view, &info, sizeof(info));
+			size = info.RegionSize;
+		}
+
+		for (int ring = 0; ring < 2; ++ring)
+		{
+			for (int bell = 0; bell < 2; ++bell)
+			{
+				std::string event_name = mapping_name + "_" + std::to_string(ring) + std::to_string(bell);
+				m_events[ring][bell] = CreateEventA(nullptr, FALSE, FALSE, event_name.c_str());
+			}
+		}
+#else
+		std::string shm_name = "/" + name;
+		int fd = create ? shm_open(shm_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600) : shm_open(shm_name.c_str(), O_RDWR, 0600);
+		if (fd < 0)
+			return false;
+
+		if (create)
+		{
+			if (ftruncate(fd, (off_t)size) != 0)
+			{
+				::close(fd);
+				shm_unlink(shm_name.c_str());
+				return false;
+			}
+		}
+		else
+		{
+			struct stat st;
+			if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(control_block))
+			{
+				::close(fd);
+				return false;
+			}
+			size = (size_t)st.st_size;
+		}
+
+		void* view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (view == MAP_FAILED)
+		{
+			if (create)
+				shm_unlink(shm_name.c_str());
+			return false;
+		}
+#endif
+		m_control = (control_block*)view;
+		m_mapping_size = size;
+		m_name = name;
+		return true;
+	}
+
+	bool shm_channel::create(const std::string& name, size_t ring_size)
+	{
+		close();
+
+		if (!map(name, header_size() + ring_size + COMMAND_RING_SIZE, true))
+			return false;
+
+		m_is_server = true;
+
+		// A fresh mapping is zero-filled, which is a valid initial state for the atomics
+		m_control->magic = SHM_MAGIC;
+		m_control->version = SHM_VERSION;
+		m_control->ring_sizes[0] = ring_size;
+		m_control->ring_sizes[1] = COMMAND_RING_SIZE;
+		m_control->pids[0].store(current_pid());
+		return true;
+	}
+
+	bool shm_channel::open(const std::string& name)
+	{
+		close();
+
+		if (!map(name, 0, false))
+			return false;
+
+		m_is_server = false;
+
+		if (m_control->magic != SHM_MAGIC || m_control->version != SHM_VERSION
+			|| header_size() + m_control->ring_sizes[0] + m_control->ring_sizes[1] > m_mapping_size
+			|| m_control->client_attached.load() != 0)
+		{
+			// Not ours, from an incompatible version, or already taken by another client
+			close();
+			return false;
+		}
+
+		m_control->pids[1].store(current_pid());
+		m_control->client_attached.store(1);
+		return true;
+	}
+
+	void shm_channel::close()
+	{
+		if (m_control == nullptr)
+			return;
+
+		// Tell the peer, and wake it up if it sleeps on one of the doorbells
+		m_control->closed[m_is_server ? 0 : 1].store(1);
+		for (int ring = 0; ring < 2; ++ring)
+		{
+			for (int bell = 0; bell < 2; ++bell)
+			{
+				m_control->rings[ring].doorbell_seq[bell].fetch_add(1);
+				wake(ring, bell);
+			}
+		}
+
+#if defined(WIN32)
+		UnmapViewOfFile(m_control);
+		CloseHandle(m_mapping);
+		m_mapping = nullptr;
+		for (int ring = 0; ring < 2; ++ring)
+		{
+			for (int bell = 0; bell < 2; ++bell)
+			{
+				if (m_events[ring][bell] != nullptr)
+					CloseHandle(m_events[ring][bell]);
+				m_events[ring][bell] = nullptr;
+			}
+		}
+		if (m_peer_process != nullptr)
+			CloseHandle(m_peer_process);
+		m_peer_process = nullptr;
+#else
+		munmap(m_control, m_mapping_size);
+		// The client has mapped it already (or never will), the name is no longer needed
+		if (m_is_server)
+			shm_unlink(("/" + m_name).c_str());
+#endif
+		m_control = nullptr;
+		m_mapping_size = 0;
+	}
+
+	bool shm_channel::is_peer_attached() const
+	{
+		return m_control != nullptr && m_control->client_attached.load() != 0;
+	}
+
+	bool shm_channel::is_peer_alive()
+	{
+		if (m_control == nullptr)
+			return false;
+
+		int peer = m_is_server ? 1 : 0;
+		if (m_control->closed[peer].load() != 0)
+			return false;
+
+		uint32_t pid = m_control->pids[peer].load();
+		if (pid == 0)
+			return true; // not attached yet
+
+#if defined(WIN32)
+		if (m_peer_process == nullptr)
+			m_peer_process = OpenProcess(SYNCHRONIZE, FALSE, pid);
+		if (m_peer_process == nullptr)
+			return false;
+		return WaitForSingleObject(m_peer_process, 0) == WAIT_TIMEOUT;
+#else
+		return kill((pid_t)pid, 0) == 0 || errno == EPERM;
+#endif
+	}
+
+	size_t shm_channel::write(const uint8_t* data, size_t size)
+	{
+		int index = outbound_index();
+		auto& ring = outbound();
+		uint64_t capacity = ring_size(index);
+
+		uint64_t w = ring.write_pos.load(std::memory_order_relaxed);
+		uint64_t r = ring.read_pos.load(std::memory_order_acquire);
+		uint64_t free_bytes = capacity - (w - r);
+		size_t count = (size_t)(size < free_bytes ? size : free_bytes);
+		if (count == 0)
+			return 0;
+
+		uint8_t* dst = ring_data(index);
+		size_t offset = (size_t)(w % capacity);
+		size_t first = count < capacity - offset ? count : (size_t)(capacity - offset);
+		memcpy(dst + offset, data, first);
+		memcpy(dst, data + first, count - first);
+
+		ring.write_pos.store(w + count, std::memory_order_release);
+		ring.doorbell_seq[doorbell_data].fetch_add(1);
+		if (ring.waiting[doorbell_data].load() != 0)
+			wake(index, doorbell_data);
+
+		return count;
+	}
+
+	size_t shm_channel::read(uint8_t* data, size_t size)
+	{
+		int index = inbound_index();
+		auto& ring = inbound();
+		uint64_t capacity = ring_size(index);
+
+		uint64_t r = ring.read_pos.load(std::memory_order_relaxed);
+		uint64_t w = ring.write_pos.load(std::memory_order_acquire);
+		uint64_t available = w - r;
+		size_t count = (size_t)(size < available ? size : available);
+		if (count == 0)
+			return 0;
+
+		const uint8_t* src = ring_data(index);
+		size_t offset = (size_t)(r % capacity);
+		size_t first = count < capacity - offset ? count : (size_t)(capacity - offset);
+		memcpy(data, src + offset, first);
+		memcpy(data + first, src, count - first);
+
+		ring.read_pos.store(r + count, std::memory_order_release);
+		ring.doorbell_seq[doorbell_space].fetch_add(1);
+		if (ring.waiting[doorbell_space].load() != 0)
+			wake(index, doorbell_space);
+
+		return count;
+	}
+
+	bool shm_channel::wait_writable(int timeout_ms)
+	{
+		int index = outbound_index();
+		auto& ring = outbound();
+		auto has_space = [&]() { return ring.write_pos.load(std::memory_order_relaxed) - ring.read_pos.load(std::memory_order_acquire) < ring_size(index); };
+
+		uint32_t seen = ring.doorbell_seq[doorbell_space].load();
+		if (has_space())
+			return true;
+
+		ring.waiting[doorbell_space].store(1);
+		if (!has_space())
+			wait(index, doorbell_space, seen, timeout_ms);
+		ring.waiting[doorbell_space].store(0);
+
+		return has_space();
+	}
+
+	bool shm_channel::wait_readable(int timeout_ms)
+	{
+		int index = inbound_index();
+		auto& ring = inbound();
+		auto has_data = [&]() { return ring.write_pos.load(std::memory_order_acquire) != ring.read_pos.load(std::memory_order_relaxed); };
+
+		uint32_t seen = ring.doorbell_seq[doorbell_data].load();
+		if (has_data())
+			return true;
+
+		ring.waiting[doorbell_data].store(1);
+		if (!has_data())
+			wait(index, doorbell_data, seen, timeout_ms);
+		ring.waiting[doorbell_data].store(0);
+
+		return has_data();
+	}
+
+	void shm_channel::wait(int ring, int bell, uint32_t seen, int timeout_ms)
+	{
+#if defined(WIN32)
+		(void)seen;
+		WaitForSingleObject(m_events[ring][bell], (DWORD)timeout_ms);
+#elif defined(__linux__)
+		// Returns immediately if the sequence number has changed since we checked the ring
+		timespec timeout{ timeout_ms / 1000, (long)(timeout_ms % 1000) * 1000000 };
+		syscall(SYS_futex, (uint32_t*)&m_control->rings[ring].doorbell_seq[bell], FUTEX_WAIT, seen, &timeout, nullptr, 0);
+#else
+		// No cross-process futex: poll
+		(void)ring; (void)bell; (void)seen; (void)timeout_ms;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+#endif
+	}
+
+	void shm_channel::wake(int ring, int bell)
+	{
+#if defined(WIN32)
+		if (m_events[ring][bell] != nullptr)
+			SetEvent(m_events[ring][bell]);
+#elif defined(__linux__)
+		syscall(SYS_futex, (uint32_t*)&m_control->rings[ring].doorbell_seq[bell], FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#else
+		(void)ring; (void)bell;
+#endif
+	}
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+namespace owlcat
+{
+	/*
+		A pair of single-producer/single-consumer byte rings in a named shared-memory segment,
+		used by network as an alternative to TCP when the client and the profiled app run on
+		the same machine. One ring carries server->client data (events, large), the other one
+		client->server data (commands, small). Each ring is a plain byte stream, so network
+		frames messages on it exactly like on a socket.
+
+		Data is copied straight into the peer's address space: no syscalls per batch, and
+		only when one side actually sleeps does the other one ring its doorbell (a futex on
+		Linux, a named auto-reset event on Windows). Waits always have a timeout, so a missed
+		wake-up costs at most one timeout, and a dead peer is detected by polling its pid.
+
+		The server creates the segment, the client opens it. Every process may only write on
+		its own outbound ring from one thread, and read its inbound ring from one thread.
+	*/
+	class shm_channel
+	{
+		struct control_block;
+		struct ring_header;
+
+		control_block* m_control = nullptr;
+		size_t m_mapping_size = 0;
+		bool m_is_server = false;
+		std::string m_name;
+
+#if defined(WIN32)
+		void* m_mapping = nullptr;
+		// Doorbells, indexed by [ring][0 = data available, 1 = space available]
+		void* m_events[2][2] = {};
+		void* m_peer_process = nullptr;
+#endif
+
+		static size_t header_size();
+		ring_header& outbound() const;
+		ring_header& inbound() const;
+		uint8_t* ring_data(int ring) const;
+		uint64_t ring_size(int ring) const;
+		int outbound_index() const { return m_is_server ? 0 : 1; }
+		int inbound_index() const { return m_is_server ? 1 : 0; }
+
+		bool map(const std::string& name, size_t size, bool create);
+		void wait(int ring, int doorbell, uint32_t seen, int timeout_ms);
+		void wake(int ring, int doorbell);
+
+	public:
+		// Size of the server->client ring used by network. Big enough to absorb a frame's
+		// worth of events while the client is busy.
+		static constexpr size_t DEFAULT_RING_SIZE = 64 * 1024 * 1024;
+
+		shm_channel() = default;
+		~shm_channel();
+
+		shm_channel(const shm_channel&) = delete;
+		shm_channel& operator=(const shm_channel&) = delete;
+
+		// Server side: creates the segment with the given server->client ring size
+		bool create(const std::string& name, size_t ring_size);
+		// Client side: opens a segment created by the server and announces itself
+		bool open(const std::string& name);
+		// Marks our side closed and unmaps the segment (the server also removes its name)
+		void close();
+
+		bool is_open() const { return m_control != nullptr; }
+		// True once the client has opened the segment (always true on the client side)
+		bool is_peer_attached() const;
+		// False if the peer has closed its side or its process is gone
+		bool is_peer_alive();
+
+		// Copies up to size bytes to the outbound ring. Returns the number of bytes written,
+		// 0 if the ring is full.
+		size_t write(const uint8_t* data, size_t size);
+		// Copies up to size bytes from the inbound ring. Returns the number of bytes read,
+		// 0 if the ring is empty.
+		size_t read(uint8_t* data, size_t size);
+
+		// Block until the outbound ring has free space / the inbound ring has data, or until
+		// the timeout expires. Return true if the condition is met.
+		bool wait_writable(int timeout_ms);
+		bool wait_readable(int timeout_ms);
+	};
+}
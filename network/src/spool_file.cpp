@@ -0,0 +1,325 @@
+#include "spool_file.h"
+
+#include <cstring>
+
+#include "profiler_thread.h"
+
+namespace owlcat
+{
+	static const char SPOOL_MAGIC[8] = { 'O', 'W', 'L', 'S', 'P', 'O', 'O', 'L' };
+	static const uint32_t SPOOL_VERSION = 1;
+
+	std::string spool_segment_path(const std::string& prefix, uint32_t index)
+	{
+		char suffix[32];
+		snprintf(suffix, sizeof(suffix), ".%06u.spool", index);
+		return prefix + suffix;
+	}
+
+	// ---------------- spool_writer ----------------
+
+	spool_writer::~spool_writer()
+	{
+		close();
+	}
+
+	bool spool_writer::open_segment()
+	{
+		if (m_file != nullptr)
+		{
+			fclose(m_file);
+			++m_segment_index;
+		}
+
+		m_file = fopen(spool_segment_path(m_prefix, m_segment_index).c_str(), "wb");
+		if (m_file == nullptr)
+			return false;
+
+		// We do our own buffering
+		setvbuf(m_file, nullptr, _IONBF, 0);
+
+		spool_segment_header header{};
+		memcpy(header.magic, SPOOL_MAGIC, sizeof(header.magic));
+		header.version = SPOOL_VERSION;
+		header.segment_index = m_segment_index;
+		if (fwrite(&header, sizeof(header), 1, m_file) != 1)
+			return false;
+
+		m_segment_bytes = sizeof(header);
+		return true;
+	}
+
+	bool spool_writer::open(const std::string& prefix, uint64_t segment_size)
+	{
+		close();
+
+		m_prefix = prefix;
+		m_segment_size = segment_size;
+		m_segment_index = 0;
+		m_failed = false;
+		m_stop = false;
+		m_flush_requested = false;
+		m_pending_bytes = 0;
+		m_current.clear();
+		m_current.reserve(BUFFER_SIZE);
+
+		if (!open_segment())
+		{
+			if (m_file != nullptr)
+				fclose(m_file);
+			m_file = nullptr;
+			return false;
+		}
+
+		m_thread = std::thread(&spool_writer::write_loop, this);
+		return true;
+	}
+
+	void spool_writer::close()
+	{
+		if (!m_thread.joinable())
+			return;
+
+		{
+			std::scoped_lock lock(m_mutex);
+			m_stop = true;
+		}
+		m_cv.notify_one();
+		m_thread.join();
+
+		if (m_file != nullptr)
+			fclose(m_file);
+		m_file = nullptr;
+		m_full.clear();
+		m_free.clear();
+		m_current = std::vector<uint8_t>();
+	}
+
+	void spool_writer::write_message(uint8_t type, uint32_t length, const uint8_t* data)
+	{
+		struct message::header hdr{};
+		hdr.length = length;
+		hdr.type = type;
+
+		bool notify = false;
+		{
+			std::scoped_lock lock(m_mutex);
+			if (m_stop)
+				return;
+
+			if (m_current.size() + sizeof(hdr) + length > BUFFER_SIZE && !m_current.empty())
+			{
+				m_full.push_back(std::move(m_current));
+				if (!m_free.empty())
+				{
+					m_current = std::move(m_free.back());
+					m_free.pop_back();
+				}
+				else
+				{
+					m_current = std::vector<uint8_t>();
+					m_current.reserve(BUFFER_SIZE);
+				}
+				notify = true;
+			}
+
+			size_t old_size = m_current.size();
+			m_current.resize(old_size + sizeof(hdr) + length);
+			memcpy(m_current.data() + old_size, &hdr, sizeof(hdr));
+			memcpy(m_current.data() + old_size + sizeof(hdr), data, length);
+		}
+		m_pending_bytes.fetch_add(sizeof(hdr) + length, std::memory_order_relaxed);
+
+		if (notify)
+			m_cv.notify_one();
+	}
+
+	void spool_writer::flush()
+	{
+		{
+			std::scoped_lock lock(m_mutex);
+			m_flush_requested = true;
+		}
+		m_cv.notify_one();
+	}
+
+	void spool_writer::write_loop()
+	{
+		// Profiler-owned thread when used by the server
+		t_profiler_internal_thread = true;
+
+		std::unique_lock lock(m_mutex);
+		for (;;)
+		{
+			m_cv.wait(lock, [this]() { return m_stop || m_flush_requested || !m_full.empty(); });
+
+			// On flush and on stop, the partially filled buffer goes out too
+			if ((m_flush_requested || m_stop) && !m_current.empty())
+			{
+				m_full.push_back(std::move(m_current));
+				m_current = std::vector<uint8_t>();
+				m_current.reserve(BUFFER_SIZE);
+			}
+			m_flush_requested = false;
+
+			if (m_full.empty())
+			{
+				if (m_stop)
+					break;
+				continue;
+			}
+
+			std::vector<std::vector<uint8_t>> buffers;
+			buffers.swap(m_full);
+			lock.unlock();
+
+			for (auto& buffer : buffers)
+			{
+				// Segments hold whole buffers (and thus whole messages) only
+				if (m_segment_bytes + buffer.size() > m_segment_size && m_segment_bytes > sizeof(spool_segment_header))
+					m_failed = m_failed || !open_segment();
+
+				if (!m_failed && fwrite(buffer.data(), 1, buffer.size(), m_file) != buffer.size())
+					m_failed = true;
+
+				m_segment_bytes += buffer.size();
+				m_pending_bytes.fetch_sub(buffer.size(), std::memory_order_relaxed);
+			}
+			if (m_file != nullptr)
+				fflush(m_file);
+
+			lock.lock();
+			for (auto& buffer : buffers)
+			{
+				buffer.clear();
+				// Keep a couple of buffers around for reuse, not all of a burst's worth
+				if (m_free.size() < 4)
+					m_free.push_back(std::move(buffer));
+			}
+		}
+	}
+
+	// ---------------- spool_reader ----------------
+
+	spool_reader::~spool_reader()
+	{
+		close();
+	}
+
+	FILE* spool_reader::open_segment_file(uint32_t index) const
+	{
+		FILE* file = fopen(spool_segment_path(m_prefix, index).c_str(), "rb");
+		if (file == nullptr)
+			return nullptr;
+
+		spool_segment_header header;
+		if (fread(&header, sizeof(header), 1, file) != 1
+			|| memcmp(header.magic, SPOOL_MAGIC, sizeof(header.magic)) != 0
+			|| header.version != SPOOL_VERSION
+			|| header.segment_index != index)
+		{
+			fclose(file);
+			return nullptr;
+		}
+		return file;
+	}
+
+	void spool_reader::use_segment(FILE* file, uint32_t index)
+	{
+		if (m_file != nullptr)
+			fclose(m_file);
+		m_file = file;
+		m_segment_index = index;
+		m_buffer.clear();
+		m_buffer_pos = 0;
+	}
+
+	bool spool_reader::open_segment(uint32_t index)
+	{
+		FILE* file = open_segment_file(index);
+		if (file == nullptr)
+			return false;
+		use_segment(file, index);
+		return true;
+	}
+
+	bool spool_reader::open(const std::string& prefix)
+	{
+		close();
+		m_prefix = prefix;
+		return open_segment(0);
+	}
+
+	void spool_reader::close()
+	{
+		if (m_file != nullptr)
+			fclose(m_file);
+		m_file = nullptr;
+		m_buffer.clear();
+		m_buffer_pos = 0;
+	}
+
+	bool spool_reader::fill(size_t size)
+	{
+		if (m_buffer.size() - m_buffer_pos >= size)
+			return true;
+
+		// Compact, then append as much as the file has now
+		m_buffer.erase(m_buffer.begin(), m_buffer.begin() + m_buffer_pos);
+		m_buffer_pos = 0;
+
+		const size_t READ_SIZE = 4 * 1024 * 1024;
+		size_t old_size = m_buffer.size();
+		size_t want = size > old_size + READ_SIZE ? size - old_size : READ_SIZE;
+		m_buffer.resize(old_size + want);
+		// The file may be growing: clear EOF from a previous attempt
+		clearerr(m_file);
+		size_t read = fread(m_buffer.data() + old_size, 1, want, m_file);
+		m_buffer.resize(old_size + read);
+
+		return m_buffer.size() >= size;
+	}
+
+	bool spool_reader::read_message(message& msg)
+	{
+		if (m_file == nullptr)
+			return false;
+
+		for (;;)
+		{
+			if (take_message(msg))
+				return true;
+
+			// Nothing complete in this segment. Once the next segment exists, this one is
+			// finished (the writer never splits a message across segments), but the writer
+			// may have appended its last buffers to it after the read above: it is read
+			// once more before switching.
+			FILE* next = open_segment_file(m_segment_index + 1);
+			if (next == nullptr)
+				return false;
+			if (take_message(msg))
+			{
+				fclose(next);
+				return true;
+			}
+			use_segment(next, m_segment_index + 1);
+		}
+	}
+
+	bool spool_reader::take_message(message& msg)
+	{
+		if (!fill(sizeof(message::header)))
+			return false;
+
+		struct message::header hdr;
+		memcpy(&hdr, m_buffer.data() + m_buffer_pos, sizeof(hdr));
+		if (!fill(sizeof(hdr) + hdr.length))
+			return false;
+
+		msg.header = hdr;
+		const uint8_t* body = m_buffer.data() + m_buffer_pos + sizeof(hdr);
+		msg.data.assign(body, body + hdr.length);
+		m_buffer_pos += sizeof(hdr) + hdr.length;
+		return true;
+	}
+}
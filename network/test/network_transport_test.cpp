@@ -0,0 +1,198 @@
+#include "network.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(WIN32)
+#include <Windows.h>
+#else
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace owlcat;
+
+/*
+	Transport test and throughput benchmark. The "server" side streams allocation-sized
+	messages (numbered, so the receiver can check that nothing is lost or reordered) to the
+	"client" side, which acknowledges the end of the stream. Run as
+
+		network_transport_test <tcp|shm> [message count]
+
+	On Linux the client runs in a forked child process; on Windows in a second thread.
+*/
+
+static const int PORT = 8897;
+static const uint8_t MSG_DATA = 1;
+static const uint8_t MSG_END = 2;
+static const uint8_t MSG_ACK = 3;
+// Roughly the size of an SRV_ALLOC message
+static const uint32_t MSG_SIZE = 32;
+
+static bool wait_connected(network& net, int seconds)
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+	while (!net.is_connected() && std::chrono::steady_clock::now() < deadline)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	return net.is_connected();
+}
+
+static int run_client(bool shm, const std::string& shm_name)
+{
+	network net;
+	bool connected = false;
+	for (int attempt = 0; attempt < 100 && !connected; ++attempt)
+	{
+		connected = shm ? net.connect_shared_memory(shm_name) : net.connect("127.0.0.1", PORT);
+		if (!connected)
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+	if (!connected)
+	{
+		printf("client: failed to connect\n");
+		return 1;
+	}
+
+	uint64_t expected = 0;
+	for (;;)
+	{
+		message msg;
+		if (!net.read_message(msg))
+		{
+			if (!net.is_connected() && !net.is_connecting())
+			{
+				printf("client: disconnected after %llu messages\n", (unsigned long long)expected);
+				return 1;
+			}
+			std::this_thread::yield();
+			continue;
+		}
+
+		uint64_t seq = 0;
+		memcpy(&seq, msg.data.data(), sizeof(seq));
+		if (msg.header.type == MSG_DATA)
+		{
+			if (seq != expected || msg.header.length != MSG_SIZE)
+			{
+				printf("client: message %llu is broken or out of order (expected %llu)\n", (unsigned long long)seq, (unsigned long long)expected);
+				return 1;
+			}
+			++expected;
+		}
+		else if (msg.header.type == MSG_END)
+		{
+			bool ok = seq == expected;
+			if (!ok)
+				printf("client: stream ended after %llu messages, but %llu were sent\n", (unsigned long long)expected, (unsigned long long)seq);
+			uint8_t result = ok ? 1 : 0;
+			net.write_priority_message(MSG_ACK, 1, &result);
+			// Let the acknowledgement go out before disconnecting
+			std::this_thread::sleep_for(std::chrono::milliseconds(500));
+			net.stop();
+			return ok ? 0 : 1;
+		}
+	}
+}
+
+static int run_server(bool shm, const std::string& shm_name, uint64_t count)
+{
+	network net;
+	if (shm)
+	{
+		if (!net.listen_shared_memory(shm_name))
+		{
+			printf("server: failed to create shared memory channel\n");
+			return 1;
+		}
+	}
+	else
+		net.listen_async(PORT);
+
+	if (!wait_connected(net, 10))
+	{
+		printf("server: no client\n");
+		return 1;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	uint8_t data[MSG_SIZE] = {};
+	for (uint64_t i = 0; i < count; ++i)
+	{
+		memcpy(data, &i, sizeof(i));
+		net.write_message(MSG_DATA, MSG_SIZE, data);
+
+		// Same back-pressure the profiler applies, so the send buffer stays bounded
+		while (net.get_pending_write_bytes() > 256 * 1024 * 1024 && net.is_connected())
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	memcpy(data, &count, sizeof(count));
+	net.write_message(MSG_END, MSG_SIZE, data);
+
+	uint8_t result = 0;
+	for (;;)
+	{
+		message msg;
+		if (net.read_message(msg))
+		{
+			if (msg.header.type == MSG_ACK)
+			{
+				result = msg.data[0];
+				break;
+			}
+			continue;
+		}
+		if (!net.is_connected())
+			break;
+		std::this_thread::yield();
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	uint64_t bytes = count * (MSG_SIZE + sizeof(message::header));
+	printf("%s: %llu messages in %.2f s: %.2f M msg/s, %.1f MB/s\n", shm ? "shm" : "tcp", (unsigned long long)count, seconds, count / seconds / 1e6, bytes / seconds / (1024.0 * 1024.0));
+
+	net.stop();
+
+	if (result != 1)
+	{
+		printf("FAILED: the client did not confirm the stream\n");
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2 || (strcmp(argv[1], "tcp") != 0 && strcmp(argv[1], "shm") != 0))
+	{
+		printf("Usage: network_transport_test <tcp|shm> [message count]\n");
+		return 1;
+	}
+
+	bool shm = strcmp(argv[1], "shm") == 0;
+	uint64_t count = argc > 2 ? strtoull(argv[2], nullptr, 10) : 20000000;
+
+#if defined(WIN32)
+	std::string shm_name = "OwlcatMonoProfilerTest_" + std::to_string(GetCurrentProcessId());
+	int client_result = 0;
+	std::thread client([&]() { client_result = run_client(shm, shm_name); });
+	int server_result = run_server(shm, shm_name, count);
+	client.join();
+	return server_result != 0 ? server_result : client_result;
+#else
+	std::string shm_name = "OwlcatMonoProfilerTest_" + std::to_string(getpid());
+	pid_t child = fork();
+	if (child == 0)
+		return run_client(shm, shm_name);
+
+	int server_result = run_server(shm, shm_name, count);
+	int status = 0;
+	waitpid(child, &status, 0);
+	int client_result = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+	return server_result != 0 ? server_result : client_result;
+#endif
+}
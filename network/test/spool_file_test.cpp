@@ -0,0 +1,205 @@
+#include "spool_file.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace owlcat;
+
+/*
+	Spool test: writes numbered messages of varying size to a spool with small segments (so
+	it rolls over many times), reading it back while it is being written, like a client
+	following a spool, and again from the start once it is closed. A spool with small
+	segments is then followed by a thread that reads as soon as anything is written, across
+	hundreds of rollovers. Every message must come back once, in order and intact, and
+	messages written after close must be dropped. Run as
+
+		spool_file_test [message count]
+*/
+
+static const uint8_t MSG_DATA = 1;
+// Small enough to give dozens of segments with the default message count
+static const uint64_t SEGMENT_SIZE = 1024 * 1024;
+// Small enough for a rollover every few flushes in the follow test
+static const uint64_t SMALL_SEGMENT_SIZE = 16 * 1024;
+
+static uint32_t message_size(uint64_t seq)
+{
+	return (uint32_t)(sizeof(uint64_t) + seq % 200);
+}
+
+static void make_message(uint64_t seq, std::vector<uint8_t>& data)
+{
+	data.resize(message_size(seq));
+	for (size_t i = 0; i < data.size(); ++i)
+		data[i] = (uint8_t)(seq * 31 + i);
+	memcpy(data.data(), &seq, sizeof(seq));
+}
+
+// Reads the messages available now, checking they continue the sequence at expected
+static bool read_available(spool_reader& reader, uint64_t& expected)
+{
+	std::vector<uint8_t> data;
+	message msg;
+	while (reader.read_message(msg))
+	{
+		make_message(expected, data);
+		if (msg.header.type != MSG_DATA || msg.data != data)
+		{
+			printf("FAILED: message %llu is broken or out of order\n", (unsigned long long)expected);
+			return false;
+		}
+		++expected;
+	}
+	return true;
+}
+
+// Follows a spool with small segments from another thread, reading as soon as anything is
+// written, so that the follower is often at the end of a segment when the writer appends
+// to it and rolls over to the next one
+static bool follow_rollovers(const std::string& prefix, uint64_t count)
+{
+	spool_writer writer;
+	spool_reader follower;
+	if (!writer.open(prefix, SMALL_SEGMENT_SIZE) || !follower.open(prefix))
+	{
+		printf("FAILED: can't open the spool to follow\n");
+		return false;
+	}
+
+	std::atomic<bool> closed{ false };
+	uint64_t followed = 0;
+	bool ok = true;
+	std::thread thread([&]()
+	{
+		while (ok && !closed)
+		{
+			ok = read_available(follower, followed);
+			std::this_thread::yield();
+		}
+		// Whatever was written before close
+		ok = ok && read_available(follower, followed);
+	});
+
+	std::vector<uint8_t> data;
+	for (uint64_t seq = 0; seq < count; ++seq)
+	{
+		make_message(seq, data);
+		writer.write_message(MSG_DATA, (uint32_t)data.size(), data.data());
+		// Paced, so that the writer thread keeps up and writes every flush as a buffer of
+		// its own: a segment gets several, the last one right before the rollover
+		if (seq % 16 == 15)
+		{
+			writer.flush();
+			std::this_thread::sleep_for(std::chrono::microseconds(20));
+		}
+	}
+	writer.close();
+	closed = true;
+	thread.join();
+	follower.close();
+
+	uint32_t segments = 0;
+	std::error_code ec;
+	while (std::filesystem::exists(spool_segment_path(prefix, segments), ec))
+		++segments;
+	printf("%llu messages in %u small segments: followed %llu\n", (unsigned long long)count, segments, (unsigned long long)followed);
+
+	if (!ok || followed != count)
+	{
+		printf("FAILED: followed %llu of %llu messages across segment rollovers\n", (unsigned long long)followed, (unsigned long long)count);
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	uint64_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 500000;
+	if (count == 0)
+	{
+		printf("Usage: spool_file_test [message count]\n");
+		return 1;
+	}
+
+	std::error_code ec;
+	const auto dir = std::filesystem::temp_directory_path(ec) / "owlcat_spool_file_test";
+	std::filesystem::remove_all(dir, ec);
+	std::filesystem::create_directories(dir, ec);
+	const std::string prefix = (dir / "capture").string();
+
+	spool_writer writer;
+	if (!writer.open(prefix, SEGMENT_SIZE))
+	{
+		printf("FAILED: can't open the spool for writing\n");
+		return 1;
+	}
+
+	// Follow the spool while it is written: flush every so often, like the server does
+	// at the end of a frame, and read whatever has reached the disk
+	spool_reader follower;
+	if (!follower.open(prefix))
+	{
+		printf("FAILED: can't open the spool for reading\n");
+		return 1;
+	}
+
+	int result = 0;
+	uint64_t followed = 0;
+	std::vector<uint8_t> data;
+	for (uint64_t seq = 0; seq < count; ++seq)
+	{
+		make_message(seq, data);
+		writer.write_message(MSG_DATA, (uint32_t)data.size(), data.data());
+		if (seq % 10000 == 9999)
+		{
+			writer.flush();
+			if (!read_available(follower, followed))
+				result = 1;
+		}
+	}
+	writer.close();
+
+	// Dropped: the spool is closed
+	make_message(count, data);
+	writer.write_message(MSG_DATA, (uint32_t)data.size(), data.data());
+	if (writer.pending_bytes() != 0 || writer.has_failed())
+	{
+		printf("FAILED: %llu bytes pending after close, failed %d\n", (unsigned long long)writer.pending_bytes(), writer.has_failed() ? 1 : 0);
+		result = 1;
+	}
+
+	if (!read_available(follower, followed) || followed != count)
+	{
+		printf("FAILED: followed %llu of %llu messages\n", (unsigned long long)followed, (unsigned long long)count);
+		result = 1;
+	}
+
+	spool_reader reader;
+	uint64_t imported = 0;
+	if (!reader.open(prefix) || !read_available(reader, imported) || imported != count)
+	{
+		printf("FAILED: imported %llu of %llu messages\n", (unsigned long long)imported, (unsigned long long)count);
+		result = 1;
+	}
+
+	uint32_t segments = 0;
+	while (std::filesystem::exists(spool_segment_path(prefix, segments), ec))
+		++segments;
+	printf("%llu messages in %u segments: followed %llu, imported %llu\n", (unsigned long long)count, segments, (unsigned long long)followed, (unsigned long long)imported);
+
+	follower.close();
+	reader.close();
+
+	if (!follow_rollovers((dir / "followed").string(), count / 5))
+		result = 1;
+
+	std::filesystem::remove_all(dir, ec);
+	return result;
+}
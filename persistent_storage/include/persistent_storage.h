@@ -1,10 +1,15 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <map>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
+struct sqlite3_stmt;
+
 namespace persistent_storage {
 
 /**
@@ -98,6 +103,119 @@ private:
     std::map<std::string, db_value> m_saved_params;
 };
 
+/**
+    \brief A view of a blob, either bound to a statement or returned by it
+*/
+struct blob_view
+{
+    blob_view() {}
+    blob_view(const uint8_t* data, size_t size) : data(data), size(size) {}
+    blob_view(const std::vector<uint8_t>& value) : data(value.data()), size(value.size()) {}
+
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+};
+
+/**
+    \brief A compiled statement with typed, positional parameters and columns accessed by ordinal
+
+    This is the fast path for queries that run once per row: nothing is looked up by name,
+    and nothing is copied. Parameters are bound in the order they first appear in the query
+    text, columns are numbered from 0 in the order of the SELECT list.
+
+    \important Bound strings and blobs are not copied, so they must stay alive until the statement
+    is stepped (execute() binds and steps in one call, so temporaries are fine there). Text and
+    blob views returned by the get_* functions are only valid until the next step() or reset().
+*/
+class statement
+{
+public:
+    statement();
+    ~statement();
+
+    statement(statement&& other);
+    statement& operator=(statement&& other);
+
+    statement(const statement& other) = delete;
+    void operator=(const statement& other) = delete;
+
+    bool is_valid() const;
+    int parameter_count() const;
+    int column_count() const;
+    /**
+        \brief Returns the ordinal of the named column, or -1. Meant to be called once, not per row
+    */
+    int column_index(const std::string& column_name) const;
+
+    /**
+        \brief Resets the statement and binds all of its parameters, in order
+    */
+    template<typename... Args>
+    bool bind(const Args&... args)
+    {
+        if (!reset() || !check_parameter_count(sizeof...(Args)))
+            return false;
+
+        int index = 0;
+        return (bind_value(++index, args) && ...);
+    }
+
+    /**
+        \brief Binds the parameters and runs the statement to completion (e.g. INSERT, DELETE or UPDATE)
+    */
+    template<typename... Args>
+    bool execute(const Args&... args)
+    {
+        if (!bind(args...))
+            return false;
+
+        step();
+        return is_done();
+    }
+
+    /**
+        \brief Advances to the next row. Returns false when there are no more rows, or on error
+    */
+    bool step();
+    bool is_done() const;
+    bool has_error() const;
+    bool reset();
+
+    bool is_null(int column) const;
+    int32_t get_int(int column) const;
+    int64_t get_int64(int column) const;
+    uint32_t get_uint(int column) const;
+    uint64_t get_uint64(int column) const;
+    std::string_view get_text(int column) const;
+    blob_view get_blob(int column) const;
+
+private:
+    bool check_parameter_count(size_t count) const;
+
+    bool bind_value(int index, int32_t value);
+    bool bind_value(int index, uint32_t value);
+    bool bind_value(int index, int64_t value);
+    bool bind_value(int index, uint64_t value);
+    bool bind_value(int index, std::string_view value);
+    bool bind_value(int index, blob_view value);
+    bool bind_value(int index, std::nullptr_t);
+
+    friend class persistent_storage;
+    sqlite3_stmt* m_stmt = nullptr;
+    // Statements compiled from text are finalized with the instance, registered ones belong to the storage
+    bool m_owned = false;
+    int m_result = 0;
+};
+
+/**
+    \brief A byte range of a file
+*/
+struct byte_range
+{
+    uint64_t offset = 0;
+    uint64_t size = 0;
+};
+
 /**
     \brief Database wrapper class (Sqlite)
 */
@@ -111,6 +229,18 @@ public:
         \brief Opens Sqlite database from the specified path. If create is specified, creates it if it's not present
     */
     bool open(const std::string& path, bool create);
+    /**
+        \brief Same as open, but the byte ranges of the database file that SQLite writes are recorded (see take_written_ranges)
+    */
+    bool open_tracked(const std::string& path, bool create);
+    /**
+        \brief Opens, read-only, a Sqlite database stored as size bytes at offset in a larger file (e.g. an entry of an archive), in place: nothing is copied. Anything that would write to the database fails.
+    */
+    bool open_range(const std::string& path, uint64_t offset, uint64_t size);
+    /**
+        \brief Same as open_range, for a database stored as several byte ranges of the file, one after the other
+    */
+    bool open_range(const std::string& path, const std::vector<byte_range>& pieces);
     /**
         \brief Closes the database
     */
@@ -125,6 +255,18 @@ public:
     */
     bool save(const std::string& path);
 
+    /**
+        \brief Returns the byte ranges of the database file written since the last call (or since open_tracked), sorted and merged, and the size of the file
+
+        Together with read_file, this copies a database incrementally: only what changed since the last copy.
+        Only what is committed is in the file, so call it between transactions, on the thread that writes.
+    */
+    bool take_written_ranges(std::vector<byte_range>& ranges, uint64_t& file_size);
+    /**
+        \brief Reads bytes of the database file of a database opened with open_tracked, as they are on disk
+    */
+    bool read_file(uint64_t offset, void* buffer, size_t size);
+
     /**
         \brief Registers a named query (prepared statement)
     */
@@ -152,6 +294,19 @@ public:
     */
     cursor query_data_immediate(const std::string& query_text, const std::map<std::string, db_value>& params);
 
+    /**
+        \brief Returns a typed statement over a registered query. It stays valid until the storage is closed
+
+        Shares the underlying statement with query() and query_data(), so don't run the same query
+        through both at once.
+    */
+    statement get_statement(const std::string& queryID);
+
+    /**
+        \brief Compiles a typed statement from text. The statement is owned by the caller
+    */
+    statement compile_statement(const std::string& query_text);
+
     /**
         \brief Returns the last row ID generated by an INSERT operation
     */
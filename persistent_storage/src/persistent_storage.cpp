@@ -6,6 +6,7 @@
 #include <iostream>
 #include <filesystem>
 #include <algorithm>
+#include <mutex>
 
 namespace persistent_storage{
 
@@ -17,6 +18,375 @@ static void logger( void *pArg, int iErrCode, const char *zMsg )
 // TODO: Replace with better logging
 #define LOG(channel) std::cout
 
+/*
+    SQLite is shut down when the last connection closes, and not before: shutting it down
+    with connections open (e.g. a capture's while a snapshot of it is written) is undefined
+    behaviour. Every open storage holds a reference.
+*/
+static std::mutex sqlite_mutex;
+static int sqlite_references = 0;
+
+static void acquire_sqlite()
+{
+    std::scoped_lock lock(sqlite_mutex);
+    ++sqlite_references;
+    sqlite3_initialize();
+    sqlite3_config(SQLITE_CONFIG_LOG, logger, 0);
+    // TODO: Examine possible use of SQLITE_CONFIG_SINGLETHREAD for read-only connections
+    sqlite3_config(SQLITE_CONFIG_MULTITHREAD, 0, 0);
+    //sqlite3_config(SQLITE_CONFIG_SINGLETHREAD, 1, 0);
+}
+
+static void release_sqlite()
+{
+    std::scoped_lock lock(sqlite_mutex);
+    if (--sqlite_references == 0)
+        sqlite3_shutdown();
+}
+
+/*
+    A version 1 table of file methods: the members of later versions (shared memory for WAL,
+    memory-mapped I/O) stay null, so SQLite doesn't use either
+*/
+static sqlite3_io_methods make_io_methods(decltype(sqlite3_io_methods::xClose) close, decltype(sqlite3_io_methods::xRead) read,
+    decltype(sqlite3_io_methods::xWrite) write, decltype(sqlite3_io_methods::xTruncate) truncate, decltype(sqlite3_io_methods::xSync) sync,
+    decltype(sqlite3_io_methods::xFileSize) file_size, decltype(sqlite3_io_methods::xLock) lock, decltype(sqlite3_io_methods::xUnlock) unlock,
+    decltype(sqlite3_io_methods::xCheckReservedLock) check_reserved_lock, decltype(sqlite3_io_methods::xFileControl) file_control,
+    decltype(sqlite3_io_methods::xSectorSize) sector_size, decltype(sqlite3_io_methods::xDeviceCharacteristics) device_characteristics)
+{
+    sqlite3_io_methods methods = {};
+    methods.iVersion = 1;
+    methods.xClose = close;
+    methods.xRead = read;
+    methods.xWrite = write;
+    methods.xTruncate = truncate;
+    methods.xSync = sync;
+    methods.xFileSize = file_size;
+    methods.xLock = lock;
+    methods.xUnlock = unlock;
+    methods.xCheckReservedLock = check_reserved_lock;
+    methods.xFileControl = file_control;
+    methods.xSectorSize = sector_size;
+    methods.xDeviceCharacteristics = device_characteristics;
+    return methods;
+}
+
+/*
+    Registers vfs as a copy of the default VFS that opens files with open: everything else is
+    the default VFS' business. Its files hold file_size bytes of their own, followed by the
+    file the default VFS opens. Registered again before every open, since shutting SQLite
+    down forgets it.
+*/
+static bool register_wrapping_vfs(sqlite3_vfs& vfs, sqlite3_vfs*& default_vfs, const char* name, int file_size,
+    int (*open)(sqlite3_vfs*, const char*, sqlite3_file*, int, int*))
+{
+    default_vfs = sqlite3_vfs_find(nullptr);
+    if (default_vfs == nullptr)
+        return false;
+
+    vfs = *default_vfs;
+    vfs.pNext = nullptr;
+    vfs.zName = name;
+    vfs.szOsFile = file_size + default_vfs->szOsFile;
+    vfs.xOpen = open;
+    return sqlite3_vfs_register(&vfs, 0) == SQLITE_OK;
+}
+
+/*
+    A read-only VFS for databases stored inside a larger file (see open_range). The file is
+    opened with the default VFS, and reads are shifted by the offset of the database in it
+    and stopped at its size, so that SQLite sees a file of its own. The offset and the size
+    are URI parameters of the database name. Databases are opened immutable: SQLite then
+    opens no journal and takes no lock, so only the database file itself goes through here.
+
+    A database stored as several pieces of the file (e.g. pages copied at different times)
+    has too many of them for a URI: the URI names a list of pieces registered by open_range
+    instead, which the file copies when it is opened.
+*/
+namespace range_vfs
+{
+    static const char* vfs_name = "persistent_storage_range";
+
+    static sqlite3_vfs vfs;
+    static sqlite3_vfs* default_vfs = nullptr;
+
+    // Pieces lists waiting to be opened, by id
+    static std::mutex pieces_mutex;
+    static std::map<sqlite3_int64, std::vector<byte_range>> registered_pieces;
+    static sqlite3_int64 next_pieces_id = 1;
+
+    struct piece_t
+    {
+        // Offset of the piece in the database, and in the file
+        sqlite3_int64 begin;
+        sqlite3_int64 offset;
+        sqlite3_int64 size;
+    };
+
+    struct file_t
+    {
+        // Must be first: SQLite sees a sqlite3_file
+        sqlite3_file base;
+        piece_t* pieces;
+        int piece_count;
+        sqlite3_int64 size;
+        // The file opened by the default VFS, stored right after this structure
+        sqlite3_file* file;
+    };
+
+    static int close(sqlite3_file* file)
+    {
+        auto range = (file_t*)file;
+        delete[] range->pieces;
+        range->pieces = nullptr;
+        return range->file->pMethods->xClose(range->file);
+    }
+
+    static int read(sqlite3_file* file, void* buffer, int amount, sqlite3_int64 offset)
+    {
+        auto range = (file_t*)file;
+        const int available = offset < range->size ? (int)std::min<sqlite3_int64>(amount, range->size - offset) : 0;
+
+        // The piece holding the offset, then the following ones
+        int result = SQLITE_OK;
+        const piece_t* piece = available > 0 ? std::upper_bound(range->pieces, range->pieces + range->piece_count, offset,
+            [](sqlite3_int64 value, const piece_t& p) { return value < p.begin; }) - 1 : nullptr;
+        for (int done = 0; result == SQLITE_OK && done < available; ++piece)
+        {
+            const sqlite3_int64 from = offset + done - piece->begin;
+            const int count = (int)std::min<sqlite3_int64>(available - done, piece->size - from);
+            result = range->file->pMethods->xRead(range->file, (char*)buffer + done, count, piece->offset + from);
+            done += count;
+        }
+
+        if (result == SQLITE_OK && available < amount)
+        {
+            // Short reads must zero the rest of the buffer
+            memset((char*)buffer + available, 0, (size_t)(amount - available));
+            result = SQLITE_IOERR_SHORT_READ;
+        }
+        return result;
+    }
+
+    static int write(sqlite3_file*, const void*, int, sqlite3_int64) { return SQLITE_READONLY; }
+    static int truncate(sqlite3_file*, sqlite3_int64) { return SQLITE_READONLY; }
+    static int sync(sqlite3_file*, int) { return SQLITE_OK; }
+
+    static int file_size(sqlite3_file* file, sqlite3_int64* size)
+    {
+        *size = ((file_t*)file)->size;
+        return SQLITE_OK;
+    }
+
+    static int lock(sqlite3_file* file, int level) { auto range = (file_t*)file; return range->file->pMethods->xLock(range->file, level); }
+    static int unlock(sqlite3_file* file, int level) { auto range = (file_t*)file; return range->file->pMethods->xUnlock(range->file, level); }
+    static int check_reserved_lock(sqlite3_file* file, int* result) { auto range = (file_t*)file; return range->file->pMethods->xCheckReservedLock(range->file, result); }
+    // Controls could refer to the whole file (e.g. its size): none is supported
+    static int file_control(sqlite3_file*, int, void*) { return SQLITE_NOTFOUND; }
+    static int sector_size(sqlite3_file* file) { auto range = (file_t*)file; return range->file->pMethods->xSectorSize(range->file); }
+    static int device_characteristics(sqlite3_file* file) { auto range = (file_t*)file; return range->file->pMethods->xDeviceCharacteristics(range->file); }
+
+    static const sqlite3_io_methods io_methods = make_io_methods(close, read, write, truncate, sync, file_size, lock, unlock,
+        check_reserved_lock, file_control, sector_size, device_characteristics);
+
+    static int open(sqlite3_vfs*, const char* name, sqlite3_file* file, int flags, int* out_flags)
+    {
+        auto range = (file_t*)file;
+        range->base.pMethods = nullptr;
+        if (name == nullptr || (flags & SQLITE_OPEN_MAIN_DB) == 0 || (flags & SQLITE_OPEN_READONLY) == 0)
+            return SQLITE_CANTOPEN;
+
+        std::vector<byte_range> pieces;
+        const sqlite3_int64 pieces_id = sqlite3_uri_int64(name, "range_pieces", 0);
+        if (pieces_id != 0)
+        {
+            std::scoped_lock lock(pieces_mutex);
+            auto iter = registered_pieces.find(pieces_id);
+            if (iter == registered_pieces.end())
+                return SQLITE_CANTOPEN;
+            pieces = iter->second;
+        }
+        else
+            pieces.push_back({ (uint64_t)sqlite3_uri_int64(name, "range_offset", 0), (uint64_t)sqlite3_uri_int64(name, "range_size", 0) });
+
+        range->pieces = new piece_t[pieces.size()];
+        range->piece_count = 0;
+        range->size = 0;
+        for (auto& piece : pieces)
+        {
+            if (piece.size == 0)
+                continue;
+            range->pieces[range->piece_count++] = { range->size, (sqlite3_int64)piece.offset, (sqlite3_int64)piece.size };
+            range->size += (sqlite3_int64)piece.size;
+        }
+
+        range->file = (sqlite3_file*)(range + 1);
+        const int result = default_vfs->xOpen(default_vfs, name, range->file, flags, out_flags);
+        if (result == SQLITE_OK)
+            range->base.pMethods = &io_methods;
+        else
+        {
+            delete[] range->pieces;
+            range->pieces = nullptr;
+        }
+        return result;
+    }
+
+    static bool register_vfs()
+    {
+        return register_wrapping_vfs(vfs, default_vfs, vfs_name, (int)sizeof(file_t), open);
+    }
+
+    // A "file:" URI for the path, with the given parameters
+    static std::string make_uri(const std::string& path, const std::string& parameters)
+    {
+        std::string uri = "file:";
+#if defined(WIN32)
+        // Drive letters are in an absolute path: "file:/C:/..."
+        if (path.size() > 1 && path[1] == ':')
+            uri += '/';
+#endif
+        for (char c : path)
+        {
+#if defined(WIN32)
+            if (c == '\\')
+                c = '/';
+#endif
+            if (c == '?' || c == '#' || c == '%' || (unsigned char)c < 0x20)
+            {
+                char escaped[4];
+                snprintf(escaped, sizeof(escaped), "%%%02X", (unsigned char)c);
+                uri += escaped;
+            }
+            else
+                uri += c;
+        }
+        return uri + "?" + parameters;
+    }
+}
+
+/*
+    A VFS that records the byte ranges written to a database file (see open_tracked), so
+    that the file can be copied incrementally. Only the main database file is wrapped: the
+    other files SQLite opens (journals, temporary files) are the default VFS' own, and all
+    calls are passed on to the default VFS.
+*/
+namespace tracked_vfs
+{
+    static const char* vfs_name = "persistent_storage_tracked";
+
+    static sqlite3_vfs vfs;
+    static sqlite3_vfs* default_vfs = nullptr;
+
+    struct file_t
+    {
+        // Must be first: SQLite sees a sqlite3_file
+        sqlite3_file base;
+        // Ranges written since they were last taken: begin -> end, disjoint and not adjacent
+        std::map<sqlite3_int64, sqlite3_int64>* written;
+        // The file opened by the default VFS, stored right after this structure
+        sqlite3_file* file;
+    };
+
+    static void add_written(file_t* tracked, sqlite3_int64 begin, sqlite3_int64 end)
+    {
+        auto& written = *tracked->written;
+        auto iter = written.upper_bound(begin);
+        if (iter != written.begin() && std::prev(iter)->second >= begin)
+        {
+            --iter;
+            begin = iter->first;
+            end = std::max(end, iter->second);
+            iter = written.erase(iter);
+        }
+        while (iter != written.end() && iter->first <= end)
+        {
+            end = std::max(end, iter->second);
+            iter = written.erase(iter);
+        }
+        written[begin] = end;
+    }
+
+    static int close(sqlite3_file* file)
+    {
+        auto tracked = (file_t*)file;
+        delete tracked->written;
+        tracked->written = nullptr;
+        return tracked->file->pMethods->xClose(tracked->file);
+    }
+
+    static int write(sqlite3_file* file, const void* buffer, int amount, sqlite3_int64 offset)
+    {
+        auto tracked = (file_t*)file;
+        const int result = tracked->file->pMethods->xWrite(tracked->file, buffer, amount, offset);
+        if (result == SQLITE_OK && amount > 0)
+            add_written(tracked, offset, offset + amount);
+        return result;
+    }
+
+    static int truncate(sqlite3_file* file, sqlite3_int64 size)
+    {
+        auto tracked = (file_t*)file;
+        const int result = tracked->file->pMethods->xTruncate(tracked->file, size);
+        if (result == SQLITE_OK)
+        {
+            // What was written past the end is gone
+            auto& written = *tracked->written;
+            written.erase(written.lower_bound(size), written.end());
+            if (!written.empty() && written.rbegin()->second > size)
+                written.rbegin()->second = size;
+        }
+        return result;
+    }
+
+    static int read(sqlite3_file* file, void* buffer, int amount, sqlite3_int64 offset) { auto tracked = (file_t*)file; return tracked->file->pMethods->xRead(tracked->file, buffer, amount, offset); }
+    static int sync(sqlite3_file* file, int flags) { auto tracked = (file_t*)file; return tracked->file->pMethods->xSync(tracked->file, flags); }
+    static int file_size(sqlite3_file* file, sqlite3_int64* size) { auto tracked = (file_t*)file; return tracked->file->pMethods->xFileSize(tracked->file, size); }
+    static int lock(sqlite3_file* file, int level) { auto tracked = (file_t*)file; return tracked->file->pMethods->xLock(tracked->file, level); }
+    static int unlock(sqlite3_file* file, int level) { auto tracked = (file_t*)file; return tracked->file->pMethods->xUnlock(tracked->file, level); }
+    static int check_reserved_lock(sqlite3_file* file, int* result) { auto tracked = (file_t*)file; return tracked->file->pMethods->xCheckReservedLock(tracked->file, result); }
+    static int file_control(sqlite3_file* file, int op, void* arg) { auto tracked = (file_t*)file; return tracked->file->pMethods->xFileControl(tracked->file, op, arg); }
+    static int sector_size(sqlite3_file* file) { auto tracked = (file_t*)file; return tracked->file->pMethods->xSectorSize(tracked->file); }
+    static int device_characteristics(sqlite3_file* file) { auto tracked = (file_t*)file; return tracked->file->pMethods->xDeviceCharacteristics(tracked->file); }
+
+    // Version 1: no shared memory (WAL) and no memory-mapped I/O, which would write to the
+    // file behind our back
+    static const sqlite3_io_methods io_methods = make_io_methods(close, read, write, truncate, sync, file_size, lock, unlock,
+        check_reserved_lock, file_control, sector_size, device_characteristics);
+
+    static int open(sqlite3_vfs*, const char* name, sqlite3_file* file, int flags, int* out_flags)
+    {
+        if (name == nullptr || (flags & SQLITE_OPEN_MAIN_DB) == 0)
+            return default_vfs->xOpen(default_vfs, name, file, flags, out_flags);
+
+        auto tracked = (file_t*)file;
+        tracked->base.pMethods = nullptr;
+        tracked->file = (sqlite3_file*)(tracked + 1);
+        const int result = default_vfs->xOpen(default_vfs, name, tracked->file, flags, out_flags);
+        if (result == SQLITE_OK)
+        {
+            tracked->written = new std::map<sqlite3_int64, sqlite3_int64>();
+            tracked->base.pMethods = &io_methods;
+        }
+        return result;
+    }
+
+    static bool register_vfs()
+    {
+        return register_wrapping_vfs(vfs, default_vfs, vfs_name, (int)sizeof(file_t), open);
+    }
+
+    // The main database file of a connection, if it was opened through this VFS
+    static file_t* get_file(sqlite3* db)
+    {
+        sqlite3_file* file = nullptr;
+        if (db == nullptr || sqlite3_file_control(db, "main", SQLITE_FCNTL_FILE_POINTER, &file) != SQLITE_OK ||
+            file == nullptr || file->pMethods != &io_methods)
+            return nullptr;
+        return (file_t*)file;
+    }
+}
+
 struct persistent_storage::details
 {
     ~details() {}
@@ -146,19 +516,99 @@ persistent_storage::~persistent_storage()
 
 bool persistent_storage::open(const std::string& path, bool create)
 {
+    close();
     m_details = std::make_unique<details>();
 
-    sqlite3_initialize();
-    sqlite3_config(SQLITE_CONFIG_LOG, logger, 0);
-    // TODO: Examine possible use of SQLITE_CONFIG_SINGLETHREAD for read-only connections
-    sqlite3_config(SQLITE_CONFIG_MULTITHREAD, 0, 0);
-    //sqlite3_config(SQLITE_CONFIG_SINGLETHREAD, 1, 0);
+    acquire_sqlite();
 
     const int error = sqlite3_open_v2(path.c_str(), &m_details->m_db, SQLITE_OPEN_READWRITE | (create ? SQLITE_OPEN_CREATE : 0), 0);
     if (error != 0)
     {
         sqlite3_close(m_details->m_db);
-        m_details.reset();        
+        m_details.reset();
+        release_sqlite();
+        return false;
+    }
+
+    return true;
+}
+
+bool persistent_storage::open_tracked(const std::string& path, bool create)
+{
+    close();
+    m_details = std::make_unique<details>();
+
+    acquire_sqlite();
+
+    const int error = tracked_vfs::register_vfs()
+        ? sqlite3_open_v2(path.c_str(), &m_details->m_db, SQLITE_OPEN_READWRITE | (create ? SQLITE_OPEN_CREATE : 0), tracked_vfs::vfs_name)
+        : SQLITE_ERROR;
+    if (error != 0)
+    {
+        sqlite3_close(m_details->m_db);
+        m_details.reset();
+        release_sqlite();
+        return false;
+    }
+
+    return true;
+}
+
+bool persistent_storage::open_range(const std::string& path, uint64_t offset, uint64_t size)
+{
+    close();
+    m_details = std::make_unique<details>();
+
+    acquire_sqlite();
+
+    const std::string uri = range_vfs::make_uri(path, "immutable=1&range_offset=" + std::to_string(offset) + "&range_size=" + std::to_string(size));
+    const int error = range_vfs::register_vfs()
+        ? sqlite3_open_v2(uri.c_str(), &m_details->m_db, SQLITE_OPEN_READONLY | SQLITE_OPEN_URI, range_vfs::vfs_name)
+        : SQLITE_ERROR;
+    if (error != 0)
+    {
+        sqlite3_close(m_details->m_db);
+        m_details.reset();
+        release_sqlite();
+        return false;
+    }
+
+    return true;
+}
+
+bool persistent_storage::open_range(const std::string& path, const std::vector<byte_range>& pieces)
+{
+    if (pieces.size() == 1)
+        return open_range(path, pieces[0].offset, pieces[0].size);
+
+    close();
+    m_details = std::make_unique<details>();
+
+    acquire_sqlite();
+
+    // The database file is opened (and the pieces copied) before sqlite3_open_v2 returns
+    sqlite3_int64 pieces_id;
+    {
+        std::scoped_lock lock(range_vfs::pieces_mutex);
+        pieces_id = range_vfs::next_pieces_id++;
+        range_vfs::registered_pieces[pieces_id] = pieces;
+    }
+
+    const std::string uri = range_vfs::make_uri(path, "immutable=1&range_pieces=" + std::to_string(pieces_id));
+    const int error = range_vfs::register_vfs()
+        ? sqlite3_open_v2(uri.c_str(), &m_details->m_db, SQLITE_OPEN_READONLY | SQLITE_OPEN_URI, range_vfs::vfs_name)
+        : SQLITE_ERROR;
+
+    {
+        std::scoped_lock lock(range_vfs::pieces_mutex);
+        range_vfs::registered_pieces.erase(pieces_id);
+    }
+
+    if (error != 0)
+    {
+        sqlite3_close(m_details->m_db);
+        m_details.reset();
+        release_sqlite();
         return false;
     }
 
@@ -180,7 +630,7 @@ void persistent_storage::close()
 
     m_details.reset();
 
-    sqlite3_shutdown();
+    release_sqlite();
 }
 
 bool persistent_storage::is_open() const
@@ -215,6 +665,31 @@ bool persistent_storage::save(const std::string& path)
     return true;
 }
 
+bool persistent_storage::take_written_ranges(std::vector<byte_range>& ranges, uint64_t& file_size)
+{
+    ranges.clear();
+    auto file = tracked_vfs::get_file(is_open() ? m_details->m_db : nullptr);
+    if (file == nullptr)
+        return false;
+
+    sqlite3_int64 size = 0;
+    if (file->file->pMethods->xFileSize(file->file, &size) != SQLITE_OK)
+        return false;
+
+    for (auto& range : *file->written)
+        ranges.push_back({ (uint64_t)range.first, (uint64_t)(range.second - range.first) });
+    file->written->clear();
+    file_size = (uint64_t)size;
+    return true;
+}
+
+bool persistent_storage::read_file(uint64_t offset, void* buffer, size_t size)
+{
+    auto file = tracked_vfs::get_file(is_open() ? m_details->m_db : nullptr);
+    return file != nullptr && size <= INT32_MAX &&
+        file->file->pMethods->xRead(file->file, buffer, (int)size, (sqlite3_int64)offset) == SQLITE_OK;
+}
+
 bool persistent_storage::register_query(const std::string& queryID, const std::string& text)
 {
     if (queryID.empty())
@@ -349,6 +824,46 @@ cursor persistent_storage::query_data_immediate(const std::string& query_text, c
     return result;
 }
 
+statement persistent_storage::get_statement(const std::string& queryID)
+{
+    if (!m_details || !m_details->m_db)
+    {
+        LOG(WARNING) << "Trying to get statement " << queryID << " before storage is ready";
+        return {};
+    }
+
+    auto iter = m_details->m_statements.find(queryID);
+    if (iter == m_details->m_statements.end())
+    {
+        LOG(ERROR) << "Trying to get unknown query " << queryID;
+        return {};
+    }
+
+    statement result;
+    result.m_stmt = iter->second.sqlite_statement;
+    return result;
+}
+
+statement persistent_storage::compile_statement(const std::string& query_text)
+{
+    if (!m_details || !m_details->m_db)
+    {
+        LOG(WARNING) << "Trying to compile statement " << query_text << " before storage is ready";
+        return {};
+    }
+
+    statement result;
+    const int error = sqlite3_prepare_v2(m_details->m_db, query_text.c_str(), (int)query_text.size(), &result.m_stmt, nullptr);
+    if (error != 0)
+    {
+        LOG(ERROR) << "SQL error while compiling statement '" << query_text << "': " << sqlite3_errmsg(m_details->m_db);
+        return {};
+    }
+
+    result.m_owned = true;
+    return result;
+}
+
 uint64_t persistent_storage::get_last_inserted_id() const
 {
     if (!m_details || !m_details->m_db)
@@ -567,6 +1082,196 @@ const db_value* cursor::get_value(const std::string column_name) const
     return &column->value;
 }
 
+statement::statement()
+{}
+
+statement::~statement()
+{
+    // Registered statements are reused, so don't leave them holding a read transaction open
+    if (m_owned)
+        sqlite3_finalize(m_stmt);
+    else if (m_stmt)
+        sqlite3_reset(m_stmt);
+}
+
+statement::statement(statement&& other)
+    : m_stmt(other.m_stmt)
+    , m_owned(other.m_owned)
+    , m_result(other.m_result)
+{
+    other.m_stmt = nullptr;
+    other.m_owned = false;
+}
+
+statement& statement::operator=(statement&& other)
+{
+    if (this != &other)
+    {
+        if (m_owned)
+            sqlite3_finalize(m_stmt);
+        else if (m_stmt)
+            sqlite3_reset(m_stmt);
+
+        m_stmt = other.m_stmt;
+        m_owned = other.m_owned;
+        m_result = other.m_result;
+        other.m_stmt = nullptr;
+        other.m_owned = false;
+    }
+    return *this;
+}
+
+bool statement::is_valid() const
+{
+    return m_stmt != nullptr;
+}
+
+int statement::parameter_count() const
+{
+    return m_stmt ? sqlite3_bind_parameter_count(m_stmt) : 0;
+}
+
+int statement::column_count() const
+{
+    return m_stmt ? sqlite3_column_count(m_stmt) : 0;
+}
+
+int statement::column_index(const std::string& column_name) const
+{
+    for (int i = 0; i < column_count(); ++i)
+    {
+        const char* name = sqlite3_column_name(m_stmt, i);
+        if (name && column_name == name)
+            return i;
+    }
+    return -1;
+}
+
+bool statement::step()
+{
+    if (!m_stmt)
+        return false;
+
+    m_result = sqlite3_step(m_stmt);
+    return m_result == SQLITE_ROW;
+}
+
+bool statement::is_done() const
+{
+    return !m_stmt || m_result == SQLITE_DONE;
+}
+
+bool statement::has_error() const
+{
+    return !m_stmt || (m_result != SQLITE_OK && m_result != SQLITE_DONE && m_result != SQLITE_ROW);
+}
+
+bool statement::reset()
+{
+    if (!m_stmt)
+        return false;
+
+    // sqlite3_reset() repeats the error of the last step, which has already been reported
+    sqlite3_reset(m_stmt);
+    m_result = SQLITE_OK;
+    return true;
+}
+
+bool statement::is_null(int column) const
+{
+    return sqlite3_column_type(m_stmt, column) == SQLITE_NULL;
+}
+
+int32_t statement::get_int(int column) const
+{
+    // SQLite only stores 64-bit integers, so downsize it
+    return (int32_t)sqlite3_column_int64(m_stmt, column);
+}
+
+int64_t statement::get_int64(int column) const
+{
+    return sqlite3_column_int64(m_stmt, column);
+}
+
+uint32_t statement::get_uint(int column) const
+{
+    return (uint32_t)sqlite3_column_int64(m_stmt, column);
+}
+
+uint64_t statement::get_uint64(int column) const
+{
+    return (uint64_t)sqlite3_column_int64(m_stmt, column);
+}
+
+std::string_view statement::get_text(int column) const
+{
+    // Get the pointer first: it may convert the value, which changes its size
+    const char* text = (const char*)sqlite3_column_text(m_stmt, column);
+    if (!text)
+        return {};
+
+    return std::string_view(text, (size_t)sqlite3_column_bytes(m_stmt, column));
+}
+
+blob_view statement::get_blob(int column) const
+{
+    const uint8_t* data = (const uint8_t*)sqlite3_column_blob(m_stmt, column);
+    if (!data)
+        return {};
+
+    return blob_view(data, (size_t)sqlite3_column_bytes(m_stmt, column));
+}
+
+bool statement::check_parameter_count(size_t count) const
+{
+    if ((int)count != parameter_count())
+    {
+        LOG(ERROR) << "Statement expects " << parameter_count() << " parameters, " << count << " given: " << sqlite3_sql(m_stmt);
+        return false;
+    }
+    return true;
+}
+
+bool statement::bind_value(int index, int32_t value)
+{
+    return sqlite3_bind_int(m_stmt, index, value) == SQLITE_OK;
+}
+
+bool statement::bind_value(int index, uint32_t value)
+{
+    return sqlite3_bind_int64(m_stmt, index, (sqlite3_int64)value) == SQLITE_OK;
+}
+
+bool statement::bind_value(int index, int64_t value)
+{
+    return sqlite3_bind_int64(m_stmt, index, value) == SQLITE_OK;
+}
+
+bool statement::bind_value(int index, uint64_t value)
+{
+    return sqlite3_bind_int64(m_stmt, index, (sqlite3_int64)value) == SQLITE_OK;
+}
+
+bool statement::bind_value(int index, std::string_view value)
+{
+    // Text is expected to be UTF8. Not copied, see the class description.
+    return sqlite3_bind_text(m_stmt, index, value.data() ? value.data() : "", (int)value.size(), SQLITE_STATIC) == SQLITE_OK;
+}
+
+bool statement::bind_value(int index, blob_view value)
+{
+    // SQLite binds a null pointer as NULL, not as an empty blob
+    if (!value.data)
+        return sqlite3_bind_zeroblob(m_stmt, index, 0) == SQLITE_OK;
+
+    return sqlite3_bind_blob(m_stmt, index, value.data, (int)value.size, SQLITE_STATIC) == SQLITE_OK;
+}
+
+bool statement::bind_value(int index, std::nullptr_t)
+{
+    return sqlite3_bind_null(m_stmt, index) == SQLITE_OK;
+}
+
 transaction::transaction(persistent_storage& storage, transaction_behaviour default_behaviour)
     : m_storage(storage)
     , m_default_behaviour(default_behaviour)
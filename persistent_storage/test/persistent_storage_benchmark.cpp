@@ -0,0 +1,188 @@
+#include "persistent_storage.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+using namespace persistent_storage;
+
+/*
+    Per-row overhead benchmark: inserts rows (two integers, a short text and a short blob)
+    into a table, then reads them all back, once with the named-parameter map API and the
+    cursor, and once with typed statements, and checks that both read the same data. Run as
+
+        persistent_storage_benchmark [row count]
+
+    The database is a temporary file with journaling and syncing off, and every pass runs
+    in a single transaction, so that the time is mostly spent in the API, not in the disk.
+*/
+
+static const char* INSERT_TEXT = "INSERT INTO Rows (id, frame, name, data) VALUES ($id, $frame, $name, $data)";
+static const char* SELECT_TEXT = "SELECT id, frame, name, data FROM Rows";
+
+// Fills the text and blob of a row into buffers reused from row to row, so that generating
+// them costs the same, and allocates nothing, in both passes
+static void fill_row(uint64_t row, std::string& name, std::vector<uint8_t>& data)
+{
+    name = "System.Collections.Generic.List`";
+    name += std::to_string(row % 1000);
+    data.assign(8 + row % 16, (uint8_t)row);
+}
+
+static bool recreate_table(persistent_storage::persistent_storage& db)
+{
+    return db.query_immediate("DROP TABLE IF EXISTS Rows", {})
+        && db.query_immediate("CREATE TABLE Rows (id INTEGER, frame INTEGER, name TEXT, data BLOB)", {});
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool insert_with_map(persistent_storage::persistent_storage& db, uint64_t row_count)
+{
+    if (!db.register_query("insert_row", INSERT_TEXT))
+        return false;
+
+    std::string name;
+    std::vector<uint8_t> data;
+    transaction t(db, transaction_behaviour::commit);
+    for (uint64_t row = 0; row < row_count; ++row)
+    {
+        fill_row(row, name, data);
+        const bool ok = db.query("insert_row",
+            {
+                { "id", row },
+                { "frame", row / 1000 },
+                { "name", name },
+                { "data", data },
+            });
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+static bool insert_with_statement(persistent_storage::persistent_storage& db, uint64_t row_count)
+{
+    auto insert = db.compile_statement(INSERT_TEXT);
+    if (!insert.is_valid())
+        return false;
+
+    std::string name;
+    std::vector<uint8_t> data;
+    transaction t(db, transaction_behaviour::commit);
+    for (uint64_t row = 0; row < row_count; ++row)
+    {
+        fill_row(row, name, data);
+        if (!insert.execute(row, row / 1000, name, data))
+            return false;
+    }
+    return true;
+}
+
+static uint64_t select_with_cursor(persistent_storage::persistent_storage& db, uint64_t& rows)
+{
+    uint64_t checksum = 0;
+    rows = 0;
+    auto cursor = db.query_data_immediate(SELECT_TEXT, {});
+    while (cursor.next())
+    {
+        const auto name = cursor.get_string("name");
+        const auto data = cursor.get_blob("data");
+        checksum += cursor.get_uint64("id") ^ cursor.get_uint64("frame") ^ name.size() ^ (uint64_t)name.back() ^ data.size() ^ data.back();
+        ++rows;
+    }
+    return checksum;
+}
+
+static uint64_t select_with_statement(persistent_storage::persistent_storage& db, uint64_t& rows)
+{
+    uint64_t checksum = 0;
+    rows = 0;
+    auto select = db.compile_statement(SELECT_TEXT);
+    if (!select.bind())
+        return 0;
+
+    while (select.step())
+    {
+        const auto name = select.get_text(2);
+        const auto data = select.get_blob(3);
+        checksum += select.get_uint64(0) ^ select.get_uint64(1) ^ name.size() ^ (uint64_t)name.back() ^ data.size ^ data.data[data.size - 1];
+        ++rows;
+    }
+    return checksum;
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t row_count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 10000000;
+    if (row_count == 0)
+    {
+        printf("Usage: persistent_storage_benchmark [row count]\n");
+        return 1;
+    }
+
+    std::error_code ec;
+    const std::string path = (std::filesystem::temp_directory_path(ec) / "persistent_storage_benchmark.db").string();
+    std::filesystem::remove(path, ec);
+
+    persistent_storage::persistent_storage db;
+    if (!db.open(path, true) || !db.pragma("PRAGMA journal_mode = OFF") || !db.pragma("PRAGMA synchronous = OFF"))
+    {
+        printf("Failed to create the database\n");
+        return 1;
+    }
+
+    int result = 0;
+    uint64_t checksums[2] = {};
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        const bool typed = pass == 1;
+        const char* name = typed ? "typed statement" : "map/cursor     ";
+        if (!recreate_table(db))
+        {
+            printf("Failed to create the table\n");
+            result = 1;
+            break;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        if (!(typed ? insert_with_statement(db, row_count) : insert_with_map(db, row_count)))
+        {
+            printf("FAILED: %s insert: %s\n", name, db.get_last_error().c_str());
+            result = 1;
+            break;
+        }
+        const double insert_seconds = seconds_since(start);
+
+        uint64_t rows = 0;
+        start = std::chrono::steady_clock::now();
+        checksums[pass] = typed ? select_with_statement(db, rows) : select_with_cursor(db, rows);
+        const double select_seconds = seconds_since(start);
+
+        printf("%s: insert %.2f M rows/s (%.0f ns/row), select %.2f M rows/s (%.0f ns/row)\n", name,
+            row_count / insert_seconds / 1e6, insert_seconds * 1e9 / row_count,
+            row_count / select_seconds / 1e6, select_seconds * 1e9 / row_count);
+
+        if (rows != row_count)
+        {
+            printf("FAILED: %s select returned %llu rows\n", name, (unsigned long long)rows);
+            result = 1;
+        }
+    }
+
+    if (result == 0 && checksums[0] != checksums[1])
+    {
+        printf("FAILED: the two APIs read different data\n");
+        result = 1;
+    }
+
+    db.close();
+    std::filesystem::remove(path, ec);
+    return result;
+}
@@ -26,6 +26,11 @@ namespace owlcat
 		// capture mode and native-hook config reach the in-game DLL. When wait_for_connection
 		// is true, this blocks until a client has connected AND configured the profiler.
 		void start(bool wait_for_connection, int port);
+		// Offers a same-machine shared-memory channel with the given name (see
+		// network::listen_shared_memory). Call before start(): if it returns true, start()
+		// waits for the client on this channel instead of listening on the port. After the
+		// channel's client disconnects, the server falls back to listening on the port.
+		bool listen_shared_memory(const char* name);
 		void stop();
 
 		void on_frame();
@@ -102,7 +102,13 @@ bool __cdecl player_init_engine_graphics_detour(bool arg)
         return false;
     }
 
-    SendErrorToPipe(owlcat::protocol::error_ok);
+    // Same-machine launch: the client names a shared-memory channel it would rather use than
+    // loopback TCP. Tell it in the handshake reply whether we could set it up.
+    bool shared_memory = false;
+    if (const char* shm_name = getenv("OWLCAT_PROFILER_SHM"))
+        shared_memory = server->listen_shared_memory(shm_name);
+
+    SendErrorToPipe(shared_memory ? owlcat::protocol::error_ok_shm : owlcat::protocol::error_ok);
     CloseHandle(pipe);
     pipe = INVALID_HANDLE_VALUE;
 
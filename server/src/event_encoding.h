@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <memory_writer.h>
+
+#include "mono_profiler.h" // dropped_type_count
+
+namespace owlcat
+{
+	/*
+		Bodies of the server->client event messages (see protocol::message). Shared by the
+		sinks that produce the wire stream: the network sink and the spool sink. Each function
+		replaces the contents of data.
+	*/
+	namespace event_encoding
+	{
+		inline void encode_alloc(std::vector<uint8_t>& data, uint64_t frame, uint64_t addr, uint32_t size, uint32_t type_id, uint32_t callstack_id)
+		{
+			data.clear();
+			memory_writer writer(data);
+			writer.write_uint64(frame);
+			writer.write_uint64(addr);
+			writer.write_uint32(size);
+			writer.write_varint(type_id);
+			writer.write_varint(callstack_id);
+		}
+
+		inline void encode_free(std::vector<uint8_t>& data, uint64_t frame, uint64_t addr, uint32_t size)
+		{
+			data.clear();
+			memory_writer writer(data);
+			writer.write_uint64(frame);
+			writer.write_uint64(addr);
+			writer.write_uint32(size);
+		}
+
+		// Type names and frame lines
+		inline void encode_text_definition(std::vector<uint8_t>& data, uint32_t id, const char* text)
+		{
+			data.clear();
+			memory_writer writer(data);
+			writer.write_varint(id);
+			writer.write_string(text);
+		}
+
+		inline void encode_callstack(std::vector<uint8_t>& data, uint32_t callstack_id, const uint32_t* frame_ids, uint32_t count)
+		{
+			data.clear();
+			memory_writer writer(data);
+			writer.write_varint(callstack_id);
+			writer.write_varint(count);
+			for (uint32_t i = 0; i < count; ++i)
+				writer.write_varint(frame_ids[i]);
+		}
+
+		inline void encode_memstats(std::vector<uint8_t>& data, uint64_t frame, uint64_t working_set, uint64_t committed, uint64_t gc_heap)
+		{
+			data.clear();
+			memory_writer writer(data);
+			writer.write_uint64(frame);
+			writer.write_uint64(working_set);
+			writer.write_uint64(committed);
+			writer.write_uint64(gc_heap);
+		}
+
+		inline void encode_degraded(std::vector<uint8_t>& data, uint64_t frame, uint8_t level, uint64_t dropped_count, uint64_t dropped_size, const std::vector<dropped_type_count>& dropped)
+		{
+			data.clear();
+			memory_writer writer(data);
+			writer.write_uint64(frame);
+			writer.write_uint8(level);
+			writer.write_varint(dropped_count);
+			writer.write_varint(dropped_size);
+			writer.write_varint(dropped.size());
+			for (auto& type : dropped)
+			{
+				writer.write_varint(type.type_id);
+				writer.write_varint(type.count);
+				writer.write_varint(type.size);
+			}
+		}
+	}
+}
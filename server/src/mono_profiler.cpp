@@ -4,6 +4,7 @@
 #include <mutex>
 #include <chrono>
 #include <cstdlib>
+#include <cstring>
 #include <string>
 
 #include "mono/metadata/profiler.h"
@@ -88,6 +89,9 @@ namespace owlcat
 		// If true, the Mono jit-info lookup functions were resolved and are safe to call
 		bool m_jit_available = false;
 
+		// What the worker does when the client can't keep up (see read_overload_config)
+		overload_config m_overload_config;
+
 	private:
 		void on_shutdown()
 		{
@@ -173,6 +177,7 @@ namespace owlcat
 
 			m_processing_thread->stop();
 			m_processing_thread = std::make_unique<worker_thread>(m_events_sink, &m_logger, m_use_ip_capture, m_jit_available);
+			m_processing_thread->set_overload_config(m_overload_config);
 			m_processing_thread->start();
 
 			// Repoint the (still installed) native hooks at the new worker
@@ -252,6 +257,41 @@ namespace owlcat
 				m_use_ip_capture = true;
 		}
 
+		/*
+			Reads the overload policy from the environment:
+			OWLCAT_PROFILER_OVERLOAD=block|degrade - block the game's threads while the client
+				is behind, or record less and mark the frames as degraded, which the UI reports
+				in its status bar (the default)
+			OWLCAT_PROFILER_OVERLOAD_SEND_MB=N - send-buffer high-water mark (low is half of it)
+			OWLCAT_PROFILER_OVERLOAD_QUEUE=N - work-queue high-water mark, in items (low is a quarter)
+		*/
+		void read_overload_config()
+		{
+			m_overload_config = overload_config();
+
+			const char* mode = getenv("OWLCAT_PROFILER_OVERLOAD");
+			if (mode != nullptr && strcmp(mode, "block") == 0)
+				m_overload_config.mode = overload_config::policy::block;
+
+			const char* send_mb = getenv("OWLCAT_PROFILER_OVERLOAD_SEND_MB");
+			if (send_mb != nullptr && atoll(send_mb) > 0)
+			{
+				m_overload_config.send_high = (uint64_t)atoll(send_mb) * 1024 * 1024;
+				m_overload_config.send_low = m_overload_config.send_high / 2;
+			}
+
+			const char* queue = getenv("OWLCAT_PROFILER_OVERLOAD_QUEUE");
+			if (queue != nullptr && atoll(queue) > 0)
+			{
+				m_overload_config.queue_high = (size_t)atoll(queue);
+				m_overload_config.queue_low = m_overload_config.queue_high / 4;
+			}
+
+			m_logger.log_str(m_overload_config.mode == overload_config::policy::block
+				? "Overload policy: block game threads while the client is behind"
+				: "Overload policy: degrade recording while the client is behind (set OWLCAT_PROFILER_OVERLOAD=block to block instead)");
+		}
+
 		// Installs the Mono/IL2CPP allocation, GC and root callbacks. The worker thread
 		// must already exist (the callbacks push into it).
 		void install_managed_callbacks(mono_profiler* profiler)
@@ -382,7 +422,9 @@ namespace owlcat
 		m_details->choose_backtrace_mode();
 
 		// The worker exists regardless of mode (it interns names, symbolicates and reports)
+		m_details->read_overload_config();
 		m_details->m_processing_thread = std::make_unique<worker_thread>(m_details->m_events_sink, &m_details->m_logger, m_details->m_use_ip_capture, m_details->m_jit_available);
+		m_details->m_processing_thread->set_overload_config(m_details->m_overload_config);
 		m_details->m_processing_thread->start();
 
 		if (want_managed)
@@ -407,6 +449,10 @@ namespace owlcat
 	{
 		uint64_t frame = ++m_details->m_frame_index;
 
+		// Lets the worker report whether the frame that just ended was degraded
+		if (m_details->m_processing_thread)
+			m_details->m_processing_thread->on_frame_end(frame - 1);
+
 		// Snapshot whole-process memory once per frame for the committed-vs-tracked graph.
 		// All of these are cheap O(1) reads, safe to call from the game's frame thread.
 		uint64_t working_set = 0, committed = 0, gc_heap = 0;
@@ -28,6 +28,17 @@ namespace owlcat
 		std::vector<uint64_t> parents;
 	};
 
+	/*
+		Allocations of one type that were counted instead of recorded while the profiler was
+		overloaded (see overload_level)
+	*/
+	struct dropped_type_count
+	{
+		uint32_t type_id;
+		uint64_t count;
+		uint64_t size;
+	};
+
 	/*
 		Interface used by profiler to report events and send responses to commands
 	*/
@@ -47,6 +58,11 @@ namespace owlcat
 		// Per-frame whole-process memory snapshot (see SRV_MEMSTATS). No-op by default so
 		// sinks that don't care (e.g. the test) needn't implement it.
 		virtual void report_memstats(uint64_t frame, uint64_t working_set, uint64_t committed, uint64_t gc_heap) {}
+		// Reported at the end of a frame during which recording was degraded (see
+		// overload_level). dropped_count/dropped_size cover all allocations that were not
+		// recorded; dropped lists them per type (types missing from it were counted only in
+		// the totals). Types are reported before this. No-op by default.
+		virtual void report_degraded(uint64_t frame, uint8_t level, uint64_t dropped_count, uint64_t dropped_size, const std::vector<dropped_type_count>& dropped) {}
 		virtual void report_references(uint64_t request_id, const std::vector<object_references_t>& references) = 0;
 		virtual void report_paused(uint64_t request_id, bool ok) = 0;
 		virtual void report_resumed(uint64_t request_id, bool ok) = 0;
@@ -58,6 +74,10 @@ namespace owlcat
 		// (throttle game allocations) when the client can't keep up, so the buffer stays bounded
 		// instead of growing without limit. 0 means "no send side" (never throttle).
 		virtual uint64_t pending_send_bytes() { return 0; }
+		// Called on the worker thread (like the report_* functions) when its queue is empty,
+		// so the sink can do deferred work, such as replaying definitions to a client that
+		// has just connected. No-op by default.
+		virtual void on_idle() {}
 	};
 
 	/*
@@ -3,6 +3,8 @@
 
 #include "network.h"
 #include "logger.h"
+#include "event_encoding.h"
+#include "spool_events_sink.h"
 
 #include <memory>
 #include <thread>
@@ -10,7 +12,10 @@
 #include <mutex>
 #include <chrono>
 #include <string>
-#include <unordered_map>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
 
 #include <memory_writer.h>
 #include <memory_reader.h>
@@ -32,33 +37,67 @@ namespace owlcat
 			network& m_network;
 
 			/*
-				All type and callstack definitions reported so far. The profiler reports each
-				definition only once, but a client that (re)connects mid-session has never seen
-				the definitions sent earlier, so we keep them all and re-send them when a new
+				All type, frame and callstack definitions reported so far. The profiler reports
+				each definition only once, but a client that (re)connects mid-session has never
+				seen the definitions sent earlier, so we keep them all and replay them when a new
 				connection is detected.
 				Only accessed from the worker thread (which is the only caller of
-				report_alloc/report_free/report_type/report_callstack), so no locking is needed.
+				report_alloc/report_free/report_type/report_frame/report_callstack/on_idle), so
+				no locking is needed.
+
+				Type names and frame lines live in one text arena (NUL-terminated, referenced by
+				offset), callstacks as {offset, count} slices of one frame-id pool. Ids are dense,
+				so all tables are vectors indexed by id. Nothing here does a per-definition heap
+				allocation, which matters with millions of callstacks.
 			*/
-			std::unordered_map<uint32_t, std::string> m_type_defs;
-			// Frame-line definitions, indexed by frame id (ids are dense, assigned 0..N by
-			// the worker). The ~tens of thousands of unique lines, versus millions of callstacks.
-			std::vector<std::string> m_frame_defs;
-			// Callstack definitions as {offset, count} slices into m_callstack_pool, indexed by
-			// callstack id (dense). Storing the frame-id sequences in one contiguous pool means
-			// there is no per-callstack heap allocation (millions of them would fragment the heap).
+			static constexpr uint32_t NO_DEF = 0xFFFFFFFF;
+			std::vector<char> m_text_arena;
+			std::vector<uint32_t> m_type_defs;
+			std::vector<uint32_t> m_frame_defs;
 			std::vector<std::pair<uint32_t, uint32_t>> m_callstack_defs;
 			std::vector<uint32_t> m_callstack_pool;
-			// Value of m_network.connection_generation() the definitions were last sent for
+			// Value of m_network.connection_generation() the definitions were last replayed for
 			uint64_t m_defs_generation = 0;
 
+			/*
+				Replay after a reconnect. Re-sending millions of definitions in one go used to
+				stall the worker (and, through back-pressure, the game) for a long time. Instead
+				the replay advances in bounded chunks, interleaved with live events: a little
+				after every live event, and more while the worker is idle (on_idle), and only
+				while the send buffer is below REPLAY_MAX_PENDING so it can't trigger throttling.
+				A live event that references a definition not replayed yet sends it on demand
+				first. m_*_sent track what the current connection has already received.
+			*/
+			static constexpr uint32_t REPLAY_CHUNK_PER_EVENT = 16;
+			static constexpr uint32_t REPLAY_CHUNK_IDLE = 4096;
+			static constexpr uint64_t REPLAY_MAX_PENDING = 32ull * 1024 * 1024;
+			bool m_replaying = false;
+			uint32_t m_replay_type = 0;
+			uint32_t m_replay_frame = 0;
+			uint32_t m_replay_callstack = 0;
+			std::vector<uint8_t> m_type_sent;
+			std::vector<uint8_t> m_frame_sent;
+			std::vector<uint8_t> m_callstack_sent;
+
+			uint32_t store_text(const char* text)
+			{
+				uint32_t offset = (uint32_t)m_text_arena.size();
+				m_text_arena.insert(m_text_arena.end(), text, text + strlen(text) + 1);
+				return offset;
+			}
+
+			template<typename T>
+			static void store_def(std::vector<T>& defs, uint32_t id, const T& value, const T& empty)
+			{
+				if (id >= defs.size())
+					defs.resize(id + 1, empty);
+				defs[id] = value;
+			}
+
 			void send_type(uint32_t type_id, const char* name)
 			{
 				static std::vector<uint8_t> data;
-				data.reserve(1024);
-				data.clear();
-				memory_writer writer(data);
-				writer.write_varint(type_id);
-				writer.write_string(name);
+				event_encoding::encode_text_definition(data, type_id, name);
 
 				m_network.write_message(protocol::message::SRV_TYPE, (uint32_t)data.size(), (uint8_t*)&data[0]);
 			}
@@ -66,11 +105,7 @@ namespace owlcat
 			void send_frame(uint32_t frame_id, const char* text)
 			{
 				static std::vector<uint8_t> data;
-				data.reserve(512);
-				data.clear();
-				memory_writer writer(data);
-				writer.write_varint(frame_id);
-				writer.write_string(text);
+				event_encoding::encode_text_definition(data, frame_id, text);
 
 				m_network.write_message(protocol::message::SRV_FRAME, (uint32_t)data.size(), (uint8_t*)&data[0]);
 			}
@@ -78,19 +113,51 @@ namespace owlcat
 			void send_callstack(uint32_t callstack_id, uint32_t offset, uint32_t count)
 			{
 				static std::vector<uint8_t> data;
-				data.reserve(1024);
-				data.clear();
-				memory_writer writer(data);
-				writer.write_varint(callstack_id);
-				writer.write_varint(count);
-				for (uint32_t i = 0; i < count; ++i)
-					writer.write_varint(m_callstack_pool[offset + i]);
+				event_encoding::encode_callstack(data, callstack_id, m_callstack_pool.data() + offset, count);
 
 				m_network.write_message(protocol::message::SRV_CALLSTACK, (uint32_t)data.size(), (uint8_t*)&data[0]);
 			}
 
-			// If a new connection was established since the last event, (re-)send all definitions:
-			// the client on the other side has never seen them
+			// Marks a definition as sent to the current connection. Returns false if it already was.
+			static bool mark_sent(std::vector<uint8_t>& sent, uint32_t id)
+			{
+				if (id >= sent.size())
+					sent.resize(id + 1, 0);
+				if (sent[id])
+					return false;
+				sent[id] = 1;
+				return true;
+			}
+
+			// The ensure_* functions send a stored definition unless this connection has it
+			void ensure_type(uint32_t type_id)
+			{
+				if (type_id < m_type_defs.size() && m_type_defs[type_id] != NO_DEF && mark_sent(m_type_sent, type_id))
+					send_type(type_id, &m_text_arena[m_type_defs[type_id]]);
+			}
+
+			void ensure_frame(uint32_t frame_id)
+			{
+				if (frame_id < m_frame_defs.size() && m_frame_defs[frame_id] != NO_DEF && mark_sent(m_frame_sent, frame_id))
+					send_frame(frame_id, &m_text_arena[m_frame_defs[frame_id]]);
+			}
+
+			void ensure_callstack(uint32_t callstack_id)
+			{
+				if (callstack_id >= m_callstack_defs.size() || (callstack_id < m_callstack_sent.size() && m_callstack_sent[callstack_id]))
+					return;
+
+				// Frames before callstacks: a callstack references frame ids
+				auto [offset, count] = m_callstack_defs[callstack_id];
+				for (uint32_t i = 0; i < count; ++i)
+					ensure_frame(m_callstack_pool[offset + i]);
+
+				mark_sent(m_callstack_sent, callstack_id);
+				send_callstack(callstack_id, offset, count);
+			}
+
+			// If a new connection was established since the last event, start replaying all
+			// definitions: the client on the other side has never seen them
 			void update_definitions()
 			{
 				uint64_t generation = m_network.connection_generation();
@@ -98,13 +165,38 @@ namespace owlcat
 					return;
 				m_defs_generation = generation;
 
-				for (auto& def : m_type_defs)
-					send_type(def.first, def.second.c_str());
-				// Frames before callstacks: a callstack references frame ids
-				for (uint32_t id = 0; id < (uint32_t)m_frame_defs.size(); ++id)
-					send_frame(id, m_frame_defs[id].c_str());
-				for (uint32_t id = 0; id < (uint32_t)m_callstack_defs.size(); ++id)
-					send_callstack(id, m_callstack_defs[id].first, m_callstack_defs[id].second);
+				m_type_sent.assign(m_type_defs.size(), 0);
+				m_frame_sent.assign(m_frame_defs.size(), 0);
+				m_callstack_sent.assign(m_callstack_defs.size(), 0);
+				m_replay_type = 0;
+				m_replay_frame = 0;
+				m_replay_callstack = 0;
+				m_replaying = true;
+			}
+
+			// Replays up to max_count stored definitions the current connection hasn't seen
+			void replay_definitions(uint32_t max_count)
+			{
+				if (!m_replaying || m_network.get_pending_write_bytes() > REPLAY_MAX_PENDING)
+					return;
+
+				uint32_t budget = max_count;
+				for (; budget > 0 && m_replay_type < (uint32_t)m_type_defs.size(); ++m_replay_type, --budget)
+					ensure_type(m_replay_type);
+				for (; budget > 0 && m_replay_frame < (uint32_t)m_frame_defs.size(); ++m_replay_frame, --budget)
+					ensure_frame(m_replay_frame);
+				for (; budget > 0 && m_replay_callstack < (uint32_t)m_callstack_defs.size(); ++m_replay_callstack, --budget)
+					ensure_callstack(m_replay_callstack);
+
+				if (budget > 0)
+				{
+					// Everything stored has been sent. Definitions reported from now on are
+					// sent as they arrive.
+					m_replaying = false;
+					m_type_sent = std::vector<uint8_t>();
+					m_frame_sent = std::vector<uint8_t>();
+					m_callstack_sent = std::vector<uint8_t>();
+				}
 			}
 
 		public:
@@ -116,18 +208,18 @@ namespace owlcat
 					return;
 
 				update_definitions();
+				if (m_replaying)
+				{
+					ensure_type(type_id);
+					ensure_callstack(callstack_id);
+				}
 
 				static std::vector<uint8_t> data;
-				data.reserve(64);
-				data.clear();
-				memory_writer writer(data);
-				writer.write_uint64(frame);
-				writer.write_uint64(addr);
-				writer.write_uint32(size);
-				writer.write_varint(type_id);
-				writer.write_varint(callstack_id);
+				event_encoding::encode_alloc(data, frame, addr, size, type_id, callstack_id);
 
 				m_network.write_message(protocol::message::SRV_ALLOC, (uint32_t)data.size(), (uint8_t*)&data[0]);
+
+				replay_definitions(REPLAY_CHUNK_PER_EVENT);
 			}
 
 			virtual void report_free(uint64_t frame, uint64_t addr, uint32_t size) override
@@ -138,14 +230,11 @@ namespace owlcat
 				update_definitions();
 
 				static std::vector<uint8_t> data;
-				data.reserve(32);
-				data.clear();
-				memory_writer writer(data);
-				writer.write_uint64(frame);
-				writer.write_uint64(addr);
-				writer.write_uint32(size);
+				event_encoding::encode_free(data, frame, addr, size);
 
 				m_network.write_message(protocol::message::SRV_FREE, (uint32_t)data.size(), (uint8_t*)&data[0]);
+
+				replay_definitions(REPLAY_CHUNK_PER_EVENT);
 			}
 
 			virtual void report_type(uint32_t type_id, const char* name) override
@@ -153,25 +242,27 @@ namespace owlcat
 				// Remember the definition even if not connected: a client connecting later
 				// must receive all definitions. Overwrite is intentional: the profiler may be
 				// restarted mid-session (e.g. StartProfiling called again) and re-assign ids.
-				m_type_defs[type_id] = name;
+				store_def(m_type_defs, type_id, store_text(name), NO_DEF);
 
 				if (!m_network.is_connected())
 					return;
 
 				update_definitions();
+				if (m_replaying)
+					mark_sent(m_type_sent, type_id);
 				send_type(type_id, name);
 			}
 
 			virtual void report_frame(uint32_t frame_id, const char* text) override
 			{
-				if (frame_id >= m_frame_defs.size())
-					m_frame_defs.resize(frame_id + 1);
-				m_frame_defs[frame_id] = text;
+				store_def(m_frame_defs, frame_id, store_text(text), NO_DEF);
 
 				if (!m_network.is_connected())
 					return;
 
 				update_definitions();
+				if (m_replaying)
+					mark_sent(m_frame_sent, frame_id);
 				send_frame(frame_id, text);
 			}
 
@@ -183,18 +274,51 @@ namespace owlcat
 				uint32_t offset = (uint32_t)m_callstack_pool.size();
 				uint32_t count = (uint32_t)frame_ids.size();
 				m_callstack_pool.insert(m_callstack_pool.end(), frame_ids.begin(), frame_ids.end());
-
-				if (callstack_id >= m_callstack_defs.size())
-					m_callstack_defs.resize(callstack_id + 1);
-				m_callstack_defs[callstack_id] = { offset, count };
+				store_def(m_callstack_defs, callstack_id, { offset, count }, { 0, 0 });
 
 				if (!m_network.is_connected())
 					return;
 
 				update_definitions();
+				if (m_replaying)
+				{
+					// The profiler has reported the frames already, but the replay may not have
+					// reached them yet
+					for (uint32_t frame_id : frame_ids)
+						ensure_frame(frame_id);
+					mark_sent(m_callstack_sent, callstack_id);
+				}
 				send_callstack(callstack_id, offset, count);
 			}
 
+			virtual void report_degraded(uint64_t frame, uint8_t level, uint64_t dropped_count, uint64_t dropped_size, const std::vector<dropped_type_count>& dropped) override
+			{
+				if (!m_network.is_connected())
+					return;
+
+				update_definitions();
+				if (m_replaying)
+				{
+					for (auto& type : dropped)
+						ensure_type(type.type_id);
+				}
+
+				// In the bulk lane: the marker must stay ordered with the frame's events
+				static std::vector<uint8_t> data;
+				event_encoding::encode_degraded(data, frame, level, dropped_count, dropped_size, dropped);
+
+				m_network.write_message(protocol::message::SRV_DEGRADED, (uint32_t)data.size(), (uint8_t*)&data[0]);
+			}
+
+			virtual void on_idle() override
+			{
+				if (!m_network.is_connected())
+					return;
+
+				update_definitions();
+				replay_definitions(REPLAY_CHUNK_IDLE);
+			}
+
 			virtual void report_references(uint64_t request_id, const std::vector<object_references_t>& references) override
 			{
 				if (!m_network.is_connected())
@@ -216,6 +340,9 @@ namespace owlcat
 						writer.write_varint(parent);
 				}
 
+				// In the bulk lane, unlike the other replies: the referenced objects may have been
+				// allocated by events still queued there, which the client must have before it can
+				// resolve them
 				m_network.write_message(protocol::message::SRV_REFERENCES, (uint32_t)data.size(), (uint8_t*)&data[0]);
 			}
 
@@ -231,7 +358,7 @@ namespace owlcat
 				writer.write_uint64(request_id);
 				writer.write_uint8(ok ? 0 : 1);
 
-				m_network.write_message(protocol::message::SRV_PAUSE, (uint32_t)data.size(), (uint8_t*)&data[0]);
+				m_network.write_priority_message(protocol::message::SRV_PAUSE, (uint32_t)data.size(), (uint8_t*)&data[0]);
 			}
 
 			virtual void report_resumed(uint64_t request_id, bool ok) override
@@ -246,7 +373,7 @@ namespace owlcat
 				writer.write_uint64(request_id);
 				writer.write_uint8(ok ? 0 : 1);
 
-				m_network.write_message(protocol::message::SRV_RESUME, (uint32_t)data.size(), (uint8_t*)&data[0]);
+				m_network.write_priority_message(protocol::message::SRV_RESUME, (uint32_t)data.size(), (uint8_t*)&data[0]);
 			}
 
 			// See OWLCAT_PROFILER_MEMLOG. Logs the definition tables (which grow with the
@@ -257,27 +384,10 @@ namespace owlcat
 				if (log == nullptr)
 					return;
 
-				// Approximate resident bytes of an unordered_map<uint32_t, std::string>: a list
-				// node (two pointers + the pair) per element, two iterators per bucket, plus the
-				// heap held by non-SSO strings.
-				auto def_bytes = [](const std::unordered_map<uint32_t, std::string>& m)
-				{
-					uint64_t bytes = (uint64_t)m.size() * (2 * sizeof(void*) + sizeof(std::pair<const uint32_t, std::string>))
-						+ (uint64_t)m.bucket_count() * (2 * sizeof(void*));
-					for (auto& kv : m)
-						if (kv.second.capacity() > 15)
-							bytes += kv.second.capacity() + 1;
-					return bytes;
-				};
-
 				const double MB = 1024.0 * 1024.0;
-				uint64_t type_bytes = def_bytes(m_type_defs);
-
-				// Frame lines: the vector of strings, plus each string's heap.
-				uint64_t frame_bytes = (uint64_t)m_frame_defs.capacity() * sizeof(std::string);
-				for (auto& s : m_frame_defs)
-					if (s.capacity() > 15)
-						frame_bytes += s.capacity() + 1;
+				// Type names and frame lines share the text arena
+				uint64_t text_bytes = (uint64_t)m_text_arena.capacity()
+					+ (uint64_t)(m_type_defs.capacity() + m_frame_defs.capacity()) * sizeof(uint32_t);
 
 				// Callstacks: the {offset,count} index vector, plus the contiguous frame-id pool.
 				uint64_t cs_bytes = (uint64_t)m_callstack_defs.capacity() * sizeof(std::pair<uint32_t, uint32_t>)
@@ -285,9 +395,7 @@ namespace owlcat
 				uint64_t net_bytes = m_network.get_pending_write_bytes();
 
 				char tmp[256];
-				snprintf(tmp, sizeof(tmp) - 1, "[MEMLOG] sink type defs:    %zu defs  ~ %.1f MB", m_type_defs.size(), type_bytes / MB);
-				log->log_str(tmp);
-				snprintf(tmp, sizeof(tmp) - 1, "[MEMLOG] sink frame defs:   %zu lines  ~ %.1f MB", m_frame_defs.size(), frame_bytes / MB);
+				snprintf(tmp, sizeof(tmp) - 1, "[MEMLOG] sink type/frame defs: %zu types, %zu lines  ~ %.1f MB", m_type_defs.size(), m_frame_defs.size(), text_bytes / MB);
 				log->log_str(tmp);
 				snprintf(tmp, sizeof(tmp) - 1, "[MEMLOG] sink callstack defs:%zu defs, %zu frame-refs  ~ %.1f MB", m_callstack_defs.size(), m_callstack_pool.size(), cs_bytes / MB);
 				log->log_str(tmp);
@@ -306,21 +414,23 @@ namespace owlcat
 					return;
 
 				static std::vector<uint8_t> data;
-				data.reserve(64);
-				data.clear();
-				memory_writer writer(data);
-				writer.write_uint64(frame);
-				writer.write_uint64(working_set);
-				writer.write_uint64(committed);
-				writer.write_uint64(gc_heap);
+				event_encoding::encode_memstats(data, frame, working_set, committed, gc_heap);
 
-				m_network.write_message(protocol::message::SRV_MEMSTATS, (uint32_t)data.size(), (uint8_t*)&data[0]);
+				m_network.write_priority_message(protocol::message::SRV_MEMSTATS, (uint32_t)data.size(), (uint8_t*)&data[0]);
 			}
 		};
 
 		network m_network;
 		network_events_sink m_sink;
+		// Optional spool to local disk (OWLCAT_PROFILER_SPOOL), alone or alongside the network
+		spool_events_sink m_spool;
+		tee_events_sink m_tee;
 		mono_profiler m_profiler;
+		// True if events only go to the spool: there is no client to wait for
+		bool m_spool_only = false;
+		// The spool is set up by the first start() only: stop() closes it, and opening it
+		// again would overwrite what the stopped session wrote
+		bool m_spool_set_up = false;
 
 		std::thread m_watchdog;
 		bool m_stop_watchdog = false;
@@ -338,10 +448,65 @@ namespace owlcat
 	public:
 		details()
 			: m_sink(m_network)
-			, m_profiler(&m_sink)
+			, m_tee(&m_sink, nullptr)
+			, m_profiler(&m_tee)
 		{
 		}
 
+		/*
+			Spooling is configured through the environment, because it is meant for runs
+			without a (fast enough) client:
+			  OWLCAT_PROFILER_SPOOL=<path prefix>  write the event stream to <prefix>.NNNNNN.spool
+			  OWLCAT_PROFILER_SPOOL_ONLY=1         don't use the network at all. The profiler
+			                                       starts right away, with the capture mode from
+			                                       OWLCAT_PROFILER_CAPTURE (capture_flags, default
+			                                       managed) and the native-hook config from the
+			                                       file named by OWLCAT_PROFILER_NATIVE_CONFIG.
+			Without SPOOL_ONLY the spool is teed with the network sink, and back-pressure
+			follows whichever of the two is further behind.
+		*/
+		void setup_spool()
+		{
+			if (m_spool_set_up)
+				return;
+			m_spool_set_up = true;
+
+			const char* prefix = getenv("OWLCAT_PROFILER_SPOOL");
+			if (prefix == nullptr || *prefix == 0)
+				return;
+
+			if (!m_spool.open(prefix))
+				return;
+
+			const char* only = getenv("OWLCAT_PROFILER_SPOOL_ONLY");
+			m_spool_only = only != nullptr && atoi(only) != 0;
+			m_tee.set_secondary(&m_spool);
+			if (m_spool_only)
+				m_tee.set_primary(nullptr);
+		}
+
+		void start_spool_only()
+		{
+			uint32_t capture_flags = CAPTURE_MANAGED;
+			if (const char* flags = getenv("OWLCAT_PROFILER_CAPTURE"))
+				capture_flags = (uint32_t)atoi(flags);
+
+			std::string native_config;
+			if (const char* config_path = getenv("OWLCAT_PROFILER_NATIVE_CONFIG"))
+			{
+				if (FILE* f = fopen(config_path, "rb"))
+				{
+					char buffer[4096];
+					size_t read;
+					while ((read = fread(buffer, 1, sizeof(buffer), f)) > 0)
+						native_config.append(buffer, read);
+					fclose(f);
+				}
+			}
+
+			configure(capture_flags, native_config);
+		}
+
 		// Starts the profiler exactly once, with the given capture configuration
 		void configure(uint32_t capture_flags, const std::string& native_config)
 		{
@@ -373,12 +538,33 @@ namespace owlcat
 			m_wait_for_connection = wait_for_connection;
 			m_port = port;
 
+			setup_spool();
+			if (m_spool_only)
+			{
+				start_spool_only();
+				return;
+			}
+
 			if (!m_network.is_connected())
 			{
-				if (wait_for_connection)
-					m_network.listen_sync(port);
-				else
-					m_network.listen_async(port);
+				if (m_network.is_shared_memory())
+				{
+					// listen_shared_memory was called: the client attaches to the channel, or
+					// goes for the port if it can't. The channel stops listening if nobody
+					// attaches in time (without waiting, the watchdog switches to TCP then).
+					while (wait_for_connection && !m_network.is_connected() && m_network.is_listening())
+						std::this_thread::sleep_for(std::chrono::milliseconds(5));
+					if (wait_for_connection && !m_network.is_connected())
+						m_network.stop();
+				}
+
+				if (!m_network.is_shared_memory())
+				{
+					if (wait_for_connection)
+						m_network.listen_sync(port);
+					else
+						m_network.listen_async(port);
+				}
 			}
 
 			// Stop watchdog thread if we're restarting
@@ -433,6 +619,14 @@ namespace owlcat
 			}
 		}
 
+		bool listen_shared_memory(const char* name)
+		{
+			if (m_network.is_connected())
+				return false;
+
+			return m_network.listen_shared_memory(name);
+		}
+
 		void process_messages()
 		{
 			// Profiler-owned thread (also runs find_references/pause/resume, which allocate)
@@ -506,7 +700,12 @@ namespace owlcat
 			if (m_watchdog.joinable())
 				m_watchdog.join();
 
-			m_network.stop();			
+			m_network.stop();
+
+			// Write out what the spool still buffers and join its thread here rather than in
+			// the destructor, which runs under the loader lock when the DLL is unloaded. Events
+			// reported after this are dropped by the closed spool.
+			m_spool.close();
 		}
 
 		void on_frame()
@@ -530,6 +729,11 @@ namespace owlcat
 		m_details->start(wait_for_connection, port);
 	}
 
+	bool mono_profiler_server::listen_shared_memory(const char* name)
+	{
+		return m_details->listen_shared_memory(name);
+	}
+
 	void mono_profiler_server::stop()
 	{
 		m_details->stop();
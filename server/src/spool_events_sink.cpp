@@ -0,0 +1,80 @@
+#include "spool_events_sink.h"
+#include "event_encoding.h"
+#include "logger.h"
+
+#include <cstdio>
+
+namespace owlcat
+{
+	bool spool_events_sink::open(const std::string& prefix)
+	{
+		return m_writer.open(prefix);
+	}
+
+	void spool_events_sink::close()
+	{
+		m_writer.close();
+	}
+
+	void spool_events_sink::report_alloc(uint64_t frame, uint64_t addr, uint32_t size, uint32_t type_id, uint32_t callstack_id)
+	{
+		static std::vector<uint8_t> data;
+		event_encoding::encode_alloc(data, frame, addr, size, type_id, callstack_id);
+		m_writer.write_message(protocol::message::SRV_ALLOC, (uint32_t)data.size(), data.data());
+	}
+
+	void spool_events_sink::report_free(uint64_t frame, uint64_t addr, uint32_t size)
+	{
+		static std::vector<uint8_t> data;
+		event_encoding::encode_free(data, frame, addr, size);
+		m_writer.write_message(protocol::message::SRV_FREE, (uint32_t)data.size(), data.data());
+	}
+
+	void spool_events_sink::report_type(uint32_t type_id, const char* name)
+	{
+		static std::vector<uint8_t> data;
+		event_encoding::encode_text_definition(data, type_id, name);
+		m_writer.write_message(protocol::message::SRV_TYPE, (uint32_t)data.size(), data.data());
+	}
+
+	void spool_events_sink::report_frame(uint32_t frame_id, const char* text)
+	{
+		static std::vector<uint8_t> data;
+		event_encoding::encode_text_definition(data, frame_id, text);
+		m_writer.write_message(protocol::message::SRV_FRAME, (uint32_t)data.size(), data.data());
+	}
+
+	void spool_events_sink::report_callstack(uint32_t callstack_id, const std::vector<uint32_t>& frame_ids)
+	{
+		static std::vector<uint8_t> data;
+		event_encoding::encode_callstack(data, callstack_id, frame_ids.data(), (uint32_t)frame_ids.size());
+		m_writer.write_message(protocol::message::SRV_CALLSTACK, (uint32_t)data.size(), data.data());
+	}
+
+	void spool_events_sink::report_memstats(uint64_t frame, uint64_t working_set, uint64_t committed, uint64_t gc_heap)
+	{
+		// Called once per frame, on the game's main thread: a good moment to let a client
+		// following the spool see this frame's events
+		static std::vector<uint8_t> data;
+		event_encoding::encode_memstats(data, frame, working_set, committed, gc_heap);
+		m_writer.write_message(protocol::message::SRV_MEMSTATS, (uint32_t)data.size(), data.data());
+		m_writer.flush();
+	}
+
+	void spool_events_sink::report_degraded(uint64_t frame, uint8_t level, uint64_t dropped_count, uint64_t dropped_size, const std::vector<dropped_type_count>& dropped)
+	{
+		static std::vector<uint8_t> data;
+		event_encoding::encode_degraded(data, frame, level, dropped_count, dropped_size, dropped);
+		m_writer.write_message(protocol::message::SRV_DEGRADED, (uint32_t)data.size(), data.data());
+	}
+
+	void spool_events_sink::log_memory_stats(logger* log)
+	{
+		if (log == nullptr)
+			return;
+
+		char tmp[256];
+		snprintf(tmp, sizeof(tmp) - 1, "[MEMLOG] spool buffer:      ~ %.1f MB%s", m_writer.pending_bytes() / (1024.0 * 1024.0), m_writer.has_failed() ? " (WRITE FAILED)" : "");
+		log->log_str(tmp);
+	}
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+
+#include "mono_profiler.h"
+#include "spool_file.h"
+
+namespace owlcat
+{
+	/*
+		Writes the event stream to a spool on local disk (see spool_file.h) instead of sending
+		it to a client. The client imports the spool later, or follows it while it is being
+		written, at its own pace: disk writes are large, sequential and done on a background
+		thread, so a slow (or absent) client never throttles the game.
+
+		Command replies (references, pause/resume) have no meaning in a spool and are dropped.
+	*/
+	class spool_events_sink : public events_sink
+	{
+		spool_writer m_writer;
+
+	public:
+		bool open(const std::string& prefix);
+		void close();
+		bool is_open() const { return m_writer.is_open(); }
+
+		virtual void report_alloc(uint64_t frame, uint64_t addr, uint32_t size, uint32_t type_id, uint32_t callstack_id) override;
+		virtual void report_free(uint64_t frame, uint64_t addr, uint32_t size) override;
+		virtual void report_type(uint32_t type_id, const char* name) override;
+		virtual void report_frame(uint32_t frame_id, const char* text) override;
+		virtual void report_callstack(uint32_t callstack_id, const std::vector<uint32_t>& frame_ids) override;
+		virtual void report_memstats(uint64_t frame, uint64_t working_set, uint64_t committed, uint64_t gc_heap) override;
+		virtual void report_degraded(uint64_t frame, uint8_t level, uint64_t dropped_count, uint64_t dropped_size, const std::vector<dropped_type_count>& dropped) override;
+		virtual void report_references(uint64_t request_id, const std::vector<object_references_t>& references) override {}
+		virtual void report_paused(uint64_t request_id, bool ok) override {}
+		virtual void report_resumed(uint64_t request_id, bool ok) override {}
+		virtual void log_memory_stats(logger* log) override;
+		// Only what hasn't reached the disk yet. Normally near zero; it grows only if the disk
+		// can't keep up, in which case throttling is the right thing to do.
+		virtual uint64_t pending_send_bytes() override { return m_writer.pending_bytes(); }
+	};
+
+	/*
+		Forwards events to two sinks, e.g. the network and a spool. Either can be null.
+		Back-pressure follows whichever sink is further behind, so that neither loses events
+		because the other one keeps up.
+	*/
+	class tee_events_sink : public events_sink
+	{
+		events_sink* m_primary;
+		events_sink* m_secondary;
+
+	public:
+		tee_events_sink(events_sink* primary, events_sink* secondary)
+			: m_primary(primary)
+			, m_secondary(secondary)
+		{}
+
+		// Must only be called while the profiler is not running
+		void set_primary(events_sink* sink) { m_primary = sink; }
+		void set_secondary(events_sink* sink) { m_secondary = sink; }
+
+		virtual void report_alloc(uint64_t frame, uint64_t addr, uint32_t size, uint32_t type_id, uint32_t callstack_id) override
+		{
+			if (m_primary) m_primary->report_alloc(frame, addr, size, type_id, callstack_id);
+			if (m_secondary) m_secondary->report_alloc(frame, addr, size, type_id, callstack_id);
+		}
+
+		virtual void report_free(uint64_t frame, uint64_t addr, uint32_t size) override
+		{
+			if (m_primary) m_primary->report_free(frame, addr, size);
+			if (m_secondary) m_secondary->report_free(frame, addr, size);
+		}
+
+		virtual void report_type(uint32_t type_id, const char* name) override
+		{
+			if (m_primary) m_primary->report_type(type_id, name);
+			if (m_secondary) m_secondary->report_type(type_id, name);
+		}
+
+		virtual void report_frame(uint32_t frame_id, const char* text) override
+		{
+			if (m_primary) m_primary->report_frame(frame_id, text);
+			if (m_secondary) m_secondary->report_frame(frame_id, text);
+		}
+
+		virtual void report_callstack(uint32_t callstack_id, const std::vector<uint32_t>& frame_ids) override
+		{
+			if (m_primary) m_primary->report_callstack(callstack_id, frame_ids);
+			if (m_secondary) m_secondary->report_callstack(callstack_id, frame_ids);
+		}
+
+		virtual void report_memstats(uint64_t frame, uint64_t working_set, uint64_t committed, uint64_t gc_heap) override
+		{
+			if (m_primary) m_primary->report_memstats(frame, working_set, committed, gc_heap);
+			if (m_secondary) m_secondary->report_memstats(frame, working_set, committed, gc_heap);
+		}
+
+		virtual void report_degraded(uint64_t frame, uint8_t level, uint64_t dropped_count, uint64_t dropped_size, const std::vector<dropped_type_count>& dropped) override
+		{
+			if (m_primary) m_primary->report_degraded(frame, level, dropped_count, dropped_size, dropped);
+			if (m_secondary) m_secondary->report_degraded(frame, level, dropped_count, dropped_size, dropped);
+		}
+
+		// Command replies go to whoever can answer: the sinks ignore them if they can't
+		virtual void report_references(uint64_t request_id, const std::vector<object_references_t>& references) override
+		{
+			if (m_primary) m_primary->report_references(request_id, references);
+			if (m_secondary) m_secondary->report_references(request_id, references);
+		}
+
+		virtual void report_paused(uint64_t request_id, bool ok) override
+		{
+			if (m_primary) m_primary->report_paused(request_id, ok);
+			if (m_secondary) m_secondary->report_paused(request_id, ok);
+		}
+
+		virtual void report_resumed(uint64_t request_id, bool ok) override
+		{
+			if (m_primary) m_primary->report_resumed(request_id, ok);
+			if (m_secondary) m_secondary->report_resumed(request_id, ok);
+		}
+
+		virtual void log_memory_stats(logger* log) override
+		{
+			if (m_primary) m_primary->log_memory_stats(log);
+			if (m_secondary) m_secondary->log_memory_stats(log);
+		}
+
+		virtual uint64_t pending_send_bytes() override
+		{
+			const uint64_t primary = m_primary ? m_primary->pending_send_bytes() : 0;
+			const uint64_t secondary = m_secondary ? m_secondary->pending_send_bytes() : 0;
+			return std::max(primary, secondary);
+		}
+
+		virtual void on_idle() override
+		{
+			if (m_primary) m_primary->on_idle();
+			if (m_secondary) m_secondary->on_idle();
+		}
+	};
+}
@@ -720,31 +720,56 @@ namespace owlcat
 	}
 #endif
 
-	// Back-pressure thresholds. Fixed high/low-water marks (hysteresis avoids thrashing) - an
-	// arithmetically bounded design, not an adaptive one. Healthy captures (client keeping up)
-	// keep the buffer near zero and never reach these, so there's no effect then; they only
-	// engage when the client falls behind, throttling the game to its ingest rate.
 	namespace
 	{
-		constexpr uint64_t SEND_HIGH  = 256ull * 1024 * 1024; // start throttling above this many buffered send bytes
-		constexpr uint64_t SEND_LOW   = 128ull * 1024 * 1024; // release below this
-		constexpr size_t   QUEUE_HIGH = 200000;               // ...or this many queued work items (~112 MB)
-		constexpr size_t   QUEUE_LOW  = 50000;
+		// With the degrade policy, how long a level gets to relieve the pressure before the
+		// next one is tried: the backlog only starts shrinking some time after a level change.
+		constexpr auto OVERLOAD_ESCALATE_DELAY = std::chrono::milliseconds(100);
+
+		// Per-thread counter for OVERLOAD_SAMPLING
+		thread_local uint32_t t_sample_counter = 0;
+
+		const char* overload_level_name(uint8_t level)
+		{
+			switch (level)
+			{
+			case OVERLOAD_NONE: return "full recording";
+			case OVERLOAD_NO_STACKS: return "no callstacks";
+			case OVERLOAD_SAMPLING: return "sampling";
+			default: return "per-type counters only";
+			}
+		}
 	}
 
-	// Runs on the worker thread. Sets/clears the throttle from the current send-buffer and
-	// queue sizes. When it releases, game threads blocked in wait_if_throttled are woken.
+	void worker_thread::set_overload_config(const overload_config& config)
+	{
+		m_overload = config;
+		if (m_overload.mode == overload_config::policy::degrade && m_dropped_counters == nullptr)
+			m_dropped_counters.reset(new dropped_counter[DROPPED_TABLE_SIZE]);
+	}
+
+	// Runs on the worker thread. Sets/clears the throttle (or, with the degrade policy, moves
+	// the overload level) from the current send-buffer and queue sizes. When the throttle
+	// releases, game threads blocked in wait_if_throttled are woken.
 	void worker_thread::maybe_update_throttle()
 	{
 		uint64_t sent = m_events_sink != nullptr ? m_events_sink->pending_send_bytes() : 0;
 		size_t queued = m_work_items.size_approx();
+		bool over = sent > m_overload.send_high || queued > m_overload.queue_high;
+		bool under = sent < m_overload.send_low && queued < m_overload.queue_low;
+
+		if (m_overload.mode == overload_config::policy::degrade)
+		{
+			update_overload_level(over, under);
+			return;
+		}
 
 		if (!m_send_throttle.load(std::memory_order_relaxed))
 		{
-			if (sent > SEND_HIGH || queued > QUEUE_HIGH)
+			if (over)
 				m_send_throttle.store(true, std::memory_order_relaxed);
 		}
-		else if (sent < SEND_LOW && queued < QUEUE_LOW)
+		else if (under)
 		{
 			{
 				std::scoped_lock lock(m_throttle_mutex);
@@ -754,6 +779,39 @@ namespace owlcat
 		}
 	}
 
+	// Runs on the worker thread. Escalates one level at a time while over the high-water
+	// marks, and recovers to full recording at once below the low-water marks.
+	void worker_thread::update_overload_level(bool over, bool under)
+	{
+		uint8_t level = m_overload_level.load(std::memory_order_relaxed);
+		uint8_t new_level = level;
+		if (over && level < OVERLOAD_COUNTERS)
+		{
+			auto now = std::chrono::steady_clock::now();
+			if (level == OVERLOAD_NONE || now - m_overload_changed >= OVERLOAD_ESCALATE_DELAY)
+			{
+				new_level = level + 1;
+				m_overload_changed = now;
+			}
+		}
+		else if (under && level != OVERLOAD_NONE)
+			new_level = OVERLOAD_NONE;
+
+		if (new_level == level)
+			return;
+
+		m_overload_level.store(new_level, std::memory_order_relaxed);
+		if (new_level > m_frame_overload_level)
+			m_frame_overload_level = new_level;
+
+		if (m_logger != nullptr)
+		{
+			char tmp[256];
+			snprintf(tmp, sizeof(tmp) - 1, "Profiler overload: switched to %s", overload_level_name(new_level));
+			m_logger->log_str(tmp);
+		}
+	}
+
 	// Runs on the game's allocation threads. Blocks while the throttle is set, so the game
 	// produces events no faster than the client can drain them. The common (un-throttled) case
 	// is a single relaxed atomic load.
@@ -766,6 +824,97 @@ namespace owlcat
 		m_throttle_cv.wait(lock, [this] { return !m_send_throttle.load(std::memory_order_relaxed) || m_stop; });
 	}
 
+	// Runs on the game's allocation threads. Never blocks.
+	bool worker_thread::should_record(uint8_t level, uint64_t key, uint32_t size)
+	{
+		if (level < OVERLOAD_SAMPLING)
+			return true;
+
+		if (level == OVERLOAD_SAMPLING && (++t_sample_counter % OVERLOAD_SAMPLE_INTERVAL) == 0)
+			return true;
+
+		count_dropped(key, size);
+		return false;
+	}
+
+	void worker_thread::count_dropped(uint64_t key, uint32_t size)
+	{
+		m_dropped_count.fetch_add(1, std::memory_order_relaxed);
+		m_dropped_size.fetch_add(size, std::memory_order_relaxed);
+
+		// Fibonacci hashing spreads the aligned pointer keys over the table
+		size_t index = (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (DROPPED_TABLE_SIZE - 1);
+		for (size_t probe = 0; probe < DROPPED_MAX_PROBE; ++probe)
+		{
+			dropped_counter& slot = m_dropped_counters[(index + probe) & (DROPPED_TABLE_SIZE - 1)];
+			uint64_t slot_key = slot.key.load(std::memory_order_acquire);
+			if (slot_key == 0)
+			{
+				// Claim the empty slot. If another thread beat us to it, it may have claimed it
+				// for the same key.
+				if (slot.key.compare_exchange_strong(slot_key, key, std::memory_order_acq_rel))
+					slot_key = key;
+			}
+			if (slot_key == key)
+			{
+				slot.count.fetch_add(1, std::memory_order_relaxed);
+				slot.size.fetch_add(size, std::memory_order_relaxed);
+				return;
+			}
+		}
+	}
+
+	// Runs on the worker thread when it dequeues a frame_end item
+	void worker_thread::report_overload(uint64_t frame)
+	{
+		uint8_t level = m_frame_overload_level;
+		m_frame_overload_level = m_overload_level.load(std::memory_order_relaxed);
+
+		uint64_t dropped_count = m_dropped_count.exchange(0, std::memory_order_relaxed);
+		uint64_t dropped_size = m_dropped_size.exchange(0, std::memory_order_relaxed);
+		if (level == OVERLOAD_NONE && dropped_count == 0)
+			return;
+
+		// The counters are swapped out one by one, while game threads may be adding to them:
+		// an allocation counted in between lands in this frame's or the next frame's report,
+		// and per type its count and size can be one frame apart. Good enough for a summary.
+		m_scratch_dropped.clear();
+		if (dropped_count != 0 && m_dropped_counters != nullptr)
+		{
+			for (size_t i = 0; i < DROPPED_TABLE_SIZE; ++i)
+			{
+				dropped_counter& slot = m_dropped_counters[i];
+				uint64_t key = slot.key.load(std::memory_order_acquire);
+				if (key == 0)
+					continue;
+				uint64_t count = slot.count.exchange(0, std::memory_order_relaxed);
+				if (count == 0)
+					continue;
+				uint64_t size = slot.size.exchange(0, std::memory_order_relaxed);
+
+				// Types are interned (and their definitions reported) here, on the worker
+				uint32_t type_id = (key & 1) != 0 ? intern_native_type((uint32_t)(key >> 1)) : intern_type((MonoClass*)key);
+				m_scratch_dropped.push_back({ type_id, count, size });
+			}
+		}
+
+		m_events_sink->report_degraded(frame, level, dropped_count, dropped_size, m_scratch_dropped);
+	}
+
+	// The callstack of allocations recorded without one under overload, so they stand out
+	// from genuinely stackless allocations ("<no stack>")
+	uint32_t worker_thread::dropped_callstack_id()
+	{
+		if (m_dropped_callstack_id < 0)
+		{
+			m_scratch_frame_ids.clear();
+			m_scratch_frame_ids.push_back(intern_frame_line("<callstack dropped: profiler overloaded>"));
+			m_dropped_callstack_id = m_next_callstack_id++;
+			m_events_sink->report_callstack((uint32_t)m_dropped_callstack_id, m_scratch_frame_ids);
+		}
+		return (uint32_t)m_dropped_callstack_id;
+	}
+
 	/*
 		Main processing function. Dequeues events from queue, updates set of live allocations, and reports events to client
 	*/
@@ -798,6 +947,8 @@ namespace owlcat
 			if (!m_work_items.try_dequeue(item))
 			{
 				m_work_items_empty = true;
+				if (m_events_sink != nullptr)
+					m_events_sink->on_idle();
 				std::this_thread::yield();
 				continue;
 			}
@@ -822,6 +973,12 @@ namespace owlcat
 				}
 			}
 
+			if (item.type == work_item_type::frame_end)
+			{
+				report_overload(item.frame);
+				continue;
+			}
+
 			// ---------- Native events. These bypass m_allocations (and thus the pseudo-GC):
 			// native memory is freed explicitly, not collected.
 			if (item.type == work_item_type::native_free)
@@ -842,7 +999,7 @@ namespace owlcat
 
 			if (item.type == work_item_type::native_alloc)
 			{
-				callstack_entry callstack = intern_callstack(item.backtrace);
+				callstack_entry callstack = item.backtrace.dropped ? callstack_entry{ dropped_callstack_id(), false } : intern_callstack(item.backtrace);
 				if (callstack.stopword)
 					continue;
 
@@ -883,7 +1040,7 @@ namespace owlcat
 			uint32_t type_id = intern_type(item.klass);
 			
 
-			callstack_entry callstack = intern_callstack(item.backtrace);
+			callstack_entry callstack = item.backtrace.dropped ? callstack_entry{ dropped_callstack_id(), false } : intern_callstack(item.backtrace);
 
 			// Allocations with stopworded callstacks are not tracked at all
 			if (callstack.stopword)
@@ -968,8 +1125,13 @@ namespace owlcat
 			std::shared_lock stop_lock(m_stop_mutex);
 		}
 
-		// Send back-pressure: block if the client is behind, so buffers stay bounded
-		wait_if_throttled();
+		// Send back-pressure: if the client is behind, either block so buffers stay bounded,
+		// or record less (see overload_config)
+		uint8_t overload_level = m_overload_level.load(std::memory_order_relaxed);
+		if (m_overload.mode == overload_config::policy::block)
+			wait_if_throttled();
+		else if (!should_record(overload_level, (uint64_t)klass, mono_functions::object_get_size(obj)))
+			return;
 		//fprintf(m_alloc_loc, "%p\n", obj);
 		//fflush(m_alloc_loc);
 
@@ -992,6 +1154,16 @@ namespace owlcat
 		item.size = mono_functions::object_get_size(obj);
 		item.type = work_item_type::alloc;
 
+		// The stack walk is the expensive part of recording an allocation: it's the first
+		// thing to go under overload
+		if (overload_level >= OVERLOAD_NO_STACKS)
+		{
+			item.backtrace.count = 0;
+			item.backtrace.dropped = true;
+			m_work_items.enqueue(item);
+			return;
+		}
+
 		// This is a heavy call, but it can only be done here, for obvious reasons.
 		// We ease things up a bit by only collecting addresses here. do_work translates them into strings in another thread.
 #if defined(WIN32)
@@ -1050,8 +1222,13 @@ namespace owlcat
 			std::shared_lock stop_lock(m_stop_mutex);
 		}
 
-		// Send back-pressure (allocations only; frees are never throttled - they shrink memory)
-		wait_if_throttled();
+		// Send back-pressure (allocations only; frees are never throttled - they shrink memory,
+		// and under overload they're still needed for the allocations that were recorded)
+		uint8_t overload_level = m_overload_level.load(std::memory_order_relaxed);
+		if (m_overload.mode == overload_config::policy::block)
+			wait_if_throttled();
+		else if (!should_record(overload_level, ((uint64_t)label_index << 1) | 1, size))
+			return;
 
 		work_item item;
 		item.frame = frame;
@@ -1061,13 +1238,21 @@ namespace owlcat
 		item.native_type = label_index;
 		item.type = work_item_type::native_alloc;
 
+		if (overload_level >= OVERLOAD_NO_STACKS)
+		{
+			item.backtrace.count = 0;
+			item.backtrace.dropped = true;
+		}
+		else
+		{
 #if defined(WIN32)
-		// Native frames are always raw instruction pointers
-		item.backtrace.count = capture_stack(item.backtrace.frames, (uint32_t)stack_backtrace::MAX_DEPTH);
-		item.backtrace.overflow = item.backtrace.count == stack_backtrace::MAX_DEPTH;
+			// Native frames are always raw instruction pointers
+			item.backtrace.count = capture_stack(item.backtrace.frames, (uint32_t)stack_backtrace::MAX_DEPTH);
+			item.backtrace.overflow = item.backtrace.count == stack_backtrace::MAX_DEPTH;
 #else
-		item.backtrace.count = 0;
+			item.backtrace.count = 0;
 #endif
+		}
 
 		m_work_items.enqueue(item);
 	}
@@ -1091,6 +1276,18 @@ namespace owlcat
 		m_work_items.enqueue(item);
 	}
 
+	void worker_thread::on_frame_end(uint64_t frame)
+	{
+		work_item item;
+		item.frame = frame;
+		item.klass = nullptr;
+		item.obj = nullptr;
+		item.size = 0;
+		item.type = work_item_type::frame_end;
+		item.backtrace.count = 0;
+		m_work_items.enqueue(item);
+	}
+
 	// It is possible that the memory pointed to by addr is no longer accessible to us.
 	// We can't know if it is, so we use SEH to handle the resulting access violation.
 	// Actually, we probably can call into BoehmGC itself to check, but this is a more complicated and less stable way
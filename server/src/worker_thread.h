@@ -9,7 +9,11 @@
 #include <shared_mutex>
 #include <condition_variable>
 #include <unordered_map>
+#include <memory>
+#include <chrono>
 #include <concurrentqueue.h>
+
+#include "mono_profiler.h" // events_sink, dropped_type_count, overload_level
 //#include "tsl/robin_map.h"
 
 //#define DEBUG_ALLOCS
@@ -25,10 +29,6 @@
 	#define OWLCAT_PROFILER_MEMLOG_INTERVAL_MS 5000
 #endif
 
-#if defined(OWLCAT_PROFILER_MEMLOG)
-	#include <chrono>
-#endif
-
 extern volatile size_t map_size;
 
 /*
@@ -102,9 +102,34 @@ bool operator!= (const counting_allocator<T1>&,
 
 namespace owlcat
 {
-	class events_sink;
 	class logger;
 
+	/*
+		What the worker does when the client (or the disk) can't keep up with the event
+		stream - see worker_thread::maybe_update_throttle. mono_profiler fills this from the
+		OWLCAT_PROFILER_OVERLOAD* environment variables.
+	*/
+	struct overload_config
+	{
+		enum class policy : uint8_t
+		{
+			// Block the game's allocating threads until the backlog drains. Everything is
+			// recorded, but the game's frame timings are distorted while it's blocked.
+			block,
+			// Never block: record less (see overload_level) and mark the affected frames
+			degrade,
+		};
+
+		policy mode = policy::degrade;
+		// Fixed high/low-water marks (hysteresis avoids thrashing). Pressure starts above either
+		// high mark, and ends below both low marks. Healthy captures (client keeping up) keep
+		// the buffer near zero and never reach these.
+		uint64_t send_high = 256ull * 1024 * 1024; // buffered send bytes
+		uint64_t send_low = 128ull * 1024 * 1024;
+		size_t queue_high = 200000;                // queued work items (~112 MB)
+		size_t queue_low = 50000;
+	};
+
 	/*
 		A private, low-fragmentation heap for the profiler's own large, high-churn containers
 		(the live-object map, callstack table, native-allocation map). Isolating their millions
@@ -176,11 +201,14 @@ namespace owlcat
 			uint32_t count = 0;
 			// True if frames beyond MAX_DEPTH were dropped
 			bool overflow = false;
+			// True if the callstack wasn't captured at all because the profiler was overloaded
+			bool dropped = false;
 		};
 
 		// alloc/free are Mono events (managed by the pseudo-GC); native_alloc/native_free
 		// come from hooked native allocators and are freed explicitly (never GC-swept).
-		enum class work_item_type : uint8_t {alloc, free, native_alloc, native_free};
+		// frame_end is queued by on_frame_end, so the end of a frame is seen in order with its events.
+		enum class work_item_type : uint8_t {alloc, free, native_alloc, native_free, frame_end};
 		/*
 			A work item to be processed by worker thread
 		*/
@@ -277,6 +305,40 @@ namespace owlcat
 		std::condition_variable m_throttle_cv;
 		uint32_t m_throttle_counter = 0;
 
+		/*
+			The lossy alternative to the throttle (overload_config::policy::degrade). Under
+			pressure, maybe_update_throttle raises m_overload_level one step at a time, and game
+			threads record less at each level instead of blocking. Below the low-water marks it
+			drops straight back to OVERLOAD_NONE. Allocations that aren't recorded are counted
+			per type in m_dropped_counters, which the worker drains at every frame end.
+		*/
+		overload_config m_overload;
+		std::atomic<uint8_t> m_overload_level{ OVERLOAD_NONE };
+		std::chrono::steady_clock::time_point m_overload_changed{};
+		// Highest level in effect during the current frame. Worker thread only.
+		uint8_t m_frame_overload_level = OVERLOAD_NONE;
+
+		/*
+			Lock-free open-addressing table of dropped allocations per type. Game threads claim
+			a slot for their key with a CAS and add to its counters; the worker swaps the
+			counters out. Keys are never removed (there are only so many types), and a key that
+			finds no slot within DROPPED_MAX_PROBE is only counted in the totals.
+		*/
+		struct dropped_counter
+		{
+			// MonoClass* for managed types (always even), label index * 2 + 1 for native ones
+			std::atomic<uint64_t> key{ 0 };
+			std::atomic<uint64_t> count{ 0 };
+			std::atomic<uint64_t> size{ 0 };
+		};
+		static constexpr size_t DROPPED_TABLE_SIZE = 8192; // power of two
+		static constexpr size_t DROPPED_MAX_PROBE = 32;
+		std::unique_ptr<dropped_counter[]> m_dropped_counters;
+		// All dropped allocations, including those that didn't fit in the table
+		std::atomic<uint64_t> m_dropped_count{ 0 };
+		std::atomic<uint64_t> m_dropped_size{ 0 };
+		std::vector<dropped_type_count> m_scratch_dropped;
+
 		/*
 			Information about a single allocation
 		*/
@@ -422,6 +484,9 @@ namespace owlcat
 		// Reused buffer for building a callstack's frame-id sequence (avoids an allocation
 		// per first-seen callstack).
 		std::vector<uint32_t> m_scratch_frame_ids;
+		// The callstack reported for allocations recorded without one under overload
+		// (see dropped_callstack_id). -1 until first used.
+		int64_t m_dropped_callstack_id = -1;
 
 		// Highest frame seen in dequeued items so far; used to keep reported frames monotonic
 		uint64_t m_max_seen_frame = 0;
@@ -473,8 +538,17 @@ namespace owlcat
 
 		// Back-pressure. maybe_update_throttle (worker thread) sets/clears m_send_throttle from
 		// the send-buffer and queue sizes; wait_if_throttled (game threads) blocks while it's set.
+		// With the degrade policy, maybe_update_throttle moves m_overload_level instead.
 		void maybe_update_throttle();
 		void wait_if_throttled();
+		void update_overload_level(bool over, bool under);
+		// Game threads, degrade policy: decides whether to record an allocation at the current
+		// overload level. If not, it is counted in m_dropped_counters under key.
+		bool should_record(uint8_t level, uint64_t key, uint32_t size);
+		void count_dropped(uint64_t key, uint32_t size);
+		// Worker thread, at a frame_end item: reports the frame's degradation, if any
+		void report_overload(uint64_t frame);
+		uint32_t dropped_callstack_id();
 
 #if defined(OWLCAT_PROFILER_MEMLOG)
 		// Logs the sizes of the profiler's containers, at most once per interval. Called
@@ -533,6 +607,8 @@ namespace owlcat
 		worker_thread(events_sink* sink, logger* log, bool capture_raw_ips, bool jit_available);
 		~worker_thread();		
 
+		// Sets the overload policy. Must be called before start().
+		void set_overload_config(const overload_config& config);
 		// Starts the thread
 		void start();
 		// Signals the thread to stop
@@ -547,6 +623,8 @@ namespace owlcat
 		void add_native_allocation(uint64_t frame, uint64_t addr, uint32_t size, uint32_t label_index);
 		// Adds a native free event (from a hooked free). Size is recovered from m_native_allocations.
 		void add_native_free(uint64_t frame, uint64_t addr);
+		// Marks the end of a frame in the work queue (see report_overload)
+		void on_frame_end(uint64_t frame);
 		// Performs pseudo-GC operation, blocking the calling trhead. Reports free events.
 		int do_gc_sync(uint64_t frame, bool only_update_parents);
 		// Registers a GC root
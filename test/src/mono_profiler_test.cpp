@@ -3,9 +3,14 @@
 #include "mono_profiler_server.h"
 #include "mono_profiler_client.h"
 #include "persistent_storage.h"
+#include "memory_writer.h"
 
+// Before Windows.h, which would pull in the old winsock.h otherwise
+#include <winsock2.h>
 #include <Windows.h>
 #include <thread>
+#include <atomic>
+#include <chrono>
 #include <vector>
 #include <cstdlib>
 #include <cstring>
@@ -190,6 +195,225 @@ static int run_native_hook_test()
     return 0;
 }
 
+/*
+    Measures the round-trip time of pause/resume commands while the event stream is saturated:
+    one thread allocates and frees as fast as it can, so the server's send buffer is full of
+    allocation events. Command replies go through the network's priority lane, so they should
+    not wait behind that backlog.
+*/
+static int run_command_latency_test()
+{
+    const std::string config =
+        "owlcat_mono_profiler_test.exe | test_alloc | alloc | size=a1, ptr=ret | \"Test Alloc\"\n"
+        "owlcat_mono_profiler_test.exe | test_free | free | ptr=a1 | \"Test Free\"\n";
+
+    mono_profiler_server server;
+    server.start(false, 8891);
+
+    mono_profiler_client client;
+    if (!client.start("127.0.0.1", 8891, "test_latency.owl", owlcat::CAPTURE_NATIVE, config))
+    {
+        printf("latency test: client failed to connect\n");
+        return 3;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    std::atomic<bool> stop_storm{ false };
+    std::thread storm([&]()
+        {
+            while (!stop_storm)
+                test_free(test_alloc(64));
+        });
+
+    // Let the backlog build up, advancing frames so events get flushed
+    for (int i = 0; i < 20; ++i)
+    {
+        server.on_frame();
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    int result = 0;
+    const int rounds = 5;
+    uint64_t max_round_trip_us = 0;
+    for (int i = 0; i < rounds && result == 0; ++i)
+    {
+        std::atomic<bool> paused{ false };
+        std::atomic<bool> resumed{ false };
+
+        client.pause_app([&](bool) { paused = true; });
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (!paused && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if (!paused)
+        {
+            printf("latency test FAILED: no reply to pause within 10 seconds\n");
+            result = 3;
+        }
+        uint64_t pause_us = client.get_last_command_round_trip_us();
+
+        client.resume_app([&](bool) { resumed = true; });
+        deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (!resumed && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if (!resumed && result == 0)
+        {
+            printf("latency test FAILED: no reply to resume within 10 seconds\n");
+            result = 3;
+        }
+        uint64_t resume_us = client.get_last_command_round_trip_us();
+
+        printf("latency test: pause %.2f ms, resume %.2f ms (%llu messages queued on the client)\n",
+            pause_us / 1000.0, resume_us / 1000.0, (unsigned long long)client.get_network_messages_count());
+        if (pause_us > max_round_trip_us) max_round_trip_us = pause_us;
+        if (resume_us > max_round_trip_us) max_round_trip_us = resume_us;
+
+        server.on_frame();
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    stop_storm = true;
+    storm.join();
+
+    server.stop();
+    client.stop();
+
+    if (result == 0)
+        printf("latency test OK (max command round trip %.2f ms)\n", max_round_trip_us / 1000.0);
+    return result;
+}
+
+/*
+    Overdrives the pipeline and checks that, with the degrade overload policy, no game thread
+    ever blocks. The "client" is a raw socket that configures the capture and then never reads,
+    so the server's send buffer can't drain: with the block policy the allocating threads would
+    hang until the connection closes. Low watermarks make the server degrade right away.
+*/
+static int run_overload_test()
+{
+    _putenv_s("OWLCAT_PROFILER_OVERLOAD", "degrade");
+    _putenv_s("OWLCAT_PROFILER_OVERLOAD_SEND_MB", "1");
+    _putenv_s("OWLCAT_PROFILER_OVERLOAD_QUEUE", "2000");
+
+    const std::string config =
+        "owlcat_mono_profiler_test.exe | test_alloc | alloc | size=a1, ptr=ret | \"Test Alloc\"\n"
+        "owlcat_mono_profiler_test.exe | test_free | free | ptr=a1 | \"Test Free\"\n";
+
+    mono_profiler_server server;
+    server.start(false, 8892);
+
+    WSADATA wsa_data;
+    WSAStartup(MAKEWORD(2, 2), &wsa_data);
+
+    SOCKET stalled_client = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    int receive_buffer = 4096;
+    setsockopt(stalled_client, SOL_SOCKET, SO_RCVBUF, (const char*)&receive_buffer, sizeof(receive_buffer));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(8892);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(stalled_client, (sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+        printf("overload test: failed to connect\n");
+        closesocket(stalled_client);
+        server.stop();
+        return 4;
+    }
+
+    // CMD_CONFIGURE, framed as network does it
+    {
+        std::vector<uint8_t> body;
+        memory_writer writer(body);
+        writer.write_uint32(owlcat::CAPTURE_NATIVE);
+        writer.write_string(config.c_str());
+
+        message::header header;
+        header.type = protocol::command::CMD_CONFIGURE;
+        header.length = (uint32_t)body.size();
+
+        std::vector<uint8_t> packet((const uint8_t*)&header, (const uint8_t*)&header + sizeof(header));
+        packet.insert(packet.end(), body.begin(), body.end());
+        send(stalled_client, (const char*)packet.data(), (int)packet.size(), 0);
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    const int thread_count = 4;
+    std::atomic<bool> stop_storm{ false };
+    std::atomic<int> finished{ 0 };
+    std::vector<uint64_t> iterations(thread_count, 0);
+    std::vector<uint64_t> max_call_us(thread_count, 0);
+    std::vector<std::thread> storm;
+    for (int t = 0; t < thread_count; ++t)
+    {
+        storm.emplace_back([&, t]()
+            {
+                while (!stop_storm)
+                {
+                    auto t1 = std::chrono::steady_clock::now();
+                    test_free(test_alloc(64));
+                    auto t2 = std::chrono::steady_clock::now();
+
+                    uint64_t us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
+                    if (us > max_call_us[t])
+                        max_call_us[t] = us;
+                    ++iterations[t];
+                }
+                ++finished;
+            });
+    }
+
+    // A few seconds of frames; the pipeline stays overdriven the whole time
+    for (int i = 0; i < 300; ++i)
+    {
+        server.on_frame();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    stop_storm = true;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (finished < thread_count && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    int result = 0;
+    if (finished < thread_count)
+    {
+        printf("overload test FAILED: %d of %d allocating threads are blocked\n", thread_count - finished.load(), thread_count);
+        result = 4;
+    }
+
+    // Releases blocked threads, if any
+    server.stop();
+    for (auto& thread : storm)
+        thread.join();
+    closesocket(stalled_client);
+
+    uint64_t total_iterations = 0, worst_call_us = 0;
+    for (int t = 0; t < thread_count; ++t)
+    {
+        total_iterations += iterations[t];
+        if (max_call_us[t] > worst_call_us)
+            worst_call_us = max_call_us[t];
+    }
+
+    // A call blocked on the throttle would wait for the send buffer to drain, which never
+    // happens here. Anything well below a second is scheduling noise.
+    if (result == 0 && worst_call_us > 250000)
+    {
+        printf("overload test FAILED: an allocation took %.2f ms\n", worst_call_us / 1000.0);
+        result = 4;
+    }
+
+    _putenv_s("OWLCAT_PROFILER_OVERLOAD", "");
+    _putenv_s("OWLCAT_PROFILER_OVERLOAD_SEND_MB", "");
+    _putenv_s("OWLCAT_PROFILER_OVERLOAD_QUEUE", "");
+
+    if (result == 0)
+        printf("overload test OK (%llu allocations, slowest %.2f ms)\n", (unsigned long long)total_iterations, worst_call_us / 1000.0);
+    return result;
+}
+
 int main()
 {
     // Load library so that server can start
@@ -228,5 +452,15 @@ int main()
     if (native_result != 0)
         return native_result;
 
+    // --- Command latency under a saturated event stream ---
+    int latency_result = run_command_latency_test();
+    if (latency_result != 0)
+        return latency_result;
+
+    // --- Overload: game threads must never block on a stalled client ---
+    int overload_result = run_overload_test();
+    if (overload_result != 0)
+        return overload_result;
+
     return 0;
 }
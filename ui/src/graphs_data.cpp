@@ -1,5 +1,8 @@
 #include "graphs_data.h"
 
+#include <algorithm>
+#include <array>
+
 graphs_data::graphs_data(owlcat::mono_profiler_client* client)
     : m_data(client->get_data())
 {
@@ -18,12 +21,14 @@ void graphs_data::clear()
     max_frees = 0;
     max_size = 0;
     max_committed = 0;
-    m_alloc_count.clear();
-    m_frees_count.clear();
-    m_size_points.clear();
-    m_committed_points.clear();
-    m_working_set_points.clear();
-    m_gc_heap_points.clear();
+    m_alloc_buckets.clear();
+    m_frees_buckets.clear();
+    m_size_buckets.clear();
+    m_committed_buckets.clear();
+    m_working_set_buckets.clear();
+    m_gc_heap_buckets.clear();
+    m_bucket_frames = 1;
+    m_points_per_bucket = 1;
     first_visible_frame = -1;
     last_visible_frame = -1;
 }
@@ -33,76 +38,221 @@ void graphs_data::update_boundaries()
     m_data->get_frame_boundaries(min_frame, max_frame);
 }
 
-void graphs_data::update_region(int from, int to)
+// Smallest power of two frames per bucket that shows frame_count frames in at most
+// max_buckets buckets, including the one the region may start in the middle of
+static size_t get_bucket_frames(uint64_t frame_count, int max_buckets)
+{
+    const uint64_t max_count = std::max(max_buckets, 2);
+    size_t bucket_frames = 1;
+    while ((frame_count + bucket_frames - 1) / bucket_frames + 1 > max_count)
+        bucket_frames *= 2;
+    return bucket_frames;
+}
+
+using buckets_t = std::vector<owlcat::frame_bucket_t>;
+
+/*
+    Updates series fetched together (from the same frames) to frames [from, to]. If incremental,
+    the buckets already fetched that lie in [from, to] and are final are kept, and fetch(series,
+    from, to) is only called for the frames before and after them.
+*/
+template<typename Fetch>
+static void update_series(std::array<buckets_t*, 3> series, uint64_t from, uint64_t to, bool incremental, Fetch fetch)
 {
+    const buckets_t& reference = *series[0];
+
+    // Buckets before the region, or cut short by the start of the previous one, are
+    // dropped: the region starts past them. The last bucket may have been partial.
+    size_t keep_from = 0;
+    while (keep_from < reference.size() && reference[keep_from].first_frame < from)
+        ++keep_from;
+    const size_t keep_to = reference.empty() ? 0 : reference.size() - 1;
+
+    if (!incremental || keep_from >= keep_to)
+    {
+        fetch(series, from, to);
+        return;
+    }
+
+    const uint64_t kept_first = reference[keep_from].first_frame;
+    const uint64_t tail_first = reference[keep_to].first_frame;
+    for (auto buckets : series)
+    {
+        buckets->resize(keep_to);
+        buckets->erase(buckets->begin(), buckets->begin() + keep_from);
+    }
+
+    buckets_t head[3], tail[3];
+    if (from < kept_first)
+        fetch({ &head[0], &head[1], &head[2] }, from, kept_first - 1);
+    fetch({ &tail[0], &tail[1], &tail[2] }, tail_first, to);
+
+    for (size_t i = 0; i < series.size(); ++i)
+    {
+        series[i]->insert(series[i]->begin(), head[i].begin(), head[i].end());
+        series[i]->insert(series[i]->end(), tail[i].begin(), tail[i].end());
+    }
+}
+
+void graphs_data::update_region(int from, int to, int max_buckets)
+{
+    const size_t bucket_frames = get_bucket_frames(to >= from ? (uint64_t)(to - from) + 1 : 1, max_buckets);
+    const bool incremental = bucket_frames == m_bucket_frames && first_visible_frame >= 0 &&
+        from >= first_visible_frame && from <= last_visible_frame && to >= last_visible_frame;
+
     first_visible_frame = from;
     last_visible_frame = to;
-    m_data->get_frame_stats(m_alloc_count, m_frees_count, max_allocs, max_frees, m_size_points, max_size, from, to);
-    m_data->get_memory_series(m_committed_points, m_working_set_points, m_gc_heap_points, max_committed, from, to);
+    m_bucket_frames = bucket_frames;
+    m_points_per_bucket = bucket_frames > 1 ? 2 : 1;
+
+    update_series({ &m_alloc_buckets, &m_frees_buckets, &m_size_buckets }, from, to, incremental,
+        [this](std::array<buckets_t*, 3> series, uint64_t from, uint64_t to)
+        {
+            m_data->get_frame_stats_buckets(*series[0], *series[1], *series[2], from, to, m_bucket_frames);
+        });
+    update_series({ &m_committed_buckets, &m_working_set_buckets, &m_gc_heap_buckets }, from, to, incremental,
+        [this](std::array<buckets_t*, 3> series, uint64_t from, uint64_t to)
+        {
+            m_data->get_memory_buckets(*series[0], *series[1], *series[2], from, to, m_bucket_frames);
+        });
+
+    max_allocs = 0;
+    for (auto& bucket : m_alloc_buckets)
+        max_allocs = std::max(max_allocs, (uint64_t)bucket.max);
+    max_frees = 0;
+    for (auto& bucket : m_frees_buckets)
+        max_frees = std::max(max_frees, (uint64_t)bucket.max);
+    max_size = 0;
+    for (auto& bucket : m_size_buckets)
+        max_size = std::max(max_size, bucket.max);
+    max_committed = 0;
+    for (auto& bucket : m_committed_buckets)
+        max_committed = std::max(max_committed, (uint64_t)bucket.max);
 }
 
-size_t graphs_data::get_allocations_count_size() { return m_alloc_count.size(); }
+QPointF graphs_data::get_line_point(const std::vector<owlcat::frame_bucket_t>& buckets, size_t points_per_bucket, size_t i)
+{
+    if (i >= buckets.size() * points_per_bucket)
+        return QPointF();
 
-QwtIntervalSample graphs_data::get_allocations_count(uint64_t frame)
+    // Both points of a bucket are at its first frame: the line draws a vertical stroke
+    // spanning the bucket's values, then goes on to the next bucket
+    const auto& bucket = buckets[i / points_per_bucket];
+    const bool is_max = points_per_bucket == 2 && i % 2 == 1;
+    return QPointF(bucket.first_frame, is_max ? bucket.max : bucket.min);
+}
+
+const owlcat::frame_bucket_t* graphs_data::get_bucket_at(const std::vector<owlcat::frame_bucket_t>& buckets, int64_t frame)
+{
+    if (buckets.empty())
+        return nullptr;
+
+    auto iter = std::upper_bound(buckets.begin(), buckets.end(), frame, [](int64_t f, const owlcat::frame_bucket_t& bucket) { return f < (int64_t)bucket.first_frame; });
+    return iter == buckets.begin() ? &buckets.front() : &*(iter - 1);
+}
+
+size_t graphs_data::get_allocations_count_size() { return m_alloc_buckets.size(); }
+
+QwtIntervalSample graphs_data::get_allocations_count(uint64_t i)
 {
-    if (frame >= m_alloc_count.size())
+    if (i >= m_alloc_buckets.size())
         return QwtIntervalSample();
 
-    return QwtIntervalSample(m_alloc_count[frame], frame + first_visible_frame, frame + first_visible_frame + 1);
+    const auto& bucket = m_alloc_buckets[i];
+    return QwtIntervalSample(bucket.max, bucket.first_frame, bucket.last_frame + 1);
 }
 
-size_t graphs_data::get_frees_count_size() { return m_frees_count.size(); }
-QwtIntervalSample graphs_data::get_frees_count(uint64_t frame)
+size_t graphs_data::get_frees_count_size() { return m_frees_buckets.size(); }
+QwtIntervalSample graphs_data::get_frees_count(uint64_t i)
 {
-    if (frame >= m_frees_count.size())
+    if (i >= m_frees_buckets.size())
         return QwtIntervalSample();
 
-    return QwtIntervalSample(m_frees_count[frame], frame + first_visible_frame, frame + first_visible_frame + 1);
+    const auto& bucket = m_frees_buckets[i];
+    return QwtIntervalSample(bucket.max, bucket.first_frame, bucket.last_frame + 1);
 }
 
-size_t graphs_data::get_sizes_size() { return m_size_points.size(); }
-QPointF graphs_data::get_size(uint64_t frame)
+size_t graphs_data::get_sizes_size() { return m_size_buckets.size() * m_points_per_bucket; }
+QPointF graphs_data::get_size(uint64_t i)
 {
-    if (frame >= m_size_points.size())
-        return QPointF();
+    return get_line_point(m_size_buckets, m_points_per_bucket, i);
+}
 
-    return QPointF(frame + first_visible_frame, m_size_points[frame]);
+size_t graphs_data::get_committed_size() { return m_committed_buckets.size() * m_points_per_bucket; }
+QPointF graphs_data::get_committed(uint64_t i)
+{
+    return get_line_point(m_committed_buckets, m_points_per_bucket, i);
 }
 
-size_t graphs_data::get_committed_size() { return m_committed_points.size(); }
-QPointF graphs_data::get_committed(uint64_t frame)
+bool graphs_data::get_allocations_at(int64_t frame, owlcat::frame_bucket_t& allocs, owlcat::frame_bucket_t& frees) const
 {
-    if (frame >= m_committed_points.size())
-        return QPointF();
+    auto allocs_bucket = get_bucket_at(m_alloc_buckets, frame);
+    if (allocs_bucket == nullptr)
+        return false;
+
+    allocs = *allocs_bucket;
+    auto frees_bucket = get_bucket_at(m_frees_buckets, frame);
+    frees = frees_bucket != nullptr ? *frees_bucket : owlcat::frame_bucket_t{ allocs.first_frame, allocs.last_frame, 0, 0, 0 };
+    return true;
+}
+
+bool graphs_data::get_size_at(int64_t frame, owlcat::frame_bucket_t& size) const
+{
+    auto bucket = get_bucket_at(m_size_buckets, frame);
+    if (bucket == nullptr)
+        return false;
+
+    size = *bucket;
+    return true;
+}
+
+bool graphs_data::find_gc_frame(const owlcat::frame_bucket_t& bucket, uint64_t from, uint64_t to, bool last, uint64_t& frame) const
+{
+    if (bucket.sum == 0 || from > to)
+        return false;
+
+    if (bucket.first_frame == bucket.last_frame)
+    {
+        frame = bucket.first_frame;
+        return true;
+    }
 
-    return QPointF(frame + first_visible_frame, m_committed_points[frame]);
+    // A bucket of several frames: look at its frames one by one
+    std::vector<uint64_t> allocs, frees, sizes;
+    uint64_t max_allocs = 0, max_frees = 0;
+    int64_t max_size = 0;
+    m_data->get_frame_stats(allocs, frees, max_allocs, max_frees, sizes, max_size, from, to);
+    for (size_t i = 0; i < frees.size(); ++i)
+    {
+        const size_t index = last ? frees.size() - 1 - i : i;
+        if (frees[index] > 0)
+        {
+            frame = from + index;
+            return true;
+        }
+    }
+    return false;
 }
 
 uint64_t graphs_data::get_closest_gc_frame(uint64_t frame) const
 {
-    if (frame <= first_visible_frame || frame >= last_visible_frame)
+    if (frame <= first_visible_frame || frame >= last_visible_frame || m_frees_buckets.empty())
         return frame;
 
+    const size_t holding = get_bucket_at(m_frees_buckets, frame) - m_frees_buckets.data();
+
     bool f1found = false, f2found = false;
     uint64_t f1 = frame;
     uint64_t f2 = frame;
-    while (f1 > first_visible_frame)
+    for (size_t i = holding + 1; i-- > 0 && !f1found; )
     {
-        if (m_frees_count[f1 - first_visible_frame] > 0)
-        {
-            f1found = true;
-            break;
-        }
-        --f1;
+        const auto& bucket = m_frees_buckets[i];
+        f1found = find_gc_frame(bucket, std::max<uint64_t>(bucket.first_frame, first_visible_frame + 1), std::min<uint64_t>(bucket.last_frame, frame), true, f1);
     }
-    while (f2 < last_visible_frame)
+    for (size_t i = holding; i < m_frees_buckets.size() && !f2found; ++i)
     {
-        if (m_frees_count[f2 - first_visible_frame] > 0)
-        {
-            f2found = true;
-            break;
-        }
-        ++f2;
+        const auto& bucket = m_frees_buckets[i];
+        f2found = find_gc_frame(bucket, std::max<uint64_t>(bucket.first_frame, frame), std::min<uint64_t>(bucket.last_frame, last_visible_frame - 1), false, f2);
     }
 
     if (!f1found && !f2found)
@@ -6,20 +6,41 @@
 
 /*
     Class that supplies data for Allocations cound and Memory size graphs
+
+    The visible region is fetched as at most one bucket of consecutive frames per pixel
+    (see mono_profiler_client_data::get_frame_stats_buckets), so that a zoomed out capture
+    costs no more to draw than a zoomed in one. A bucket of the count graphs is a bar as wide
+    as its frames, as high as its busiest frame. The lines go through the smallest and the
+    largest value of each bucket, unless buckets are single frames.
+
+    During a capture the region is updated every tick while it shows the newest frames. As
+    long as the zoom is the same and the region only moves forward, the buckets already
+    fetched are kept: only the last one (which may have been partial) and the frames after
+    it are fetched again, plus the first one when the region starts in the middle of it.
 */
 class graphs_data
 {
 private:
     owlcat::mono_profiler_client_data* m_data;
 
-    std::vector<uint64_t> m_alloc_count;
-    std::vector<uint64_t> m_frees_count;
-    std::vector<uint64_t> m_size_points;
+    std::vector<owlcat::frame_bucket_t> m_alloc_buckets;
+    std::vector<owlcat::frame_bucket_t> m_frees_buckets;
+    std::vector<owlcat::frame_bucket_t> m_size_buckets;
     // Whole-process committed memory per frame (see SRV_MEMSTATS). Overlaid on the size graph;
     // the gap above the tracked-size line is native allocator pool overhead.
-    std::vector<uint64_t> m_committed_points;
-    std::vector<uint64_t> m_working_set_points;
-    std::vector<uint64_t> m_gc_heap_points;
+    std::vector<owlcat::frame_bucket_t> m_committed_buckets;
+    std::vector<owlcat::frame_bucket_t> m_working_set_buckets;
+    std::vector<owlcat::frame_bucket_t> m_gc_heap_buckets;
+    // Frames per bucket, a power of two
+    size_t m_bucket_frames = 1;
+    // Line points per bucket: 1 for single frames, 2 (min and max) otherwise
+    size_t m_points_per_bucket = 1;
+
+    static QPointF get_line_point(const std::vector<owlcat::frame_bucket_t>& buckets, size_t points_per_bucket, size_t i);
+    // The bucket holding a frame: the first or the last one for frames outside of them
+    static const owlcat::frame_bucket_t* get_bucket_at(const std::vector<owlcat::frame_bucket_t>& buckets, int64_t frame);
+    // Searches frames [from, to] of a bucket for the last (or first) one with deallocations
+    bool find_gc_frame(const owlcat::frame_bucket_t& bucket, uint64_t from, uint64_t to, bool last, uint64_t& frame) const;
 
 public:
     int first_visible_frame = -1;
@@ -39,20 +60,26 @@ public:
     void clear();
 
     void update_boundaries();
-    void update_region(int from, int to);
+    // Fetches frames [from, to] in at most max_buckets buckets (the width of the graphs in
+    // pixels), or only the frames missing since the last call if the zoom is the same
+    void update_region(int from, int to, int max_buckets);
 
     size_t get_allocations_count_size();
-    QwtIntervalSample get_allocations_count(uint64_t frame);
+    QwtIntervalSample get_allocations_count(uint64_t i);
 
     size_t get_frees_count_size();
-    QwtIntervalSample get_frees_count(uint64_t frame);
+    QwtIntervalSample get_frees_count(uint64_t i);
 
     size_t get_sizes_size();
-    QPointF get_size(uint64_t frame);
+    QPointF get_size(uint64_t i);
 
     // Committed-memory line (process-wide), same x-alignment as the size line
     size_t get_committed_size();
-    QPointF get_committed(uint64_t frame);
+    QPointF get_committed(uint64_t i);
+
+    // The buckets holding a frame, for the trackers. Return false if nothing is loaded.
+    bool get_allocations_at(int64_t frame, owlcat::frame_bucket_t& allocs, owlcat::frame_bucket_t& frees) const;
+    bool get_size_at(int64_t frame, owlcat::frame_bucket_t& size) const;
 
     // Searches for a frame where there were any deallocations that is closest to the specified frame (for "Snap to GC" option)
     uint64_t get_closest_gc_frame(uint64_t frame) const;
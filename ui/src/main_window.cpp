@@ -221,35 +221,30 @@ main_window::main_window(QWidget* parent) :
     m_sizeZone.setOrientation(Qt::Vertical);
     m_sizeZone.setZ(100);
 
-    // Show the graphs' actual values at the cursor's frame in the trackers.
-    // The frame is clamped to the loaded data, so hovering past the end of the
-    // capture shows the last frame's values.
+    // Show the graphs' actual values at the cursor's frame in the trackers, or
+    // those of the frames under the cursor's pixel when zoomed out. The frame is
+    // clamped to the loaded data, so hovering past the end of the capture shows
+    // the last frame's values.
     m_allocations_picker->set_value_text([this](qint64 frame) -> QString
     {
-        if (!m_data || m_data->get_allocations_count_size() == 0)
+        owlcat::frame_bucket_t allocs, frees;
+        if (!m_data || !m_data->get_allocations_at(frame, allocs, frees))
             return QString();
 
-        const qint64 first = m_data->first_visible_frame;
-        const qint64 last = first + (qint64)m_data->get_allocations_count_size() - 1;
-        frame = qBound(first, frame, last);
-        const uint64_t index = frame - first;
-
-        const qint64 allocs = (qint64)m_data->get_allocations_count(index).value;
-        const qint64 frees = index < m_data->get_frees_count_size() ? (qint64)m_data->get_frees_count(index).value : 0;
-        return QString("frame %1: %2 allocs, %3 frees").arg(frame).arg(allocs).arg(frees);
+        if (allocs.first_frame == allocs.last_frame)
+            return QString("frame %1: %2 allocs, %3 frees").arg(allocs.first_frame).arg(allocs.sum).arg(frees.sum);
+        return QString("frames %1-%2: %3 allocs, %4 frees").arg(allocs.first_frame).arg(allocs.last_frame).arg(allocs.sum).arg(frees.sum);
     });
 
     m_size_picker->set_value_text([this](qint64 frame) -> QString
     {
-        if (!m_data || m_data->get_sizes_size() == 0)
+        owlcat::frame_bucket_t size;
+        if (!m_data || !m_data->get_size_at(frame, size))
             return QString();
 
-        const qint64 first = m_data->first_visible_frame;
-        const qint64 last = first + (qint64)m_data->get_sizes_size() - 1;
-        frame = qBound(first, frame, last);
-        const uint64_t index = frame - first;
-
-        return QString("frame %1: %2").arg(frame).arg(size_to_string(m_data->get_size(index).y()));
+        if (size.first_frame == size.last_frame)
+            return QString("frame %1: %2").arg(size.first_frame).arg(size_to_string(size.max));
+        return QString("frames %1-%2: %3 - %4").arg(size.first_frame).arg(size.last_frame).arg(size_to_string(size.min)).arg(size_to_string(size.max));
     });
 
     connect(m_allocations_picker.get(), SIGNAL(selected(const QPolygon)), this, SLOT(onPickerChanged(const QPolygon)));
@@ -401,6 +396,8 @@ void main_window::onOpenData()
 
     m_ui->allocationsGraph->replot();
     m_ui->sizeGraph->replot();
+
+    m_ui->statusbar->showMessage(QString::fromStdString(describeDegradedFrames(m_data->min_frame, m_data->max_frame)));
 }
 
 void main_window::onSaveData()
@@ -721,6 +718,14 @@ void main_window::onPickerChanged(const QPolygon& selection)
     m_allocationsZone.setInterval(first_frame, last_frame + 1);
     m_sizeZone.setInterval(first_frame, last_frame + 1);
 
+    // The live objects of a degraded selection are incomplete. While profiling, the status
+    // bar is the capture's, updated by the timer.
+    if (!m_ui->actionStop_Profiling->isEnabled())
+    {
+        const std::string degraded = describeDegradedFrames((uint64_t)std::max(first_frame, 0), (uint64_t)std::max(last_frame, 0));
+        m_ui->statusbar->showMessage(QString::fromStdString(degraded.empty() ? degraded : "Selection: " + degraded));
+    }
+
     calculateLiveObjects(first_frame, last_frame);
 }
 
@@ -859,29 +864,38 @@ void main_window::timerEvent(QTimerEvent* ev)
     }
     else if (m_data->last_visible_frame >= m_data->max_frame || m_data->last_visible_frame == 0)
     {
-        m_data->update_region(m_data->first_visible_frame, m_data->last_visible_frame);
+        m_data->update_region(m_data->first_visible_frame, m_data->last_visible_frame, m_ui->sizeGraph->canvas()->width());
 
         m_ui->allocationsGraph->replot();
         m_ui->sizeGraph->replot();
     }
 
-    // Measure the database insert rate (events written per second), averaged over ~1 second windows
+    // Measure the database insert and commit rates (per second), averaged over ~1 second windows
     uint64_t db_inserted = m_client.get_db_inserted_events_count();
+    uint64_t db_commits = m_client.get_db_commits_count();
     if (!m_db_rate_timer.isValid())
     {
         m_db_rate_timer.start();
         m_last_db_inserted_count = db_inserted;
+        m_last_db_commits_count = db_commits;
     }
     else if (m_db_rate_timer.elapsed() >= 1000)
     {
         m_db_inserts_per_second = (db_inserted - m_last_db_inserted_count) * 1000 / (uint64_t)m_db_rate_timer.elapsed();
+        m_db_commits_per_second = (db_commits - m_last_db_commits_count) * 1000 / (uint64_t)m_db_rate_timer.elapsed();
         m_last_db_inserted_count = db_inserted;
+        m_last_db_commits_count = db_commits;
         m_db_rate_timer.restart();
+
+        m_degraded_status = describeDegradedFrames(m_data->min_frame, m_data->max_frame);
     }
 
-    char tmp[160];
-    sprintf(tmp, "Network buffer: %I64u | Events stored/s: %I64u (total: %I64u)", m_client.get_network_messages_count(), m_db_inserts_per_second, db_inserted);
-    m_ui->statusbar->showMessage(tmp);
+    char tmp[192];
+    sprintf(tmp, "Network buffer: %I64u | Events stored/s: %I64u (total: %I64u) | DB commits/s: %I64u", m_client.get_network_messages_count(), m_db_inserts_per_second, db_inserted, m_db_commits_per_second);
+    std::string status = tmp;
+    if (!m_degraded_status.empty())
+        status += " | " + m_degraded_status;
+    m_ui->statusbar->showMessage(QString::fromStdString(status));
 }
 
 void main_window::closeEvent(QCloseEvent* ev)
@@ -903,7 +917,7 @@ void main_window::setZoom(float new_zoom)
     const QwtScaleMap scaleMap = m_ui->sizeGraph->canvasMap(QwtPlot::xBottom);
 
     int pos2 = m_pos + scaleMap.pDist() / m_zoom;
-    m_data->update_region(m_pos, pos2);
+    m_data->update_region(m_pos, pos2, (int)scaleMap.pDist());
     m_ui->allocationsGraph->setAxisScale(QwtPlot::xBottom, m_pos, pos2);
     m_ui->sizeGraph->setAxisScale(QwtPlot::xBottom, m_pos, pos2);    
 }
@@ -968,6 +982,30 @@ void main_window::calculateLiveObjects(int from_frame, int to_frame)
     m_types_worker->start();
 }
 
+/*
+    Under load, the server records less instead of blocking the game (see OWLCAT_PROFILER_OVERLOAD):
+    frames without callstacks, sampled, or only counted. Describes the degraded frames among
+    [from_frame, to_frame] for the status bar, empty if there are none.
+*/
+std::string main_window::describeDegradedFrames(uint64_t from_frame, uint64_t to_frame)
+{
+    if (!m_client.is_data_open())
+        return std::string();
+
+    std::vector<owlcat::degraded_frame_t> frames;
+    m_client.get_data()->get_degraded_frames(frames, from_frame, to_frame);
+    if (frames.empty())
+        return std::string();
+
+    uint64_t dropped_allocs = 0;
+    for (auto& frame : frames)
+        dropped_allocs += frame.dropped_allocs;
+
+    char tmp[192];
+    sprintf(tmp, "Incomplete: %I64u degraded frames, %I64u allocations only counted", (uint64_t)frames.size(), dropped_allocs);
+    return tmp;
+}
+
 void main_window::updateLiveObjectsSelectedSize()
 {
     auto rows = m_ui->liveObjectsList->selectionModel()->selectedRows();
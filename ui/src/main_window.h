@@ -102,6 +102,7 @@ private:
     void setZoom(float new_zoom);
     void calculateLiveObjects(int from_frame, int to_frame);
     void updateLiveObjectsSelectedSize();
+    std::string describeDegradedFrames(uint64_t from_frame, uint64_t to_frame);
     bool trySaveUnsavedData();
     void findObjectsReferences(const std::vector<uint64_t>& addresses);
     void export_types_to_csv();
@@ -152,10 +153,14 @@ private:
 
     int m_updateTimer = -1;
 
-    // For measuring the database insert rate shown in the status bar
+    // For measuring the database insert and commit rates shown in the status bar
     QElapsedTimer m_db_rate_timer;
     uint64_t m_last_db_inserted_count = 0;
     uint64_t m_db_inserts_per_second = 0;
+    uint64_t m_last_db_commits_count = 0;
+    uint64_t m_db_commits_per_second = 0;
+    // The degraded frames of the capture so far, see describeDegradedFrames
+    std::string m_degraded_status;
 
     std::string m_db_file_name;
     bool m_is_db_temporary = false;
@@ -227,11 +227,14 @@ void search_results_data::search_address_list(const std::vector<uint64_t>& addre
 
     types.clear();
 
+    // One lookup for all addresses: one per address would scan the capture every time
+    std::vector<uint64_t> type_ids, stack_ids;
+    m_data->get_allocations_type_and_stack(addresses, type_ids, stack_ids);
+
     std::unordered_map<uint64_t, uint64_t> type_indices;
-    for(auto addr : addresses)
+    for (size_t i = 0; i < addresses.size(); ++i)
     {
-        uint64_t type_id = std::numeric_limits<uint64_t>::max(), stack_id = std::numeric_limits<uint64_t>::max();
-        m_data->get_allocation_type_and_stack(addr, type_id, stack_id);
+        uint64_t type_id = type_ids[i], stack_id = stack_ids[i];
         if (type_id == std::numeric_limits<uint64_t>::max())
             continue;
 